@@ -0,0 +1,513 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Bench
+//
+// Runs a LurkerNano firmware image under simavr and times its hot paths in
+// real ATmega328 cycles. The firmware has to be built with LURKER_BENCH
+// defined, so that it marks each operation on GPIOR0 (see lurker_bench.h).
+//
+// A scenario script drives the sketch over its serial port:
+//	# comment
+//	run 2000	Run for 2000 ms of simulated time
+//	send r$	Type the text into the serial port at the line rate
+//	repeat 20	Repeat the lines up to the matching "end"
+//	end
+//
+// Results are cycles per operation, plus the peak stack and heap found by
+// painting SRAM before reset and looking for what was overwritten.
+//
+// Usage:
+//	lurker_bench [-m mcu] [-f frequency] [-b baud] [-c results.csv] [-v] firmware.elf scenario...
+//
+//	-c	Append the timings to a CSV file, for comparing builds
+//	-v	Echo the sketch's serial output
+//
+// Build:
+//	g++ -std=c++11 -O2 -o lurker_bench lurker_bench.cpp -lsimavr -lelf
+//////////////////////////////////////////////////////////////////////////
+
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <simavr/avr_uart.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_irq.h>
+
+#include "../LurkerNano/lurker_bench.h"
+
+const char* const OPERATION_NAMES[BENCH_OPERATION_COUNT] = {
+	"",
+	"loop",
+	"timer",
+	"serial_command",
+	"read_sensors",
+	"print_json",
+	"prepare_packet"
+};
+
+const avr_io_addr_t GPIOR0_ADDRESS = 0x3E;	// Data space address of GPIOR0 on the ATmega328
+const uint8_t PAINT = 0xA5;	// SRAM fill before reset
+const int PAINT_RUN = 8;	// Painted bytes in a row that count as untouched
+const int MAX_REPEAT_DEPTH = 8;
+
+struct OperationStats{
+	uint64_t calls;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	avr_cycle_count_t started;
+	bool running;
+};
+
+struct Bench{
+	avr_t* avr;
+	uint32_t baud;
+	bool verbose;
+	OperationStats operations[BENCH_OPERATION_COUNT];
+	uint64_t unmatched;	// End markers without a begin
+	std::string output;
+};
+
+static void printUsage(){
+	fprintf(stderr, "Usage: lurker_bench [-m mcu] [-f frequency] [-b baud] [-c results.csv] [-v] firmware.elf scenario...\n");
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Simulator Hooks
+
+/**
+* Marker written to GPIOR0 - start or stop the clock on an operation
+*/
+static void markerWritten(avr_t* avr, avr_io_addr_t, uint8_t value, void* param){
+	Bench* bench = static_cast<Bench*>(param);
+	uint8_t operation = value & ~BENCH_END_FLAG;
+
+	if (operation == 0 || operation >= BENCH_OPERATION_COUNT){
+		return;
+	}
+
+	OperationStats& stats = bench->operations[operation];
+
+	if (!(value & BENCH_END_FLAG)){
+		stats.started = avr->cycle;
+		stats.running = true;
+		return;
+	}
+
+	if (!stats.running){
+		bench->unmatched++;
+		return;
+	}
+
+	// The cycle count is taken at the start of each OUT, so the begin
+	// marker's own cycle is in the difference
+	uint64_t cycles = avr->cycle - stats.started - 1;
+	stats.running = false;
+	stats.calls++;
+	stats.total += cycles;
+	stats.min = stats.calls == 1 || cycles < stats.min ? cycles : stats.min;
+	stats.max = cycles > stats.max ? cycles : stats.max;
+}
+
+static void serialOutput(avr_irq_t*, uint32_t value, void* param){
+	Bench* bench = static_cast<Bench*>(param);
+	bench->output += char(value);
+
+	if (bench->verbose){
+		fputc(int(value), stderr);
+	}
+}
+
+/**
+* Run the simulation until the given cycle
+* @return False if the firmware crashed or stopped
+*/
+static bool runUntil(Bench& bench, avr_cycle_count_t end){
+	while (bench.avr->cycle < end){
+		int state = avr_run(bench.avr);
+
+		if (state == cpu_Done || state == cpu_Crashed){
+			fprintf(stderr, "Firmware %s at cycle %llu\n", state == cpu_Crashed ? "crashed" : "stopped",
+				(unsigned long long)bench.avr->cycle);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+* Type text into the serial port, one byte per character time
+*/
+static bool sendText(Bench& bench, const std::string& text){
+	avr_irq_t* input = avr_io_getirq(bench.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_cycle_count_t byteTime = bench.avr->frequency * 10 / bench.baud;
+
+	for (size_t i = 0; i < text.size(); i++){
+		avr_raise_irq(input, uint8_t(text[i]));
+
+		if (!runUntil(bench, bench.avr->cycle + byteTime)){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+* Undo the escapes a script can use in sent text: \r \n \t \\ \xHH
+*/
+static std::string unescape(const char* text){
+	std::string result;
+
+	for (const char* p = text; *p != 0; p++){
+		if (*p != '\\' || p[1] == 0){
+			result += *p;
+			continue;
+		}
+
+		p++;
+		switch (*p){
+		case 'r':
+			result += '\r';
+			break;
+		case 'n':
+			result += '\n';
+			break;
+		case 't':
+			result += '\t';
+			break;
+		case 'x':
+			if (p[1] != 0 && p[2] != 0){
+				char hex[3] = { p[1], p[2], 0 };
+				result += char(strtol(hex, NULL, 16));
+				p += 2;
+			}
+			break;
+		default:
+			result += *p;
+			break;
+		}
+	}
+
+	return result;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Scenarios
+
+/**
+* Run script lines from first up to the matching "end" or the end of the script
+* @return Index of the line after the block, or -1 on error
+*/
+static int runLines(Bench& bench, const std::vector<std::string>& lines, size_t first, int depth){
+	size_t i = first;
+
+	while (i < lines.size()){
+		char command[16] = "";
+		char argument[256] = "";
+		sscanf(lines[i].c_str(), "%15s %255[^\n]", command, argument);
+
+		if (command[0] == 0 || command[0] == '#'){
+			i++;
+		}
+		else if (strcmp(command, "end") == 0){
+			return depth > 0 ? int(i + 1) : -1;
+		}
+		else if (strcmp(command, "run") == 0){
+			avr_cycle_count_t cycles = avr_cycle_count_t(atof(argument) * bench.avr->frequency / 1000);
+			if (!runUntil(bench, bench.avr->cycle + cycles)){
+				return -1;
+			}
+			i++;
+		}
+		else if (strcmp(command, "send") == 0){
+			if (!sendText(bench, unescape(argument))){
+				return -1;
+			}
+			i++;
+		}
+		else if (strcmp(command, "repeat") == 0 && depth < MAX_REPEAT_DEPTH){
+			int count = atoi(argument);
+			int next = int(i + 1);
+
+			for (int n = 0; n < count || n == 0; n++){
+				next = runLines(bench, lines, i + 1, depth + 1);
+				if (next < 0){
+					return -1;
+				}
+			}
+
+			i = next;
+		}
+		else{
+			fprintf(stderr, "Line %zu: can't %s\n", i + 1, lines[i].c_str());
+			return -1;
+		}
+	}
+
+	return depth == 0 ? int(i) : -1;
+}
+
+static bool loadScript(const char* path, std::vector<std::string>& lines){
+	FILE* file = fopen(path, "r");
+	if (file == NULL){
+		return false;
+	}
+
+	char line[512];
+	while (fgets(line, sizeof(line), file) != NULL){
+		line[strcspn(line, "\r\n")] = 0;
+		lines.push_back(line);
+	}
+
+	fclose(file);
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// SRAM
+
+/**
+* Look up a symbol's address in the firmware image
+*/
+static bool findSymbol(const char* path, const char* name, uint32_t& address){
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || elf_version(EV_CURRENT) == EV_NONE){
+		return false;
+	}
+
+	Elf* elf = elf_begin(fd, ELF_C_READ, NULL);
+	Elf_Scn* section = NULL;
+	bool found = false;
+
+	while (elf != NULL && !found && (section = elf_nextscn(elf, section)) != NULL){
+		GElf_Shdr header;
+		if (gelf_getshdr(section, &header) == NULL || header.sh_type != SHT_SYMTAB || header.sh_entsize == 0){
+			continue;
+		}
+
+		Elf_Data* data = elf_getdata(section, NULL);
+		size_t count = header.sh_size / header.sh_entsize;
+
+		for (size_t i = 0; data != NULL && i < count; i++){
+			GElf_Sym symbol;
+			const char* symbolName;
+
+			if (gelf_getsym(data, int(i), &symbol) != NULL &&
+				(symbolName = elf_strptr(elf, header.sh_link, symbol.st_name)) != NULL &&
+				strcmp(symbolName, name) == 0){
+				// Data addresses are linked at 0x800000 and up
+				address = uint32_t(symbol.st_value) & 0xFFFF;
+				found = true;
+				break;
+			}
+		}
+	}
+
+	if (elf != NULL){
+		elf_end(elf);
+	}
+	close(fd);
+	return found;
+}
+
+static void printMemory(const Bench& bench, const char* firmwarePath){
+	const uint8_t* data = bench.avr->data;
+	uint32_t ramStart = bench.avr->ioend + 1;
+	uint32_t ramEnd = bench.avr->ramend;
+
+	// Top of the stack's reach: the first run of untouched paint below RAMEND
+	uint32_t stackLow = ramEnd + 1;
+	int run = 0;
+	for (uint32_t address = ramEnd; address >= ramStart; address--){
+		run = data[address] == PAINT ? run + 1 : 0;
+		if (run == PAINT_RUN){
+			stackLow = address + PAINT_RUN;
+			break;
+		}
+	}
+
+	// Top of static data and the heap: the first run of paint above RAMSTART
+	uint32_t heapHigh = stackLow;
+	run = 0;
+	for (uint32_t address = ramStart; address < stackLow; address++){
+		run = data[address] == PAINT ? run + 1 : 0;
+		if (run == PAINT_RUN){
+			heapHigh = address + 1 - PAINT_RUN;
+			break;
+		}
+	}
+
+	printf("sram %u B, stack peak %u B, free at worst %u B", ramEnd + 1 - ramStart, ramEnd + 1 - stackLow,
+		stackLow > heapHigh ? stackLow - heapHigh : 0);
+
+	uint32_t heapStart;
+	if (findSymbol(firmwarePath, "__heap_start", heapStart) && heapStart >= ramStart && heapStart <= heapHigh){
+		printf(", static %u B, heap peak %u B", heapStart - ramStart, heapHigh - heapStart);
+	}
+	else{
+		printf(", static + heap peak %u B", heapHigh - ramStart);
+	}
+
+	printf("\n");
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Main
+
+/**
+* Boot the firmware afresh and run one scenario
+*/
+static bool runScenario(const char* firmwarePath, const elf_firmware_t& firmware, const char* mcu, uint32_t frequency,
+	uint32_t baud, bool verbose, const char* scenarioPath, FILE* csv){
+	std::vector<std::string> lines;
+	if (!loadScript(scenarioPath, lines)){
+		perror(scenarioPath);
+		return false;
+	}
+
+	Bench bench;
+	memset(bench.operations, 0, sizeof(bench.operations));
+	bench.baud = baud;
+	bench.verbose = verbose;
+	bench.unmatched = 0;
+
+	bench.avr = avr_make_mcu_by_name(mcu);
+	if (bench.avr == NULL){
+		fprintf(stderr, "Unknown MCU %s\n", mcu);
+		return false;
+	}
+
+	avr_init(bench.avr);
+	avr_load_firmware(bench.avr, const_cast<elf_firmware_t*>(&firmware));
+	bench.avr->frequency = frequency;
+
+	// Keep the sketch's output off our stdout
+	uint32_t flags = 0;
+	avr_ioctl(bench.avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(bench.avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+	avr_irq_register_notify(avr_io_getirq(bench.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), serialOutput, &bench);
+	avr_register_io_write(bench.avr, GPIOR0_ADDRESS, markerWritten, &bench);
+
+	// The C runtime fills in .data and .bss on boot; the rest keeps the paint
+	// until the heap or stack reaches it
+	memset(bench.avr->data + bench.avr->ioend + 1, PAINT, bench.avr->ramend - bench.avr->ioend);
+
+	bool completed = runLines(bench, lines, 0, 0) >= 0;
+
+	// Results from different checkouts line up by the scenario's file name
+	const char* scenarioName = strrchr(scenarioPath, '/');
+	scenarioName = scenarioName != NULL ? scenarioName + 1 : scenarioPath;
+	double seconds = double(bench.avr->cycle) / frequency;
+
+	printf("%s: %.2f s simulated, %llu cycles, %zu bytes of serial output%s\n", scenarioPath, seconds,
+		(unsigned long long)bench.avr->cycle, bench.output.size(), completed ? "" : " (aborted)");
+	printf("  %-16s %8s %10s %10s %10s %10s\n", "operation", "calls", "min", "mean", "max", "mean us");
+
+	for (int i = 1; i < BENCH_OPERATION_COUNT; i++){
+		const OperationStats& stats = bench.operations[i];
+		if (stats.calls == 0){
+			continue;
+		}
+
+		double mean = double(stats.total) / stats.calls;
+		printf("  %-16s %8llu %10llu %10.0f %10llu %10.1f\n", OPERATION_NAMES[i], (unsigned long long)stats.calls,
+			(unsigned long long)stats.min, mean, (unsigned long long)stats.max, mean * 1e6 / frequency);
+
+		if (csv != NULL){
+			fprintf(csv, "%s,%s,%llu,%llu,%.1f,%llu\n", scenarioName, OPERATION_NAMES[i], (unsigned long long)stats.calls,
+				(unsigned long long)stats.min, mean, (unsigned long long)stats.max);
+		}
+	}
+
+	if (bench.unmatched > 0){
+		printf("  %llu end markers without a begin\n", (unsigned long long)bench.unmatched);
+	}
+
+	printf("  ");
+	printMemory(bench, firmwarePath);
+
+	avr_terminate(bench.avr);
+	return completed;
+}
+
+int main(int argc, char** argv){
+	const char* mcu = "atmega328p";
+	uint32_t frequency = 16000000;
+	uint32_t baud = 115200;
+	const char* csvPath = NULL;
+	bool verbose = false;
+	int option;
+
+	while ((option = getopt(argc, argv, "m:f:b:c:v")) != -1){
+		switch (option){
+		case 'm':
+			mcu = optarg;
+			break;
+		case 'f':
+			frequency = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			baud = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			csvPath = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 2 || frequency == 0 || baud == 0){
+		printUsage();
+		return 1;
+	}
+
+	const char* firmwarePath = argv[optind];
+	elf_firmware_t firmware;
+	memset(&firmware, 0, sizeof(firmware));
+
+	if (elf_read_firmware(firmwarePath, &firmware) != 0){
+		fprintf(stderr, "Can't load %s\n", firmwarePath);
+		return 1;
+	}
+
+	FILE* csv = NULL;
+	if (csvPath != NULL){
+		csv = fopen(csvPath, "a");
+		if (csv == NULL){
+			perror(csvPath);
+			return 1;
+		}
+	}
+
+	bool ok = true;
+	for (int i = optind + 1; i < argc; i++){
+		ok = runScenario(firmwarePath, firmware, mcu, frequency, baud, verbose, argv[i], csv) && ok;
+	}
+
+	if (csv != NULL){
+		fclose(csv);
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Build LurkerNano with benchmark markers, build the simavr harness and run
+# every scenario against the firmware.
+#
+# Usage:
+#	run_bench.sh [results.csv]
+#
+# The first run records baseline.csv next to this script, to be committed.
+# Later runs write to results.csv (build/results.csv by default) and show
+# each operation's mean against the baseline.
+#
+# Needs arduino-cli with the AVR core and the sketch's libraries installed,
+# and simavr with its headers. Override FQBN, BUILD or LIBRARIES as needed,
+# e.g. LIBRARIES=~/Arduino/libraries run_bench.sh
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BUILD=${BUILD:-$HERE/build}
+FQBN=${FQBN:-arduino:avr:nano:cpu=atmega328}
+BASELINE=$HERE/baseline.csv
+HEADER=scenario,operation,calls,min,mean,max
+
+mkdir -p "$BUILD/firmware"
+
+arduino-cli compile --fqbn "$FQBN" --build-path "$BUILD/firmware" \
+	--build-property "compiler.cpp.extra_flags=-DLURKER_BENCH" \
+	${LIBRARIES:+--libraries "$LIBRARIES"} \
+	"$HERE/../LurkerNano"
+
+g++ -std=c++11 -O2 -o "$BUILD/lurker_bench" "$HERE/lurker_bench.cpp" -lsimavr -lelf
+
+if [ -f "$BASELINE" ]; then
+	RESULTS=${1:-$BUILD/results.csv}
+else
+	RESULTS=$BASELINE
+fi
+
+echo "$HEADER" > "$RESULTS"
+"$BUILD/lurker_bench" -c "$RESULTS" "$BUILD/firmware/LurkerNano.ino.elf" "$HERE"/scenarios/*.txt
+
+if [ "$RESULTS" = "$BASELINE" ]; then
+	echo "Recorded $BASELINE"
+	exit 0
+fi
+
+# Mean cycles per operation against the baseline
+awk -F, '
+	FNR == 1 { next }
+	NR == FNR { base[$1 "," $2] = $5; next }
+	{
+		key = $1 "," $2
+		if (key in base && base[key] > 0)
+			printf "%-40s %10.0f %10.0f %+7.1f%%\n", key, base[key], $5, ($5 - base[key]) * 100 / base[key]
+		else
+			printf "%-40s %10s %10.0f\n", key, "-", $5
+	}' "$BASELINE" "$RESULTS"
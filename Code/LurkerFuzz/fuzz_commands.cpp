@@ -0,0 +1,127 @@
+//////////////////////////////////////////////////////////////////////////
+// Command Fuzzer
+//
+// Feeds arbitrary serial bytes and radio packets to the sketch's
+// FrameDispatcher, set up the way startDispatcher() does, with a serial
+// buffer of the sketch's size and a handler table with no spare room.
+// Overlong commands, missing terminators and
+// stray bytes mustn't write past the buffer, and every frame a handler
+// gets has to be whole, from a source the handler was registered for:
+//	- stream frames end at their first terminator, and no terminator runs
+//	  more than one handler
+//	- radio packets never reach a serial command, or the other way round
+//
+// Input is a series of chunks:
+//	1sxxxxxx	x bytes typed into the serial (s = 0) or relay stream
+//	0xxxxxxx	Radio packet of (x % 33) bytes, from the broadcast pipe
+//			if x is odd
+//
+// Build:
+//	clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../LurkerNano -o fuzz_commands fuzz_commands.cpp ../LurkerNano/lurker_dispatch.cpp
+//	g++ -g -O1 -fsanitize=address,undefined -I../LurkerNano -o fuzz_commands fuzz_commands.cpp fuzz_main.cpp ../LurkerNano/lurker_dispatch.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "fuzz_input.h"
+#include "lurker_dispatch.h"
+
+const uint8_t BUFFER_LENGTH = 32;	// As in the sketch, on a node
+const uint8_t ROUTE_COUNT = 9;	// Exactly the handlers registered below
+const char TERMINATOR = '$';	// PACKET_END
+const uint8_t RADIO_PAYLOAD = 32;
+
+static unsigned int handled[FRAME_SOURCE_COUNT];
+
+static void checkFrame(const FrameView& frame){
+	FUZZ_CHECK(frame.source < FRAME_SOURCE_COUNT);
+	FUZZ_CHECK(frame.length > 0);
+	handled[frame.source]++;
+
+	if (frame.source == FRAME_SERIAL || frame.source == FRAME_RELAY){
+		FUZZ_CHECK(frame.length <= BUFFER_LENGTH);
+		FUZZ_CHECK(frame.data[frame.length - 1] == TERMINATOR);
+		FUZZ_CHECK(memchr(frame.data, TERMINATOR, frame.length - 1) == 0);
+	}
+	else{
+		FUZZ_CHECK(frame.length <= RADIO_PAYLOAD);
+	}
+}
+
+static void serialCommand(const FrameView& frame){
+	checkFrame(frame);
+	FUZZ_CHECK(frame.source == FRAME_SERIAL || frame.source == FRAME_RELAY);
+}
+
+static void networkPacket(const FrameView& frame){
+	checkFrame(frame);
+	FUZZ_CHECK(frame.source == FRAME_RADIO || frame.source == FRAME_BROADCAST);
+}
+
+static void unknownCommand(const FrameView& frame){
+	checkFrame(frame);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	// Exactly sized, so any write past the end is caught
+	uint8_t* serialBuffer = new uint8_t[BUFFER_LENGTH];
+	uint8_t* relayBuffer = new uint8_t[BUFFER_LENGTH];
+
+	FrameRoute routes[ROUTE_COUNT];
+	FrameDispatcher dispatcher(TERMINATOR, routes, ROUTE_COUNT);
+	dispatcher.attachBuffer(FRAME_SERIAL, serialBuffer, BUFFER_LENGTH);
+	dispatcher.attachBuffer(FRAME_RELAY, relayBuffer, BUFFER_LENGTH);
+	dispatcher.setDefaultHandler(unknownCommand);
+
+	const char commands[] = { 'B', 'b', 'r', 'S', 'P' };
+	for (size_t i = 0; i < sizeof(commands); i++){
+		FUZZ_CHECK(dispatcher.addHandler(commands[i], FROM_SERIAL | FROM_RELAY, serialCommand));
+	}
+
+	const char packets[] = { 'j', 'J', 'D', 'd' };
+	for (size_t i = 0; i < sizeof(packets); i++){
+		FUZZ_CHECK(dispatcher.addHandler(packets[i], FROM_RADIO, networkPacket));
+	}
+
+	// The table is full
+	FUZZ_CHECK(!dispatcher.addHandler('x', FROM_ANY, serialCommand));
+
+	FuzzInput input(data, size);
+	unsigned int terminators[FRAME_SOURCE_COUNT] = {};
+	memset(handled, 0, sizeof(handled));
+
+	while (!input.empty()){
+		uint8_t op = input.byte();
+
+		if (op & 0x80){
+			FrameSource source = (op & 0x40) ? FRAME_RELAY : FRAME_SERIAL;
+
+			for (uint8_t i = 0; i < (op & 0x3F) && !input.empty(); i++){
+				uint8_t next = input.byte();
+
+				terminators[source] += next == TERMINATOR;
+				dispatcher.readIn(source, next);
+			}
+		}
+		else{
+			FrameSource source = (op & 1) ? FRAME_BROADCAST : FRAME_RADIO;
+			uint8_t length = op % (RADIO_PAYLOAD + 1);
+			uint8_t* packet = new uint8_t[length > 0 ? length : 1];
+
+			length = input.take(packet, length);
+			dispatcher.dispatch(source, packet, length);
+			terminators[source] += length > 0;
+
+			delete[] packet;
+		}
+	}
+
+	// Empty commands may be dropped, but nothing runs twice
+	for (uint8_t i = 0; i < FRAME_SOURCE_COUNT; i++){
+		FUZZ_CHECK(handled[i] <= terminators[i]);
+	}
+
+	delete[] serialBuffer;
+	delete[] relayBuffer;
+	return 0;
+}
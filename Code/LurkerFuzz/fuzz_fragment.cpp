@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////////
+// Fragment Fuzzer
+//
+// Drives a Fragmenter with arbitrary fragments, status reports and clock
+// steps while it has a message of its own in flight, and checks that:
+//	- reassembly only writes inside its slots, which are allocated at the
+//	  exact size so the sanitizer catches a write past them
+//	- whole messages are never empty or longer than MAX_MESSAGE_SIZE
+//	- every packet it sends is well formed and fits the radio payload
+//	- a message it sends is finished with exactly once
+//
+// Input, after a byte for the slot count and a byte for the length of the
+// message to send (none if 0):
+//	0xxxxxxx	Packet of (x % 33) bytes, which follow
+//	1xxxxxxx	Clock moves on x * 10 ms, then update()
+//
+// Build:
+//	clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../LurkerNano -o fuzz_fragment fuzz_fragment.cpp ../LurkerNano/lurker_fragment.cpp
+//	g++ -g -O1 -fsanitize=address,undefined -I../LurkerNano -o fuzz_fragment fuzz_fragment.cpp fuzz_main.cpp ../LurkerNano/lurker_fragment.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "fuzz_input.h"
+#include "lurker_fragment.h"
+
+const uint8_t UNIT = 1;
+const uint8_t MAX_SLOTS = 3;
+const NetworkTime TIME_STEP = 10;
+const FragmentConfig CONFIG = { 100, 5, 2000 };	// Retry, retries, slot timeout
+
+class FuzzHandler : public FragmentHandler{
+public:
+	FuzzHandler() : finished(0){}
+
+	void transmit(uint8_t, const uint8_t* packet, uint8_t length){
+		FUZZ_CHECK(length > 0 && length <= NETWORK_PAYLOAD_SIZE);
+		FUZZ_CHECK(packet[length - 1] == PACKET_END);
+		FUZZ_CHECK(packet[0] == FRAGMENT_CODE || packet[0] == FRAGMENT_STATUS_CODE);
+		FUZZ_CHECK(packet[1] == UNIT);
+
+		if (packet[0] == FRAGMENT_CODE){
+			FUZZ_CHECK(length >= FRAGMENT_HEADER_SIZE + 2);
+			FUZZ_CHECK(packet[4] > 0 && packet[4] <= MAX_FRAGMENTS && packet[3] < packet[4]);
+		}
+		else{
+			FUZZ_CHECK(length == FRAGMENT_HEADER_SIZE);
+		}
+	}
+
+	void messageReceived(uint8_t, const uint8_t* message, uint16_t length){
+		FUZZ_CHECK(length > 0 && length <= MAX_MESSAGE_SIZE);
+
+		// Touch every byte, so a bad length shows up
+		volatile uint8_t sum = 0;
+		for (uint16_t i = 0; i < length; i++){
+			sum += message[i];
+		}
+	}
+
+	void messageSent(uint8_t, bool){
+		finished++;
+	}
+
+	unsigned int finished;
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	FuzzInput input(data, size);
+
+	uint8_t slotCount = 1 + input.byte() % MAX_SLOTS;
+	uint16_t sendLength = input.byte();
+
+	// Exactly sized, so any write past the last slot is caught
+	FragmentSlot* pool = new FragmentSlot[slotCount];
+
+	uint8_t* message = new uint8_t[sendLength > 0 ? sendLength : 1];
+	memset(message, 'm', sendLength);
+
+	FuzzHandler handler;
+	Fragmenter fragmenter(UNIT, CONFIG, handler, pool, slotCount);
+
+	NetworkTime now = input.word();
+	int sent = fragmenter.send(COORDINATOR, message, sendLength, now);
+
+	FUZZ_CHECK((sent >= 0) == (sendLength > 0 && sendLength <= MAX_MESSAGE_SIZE));
+
+	while (!input.empty()){
+		uint8_t op = input.byte();
+
+		if (op & 0x80){
+			now += (op & 0x7F) * TIME_STEP;
+			fragmenter.update(now);
+		}
+		else{
+			uint8_t length = op % (NETWORK_PAYLOAD_SIZE + 1);
+			uint8_t* packet = new uint8_t[length > 0 ? length : 1];
+
+			length = input.take(packet, length);
+			fragmenter.receive(packet, length, now);
+
+			delete[] packet;
+		}
+
+		FUZZ_CHECK(handler.finished <= (sent >= 0 ? 1u : 0u));
+		FUZZ_CHECK(fragmenter.sending() == (sent >= 0 && handler.finished == 0));
+	}
+
+	delete[] message;
+	delete[] pool;
+	return 0;
+}
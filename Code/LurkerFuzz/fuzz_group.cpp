@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////////
+// Group Fuzzer
+//
+// Drives a GroupCaster with arbitrary group packets, host commands and
+// clock steps, and checks that:
+//	- commands it carries out are whole frames, for one of its groups
+//	- a repeat of the packet before it, inside the duplicate window, is
+//	  never carried out
+//	- every packet it sends is a well-formed broadcast that fits the radio
+//	  payload, and it sends no more than repeats + 1 copies of each
+//	- it builds them only in its broadcast buffer, allocated at the exact
+//	  size so the sanitizer catches a write past it
+//
+// Input, after a byte for the caster's groups:
+//	00xxxxxx	Group packet of (x % 33) bytes, which follow
+//	01xxxxxx	Host command of x bytes
+//	1xxxxxxx	Clock moves on x ms, then update()
+//
+// Build:
+//	clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../LurkerNano -o fuzz_group fuzz_group.cpp ../LurkerNano/lurker_group.cpp
+//	g++ -g -O1 -fsanitize=address,undefined -I../LurkerNano -o fuzz_group fuzz_group.cpp fuzz_main.cpp ../LurkerNano/lurker_group.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "fuzz_input.h"
+#include "lurker_group.h"
+
+const GroupConfig CONFIG = { 3, 4, 1000 };	// Repeats, repeat interval, duplicate window
+
+class FuzzHandler : public GroupHandler{
+public:
+	FuzzHandler() : copies(0), carriedOut(0){}
+
+	void transmit(uint8_t unit, const uint8_t* packet, uint8_t length){
+		FUZZ_CHECK(unit == BROADCAST);
+		FUZZ_CHECK(length >= GROUP_HEADER_SIZE + 2 && length <= NETWORK_PAYLOAD_SIZE);
+		FUZZ_CHECK(packet[0] == GROUP_CODE && packet[length - 1] == PACKET_END);
+		FUZZ_CHECK(++copies <= CONFIG.repeats + 1u);
+	}
+
+	void groupCommand(const uint8_t* command, uint8_t length){
+		FUZZ_CHECK(length >= 2 && length <= MAX_GROUP_COMMAND);
+		FUZZ_CHECK(command[length - 1] == PACKET_END);
+		carriedOut++;
+	}
+
+	unsigned int copies;
+	unsigned int carriedOut;
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	FuzzInput input(data, size);
+
+	FuzzHandler handler;
+	uint8_t* broadcast = new uint8_t[NETWORK_PAYLOAD_SIZE];
+	GroupCaster caster(input.byte(), CONFIG, handler, broadcast);
+	NetworkTime now = input.word();
+
+	// The last packet heard, for spotting repeats
+	uint8_t last[NETWORK_PAYLOAD_SIZE];
+	uint8_t lastLength = 0;
+	NetworkTime lastAt = 0;
+
+	while (!input.empty()){
+		uint8_t op = input.byte();
+
+		if (op & 0x80){
+			now += op & 0x7F;
+			caster.update(now);
+			continue;
+		}
+
+		uint8_t length = op & 0x3F;
+		if ((op & 0x40) == 0){
+			length %= NETWORK_PAYLOAD_SIZE + 1;
+		}
+
+		uint8_t* packet = new uint8_t[length > 0 ? length : 1];
+		length = input.take(packet, length);
+
+		unsigned int carriedOut = handler.carriedOut;
+
+		if (op & 0x40){
+			handler.copies = 0;
+			caster.command(packet, length, now);
+		}
+		else{
+			caster.receive(packet, length, now);
+
+			bool repeat = lastLength > 0 && length == lastLength && memcmp(packet, last, length) == 0
+				&& NetworkTime(now - lastAt) < CONFIG.duplicateWindow;
+
+			if (handler.carriedOut != carriedOut){
+				FUZZ_CHECK(caster.member(packet[1]));
+				FUZZ_CHECK(!repeat);
+			}
+
+			// Only well-formed packets count; the caster ignores the rest
+			if (length >= GROUP_HEADER_SIZE + 2 && packet[0] == GROUP_CODE && packet[length - 1] == PACKET_END){
+				memcpy(last, packet, length);
+				lastLength = length;
+				lastAt = now;
+			}
+		}
+
+		FUZZ_CHECK(handler.carriedOut - carriedOut <= 1);
+		delete[] packet;
+	}
+
+	delete[] broadcast;
+	return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef LURKER_FUZZ_INPUT_H
+#define LURKER_FUZZ_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Fuzz Input
+//
+// Shared by the harnesses. Each harness is a libFuzzer entry point,
+// LLVMFuzzerTestOneInput, built either with clang's -fsanitize=fuzzer or
+// with fuzz_main.cpp for compilers without libFuzzer.
+//////////////////////////////////////////////////////////////////////////
+
+/**
+* Abort with a message when a harness invariant fails; the fuzzer keeps
+* the input that did it
+*/
+#define FUZZ_CHECK(condition) \
+	do{ \
+		if (!(condition)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			abort(); \
+		} \
+	} while (0)
+
+/**
+* Takes bytes off the front of a fuzz input; zeros once it runs out
+*/
+class FuzzInput{
+public:
+	FuzzInput(const uint8_t* data, size_t size) : _data(data), _size(size){}
+
+	bool empty() const{
+		return _size == 0;
+	}
+
+	size_t remaining() const{
+		return _size;
+	}
+
+	uint8_t byte(){
+		if (_size == 0){
+			return 0;
+		}
+
+		_size--;
+		return *_data++;
+	}
+
+	uint32_t word(){
+		uint32_t value = 0;
+		for (int i = 0; i < 4; i++){
+			value = (value << 8) | byte();
+		}
+		return value;
+	}
+
+	/**
+	* Take up to length bytes
+	* @return Number taken
+	*/
+	size_t take(uint8_t* buffer, size_t length){
+		size_t count = length < _size ? length : _size;
+
+		for (size_t i = 0; i < count; i++){
+			buffer[i] = _data[i];
+		}
+
+		_data += count;
+		_size -= count;
+		return count;
+	}
+
+private:
+	const uint8_t* _data;
+	size_t _size;
+};
+
+#endif
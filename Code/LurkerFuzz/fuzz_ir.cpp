@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////////////////////
+// IR Fuzzer
+//
+// Feeds an IrDecoder arbitrary pulse trains, through the same queue the
+// interrupt fills, and an arbitrary event packet to decode, and checks
+// that:
+//	- every code it decodes has a protocol and a bit count that fit it
+//	- NEC codes carry their inverted command byte, and repeats the code
+//	  before them
+//	- a decoded event packet encodes back to the same bytes
+//	- NEC and Sony codes played by an IrPlayer decode back to themselves,
+//	  once for each frame, and nothing else can be played
+//
+// Input, after the event packet's length and bytes:
+//	0xxxxxxx	Space of (x * 80) us
+//	1xxxxxxx	Mark of (x * 80) us
+// with a 0xFF byte ending the frame without a gap, as the loop does after
+// a quiet spell.
+//
+// Build:
+//	clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../LurkerNano -o fuzz_ir fuzz_ir.cpp ../LurkerNano/lurker_ir.cpp
+//	g++ -g -O1 -fsanitize=address,undefined -I../LurkerNano -o fuzz_ir fuzz_ir.cpp fuzz_main.cpp ../LurkerNano/lurker_ir.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "fuzz_input.h"
+#include "lurker_ir.h"
+
+const uint32_t TIME_STEP = 80;
+const uint8_t MAX_PACKET = 32;	// Radio payload
+
+static uint32_t lastNec = 0;
+
+static void checkReplay(const IrCode& code){
+	bool nec = code.protocol == IR_NEC && code.bits == 32;
+	bool sony = code.protocol == IR_SONY && (code.bits == 12 || code.bits == 15 || code.bits == 20)
+		&& (code.value >> code.bits) == 0;
+
+	IrPlayer player;
+	FUZZ_CHECK(player.load(code) == (nec || sony));
+	if (!player.busy()){
+		return;
+	}
+	FUZZ_CHECK(!player.load(code));
+
+	// The decoder only takes NEC codes with the command's inverse
+	unsigned int frames = sony ? 3 : uint8_t(code.value >> 16) == uint8_t(~(code.value >> 24)) ? 1 : 0;
+	unsigned int decoded = 0;
+
+	IrDecoder decoder;
+	IrCode received;
+	uint16_t pulse;
+
+	while (player.next(pulse)){
+		FUZZ_CHECK((pulse & IR_MAX_PULSE) > 0);
+
+		// Cut short as the receiver's queue would
+		uint32_t duration = uint32_t(pulse & IR_MAX_PULSE) * 1000 / player.carrier();
+		if (duration > IR_MAX_PULSE){
+			duration = IR_MAX_PULSE;
+		}
+
+		if (decoder.pulse(uint16_t(duration) | (pulse & IR_MARK), received) && received.protocol != IR_HASH){
+			FUZZ_CHECK(received.protocol == code.protocol && received.bits == code.bits);
+			FUZZ_CHECK(received.value == code.value && !received.repeat);
+			decoded++;
+		}
+	}
+
+	FUZZ_CHECK(!player.busy() && !player.next(pulse));
+	FUZZ_CHECK(decoded == frames);
+}
+
+static void checkCode(const IrCode& code){
+	FUZZ_CHECK(code.protocol == IR_NEC || code.protocol == IR_SONY || code.protocol == IR_HASH);
+
+	switch (code.protocol){
+	case IR_NEC:
+		FUZZ_CHECK(code.bits == 32);
+		FUZZ_CHECK(uint8_t(code.value >> 16) == uint8_t(~(code.value >> 24)));
+		FUZZ_CHECK(!code.repeat || code.value == lastNec);
+		lastNec = code.value;
+		break;
+	case IR_SONY:
+		FUZZ_CHECK(code.bits == 12 || code.bits == 15 || code.bits == 20);
+		FUZZ_CHECK((code.value >> code.bits) == 0);
+		FUZZ_CHECK(!code.repeat);
+		break;
+	default:
+		FUZZ_CHECK(code.bits == 32 && !code.repeat);
+		break;
+	}
+
+	if (!code.repeat){
+		checkReplay(code);
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	FuzzInput input(data, size);
+
+	// Event packet
+	uint8_t packet[MAX_PACKET];
+	uint8_t length = input.take(packet, input.byte() % (MAX_PACKET + 1));
+	uint8_t unit;
+	IrCode event;
+
+	if (IrDecoder::decodeEvent(packet, length, unit, event)){
+		uint8_t encoded[IR_EVENT_SIZE];
+
+		FUZZ_CHECK(IrDecoder::encodeEvent(unit, event, encoded) == length);
+		FUZZ_CHECK(memcmp(encoded, packet, length) == 0);
+
+		checkReplay(event);
+	}
+
+	// Pulse train
+	IrPulseQueue queue;
+	IrDecoder decoder;
+	IrCode code;
+	uint32_t now = 0;
+	bool carrier = false;
+
+	lastNec = 0;
+
+	while (!input.empty()){
+		uint8_t op = input.byte();
+
+		if (op == 0xFF){
+			if (decoder.end(code)){
+				checkCode(code);
+			}
+			continue;
+		}
+
+		// The queue sees edges, so two pulses of the same kind in a row
+		// have a glitch between them
+		bool mark = op & 0x80;
+		if (mark != carrier){
+			queue.edge(now += 1, carrier);
+			carrier = !carrier;
+		}
+
+		now += (op & 0x7F) * TIME_STEP;
+		queue.edge(now, carrier);
+		carrier = !carrier;
+
+		uint16_t pulse;
+		while (queue.pop(pulse)){
+			if (decoder.pulse(pulse, code)){
+				checkCode(code);
+			}
+		}
+	}
+
+	return 0;
+}
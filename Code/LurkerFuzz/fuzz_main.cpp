@@ -0,0 +1,223 @@
+//////////////////////////////////////////////////////////////////////////
+// Fuzz Driver
+//
+// Stands in for libFuzzer where the compiler doesn't have it. Runs every
+// corpus file through the harness once, then, with -r, that many random
+// mutations of them: bit flips, byte changes, inserts, deletes and
+// splices. There is no coverage feedback, so it finds less than libFuzzer
+// does, but it runs the same harnesses under the same sanitizers.
+//
+// Usage:
+//	fuzz_<harness> [-r runs] [-S seed] [-m max_length] corpus...
+//
+//	Corpus arguments are files or directories of files. If a mutation
+//	fails, it is left in fuzz-crash-input.
+//////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+typedef std::vector<uint8_t> FuzzCase;
+
+const char LAST_INPUT[] = "fuzz-crash-input";
+
+static uint64_t state;
+
+/**
+* splitmix64
+*/
+static uint64_t randomNumber(){
+	uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static size_t randomBelow(size_t limit){
+	return limit > 0 ? randomNumber() % limit : 0;
+}
+
+static bool readCase(const std::string& path, FuzzCase& input){
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL){
+		perror(path.c_str());
+		return false;
+	}
+
+	uint8_t buffer[4096];
+	size_t count;
+
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0){
+		input.insert(input.end(), buffer, buffer + count);
+	}
+
+	fclose(file);
+	return true;
+}
+
+static bool loadCorpus(const char* path, std::vector<FuzzCase>& corpus){
+	struct stat info;
+	if (stat(path, &info) != 0){
+		perror(path);
+		return false;
+	}
+
+	if (!S_ISDIR(info.st_mode)){
+		corpus.push_back(FuzzCase());
+		return readCase(path, corpus.back());
+	}
+
+	DIR* directory = opendir(path);
+	if (directory == NULL){
+		perror(path);
+		return false;
+	}
+
+	// Sorted, so runs are repeatable
+	std::vector<std::string> names;
+	struct dirent* entry;
+
+	while ((entry = readdir(directory)) != NULL){
+		if (entry->d_name[0] != '.'){
+			names.push_back(entry->d_name);
+		}
+	}
+	closedir(directory);
+
+	std::sort(names.begin(), names.end());
+
+	for (size_t i = 0; i < names.size(); i++){
+		corpus.push_back(FuzzCase());
+		if (!readCase(std::string(path) + "/" + names[i], corpus.back())){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void mutate(FuzzCase& input, const std::vector<FuzzCase>& corpus, size_t maxLength){
+	int mutations = 1 + randomBelow(4);
+
+	for (int i = 0; i < mutations; i++){
+		size_t position = randomBelow(input.size() + 1);
+
+		switch (randomBelow(6)){
+		case 0:
+			if (!input.empty()){
+				input[randomBelow(input.size())] ^= 1 << randomBelow(8);
+			}
+			break;
+		case 1:
+			if (!input.empty()){
+				input[randomBelow(input.size())] = uint8_t(randomNumber());
+			}
+			break;
+		case 2:
+			input.insert(input.begin() + position, uint8_t(randomNumber()));
+			break;
+		case 3:
+			if (position < input.size()){
+				input.erase(input.begin() + position, input.begin() + std::min(input.size(), position + 1 + randomBelow(8)));
+			}
+			break;
+		case 4:{
+			// Interesting values for lengths, units and times
+			static const uint8_t SPECIAL[] = { 0, 1, 0x7F, 0x80, 0xFE, 0xFF, '$', 'j', 'J', 'D', 'd', 'F' };
+			if (!input.empty()){
+				input[randomBelow(input.size())] = SPECIAL[randomBelow(sizeof(SPECIAL))];
+			}
+			break;
+		}
+		case 5:{
+			const FuzzCase& other = corpus[randomBelow(corpus.size())];
+			if (!other.empty()){
+				size_t start = randomBelow(other.size());
+				size_t length = 1 + randomBelow(other.size() - start);
+				input.insert(input.begin() + position, other.begin() + start, other.begin() + start + length);
+			}
+			break;
+		}
+		}
+	}
+
+	if (input.size() > maxLength){
+		input.resize(maxLength);
+	}
+}
+
+int main(int argc, char** argv){
+	unsigned long runs = 0;
+	size_t maxLength = 4096;
+	int option;
+
+	state = 1;
+
+	while ((option = getopt(argc, argv, "r:S:m:")) != -1){
+		switch (option){
+		case 'r':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			state = strtoull(optarg, NULL, 10);
+			break;
+		case 'm':
+			maxLength = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r runs] [-S seed] [-m max_length] corpus...\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<FuzzCase> corpus;
+
+	for (int i = optind; i < argc; i++){
+		if (!loadCorpus(argv[i], corpus)){
+			return 1;
+		}
+	}
+
+	for (size_t i = 0; i < corpus.size(); i++){
+		LLVMFuzzerTestOneInput(corpus[i].data(), corpus[i].size());
+	}
+
+	if (corpus.empty()){
+		corpus.push_back(FuzzCase());
+	}
+
+	// Each mutation is written here first, so the one that crashes is kept
+	FILE* last = runs > 0 ? fopen(LAST_INPUT, "wb") : NULL;
+
+	for (unsigned long run = 0; run < runs; run++){
+		FuzzCase input = corpus[randomBelow(corpus.size())];
+		mutate(input, corpus, maxLength);
+
+		if (last != NULL){
+			rewind(last);
+			if (ftruncate(fileno(last), 0) == 0 && !input.empty()){
+				fwrite(input.data(), 1, input.size(), last);
+			}
+			fflush(last);
+		}
+
+		LLVMFuzzerTestOneInput(input.data(), input.size());
+	}
+
+	if (last != NULL){
+		fclose(last);
+		unlink(LAST_INPUT);
+	}
+
+	fprintf(stderr, "%zu corpus inputs and %lu mutations passed\n", corpus.size(), runs);
+	return 0;
+}
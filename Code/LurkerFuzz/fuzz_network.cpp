@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////
+// Network Fuzzer
+//
+// Drives a coordinator or a node's LurkerNetwork with arbitrary radio
+// packets and clock steps, and checks after every step that nothing it
+// received has corrupted its state or stalled it:
+//	- the routing table is only written inside its bounds (the table is
+//	  allocated to the exact size, so the sanitizer catches any stray
+//	  write) and the coordinator's own slot never becomes active
+//	- readings only come from nodes in the table
+//	- packets only go to units that exist, and fit the radio payload
+//	- update() always makes progress, and the next one is never further
+//	  off than the longest interval in the config
+//
+// Input, after a byte that picks the device and a few for its set-up:
+//	0xxxxxxx	Packet of (x % 33) bytes, which follow
+//	1xxxxxxx	Clock moves on x * 10 ms, then update()
+//
+// Build:
+//	clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../LurkerNano -o fuzz_network fuzz_network.cpp ../LurkerNano/lurker_network.cpp
+//	g++ -g -O1 -fsanitize=address,undefined -I../LurkerNano -o fuzz_network fuzz_network.cpp fuzz_main.cpp ../LurkerNano/lurker_network.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "fuzz_input.h"
+#include "lurker_network.h"
+
+const uint8_t MAX_ROUTES = 32;
+const NetworkTime TIME_STEP = 10;
+const NetworkConfig CONFIG = { 2000, 1000, 100 };	// Timeout, join, poll
+
+class FuzzHandler : public NetworkHandler{
+public:
+	FuzzHandler(bool coordinator, const NetworkRoute* routes, uint8_t routeCount) :
+		_coordinator(coordinator), _routes(routes), _routeCount(routeCount){}
+
+	void transmit(uint8_t unit, const uint8_t* packet, uint8_t length){
+		FUZZ_CHECK(length > 0 && length <= NETWORK_PAYLOAD_SIZE);
+
+		if (_coordinator){
+			FUZZ_CHECK(unit == BROADCAST || (unit != COORDINATOR && unit < _routeCount));
+		}
+		else{
+			FUZZ_CHECK(unit == COORDINATOR);
+		}
+
+		// Everything sent is well formed, even when answering garbage
+		FUZZ_CHECK(packet[length - 1] == PACKET_END);
+
+		if (packet[0] == DATA_TRANSMIT_RESPONSE){
+			SensorReading reading;
+			FUZZ_CHECK(LurkerNetwork::decodeReading(packet, length, reading));
+		}
+	}
+
+	void readSensors(SensorReading& reading){
+		FUZZ_CHECK(!_coordinator);
+
+		reading.unit = 0;
+		reading.temperature = 21.5f;
+		reading.humidity = 45;
+		reading.illuminance = 300;
+		reading.motion = false;
+		reading.valid = ALL_VALID;
+	}
+
+	void readingReceived(const SensorReading& reading){
+		FUZZ_CHECK(_coordinator);
+		FUZZ_CHECK(reading.unit != COORDINATOR && reading.unit < _routeCount);
+		FUZZ_CHECK(_routes[reading.unit].active);
+	}
+
+private:
+	bool _coordinator;
+	const NetworkRoute* _routes;
+	uint8_t _routeCount;
+};
+
+static void checkState(const LurkerNetwork& network, const NetworkRoute* routes, uint8_t routeCount){
+	if (network.isCoordinator()){
+		FUZZ_CHECK(routeCount == 0 || !routes[COORDINATOR].active);
+		FUZZ_CHECK(network.activeNodes() < routeCount || routeCount == 0);
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	FuzzInput input(data, size);
+
+	bool coordinator = input.byte() & 1;
+	uint8_t unit = coordinator ? COORDINATOR : 1 + input.byte() % (BROADCAST - 1);
+	uint8_t routeCount = coordinator ? input.byte() % (MAX_ROUTES + 1) : 0;
+
+	// Exactly sized, so any write past the end is caught
+	NetworkRoute* routes = routeCount > 0 ? new NetworkRoute[routeCount] : 0;
+
+	FuzzHandler handler(coordinator, routes, routeCount);
+	LurkerNetwork network(unit, CONFIG, handler, routes, routeCount);
+
+	// Anywhere on the clock, wrap included
+	NetworkTime now = input.word();
+	network.begin(now);
+
+	NetworkTime longest = CONFIG.nodeTimeout;
+
+	while (!input.empty()){
+		uint8_t op = input.byte();
+
+		if (op & 0x80){
+			now += (op & 0x7F) * TIME_STEP;
+			network.update(now);
+
+			NetworkTime wait = network.nextUpdate(now) - now;
+			FUZZ_CHECK(wait > 0 && wait <= longest);
+		}
+		else{
+			uint8_t length = op % (NETWORK_PAYLOAD_SIZE + 1);
+			uint8_t* packet = new uint8_t[length > 0 ? length : 1];
+
+			length = input.take(packet, length);
+			network.receive(packet, length, now);
+
+			delete[] packet;
+
+			NetworkTime wait = network.nextUpdate(now) - now;
+			FUZZ_CHECK(wait <= longest);
+		}
+
+		checkState(network, routes, routeCount);
+	}
+
+	delete[] routes;
+	return 0;
+}
@@ -0,0 +1,66 @@
+//////////////////////////////////////////////////////////////////////////
+// Reading Fuzzer
+//
+// Feeds arbitrary bytes to LurkerNetwork::decodeReading, which has to
+// reject anything short, unterminated or out of order without reading past
+// the packet, and checks that any reading it does accept survives being
+// encoded and decoded again, down to which readings are marked invalid.
+//
+// Build:
+//	clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../LurkerNano -o fuzz_reading fuzz_reading.cpp ../LurkerNano/lurker_network.cpp
+//	g++ -g -O1 -fsanitize=address,undefined -I../LurkerNano -o fuzz_reading fuzz_reading.cpp fuzz_main.cpp ../LurkerNano/lurker_network.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <string.h>
+
+#include "fuzz_input.h"
+#include "lurker_network.h"
+
+const size_t MAX_PACKET = 255;	// Lengths are a byte
+
+static bool sameReading(const SensorReading& a, const SensorReading& b){
+	return a.unit == b.unit
+		&& a.valid == b.valid
+		&& fabsf(a.temperature - b.temperature) < 0.006f
+		&& fabsf(a.humidity - b.humidity) < 0.006f
+		&& a.illuminance == b.illuminance
+		&& a.motion == b.motion;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	if (size > MAX_PACKET){
+		return 0;
+	}
+
+	// Exactly sized, so any read past the end is caught
+	uint8_t* packet = new uint8_t[size > 0 ? size : 1];
+	memcpy(packet, data, size);
+
+	SensorReading reading;
+
+	if (LurkerNetwork::decodeReading(packet, uint8_t(size), reading)){
+		FUZZ_CHECK(size >= 17 && packet[0] == DATA_TRANSMIT_RESPONSE && packet[1] == PROTOCOL_VERSION);
+
+		// Fields are 16-bit hundredths, so always in range
+		FUZZ_CHECK(fabsf(reading.temperature) <= 327.68f);
+		FUZZ_CHECK(fabsf(reading.humidity) <= 327.68f);
+
+		// Invalid readings are zeroed, not left as the marker
+		FUZZ_CHECK((reading.valid & ~ALL_VALID) == 0);
+		FUZZ_CHECK((reading.valid & VALID_TEMPERATURE) || reading.temperature == 0);
+		FUZZ_CHECK((reading.valid & VALID_HUMIDITY) || reading.humidity == 0);
+		FUZZ_CHECK((reading.valid & VALID_ILLUMINANCE) ? reading.illuminance != INVALID_ILLUMINANCE : reading.illuminance == 0);
+
+		uint8_t encoded[NETWORK_PAYLOAD_SIZE];
+		uint8_t length = LurkerNetwork::encodeReading(reading, encoded);
+		FUZZ_CHECK(length <= NETWORK_PAYLOAD_SIZE);
+
+		SensorReading decoded;
+		FUZZ_CHECK(LurkerNetwork::decodeReading(encoded, length, decoded));
+		FUZZ_CHECK(sameReading(reading, decoded));
+	}
+
+	delete[] packet;
+	return 0;
+}
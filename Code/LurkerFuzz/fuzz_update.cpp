@@ -0,0 +1,219 @@
+//////////////////////////////////////////////////////////////////////////
+// Update Fuzzer
+//
+// Drives an UpdateReceiver with arbitrary radio packets, and an
+// UpdateSender with arbitrary host commands, node status reports and
+// clock steps, and checks that:
+//	- the receiver only writes and reads inside the image it erased, which
+//	  is allocated at the exact size so the sanitizer catches the rest
+//	- it only activates an image that matches the CRC it was announced with,
+//	  and only confirms an activate for that image or the one installed
+//	- the sender only fills its window buffer, also exactly sized
+//	- every packet either sends is well formed and fits the radio payload
+//	- the sender reports on units in its table only, once each per update
+//
+// Input, after a byte for which of the sender's units are active:
+//	00xxxxxx	Radio packet of (x % 33) bytes to the receiver, which follow
+//	01xxxxxx	Status packet of (x % 33) bytes to the sender
+//	10xxxxxx	Host command of x bytes to the sender
+//	11xxxxxx	Clock moves on x * 10 ms, then update()
+//
+// Build:
+//	clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../LurkerNano -o fuzz_update fuzz_update.cpp ../LurkerNano/lurker_update.cpp
+//	g++ -g -O1 -fsanitize=address,undefined -I../LurkerNano -o fuzz_update fuzz_update.cpp fuzz_main.cpp ../LurkerNano/lurker_update.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "fuzz_input.h"
+#include "lurker_update.h"
+
+const uint8_t UNIT = 1;
+const uint8_t ROUTE_COUNT = 6;
+const NetworkTime TIME_STEP = 10;
+const UpdateConfig CONFIG = { 200, 30, 3, 4, 500, 300 };	// Start delay, poll timeout, retries, rounds, host and activate timeouts
+
+static void checkPacket(const uint8_t* packet, uint8_t length){
+	FUZZ_CHECK(length > 0 && length <= NETWORK_PAYLOAD_SIZE);
+	FUZZ_CHECK(packet[length - 1] == PACKET_END);
+}
+
+/**
+* Node side, with an image store sized by the last erase
+*/
+class FuzzNode : public UpdateHandler{
+public:
+	FuzzNode() : image(0), size(0), activated(0), installed(0){}
+
+	~FuzzNode(){
+		delete[] image;
+	}
+
+	void transmit(uint8_t unit, const uint8_t* packet, uint8_t length){
+		checkPacket(packet, length);
+		FUZZ_CHECK(unit == COORDINATOR);
+		FUZZ_CHECK(length == 7 && packet[0] == UPDATE_STATUS && packet[1] == UNIT);
+	}
+
+	bool eraseImage(uint16_t length){
+		FUZZ_CHECK(length > 0 && length <= MAX_IMAGE_SIZE);
+
+		delete[] image;
+		image = new uint8_t[length];
+		memset(image, 0xFF, length);
+		size = length;
+		return true;
+	}
+
+	void writeImage(uint16_t offset, const uint8_t* data, uint8_t length){
+		FUZZ_CHECK(offset + length <= size);
+		memcpy(image + offset, data, length);
+	}
+
+	void readImage(uint16_t offset, uint8_t* data, uint8_t length){
+		FUZZ_CHECK(offset + length <= size);
+		memcpy(data, image + offset, length);
+	}
+
+	void activateImage(uint16_t length, uint32_t crc){
+		FUZZ_CHECK(length == size);
+		activated++;
+		installed = crc;
+	}
+
+	uint32_t installedImage(){
+		return installed;
+	}
+
+	uint8_t* image;
+	uint16_t size;
+	unsigned int activated;
+	uint32_t installed;
+};
+
+/**
+* Coordinator side
+*/
+class FuzzCoordinator : public UpdateHandler{
+public:
+	FuzzCoordinator(){
+		memset(reported, 0, sizeof(reported));
+	}
+
+	void transmit(uint8_t unit, const uint8_t* packet, uint8_t length){
+		checkPacket(packet, length);
+		FUZZ_CHECK(unit == BROADCAST || (unit > COORDINATOR && unit < ROUTE_COUNT));
+		FUZZ_CHECK(packet[0] == UPDATE_START || packet[0] == UPDATE_BLOCK
+			|| packet[0] == UPDATE_POLL || packet[0] == UPDATE_ACTIVATE);
+	}
+
+	void requestBlocks(uint16_t first, uint8_t count){
+		FUZZ_CHECK(first % UPDATE_WINDOW == 0);
+		FUZZ_CHECK(count > 0 && count <= UPDATE_WINDOW);
+	}
+
+	void targetFinished(uint8_t unit, UpdateState state){
+		FUZZ_CHECK(unit > COORDINATOR && unit < ROUTE_COUNT);
+		FUZZ_CHECK(state == UPDATE_ACTIVATED || state == UPDATE_FAILED);
+		FUZZ_CHECK(!reported[unit]);
+		reported[unit] = true;
+	}
+
+	void updateFinished(){
+		memset(reported, 0, sizeof(reported));
+	}
+
+	bool reported[ROUTE_COUNT];
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	FuzzInput input(data, size);
+
+	FuzzNode node;
+	UpdateReceiver receiver(UNIT, node);
+
+	uint8_t activeUnits = input.byte();
+	NetworkRoute routes[ROUTE_COUNT];
+	UpdateTarget targets[ROUTE_COUNT];
+
+	for (uint8_t i = 0; i < ROUTE_COUNT; i++){
+		routes[i].active = activeUnits & (1 << i);
+		routes[i].lastHeard = 0;
+	}
+
+	// Exactly sized, so any write past the window is caught
+	uint8_t* window = new uint8_t[UPDATE_WINDOW * UPDATE_BLOCK_SIZE];
+
+	FuzzCoordinator coordinator;
+	UpdateSender sender(CONFIG, coordinator, routes, targets, ROUTE_COUNT, window);
+	NetworkTime now = input.word();
+
+	// The last start the receiver was sent, for checking what it activates
+	uint16_t announcedSize = 0;
+	uint32_t announcedCrc = 0;
+
+	while (!input.empty()){
+		uint8_t op = input.byte();
+		uint8_t length = op & 0x3F;
+
+		if ((op & 0xC0) == 0xC0){
+			now += length * TIME_STEP;
+			sender.update(now);
+			continue;
+		}
+
+		if ((op & 0x80) == 0){
+			length %= NETWORK_PAYLOAD_SIZE + 1;
+		}
+
+		uint8_t* packet = new uint8_t[length > 0 ? length : 1];
+		length = input.take(packet, length);
+
+		switch (op & 0xC0){
+		case 0x00:{
+			unsigned int activated = node.activated;
+
+			if (length >= 8 && packet[0] == UPDATE_START && packet[length - 1] == PACKET_END){
+				FrameReader fields(packet + 1, length - 1);
+				uint16_t announced = fields.word();
+
+				if (announced > 0 && announced <= MAX_IMAGE_SIZE){
+					announcedSize = announced;
+					announcedCrc = uint32_t(fields.word()) << 16;
+					announcedCrc |= fields.word();
+				}
+			}
+
+			UpdateState before = receiver.state();
+			receiver.receive(packet, length);
+
+			if (node.activated != activated){
+				FUZZ_CHECK(node.size == announcedSize);
+				FUZZ_CHECK(crc32(0, node.image, node.size) == announcedCrc);
+			}
+
+			// Confirmed for the image it activated, or had installed already
+			if (receiver.state() == UPDATE_ACTIVATED && before != UPDATE_ACTIVATED){
+				FUZZ_CHECK(length >= 6 && packet[0] == UPDATE_ACTIVATE);
+
+				FrameReader fields(packet + 1, 4);
+				uint32_t crc = uint32_t(fields.word()) << 16;
+				crc |= fields.word();
+				FUZZ_CHECK(crc == node.installed);
+			}
+			break;
+		}
+		case 0x40:
+			sender.receive(packet, length, now);
+			break;
+		default:
+			sender.command(packet, length, now);
+			break;
+		}
+
+		delete[] packet;
+	}
+
+	delete[] window;
+	return 0;
+}
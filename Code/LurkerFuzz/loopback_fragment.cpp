@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////////////////////
+// Fragment Loopback
+//
+// Sends random messages between two Fragmenters over a link that drops
+// packets at random, and checks that every message arrives whole, exactly
+// once, and that the sender is told it was delivered. Where the fuzzer
+// looks for bad input, this looks for messages the retry scheme loses.
+//
+// Packets take LINK_DELAY to cross; the clock runs in 1 ms steps with
+// update() called on both ends each step.
+//
+// Usage:
+//	loopback_fragment [-m messages] [-l loss_percent] [-S seed]
+//
+//	Defaults are 2000 messages at 10% loss. Exits 1 if any message was
+//	lost, duplicated, corrupted or reported undelivered.
+//
+// Build:
+//	g++ -std=c++11 -g -O1 -fsanitize=address,undefined -I../LurkerNano -o loopback_fragment loopback_fragment.cpp ../LurkerNano/lurker_fragment.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lurker_fragment.h"
+
+const uint8_t SENDER = 1;
+const uint8_t RECEIVER = COORDINATOR;
+const NetworkTime LINK_DELAY = 5;
+const NetworkTime GIVE_UP = 10000;	// Longer than any retry sequence
+
+const FragmentConfig CONFIG = { 0, 0, 0 };	// The defaults, as a sketch would leave them
+
+static uint64_t state;
+
+/**
+* splitmix64
+*/
+static uint64_t randomNumber(){
+	uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+struct LinkPacket{
+	uint8_t to;
+	NetworkTime arrives;
+	uint8_t length;
+	uint8_t data[NETWORK_PAYLOAD_SIZE];
+};
+
+/**
+* Both ends' packets in flight, and what each end has been told
+*/
+class Link : public FragmentHandler{
+public:
+	Link(unsigned int loss) :
+		now(0),
+		loss(loss),
+		sent(0),
+		dropped(0),
+		received(0),
+		finished(0),
+		delivered(false),
+		expected(0),
+		expectedLength(0),
+		corrupted(false){}
+
+	void transmit(uint8_t unit, const uint8_t* packet, uint8_t length){
+		sent++;
+
+		if (randomNumber() % 100 < loss){
+			dropped++;
+			return;
+		}
+
+		LinkPacket in;
+		in.to = unit;
+		in.arrives = now + LINK_DELAY;
+		in.length = length;
+		memcpy(in.data, packet, length);
+		queue.push_back(in);
+	}
+
+	void messageReceived(uint8_t unit, const uint8_t* message, uint16_t length){
+		received++;
+
+		if (unit != SENDER || length != expectedLength || memcmp(message, expected, length) != 0){
+			corrupted = true;
+		}
+	}
+
+	void messageSent(uint8_t, bool wasDelivered){
+		finished++;
+		delivered = wasDelivered;
+	}
+
+	NetworkTime now;
+	unsigned int loss;
+	std::deque<LinkPacket> queue;
+	unsigned long sent;
+	unsigned long dropped;
+
+	unsigned int received;
+	unsigned int finished;
+	bool delivered;
+	const uint8_t* expected;
+	uint16_t expectedLength;
+	bool corrupted;
+};
+
+static void printUsage(){
+	fprintf(stderr, "Usage: loopback_fragment [-m messages] [-l loss_percent] [-S seed]\n");
+}
+
+int main(int argc, char** argv){
+	unsigned long messages = 2000;
+	unsigned int loss = 10;
+	state = 1;
+	int option;
+
+	while ((option = getopt(argc, argv, "m:l:S:")) != -1){
+		switch (option){
+		case 'm':
+			messages = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			loss = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			state = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (loss >= 100){
+		printUsage();
+		return 1;
+	}
+
+	Link link(loss);
+	FragmentSlot senderSlot;
+	FragmentSlot receiverSlot;
+	Fragmenter sender(SENDER, CONFIG, link, &senderSlot, 1);
+	Fragmenter receiver(RECEIVER, CONFIG, link, &receiverSlot, 1);
+
+	uint8_t message[MAX_MESSAGE_SIZE];
+	unsigned long fragments = 0;
+	unsigned long failed = 0;
+
+	for (unsigned long i = 0; i < messages; i++){
+		uint16_t length = 1 + randomNumber() % MAX_MESSAGE_SIZE;
+		for (uint16_t j = 0; j < length; j++){
+			message[j] = uint8_t(randomNumber());
+		}
+
+		link.expected = message;
+		link.expectedLength = length;
+		link.received = 0;
+		link.finished = 0;
+		link.corrupted = false;
+		fragments += (length + FRAGMENT_DATA_SIZE - 1) / FRAGMENT_DATA_SIZE;
+
+		if (sender.send(RECEIVER, message, length, link.now) < 0){
+			printf("message %lu: not accepted\n", i);
+			return 1;
+		}
+
+		// Until the sender has finished and everything in flight has landed
+		NetworkTime start = link.now;
+		while ((sender.sending() || !link.queue.empty()) && NetworkTime(link.now - start) < GIVE_UP){
+			link.now++;
+
+			while (!link.queue.empty() && link.queue.front().arrives == link.now){
+				LinkPacket in = link.queue.front();
+				link.queue.pop_front();
+				(in.to == RECEIVER ? receiver : sender).receive(in.data, in.length, link.now);
+			}
+
+			sender.update(link.now);
+			receiver.update(link.now);
+		}
+
+		if (link.finished != 1 || !link.delivered || link.received != 1 || link.corrupted){
+			printf("message %lu (%u bytes): finished %u times, %s, received %u times%s\n", i, length,
+				link.finished, link.delivered ? "delivered" : "not delivered", link.received,
+				link.corrupted ? ", corrupted" : "");
+			failed++;
+		}
+	}
+
+	printf("%lu messages, %lu fragments, %lu packets sent, %lu dropped (%.1f%%), %lu failed\n",
+		messages, fragments, link.sent, link.dropped, link.sent > 0 ? 100.0 * link.dropped / link.sent : 0.0, failed);
+
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Build the fuzz harnesses with AddressSanitizer and UndefinedBehaviorSanitizer
+# and run each one over its seed corpus, then the fragment loopback check.
+#
+# Usage:
+#	run_fuzz.sh [runs]
+#
+# Uses clang's libFuzzer when it's there, for coverage-guided runs that add
+# what they find to the corpus; otherwise g++ with fuzz_main.cpp, which only
+# mutates the seeds at random. Override CXX or BUILD as needed.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BUILD=${BUILD:-$HERE/build}
+RUNS=${1:-1000000}
+SANITIZE="address,undefined"
+
+if [ -z "$CXX" ] && command -v clang++ > /dev/null; then
+	CXX=clang++
+fi
+CXX=${CXX:-g++}
+
+if echo 'int LLVMFuzzerTestOneInput(const char*, long){ return 0; }' |
+	"$CXX" -fsanitize=fuzzer -x c++ -o /dev/null - 2> /dev/null; then
+	SANITIZE="fuzzer,$SANITIZE"
+	DRIVER=
+else
+	DRIVER="$HERE/fuzz_main.cpp"
+fi
+
+mkdir -p "$BUILD"
+
+build(){
+	name=$1
+	shift
+	"$CXX" -std=c++11 -g -O1 -fsanitize=$SANITIZE -fno-sanitize-recover=undefined \
+		-o "$BUILD/fuzz_$name" "$HERE/fuzz_$name.cpp" $DRIVER "$@"
+}
+
+run(){
+	name=$1
+	cd "$BUILD"
+	if [ -z "$DRIVER" ]; then
+		mkdir -p "corpus/$name"
+		"./fuzz_$name" -runs="$RUNS" "corpus/$name" "$HERE/corpus/$name"
+	else
+		"./fuzz_$name" -r "$RUNS" "$HERE/corpus/$name"
+	fi
+	cd "$HERE"
+}
+
+NANO="$HERE/../LurkerNano"
+
+build network -I"$NANO" "$NANO/lurker_network.cpp"
+build reading -I"$NANO" "$NANO/lurker_network.cpp"
+build commands -I"$NANO" "$NANO/lurker_dispatch.cpp"
+build fragment -I"$NANO" "$NANO/lurker_fragment.cpp"
+build update -I"$NANO" "$NANO/lurker_update.cpp"
+build group -I"$NANO" "$NANO/lurker_group.cpp"
+build ir -I"$NANO" "$NANO/lurker_ir.cpp"
+
+run network
+run reading
+run commands
+run fragment
+run update
+run group
+run ir
+
+"$CXX" -std=c++11 -g -O1 -fsanitize=address,undefined -fno-sanitize-recover=undefined -I"$NANO" \
+	-o "$BUILD/loopback_fragment" "$HERE/loopback_fragment.cpp" "$NANO/lurker_fragment.cpp"
+"$BUILD/loopback_fragment"
@@ -0,0 +1,201 @@
+#include "capture_file.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char CAPTURE_MAGIC[8] = { 'L', 'K', 'C', 'A', 'P', 'T', 'U', 'R' };
+
+int64_t currentTimeMicros(){
+	struct timespec time;
+	clock_gettime(CLOCK_REALTIME, &time);
+	return int64_t(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+int64_t monotonicMicros(){
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return int64_t(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Writer
+
+CaptureWriter::CaptureWriter() : _file(NULL), _lastTime(0), _chunks(0), _bytes(0){
+}
+
+CaptureWriter::~CaptureWriter(){
+	close();
+}
+
+bool CaptureWriter::open(const char* path, int64_t startTime){
+	close();
+
+	_file = fopen(path, "wb");
+	if (_file == NULL){
+		return false;
+	}
+
+	CaptureHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+	header.version = CAPTURE_VERSION;
+	header.startTime = startTime;
+
+	_lastTime = 0;
+	_chunks = 0;
+	_bytes = 0;
+
+	if (fwrite(&header, sizeof(header), 1, _file) != 1){
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void CaptureWriter::close(){
+	if (_file != NULL){
+		fclose(_file);
+	}
+
+	_file = NULL;
+}
+
+bool CaptureWriter::writeVarint(uint64_t value){
+	uint8_t bytes[10];
+	size_t length = 0;
+
+	do{
+		bytes[length] = value & 0x7F;
+		value >>= 7;
+
+		if (value != 0){
+			bytes[length] |= 0x80;
+		}
+		length++;
+	} while (value != 0);
+
+	return fwrite(bytes, 1, length, _file) == length;
+}
+
+bool CaptureWriter::write(int64_t time, const void* data, size_t length){
+	if (_file == NULL || length == 0 || length > MAX_CHUNK_LENGTH){
+		return false;
+	}
+
+	// Clock steps backwards are flattened rather than stored as huge delays
+	int64_t delay = time > _lastTime ? time - _lastTime : 0;
+
+	if (!writeVarint(delay) || !writeVarint(length) || fwrite(data, 1, length, _file) != length){
+		return false;
+	}
+
+	_lastTime += delay;
+	_chunks++;
+	_bytes += length;
+	return true;
+}
+
+bool CaptureWriter::flush(){
+	return _file != NULL && fflush(_file) == 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Reader
+
+CaptureReader::CaptureReader() : _data(NULL), _size(0), _position(0), _time(0){
+	memset(&_header, 0, sizeof(_header));
+}
+
+CaptureReader::~CaptureReader(){
+	close();
+}
+
+bool CaptureReader::open(const char* path){
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0){
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(CaptureHeader)){
+		::close(fd);
+		return false;
+	}
+
+	_size = info.st_size;
+	void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (data == MAP_FAILED){
+		_size = 0;
+		return false;
+	}
+
+	_data = static_cast<const uint8_t*>(data);
+	memcpy(&_header, _data, sizeof(_header));
+
+	if (memcmp(_header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || _header.version != CAPTURE_VERSION){
+		close();
+		return false;
+	}
+
+	// Replays run straight through the file
+	madvise(const_cast<uint8_t*>(_data), _size, MADV_SEQUENTIAL);
+	rewind();
+	return true;
+}
+
+void CaptureReader::close(){
+	if (_data != NULL){
+		munmap(const_cast<uint8_t*>(_data), _size);
+	}
+
+	_data = NULL;
+	_size = 0;
+}
+
+void CaptureReader::rewind(){
+	_position = sizeof(CaptureHeader);
+	_time = 0;
+}
+
+bool CaptureReader::readVarint(uint64_t& value){
+	value = 0;
+
+	for (int shift = 0; shift < 64 && _position < _size; shift += 7){
+		uint8_t byte = _data[_position++];
+		value |= uint64_t(byte & 0x7F) << shift;
+
+		if (!(byte & 0x80)){
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool CaptureReader::next(CaptureChunk& chunk){
+	uint64_t delay;
+	uint64_t length;
+
+	if (_data == NULL || !readVarint(delay) || !readVarint(length) || length > _size - _position){
+		return false;
+	}
+
+	_time += delay;
+	chunk.time = _time;
+	chunk.data = _data + _position;
+	chunk.length = length;
+
+	_position += length;
+	return true;
+}
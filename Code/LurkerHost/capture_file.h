@@ -0,0 +1,130 @@
+#ifndef LURKER_CAPTURE_FILE_H
+#define LURKER_CAPTURE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+//////////////////////////////////////////////////////////////////////////
+// Capture Files
+//
+// Raw serial bytes with their arrival times, as read from a port:
+//	header	- magic "LKCAPTUR", version, flags, start time (us since the epoch)
+//	chunk	- varint delay since the previous chunk in us, varint length, bytes
+//	...
+//
+// Chunks are whatever one read() returned, so replaying them reproduces
+// the original burst pattern as well as the rate. Varints are LEB128; a
+// steady 115200 baud stream costs about 3 bytes of overhead per chunk.
+//////////////////////////////////////////////////////////////////////////
+
+const uint32_t CAPTURE_VERSION = 1;
+const size_t MAX_CHUNK_LENGTH = 65536;
+
+struct CaptureHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	int64_t startTime;	// us since the epoch
+};
+
+struct CaptureChunk{
+	int64_t time;	// us since the start of the capture
+	const uint8_t* data;
+	size_t length;
+};
+
+/**
+* Writes a capture file through a stdio buffer
+*/
+class CaptureWriter{
+public:
+	CaptureWriter();
+	~CaptureWriter();
+
+	/**
+	* Create a capture file
+	* @param startTime Wall-clock time of the capture start, us since the epoch
+	*/
+	bool open(const char* path, int64_t startTime);
+	void close();
+
+	/**
+	* Add a chunk
+	* @param time us since the start of the capture; must not go backwards
+	*/
+	bool write(int64_t time, const void* data, size_t length);
+	bool flush();
+
+	uint64_t chunks() const{
+		return _chunks;
+	}
+
+	uint64_t bytes() const{
+		return _bytes;
+	}
+
+private:
+	CaptureWriter(const CaptureWriter&);
+	CaptureWriter& operator=(const CaptureWriter&);
+
+	bool writeVarint(uint64_t value);
+
+	FILE* _file;
+	int64_t _lastTime;
+	uint64_t _chunks;
+	uint64_t _bytes;
+};
+
+/**
+* Reads a capture file through a memory map
+*/
+class CaptureReader{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	bool open(const char* path);
+	void close();
+
+	const CaptureHeader& header() const{
+		return _header;
+	}
+
+	/**
+	* Get the next chunk
+	* The data stays valid until the reader is closed.
+	* @return False at the end of the capture or if the rest is truncated
+	*/
+	bool next(CaptureChunk& chunk);
+
+	/**
+	* Go back to the first chunk
+	*/
+	void rewind();
+
+private:
+	CaptureReader(const CaptureReader&);
+	CaptureReader& operator=(const CaptureReader&);
+
+	bool readVarint(uint64_t& value);
+
+	CaptureHeader _header;
+	const uint8_t* _data;
+	size_t _size;
+	size_t _position;
+	int64_t _time;
+};
+
+/**
+* Current wall-clock time in us since the epoch
+*/
+int64_t currentTimeMicros();
+
+/**
+* Current monotonic time in us, for measuring intervals
+*/
+int64_t monotonicMicros();
+
+#endif
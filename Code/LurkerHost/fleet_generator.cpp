@@ -0,0 +1,292 @@
+#include "fleet_generator.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+const char* const NODE_KIND_NAMES[NODE_KIND_COUNT] = { "nano", "relayed", "office" };
+
+const double MS_PER_HOUR = 3600000.0;
+const double MS_PER_DAY = 24 * MS_PER_HOUR;
+
+const double WORK_START = 8;	// Local hour
+const double WORK_END = 18;
+const double MEAN_STAY = 20 * 60000.0;	// Mean length of an occupancy burst in ms
+const double MOTION_CHANCE = 0.7;	// Chance an occupied room trips the PIR in one sample
+const double OFFICE_LIGHTING = 320;	// Lux from the lights when a room is in use
+const int64_t SAMPLE_JITTER = 40;	// Loop timing wobble of the sketches, +/- ms
+
+double FleetRandom::normal(){
+	// Box-Muller; the second value is thrown away to keep the state simple
+	double u = uniform();
+	double v = uniform();
+	return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+double FleetRandom::exponential(double mean){
+	return -mean * log(1 - uniform());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Fleet
+
+FleetGenerator::FleetGenerator(const FleetConfig& config) :
+	_config(config),
+	_random(config.seed),
+	_repeat(false){
+	_weatherPhase[0] = _random.uniform(0, 2 * M_PI);
+	_weatherPhase[1] = _random.uniform(0, 2 * M_PI);
+
+	double total = 0;
+	for (int kind = 0; kind < NODE_KIND_COUNT; kind++){
+		total += std::max(0.0, config.kindShare[kind]);
+	}
+
+	uint32_t streams = std::max<uint32_t>(config.streams, 1);
+	_nodes.resize(config.nodes);
+
+	for (uint32_t i = 0; i < config.nodes; i++){
+		Node& node = _nodes[i];
+
+		// Kinds are dealt out in proportion rather than drawn, so small fleets
+		// still get the mix that was asked for
+		double position = (i + 0.5) / config.nodes * total;
+		int kind = 0;
+		while (kind < NODE_KIND_COUNT - 1 && position >= std::max(0.0, config.kindShare[kind])){
+			position -= std::max(0.0, config.kindShare[kind]);
+			kind++;
+		}
+
+		node.kind = NodeKind(kind);
+		node.unit = i + 1;
+		node.stream = i % streams;
+		node.random = FleetRandom(_random.next());
+
+		node.baseTemperature = node.random.uniform(18, 24);
+		node.swing = node.random.uniform(0.5, 3.5);
+		node.baseHumidity = node.random.uniform(30, 60);
+		node.daylight = node.random.uniform(20, 900);
+		node.activity = node.random.uniform(0.1, 0.9);
+		node.surfaceOffset = node.random.uniform(-1.5, 0.5);
+
+		node.drift = 0;
+		node.occupied = false;
+		node.motion = false;
+		node.lastMotionEvent = INT64_MIN / 2;
+		node.bootTime = config.startTime - int64_t(node.random.uniform(0, 7 * MS_PER_DAY));
+		node.online = config.startTime;
+
+		// Nodes were started at different times, so their samples are spread out
+		int64_t interval = node.kind == NODE_OFFICE ? OFFICE_SAMPLE_INTERVAL : NANO_SAMPLE_INTERVAL;
+		schedule(config.startTime + int64_t(node.random.uniform(0, double(interval))), i, EVENT_SAMPLE);
+	}
+}
+
+size_t FleetGenerator::nodeCount(NodeKind kind) const{
+	size_t count = 0;
+	for (size_t i = 0; i < _nodes.size(); i++){
+		count += _nodes[i].kind == kind;
+	}
+	return count;
+}
+
+double FleetGenerator::frameRate() const{
+	return nodeCount(NODE_OFFICE) * 1000.0 / OFFICE_SAMPLE_INTERVAL +
+		(nodeCount(NODE_NANO) + nodeCount(NODE_RELAYED)) * 1000.0 / NANO_SAMPLE_INTERVAL;
+}
+
+void FleetGenerator::schedule(int64_t time, uint32_t node, EventType type){
+	Event event = { time, node, type };
+	_events.push(event);
+}
+
+void FleetGenerator::next(FleetFrame& frame){
+	if (_repeat){
+		frame = _repeated;
+		_repeat = false;
+		return;
+	}
+
+	for (;;){
+		Event event = _events.top();
+		_events.pop();
+
+		Node& node = _nodes[event.node];
+		frame.time = event.time;
+		frame.stream = node.stream;
+		frame.node = event.node;
+
+		if (event.type == EVENT_BOOT){
+			boot(node, frame);
+			return;
+		}
+
+		if (event.type == EVENT_MOTION){
+			if (event.time < node.online){
+				continue;
+			}
+
+			motionEvent(node, frame);
+		}
+		else{
+			int64_t interval = node.kind == NODE_OFFICE ? OFFICE_SAMPLE_INTERVAL : NANO_SAMPLE_INTERVAL;
+
+			if (node.random.chance(_config.dropoutRate * interval / MS_PER_HOUR)){
+				node.online = event.time + int64_t(node.random.exponential(_config.dropoutLength) * 1000) + 1;
+				schedule(node.online, event.node, EVENT_BOOT);
+				continue;
+			}
+
+			sample(node, event.time, frame);
+			schedule(event.time + interval + int64_t(node.random.uniform(-SAMPLE_JITTER, SAMPLE_JITTER)), event.node, EVENT_SAMPLE);
+		}
+
+		// Bytes lost on the link; the parser has to resync on the next '#'
+		if (frame.length > 1 && node.random.chance(_config.corruptRate)){
+			frame.length = 1 + node.random.next() % (frame.length - 1);
+		}
+		// Radio retries whose acknowledgement was lost
+		else if (node.kind == NODE_RELAYED && node.random.chance(_config.duplicateRate)){
+			_repeated = frame;
+			_repeat = true;
+		}
+
+		return;
+	}
+}
+
+double FleetGenerator::localHour(int64_t time) const{
+	double hour = fmod(time / MS_PER_HOUR + _config.utcOffset, 24);
+	return hour < 0 ? hour + 24 : hour;
+}
+
+bool FleetGenerator::workingHours(int64_t time) const{
+	// 1970-01-01 was a Thursday
+	int64_t day = int64_t(floor((time / MS_PER_HOUR + _config.utcOffset) / 24));
+	int weekday = int(((day + 4) % 7 + 7) % 7);
+	double hour = localHour(time);
+
+	return weekday != 0 && weekday != 6 && hour >= WORK_START && hour < WORK_END;
+}
+
+double FleetGenerator::weather(int64_t time) const{
+	// Fronts coming through every few days, shared by the whole site
+	double days = time / MS_PER_DAY;
+	return 1.5 * sin(2 * M_PI * days / 3.7 + _weatherPhase[0]) + 0.8 * sin(2 * M_PI * days / 9.1 + _weatherPhase[1]);
+}
+
+void FleetGenerator::updateOccupancy(Node& node, int64_t time, int64_t interval){
+	// Two-state chain whose long-run occupancy is the room's activity at work
+	// and a trickle outside of it; stays average MEAN_STAY
+	double occupancy = workingHours(time) ? node.activity : node.activity * 0.03;
+	double leave = std::min(1.0, interval / MEAN_STAY);
+	double enter = std::min(1.0, leave * occupancy / (1 - occupancy));
+
+	node.occupied = node.random.chance(node.occupied ? 1 - leave : enter);
+	node.motion = node.occupied && node.random.chance(MOTION_CHANCE);
+}
+
+void FleetGenerator::sample(Node& node, int64_t time, FleetFrame& frame){
+	int64_t interval = node.kind == NODE_OFFICE ? OFFICE_SAMPLE_INTERVAL : NANO_SAMPLE_INTERVAL;
+	double hour = localHour(time);
+	double diurnal = cos(2 * M_PI * (hour - 15) / 24);	// Warmest mid-afternoon
+
+	// Slow wander of the room itself, decaying over a few hours
+	node.drift = node.drift * exp(-interval / (4 * MS_PER_HOUR)) + node.random.normal() * 0.02;
+
+	updateOccupancy(node, time, interval);
+
+	double temperature = node.baseTemperature + node.swing * diurnal + weather(time) + node.drift +
+		(node.occupied ? 0.6 : 0) + node.random.normal() * 0.05;
+	double humidity = node.baseHumidity - 2 * (temperature - node.baseTemperature) + node.random.normal() * 0.3;
+	humidity = std::min(95.0, std::max(5.0, humidity));
+
+	double sun = hour > 6 && hour < 20 ? sin(M_PI * (hour - 6) / 14) : 0;
+	double clouds = 0.75 + 0.25 * sin(weather(time) * 2);
+	double illuminance = node.daylight * sun * clouds + (node.occupied ? OFFICE_LIGHTING : 0) + node.random.normal() * 2;
+	illuminance = std::max(0.0, illuminance);
+
+	// Sensor resolution: DS18B20 in 1/16 C, DHT22 in 0.1 %
+	temperature = floor(temperature * 16 + 0.5) / 16;
+	humidity = floor(humidity * 10 + 0.5) / 10;
+
+	int length = 0;
+	char* text = frame.text;
+	size_t size = sizeof(frame.text);
+
+	switch (node.kind){
+	case NODE_NANO:
+		length = snprintf(text, size,
+			"#{\"id\":\"lurker%u\",\"version\":0.90,\"temperature\":%.2f,\"humidity\":%.2f,\"illuminance\":%ld,\"motion\":%s}$\r\n",
+			node.unit, temperature, humidity, long(illuminance), node.motion ? "true" : "false");
+		break;
+
+	case NODE_RELAYED:
+		if (_config.requestLines){
+			length = snprintf(text, size, "Requesting data from Unit %u\r\n", node.unit);
+		}
+
+		length += snprintf(text + length, size - length,
+			"#{\"id\":%u,\"temperature\":%.2f,\"humidity\":%.2f,\"illuminance\":%ld,\"motion\":%s}$\r\n",
+			node.unit, temperature, humidity, long(illuminance), node.motion ? "true" : "false");
+		break;
+
+	default:{
+		double surface = temperature + node.surfaceOffset - 0.3 * diurnal + node.random.normal() * 0.05;
+		double noise = node.occupied ? 150 + 80 * fabs(node.random.normal()) : 40 + 10 * fabs(node.random.normal());
+
+		length = snprintf(text, size,
+			"#{\"id\":\"lurker%u\",\"timestamp\":%lu,\"air_temp\":%.2f,\"surface_temp\":%.2f,\"humidity\":%.2f,"
+			"\"illuminance\":%ld,\"noise_level\":%ld,\"motion\":0}$\r\n",
+			node.unit, (unsigned long)uint32_t(time - node.bootTime), temperature, floor(surface * 16 + 0.5) / 16,
+			humidity, long(illuminance), long(std::min(1023.0, noise)));
+
+		// The PIR trips somewhere in the coming period, subject to the cooloff
+		if (node.motion){
+			int64_t motionTime = time + int64_t(node.random.uniform(0, double(interval)));
+			if (motionTime - node.lastMotionEvent >= OFFICE_MOTION_COOLOFF){
+				node.lastMotionEvent = motionTime;
+				schedule(motionTime, uint32_t(&node - &_nodes[0]), EVENT_MOTION);
+			}
+		}
+		break;
+	}
+	}
+
+	frame.length = std::min(size_t(std::max(length, 0)), size - 1);
+}
+
+void FleetGenerator::motionEvent(Node& node, FleetFrame& frame){
+	int length = snprintf(frame.text, sizeof(frame.text), "#{\"id\":\"lurker%u\",\"motion\":1}$\r\n", node.unit);
+	frame.length = std::max(length, 0);
+}
+
+void FleetGenerator::boot(Node& node, FleetFrame& frame){
+	int length;
+
+	switch (node.kind){
+	case NODE_NANO:
+		length = snprintf(frame.text, sizeof(frame.text), "Lurker starting - lurker%u\r\n", node.unit);
+		break;
+
+	case NODE_RELAYED:
+		// A relayed node's start-up goes out on its own USB port, if any; the
+		// coordinator only notices it rejoining
+		length = snprintf(frame.text, sizeof(frame.text), "Unit %u joined the network\r\n", node.unit);
+		break;
+
+	default:
+		length = snprintf(frame.text, sizeof(frame.text),
+			"==== Office Lurker - Node %u ====\nCalibrating motion sensor. Please wait\r\n", node.unit);
+		break;
+	}
+
+	frame.length = std::max(length, 0);
+	node.bootTime = frame.time;
+	node.occupied = false;
+	node.motion = false;
+
+	int64_t interval = node.kind == NODE_OFFICE ? OFFICE_SAMPLE_INTERVAL : NANO_SAMPLE_INTERVAL;
+	schedule(frame.time + interval, frame.node, EVENT_SAMPLE);
+}
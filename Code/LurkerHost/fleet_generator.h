@@ -0,0 +1,207 @@
+#ifndef LURKER_FLEET_GENERATOR_H
+#define LURKER_FLEET_GENERATOR_H
+
+#include <queue>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "record.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Fleet Generator
+//
+// Simulates a fleet of Lurker nodes and produces the exact frames their
+// sketches print, in time order, for benchmarks far beyond the hardware
+// we have:
+//	nano	 - LurkerNano on USB, every SAMPLE_INTERVAL (20 s)
+//	relayed	 - LurkerNano node relayed by a coordinator, numeric ID
+//	office	 - OfficeLurker, every SAMPLE_PERIOD (60 s), plus motion events
+//
+// Every node lives in a room with its own diurnal temperature, humidity
+// and daylight curves, slow weather drift and sensor noise. Occupancy
+// comes in bursts during working hours and drives motion, artificial
+// light and noise. Nodes drop out for a while now and then (and print
+// their start-up banner when they come back), some relayed frames arrive
+// twice and some frames are cut short, as they are over a real radio and
+// USB link.
+//
+// Nodes are spread round robin over the output streams, one stream per
+// simulated coordinator port. Everything is derived from the seed, so
+// the same config always gives the same byte stream.
+//////////////////////////////////////////////////////////////////////////
+
+enum NodeKind{
+	NODE_NANO,
+	NODE_RELAYED,
+	NODE_OFFICE,
+	NODE_KIND_COUNT
+};
+
+extern const char* const NODE_KIND_NAMES[NODE_KIND_COUNT];
+
+const int64_t NANO_SAMPLE_INTERVAL = 20000;	// SAMPLE_INTERVAL in lurker_settings.h
+const int64_t OFFICE_SAMPLE_INTERVAL = 60000;	// SAMPLE_PERIOD in OfficeLurker.ino
+const int64_t OFFICE_MOTION_COOLOFF = 60000;	// MOTION_COOLOFF in OfficeLurker.ino
+
+struct FleetConfig{
+	uint32_t nodes;
+	uint32_t streams;	// Coordinator ports the nodes are spread over
+	double kindShare[NODE_KIND_COUNT];	// Relative share of each node kind
+	int64_t startTime;	// Simulated start, ms since the epoch
+	double utcOffset;	// Local time of the site, hours from UTC
+	uint64_t seed;
+	double dropoutRate;	// Dropouts per node per hour
+	double dropoutLength;	// Mean dropout in s
+	double duplicateRate;	// Share of frames that arrive twice
+	double corruptRate;	// Share of frames that are cut short
+	bool requestLines;	// Log a coordinator line before each relayed frame
+
+	FleetConfig() :
+		nodes(1000),
+		streams(1),
+		startTime(0),
+		utcOffset(0),
+		seed(1),
+		dropoutRate(0.02),
+		dropoutLength(1800),
+		duplicateRate(0.005),
+		corruptRate(0.001),
+		requestLines(false){
+		kindShare[NODE_NANO] = 1;
+		kindShare[NODE_RELAYED] = 7;
+		kindShare[NODE_OFFICE] = 2;
+	}
+};
+
+/**
+* One chunk of output, a frame or a log line
+*/
+struct FleetFrame{
+	int64_t time;	// ms since the epoch
+	uint32_t stream;
+	uint32_t node;
+	size_t length;
+	char text[MAX_FRAME_LENGTH + 16];
+};
+
+/**
+* Small, fast and reproducible random numbers (splitmix64)
+*/
+class FleetRandom{
+public:
+	explicit FleetRandom(uint64_t seed = 0) : _state(seed){}
+
+	uint64_t next(){
+		uint64_t z = (_state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	/**
+	* Uniform in [0, 1)
+	*/
+	double uniform(){
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	double uniform(double low, double high){
+		return low + (high - low) * uniform();
+	}
+
+	bool chance(double probability){
+		return uniform() < probability;
+	}
+
+	/**
+	* Normally distributed with mean 0 and standard deviation 1
+	*/
+	double normal();
+
+	/**
+	* Exponentially distributed with the given mean
+	*/
+	double exponential(double mean);
+
+private:
+	uint64_t _state;
+};
+
+class FleetGenerator{
+public:
+	explicit FleetGenerator(const FleetConfig& config);
+
+	/**
+	* Get the next chunk of output, in time order across all streams
+	* The fleet runs forever; stop when the time is far enough along.
+	*/
+	void next(FleetFrame& frame);
+
+	size_t nodeCount(NodeKind kind) const;
+
+	/**
+	* Frames per second the fleet produces on average, for pacing
+	*/
+	double frameRate() const;
+
+private:
+	enum EventType{
+		EVENT_SAMPLE,
+		EVENT_MOTION,	// Office motion alarm
+		EVENT_BOOT	// Start-up banner after power-up or a dropout
+	};
+
+	struct Event{
+		int64_t time;
+		uint32_t node;
+		EventType type;
+
+		bool operator>(const Event& other) const{
+			return time != other.time ? time > other.time : node > other.node;
+		}
+	};
+
+	struct Node{
+		NodeKind kind;
+		uint32_t unit;	// Unit number in the node's ID
+		uint32_t stream;
+		FleetRandom random;
+
+		// Room
+		double baseTemperature;
+		double swing;	// Diurnal amplitude
+		double baseHumidity;
+		double daylight;	// Peak daylight lux
+		double activity;	// How busy the room is, 0 to 1
+		double surfaceOffset;
+
+		// State
+		double drift;	// Slow weather deviation
+		bool occupied;
+		bool motion;	// Motion seen since the last sample
+		int64_t lastMotionEvent;
+		int64_t bootTime;
+		int64_t online;	// Offline until this time
+	};
+
+	void schedule(int64_t time, uint32_t node, EventType type);
+	void sample(Node& node, int64_t time, FleetFrame& frame);
+	void motionEvent(Node& node, FleetFrame& frame);
+	void boot(Node& node, FleetFrame& frame);
+	void updateOccupancy(Node& node, int64_t time, int64_t interval);
+	double localHour(int64_t time) const;
+	bool workingHours(int64_t time) const;
+	double weather(int64_t time) const;
+
+	FleetConfig _config;
+	FleetRandom _random;
+	double _weatherPhase[2];
+	std::vector<Node> _nodes;
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event> > _events;
+
+	bool _repeat;	// The last frame is due again
+	FleetFrame _repeated;
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include "http_client.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+const size_t MAX_HEADER_LINE = 8192;
+
+HttpClient::HttpClient(const std::string& host, int port, int timeout) :
+	_host(host), _port(port), _timeout(timeout), _fd(-1), _connects(0){
+}
+
+HttpClient::~HttpClient(){
+	close();
+}
+
+void HttpClient::close(){
+	if (_fd >= 0){
+		::close(_fd);
+	}
+
+	_fd = -1;
+	_buffer.clear();
+}
+
+bool HttpClient::connect(){
+	close();
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	char port[8];
+	snprintf(port, sizeof(port), "%d", _port);
+
+	struct addrinfo* addresses;
+	if (getaddrinfo(_host.c_str(), port, &hints, &addresses) != 0){
+		return false;
+	}
+
+	for (struct addrinfo* address = addresses; address != NULL && _fd < 0; address = address->ai_next){
+		_fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (_fd < 0){
+			continue;
+		}
+
+		struct timeval timeout = { _timeout / 1000, (_timeout % 1000) * 1000 };
+		setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		// Requests go out in one write; don't hold the tail back
+		int on = 1;
+		setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		if (::connect(_fd, address->ai_addr, address->ai_addrlen) != 0){
+			::close(_fd);
+			_fd = -1;
+		}
+	}
+
+	freeaddrinfo(addresses);
+
+	if (_fd >= 0){
+		_connects++;
+	}
+	return _fd >= 0;
+}
+
+bool HttpClient::sendAll(const std::string& data){
+	const char* p = data.data();
+	size_t length = data.size();
+
+	while (length > 0){
+		ssize_t count = send(_fd, p, length, MSG_NOSIGNAL);
+
+		if (count < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return false;
+		}
+
+		p += count;
+		length -= count;
+	}
+
+	return true;
+}
+
+/**
+* Wait for more of the response
+* @return False on timeout, error or if the server closed the connection
+*/
+bool HttpClient::fill(){
+	struct pollfd poller = { _fd, POLLIN, 0 };
+
+	if (poll(&poller, 1, _timeout) <= 0){
+		return false;
+	}
+
+	char chunk[4096];
+	ssize_t count = recv(_fd, chunk, sizeof(chunk), 0);
+
+	if (count <= 0){
+		return false;
+	}
+
+	_buffer.append(chunk, count);
+	return true;
+}
+
+bool HttpClient::readLine(std::string& line){
+	size_t end;
+
+	while ((end = _buffer.find("\r\n")) == std::string::npos){
+		if (_buffer.size() > MAX_HEADER_LINE || !fill()){
+			return false;
+		}
+	}
+
+	line.assign(_buffer, 0, end);
+	_buffer.erase(0, end + 2);
+	return true;
+}
+
+bool HttpClient::readBody(size_t length, std::string& body){
+	while (_buffer.size() < length){
+		if (!fill()){
+			return false;
+		}
+	}
+
+	body.append(_buffer, 0, length);
+	_buffer.erase(0, length);
+	return true;
+}
+
+/**
+* Read the status line, headers and body of one response
+* @return Status code, or -1 if the response was cut short
+*/
+int HttpClient::readResponse(std::string& body, bool& keepAlive){
+	std::string line;
+
+	if (!readLine(line) || line.compare(0, 5, "HTTP/") != 0 || line.size() < 12){
+		return -1;
+	}
+
+	int status = atoi(line.c_str() + 9);
+	keepAlive = line.compare(0, 8, "HTTP/1.0") != 0;
+
+	long contentLength = -1;
+	bool chunked = false;
+
+	while (readLine(line) && !line.empty()){
+		const char* header = line.c_str();
+
+		if (strncasecmp(header, "Content-Length:", 15) == 0){
+			contentLength = atol(header + 15);
+		}
+		else if (strncasecmp(header, "Transfer-Encoding:", 18) == 0 && strstr(header + 18, "chunked") != NULL){
+			chunked = true;
+		}
+		else if (strncasecmp(header, "Connection:", 11) == 0){
+			keepAlive = strcasestr(header + 11, "close") == NULL;
+		}
+	}
+
+	if (!line.empty()){
+		return -1;
+	}
+
+	body.clear();
+
+	if (chunked){
+		for (;;){
+			if (!readLine(line)){
+				return -1;
+			}
+
+			size_t size = strtoul(line.c_str(), NULL, 16);
+			std::string crlf;
+
+			if (size == 0){
+				// Skip any trailers up to the blank line
+				while (readLine(line) && !line.empty()){
+				}
+				break;
+			}
+
+			if (!readBody(size, body) || !readBody(2, crlf)){
+				return -1;
+			}
+		}
+	}
+	else if (contentLength >= 0){
+		if (!readBody(contentLength, body)){
+			return -1;
+		}
+	}
+	else{
+		// Body runs until the server closes the connection
+		while (fill()){
+		}
+		body.swap(_buffer);
+		_buffer.clear();
+		keepAlive = false;
+	}
+
+	return status;
+}
+
+int HttpClient::post(const std::string& path, const std::string& contentType, const std::string& body, std::string* response){
+	std::string request;
+	char length[32];
+
+	snprintf(length, sizeof(length), "%zu", body.size());
+
+	request.reserve(body.size() + 256);
+	request += "POST " + path + " HTTP/1.1\r\n";
+	request += "Host: " + _host + "\r\n";
+	request += "Content-Type: " + contentType + "\r\n";
+	request += std::string("Content-Length: ") + length + "\r\n";
+	request += "Connection: keep-alive\r\n\r\n";
+	request += body;
+
+	// A kept-alive connection may have been closed by the server while idle;
+	// that only shows up once we use it, so try once more on a fresh one.
+	for (int attempt = 0; attempt < 2; attempt++){
+		bool reused = _fd >= 0;
+
+		if (!reused && !connect()){
+			return -1;
+		}
+
+		std::string received;
+		bool keepAlive = false;
+		int status = sendAll(request) ? readResponse(received, keepAlive) : -1;
+
+		if (status < 0){
+			close();
+
+			if (reused){
+				continue;
+			}
+			return -1;
+		}
+
+		if (!keepAlive){
+			close();
+		}
+
+		if (response != NULL){
+			response->swap(received);
+		}
+		return status;
+	}
+
+	return -1;
+}
@@ -0,0 +1,55 @@
+#ifndef LURKER_HTTP_CLIENT_H
+#define LURKER_HTTP_CLIENT_H
+
+#include <string>
+
+/**
+* Minimal HTTP/1.1 client over plain TCP
+* Keeps one connection to a single server alive between requests and
+* reconnects transparently when the server has closed it.
+*/
+class HttpClient{
+public:
+	/**
+	* @param timeout Connect, send and receive timeout in ms
+	*/
+	HttpClient(const std::string& host, int port, int timeout);
+	~HttpClient();
+
+	/**
+	* Send a POST request and wait for the response
+	* @param response Receives the response body, or NULL to discard it
+	* @return HTTP status code, or -1 if the server could not be reached
+	*/
+	int post(const std::string& path, const std::string& contentType, const std::string& body, std::string* response);
+
+	void close();
+
+	bool isConnected() const{
+		return _fd >= 0;
+	}
+
+	unsigned long connects() const{
+		return _connects;
+	}
+
+private:
+	HttpClient(const HttpClient&);
+	HttpClient& operator=(const HttpClient&);
+
+	bool connect();
+	bool sendAll(const std::string& data);
+	bool fill();
+	bool readLine(std::string& line);
+	bool readBody(size_t length, std::string& body);
+	int readResponse(std::string& body, bool& keepAlive);
+
+	std::string _host;
+	int _port;
+	int _timeout;
+	int _fd;
+	std::string _buffer;	// Received but not yet parsed
+	unsigned long _connects;
+};
+
+#endif
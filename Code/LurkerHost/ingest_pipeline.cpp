@@ -0,0 +1,378 @@
+#include "ingest_pipeline.h"
+
+#include <chrono>
+#include <inttypes.h>
+
+#include "record_parser.h"
+
+const size_t READ_CHUNK_SIZE = 4096;
+const int READ_TIMEOUT = 100;	// Poll period for the reader threads in ms
+const int RECONNECT_INTERVAL = 1000;	// Time between attempts to reopen a lost port in ms
+const int IDLE_SPINS = 64;	// Empty polls before an idle thread starts sleeping
+
+struct IngestPipeline::Batch{
+	RecordBatch records;
+	ColumnBatch columns;
+};
+
+struct IngestPipeline::Port{
+	std::string path;
+	uint8_t index;
+	SerialPort serial;
+
+	SpscQueue<Frame> frames;
+	SpscQueue<Batch*> filledBatches;
+	SpscQueue<Batch*> freeBatches;
+	std::vector<Batch> batches;
+
+	PortStats stats;
+	std::thread reader;
+	std::thread parser;
+
+	Port(const char* devicePath, uint8_t portIndex, const IngestConfig& config) :
+		path(devicePath),
+		index(portIndex),
+		frames(config.frameQueueLength),
+		filledBatches(config.batchesPerPort),
+		freeBatches(config.batchesPerPort),
+		batches(config.batchesPerPort){
+
+		for (size_t i = 0; i < batches.size(); i++){
+			batches[i].records.port = portIndex;
+			batches[i].records.records.reserve(config.batchSize);
+			freeBatches.push(&batches[i]);
+		}
+	}
+};
+
+int64_t currentTimeMillis(){
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+* Back off gently while a thread has nothing to do
+*/
+static void idle(int& spins){
+	if (++spins < IDLE_SPINS){
+		std::this_thread::yield();
+	}
+	else{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Setup
+
+IngestPipeline::IngestPipeline(const IngestConfig& config) :
+	_config(config), _reading(false), _parsing(false), _sinking(false), _started(false){
+}
+
+IngestPipeline::~IngestPipeline(){
+	stop();
+
+	for (size_t i = 0; i < _ports.size(); i++){
+		delete _ports[i];
+	}
+}
+
+int IngestPipeline::addPort(const char* path){
+	int index = _ports.size();
+	_ports.push_back(new Port(path, index, _config));
+	return index;
+}
+
+void IngestPipeline::addSink(RecordSink* sink){
+	_sinks.push_back(sink);
+}
+
+bool IngestPipeline::start(){
+	for (size_t i = 0; i < _ports.size(); i++){
+		if (!_ports[i]->serial.open(_ports[i]->path.c_str(), _config.baud)){
+			fprintf(stderr, "Could not open %s\n", _ports[i]->path.c_str());
+			return false;
+		}
+	}
+
+	_reading = true;
+	_parsing = true;
+	_sinking = true;
+	_started = true;
+
+	for (size_t i = 0; i < _ports.size(); i++){
+		_ports[i]->reader = std::thread(&IngestPipeline::readPort, this, _ports[i]);
+		_ports[i]->parser = std::thread(&IngestPipeline::parsePort, this, _ports[i]);
+	}
+	_sinkThread = std::thread(&IngestPipeline::runSinks, this);
+
+	return true;
+}
+
+void IngestPipeline::stop(){
+	if (!_started){
+		return;
+	}
+
+	// Shut down front to back so everything already read reaches the sinks
+	_reading = false;
+	for (size_t i = 0; i < _ports.size(); i++){
+		_ports[i]->reader.join();
+	}
+
+	_parsing = false;
+	for (size_t i = 0; i < _ports.size(); i++){
+		_ports[i]->parser.join();
+	}
+
+	_sinking = false;
+	_sinkThread.join();
+
+	for (size_t i = 0; i < _ports.size(); i++){
+		_ports[i]->serial.close();
+	}
+	_started = false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Reader Threads
+
+/**
+* Read raw bytes from a port and cut them into frames
+* Frames are written straight into the claimed ring slot.
+* Anything outside the packet tags (log messages etc.) is discarded.
+*/
+void IngestPipeline::readPort(Port* port){
+	char buffer[READ_CHUNK_SIZE];
+	Frame* frame = NULL;
+	bool inFrame = false;
+
+	while (_reading){
+		ssize_t count = port->serial.read(buffer, sizeof(buffer), READ_TIMEOUT);
+
+		// Port lost (device unplugged, pty closed) - keep trying to get it back
+		if (count < 0){
+			port->serial.close();
+			inFrame = false;
+
+			while (_reading && !port->serial.open(port->path.c_str(), _config.baud)){
+				std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_INTERVAL));
+			}
+			if (port->serial.isOpen()){
+				port->stats.reconnects++;
+			}
+			continue;
+		}
+
+		port->stats.bytesRead += count;
+
+		for (ssize_t i = 0; i < count; i++){
+			char c = buffer[i];
+
+			if (c == PACKET_START){
+				if (inFrame){
+					port->stats.framesMalformed++;
+				}
+
+				inFrame = true;
+				frame = port->frames.claim();
+				if (frame != NULL){
+					frame->length = 0;
+				}
+			}
+
+			else if (!inFrame){
+				continue;
+			}
+
+			else if (c == PACKET_END){
+				inFrame = false;
+
+				if (frame != NULL){
+					frame->receivedAt = currentTimeMillis();
+					port->frames.publish();
+					port->stats.framesRead++;
+				}
+				else{
+					port->stats.framesDropped++;
+				}
+			}
+
+			else if (frame != NULL){
+				if (frame->length < MAX_FRAME_LENGTH){
+					frame->text[frame->length++] = c;
+				}
+				else{
+					inFrame = false;
+					port->stats.framesMalformed++;
+				}
+			}
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Parser Workers
+
+/**
+* Parse frames from a port into batches of records
+* Batches are passed on when full or when they get too old.
+*/
+void IngestPipeline::parsePort(Port* port){
+	Batch* batch = NULL;
+	std::vector<Record>* records = NULL;
+	int64_t batchStarted = 0;
+	bool stalled = false;
+	int spins = 0;
+
+	while (true){
+		bool parsing = _parsing;
+		Frame* frame = port->frames.front();
+
+		if (frame == NULL){
+			// The reader had already finished before the ring was found empty
+			if (!parsing){
+				break;
+			}
+
+			if (batch != NULL && !records->empty() &&
+				currentTimeMillis() - batchStarted >= _config.flushInterval){
+				queueBatch(port, batch);
+				batch = NULL;
+			}
+
+			idle(spins);
+			continue;
+		}
+
+		if (batch == NULL){
+			// Backpressure - leave the frame in the ring until a batch frees up
+			if (!port->freeBatches.tryPop(batch)){
+				if (!stalled){
+					port->stats.sinkStalls++;
+					stalled = true;
+				}
+				idle(spins);
+				continue;
+			}
+
+			stalled = false;
+			records = &batch->records.records;
+			records->clear();
+			batchStarted = currentTimeMillis();
+		}
+
+		spins = 0;
+
+		records->resize(records->size() + 1);
+		Record& record = records->back();
+
+		if (parseRecord(frame->text, frame->length, record)){
+			record.receivedAt = frame->receivedAt;
+			record.port = port->index;
+			port->stats.recordsParsed++;
+		}
+		else{
+			records->pop_back();
+			port->stats.parseErrors++;
+		}
+
+		port->frames.pop();
+
+		if (records->size() >= _config.batchSize){
+			queueBatch(port, batch);
+			batch = NULL;
+		}
+	}
+
+	if (batch != NULL && !records->empty()){
+		queueBatch(port, batch);
+	}
+}
+
+/**
+* Normalise a finished batch and pass it to the sink thread
+*/
+void IngestPipeline::queueBatch(Port* port, Batch* batch){
+	_normalizer.normalize(batch->records, batch->columns);
+	port->filledBatches.push(batch);
+	port->stats.batchesQueued++;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Sink Thread
+
+/**
+* Hand filled batches from every port to the sinks and recycle them
+*/
+void IngestPipeline::runSinks(){
+	bool unflushed = false;
+	int spins = 0;
+
+	while (true){
+		bool sinking = _sinking;
+		bool found = false;
+
+		for (size_t i = 0; i < _ports.size(); i++){
+			Batch* batch;
+
+			while (_ports[i]->filledBatches.tryPop(batch)){
+				for (size_t s = 0; s < _sinks.size(); s++){
+					_sinks[s]->write(batch->columns);
+				}
+
+				_ports[i]->freeBatches.push(batch);
+				found = true;
+			}
+		}
+
+		if (found){
+			unflushed = true;
+			spins = 0;
+			continue;
+		}
+
+		if (unflushed){
+			for (size_t s = 0; s < _sinks.size(); s++){
+				_sinks[s]->flush();
+			}
+			unflushed = false;
+		}
+
+		// Workers had already finished before this pass, so nothing is left
+		if (!sinking){
+			break;
+		}
+
+		idle(spins);
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Stats
+
+const PortStats& IngestPipeline::stats(int port) const{
+	return _ports[port]->stats;
+}
+
+void IngestPipeline::printStats(FILE* output) const{
+	for (size_t i = 0; i < _ports.size(); i++){
+		const Port* port = _ports[i];
+		const PortStats& stats = port->stats;
+
+		fprintf(output,
+			"[%zu] %s bytes=%" PRIu64 " frames=%" PRIu64 " dropped=%" PRIu64 " malformed=%" PRIu64
+			" records=%" PRIu64 " errors=%" PRIu64 " batches=%" PRIu64 " stalls=%" PRIu64
+			" reconnects=%" PRIu64 " queue=%zu/%zu\n",
+			i, port->path.c_str(),
+			uint64_t(stats.bytesRead), uint64_t(stats.framesRead), uint64_t(stats.framesDropped),
+			uint64_t(stats.framesMalformed), uint64_t(stats.recordsParsed), uint64_t(stats.parseErrors),
+			uint64_t(stats.batchesQueued), uint64_t(stats.sinkStalls), uint64_t(stats.reconnects),
+			port->frames.size(), port->frames.capacity());
+	}
+}
@@ -0,0 +1,136 @@
+#ifndef LURKER_INGEST_PIPELINE_H
+#define LURKER_INGEST_PIPELINE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "record.h"
+#include "record_sink.h"
+#include "schema.h"
+#include "serial_port.h"
+#include "spsc_queue.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Ingestion Pipeline
+//
+//	[port reader] --frames--> [parser worker] --batches--> [sink thread] -> sinks
+//	[port reader] --frames--> [parser worker] --batches--/
+//	...
+//
+// Every serial port gets its own reader thread and parser worker, joined
+// by a lock-free SPSC ring of frames. Workers hand filled record batches
+// to the single sink thread through another SPSC ring, and get them back
+// through a third once the sinks are done, so batches are never allocated
+// in steady state. Workers normalise each batch into the canonical columns
+// before passing it on, so sinks only ever see one schema.
+//
+// Backpressure: a worker with no free batch stops taking frames (sink
+// stall); the frame ring then fills and the reader drops whole frames
+// rather than blocking the port.
+//////////////////////////////////////////////////////////////////////////
+
+struct IngestConfig{
+	long baud;
+	size_t frameQueueLength;	// Frames buffered between reader and parser
+	size_t batchSize;	// Records per batch
+	size_t batchesPerPort;	// Batches in circulation per port
+	int flushInterval;	// Max age of a partial batch in ms
+
+	IngestConfig() :
+		baud(115200),
+		frameQueueLength(1024),
+		batchSize(256),
+		batchesPerPort(8),
+		flushInterval(250){}
+};
+
+/**
+* Per-port counters
+* Written by the port's own threads, readable from anywhere
+*/
+struct PortStats{
+	std::atomic<uint64_t> bytesRead;
+	std::atomic<uint64_t> framesRead;
+	std::atomic<uint64_t> framesDropped;	// Frame ring full
+	std::atomic<uint64_t> framesMalformed;	// Oversized or unterminated
+	std::atomic<uint64_t> recordsParsed;
+	std::atomic<uint64_t> parseErrors;
+	std::atomic<uint64_t> batchesQueued;
+	std::atomic<uint64_t> sinkStalls;	// Worker waited for a free batch
+	std::atomic<uint64_t> reconnects;
+
+	PortStats() :
+		bytesRead(0), framesRead(0), framesDropped(0), framesMalformed(0),
+		recordsParsed(0), parseErrors(0), batchesQueued(0), sinkStalls(0), reconnects(0){}
+};
+
+class IngestPipeline{
+public:
+	explicit IngestPipeline(const IngestConfig& config);
+	~IngestPipeline();
+
+	/**
+	* Add a serial port to read from; must be called before start()
+	* @return Index of the port, used as the record's port number
+	*/
+	int addPort(const char* path);
+
+	/**
+	* Add a destination for the records; must be called before start()
+	* The pipeline does not take ownership of the sink.
+	*/
+	void addSink(RecordSink* sink);
+
+	/**
+	* Open the ports and start all threads
+	* @return False if any port could not be opened
+	*/
+	bool start();
+
+	/**
+	* Stop reading, drain everything already received into the sinks and join all threads
+	*/
+	void stop();
+
+	size_t portCount() const{
+		return _ports.size();
+	}
+
+	const PortStats& stats(int port) const;
+
+	/**
+	* Print one line of counters per port
+	*/
+	void printStats(FILE* output) const;
+
+private:
+	struct Batch;
+	struct Port;
+
+	void readPort(Port* port);
+	void parsePort(Port* port);
+	void queueBatch(Port* port, Batch* batch);
+	void runSinks();
+
+	IngestConfig _config;
+	SchemaNormalizer _normalizer;
+	std::vector<Port*> _ports;
+	std::vector<RecordSink*> _sinks;
+	std::thread _sinkThread;
+
+	std::atomic<bool> _reading;
+	std::atomic<bool> _parsing;
+	std::atomic<bool> _sinking;
+	bool _started;
+};
+
+/**
+* Current wall-clock time in ms since the epoch
+*/
+int64_t currentTimeMillis();
+
+#endif
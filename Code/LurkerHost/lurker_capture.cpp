@@ -0,0 +1,346 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Capture
+//
+// Records the raw byte stream of a coordinator's serial port, with arrival
+// times, and plays it back into pseudo-terminals for lurkerd to read.
+// Replays are the standard input for host benchmarks and regression runs.
+//
+// Usage:
+//	lurker_capture record [-b baud] [-t seconds] port capture.cap
+//	lurker_capture replay [-x speed | -m] [-n copies] [-l loops] [-w seconds] capture.cap
+//	lurker_capture info capture.cap
+//
+//	record	Capture until interrupted, or for -t seconds
+//	replay	Print one pty path per copy, wait -w seconds, then play the capture
+//			into every pty at -x times the recorded speed (default 1), or as fast
+//			as the reader keeps up with -m. -l repeats the capture.
+//	info	Print the length, size and rates of a capture
+//
+// Simulate ten coordinators at 100x:
+//	lurker_capture replay -x 100 -n 10 -w 2 capture.cap > ports &
+//	lurkerd $(cat ports)
+//
+// Build:
+//	g++ -std=c++11 -O2 -pthread -o lurker_capture lurker_capture.cpp capture_file.cpp pseudo_terminal.cpp serial_port.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "capture_file.h"
+#include "pseudo_terminal.h"
+#include "record.h"
+#include "serial_port.h"
+
+const int DRAIN_TIMEOUT = 5000000;	// Max wait for readers to take the last bytes, in us
+
+static volatile sig_atomic_t running = 1;
+
+static void requestShutdown(int){
+	running = 0;
+}
+
+static void printUsage(){
+	fprintf(stderr,
+		"Usage: lurker_capture record [-b baud] [-t seconds] port capture.cap\n"
+		"       lurker_capture replay [-x speed | -m] [-n copies] [-l loops] [-w seconds] capture.cap\n"
+		"       lurker_capture info capture.cap\n");
+}
+
+/**
+* Sleep until a monotonic time in us
+*/
+static void sleepUntil(int64_t time){
+	struct timespec target = { time_t(time / 1000000), long(time % 1000000) * 1000 };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL) == EINTR && running){
+	}
+}
+
+static size_t countFrames(const uint8_t* data, size_t length){
+	return std::count(data, data + length, uint8_t(PACKET_START));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Record
+
+static int record(int argc, char** argv){
+	long baud = 115200;
+	double duration = 0;
+	int option;
+
+	while ((option = getopt(argc, argv, "b:t:")) != -1){
+		switch (option){
+		case 'b':
+			baud = atol(optarg);
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (argc - optind != 2){
+		printUsage();
+		return 1;
+	}
+
+	SerialPort port;
+	CaptureWriter writer;
+
+	if (!port.open(argv[optind], baud)){
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (!writer.open(argv[optind + 1], currentTimeMicros())){
+		perror(argv[optind + 1]);
+		return 1;
+	}
+
+	int64_t start = monotonicMicros();
+	int64_t end = duration > 0 ? start + int64_t(duration * 1000000) : INT64_MAX;
+	size_t frames = 0;
+	char buffer[4096];
+
+	fprintf(stderr, "Recording %s...\n", argv[optind]);
+
+	while (running && monotonicMicros() < end){
+		ssize_t count = port.read(buffer, sizeof(buffer), 100);
+
+		if (count < 0){
+			fprintf(stderr, "%s hung up\n", argv[optind]);
+			break;
+		}
+
+		if (count > 0){
+			writer.write(monotonicMicros() - start, buffer, count);
+			frames += countFrames(reinterpret_cast<uint8_t*>(buffer), count);
+		}
+	}
+
+	writer.close();
+	fprintf(stderr, "%llu bytes, %llu chunks, %zu frames in %.1f s\n",
+		(unsigned long long)writer.bytes(), (unsigned long long)writer.chunks(), frames,
+		(monotonicMicros() - start) / 1e6);
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Replay
+
+struct ReplayStats{
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> frames;
+
+	ReplayStats() : bytes(0), frames(0){}
+};
+
+/**
+* Play a capture into one pty
+* @param speed Time scale, or 0 for as fast as the reader takes it
+*/
+static void replayCopy(const char* path, PseudoTerminal* terminal, double speed, int loops, int64_t start, ReplayStats* stats){
+	CaptureReader reader;
+	if (!reader.open(path)){
+		return;
+	}
+
+	int64_t loopOffset = 0;
+
+	for (int loop = 0; (loops == 0 || loop < loops) && running; loop++){
+		CaptureChunk chunk;
+		int64_t lastTime = 0;
+
+		reader.rewind();
+
+		while (running && reader.next(chunk)){
+			if (speed > 0){
+				sleepUntil(start + int64_t((loopOffset + chunk.time) / speed));
+			}
+
+			if (!terminal->write(chunk.data, chunk.length)){
+				return;
+			}
+
+			stats->bytes += chunk.length;
+			stats->frames += countFrames(chunk.data, chunk.length);
+			lastTime = chunk.time;
+		}
+
+		loopOffset += lastTime;
+	}
+}
+
+static int replay(int argc, char** argv){
+	double speed = 1;
+	int copies = 1;
+	int loops = 1;
+	double wait = 0;
+	int option;
+
+	while ((option = getopt(argc, argv, "x:mn:l:w:")) != -1){
+		switch (option){
+		case 'x':
+			speed = atof(optarg);
+			break;
+		case 'm':
+			speed = 0;
+			break;
+		case 'n':
+			copies = atoi(optarg);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'w':
+			wait = atof(optarg);
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1 || copies < 1 || speed < 0 || loops < 0){
+		printUsage();
+		return 1;
+	}
+
+	const char* path = argv[optind];
+	CaptureReader check;
+	if (!check.open(path)){
+		fprintf(stderr, "%s is not a capture file\n", path);
+		return 1;
+	}
+	check.close();
+
+	std::vector<PseudoTerminal*> terminals;
+	for (int i = 0; i < copies; i++){
+		PseudoTerminal* terminal = new PseudoTerminal();
+
+		if (!terminal->open()){
+			perror("posix_openpt");
+			return 1;
+		}
+
+		printf("%s\n", terminal->path().c_str());
+		terminals.push_back(terminal);
+	}
+	fflush(stdout);
+
+	// Give the reader time to open the ports
+	int64_t start = monotonicMicros() + int64_t(wait * 1000000);
+	sleepUntil(start);
+
+	ReplayStats stats;
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < copies; i++){
+		threads.push_back(std::thread(replayCopy, path, terminals[i], speed, loops, start, &stats));
+	}
+
+	for (int i = 0; i < copies; i++){
+		threads[i].join();
+	}
+
+	double elapsed = (monotonicMicros() - start) / 1e6;
+
+	// Closing a pty throws away whatever the reader hasn't taken yet
+	int64_t drainEnd = monotonicMicros() + DRAIN_TIMEOUT;
+	for (int i = 0; i < copies; i++){
+		while (running && terminals[i]->pending() > 0 && monotonicMicros() < drainEnd){
+			usleep(10000);
+		}
+		delete terminals[i];
+	}
+
+	fprintf(stderr, "%d cop%s: %llu bytes, %llu frames in %.2f s (%.2f MB/s, %.0f frames/s)\n",
+		copies, copies == 1 ? "y" : "ies", (unsigned long long)stats.bytes, (unsigned long long)stats.frames, elapsed,
+		elapsed > 0 ? stats.bytes / elapsed / 1e6 : 0.0, elapsed > 0 ? stats.frames / elapsed : 0.0);
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Info
+
+static int info(int argc, char** argv){
+	if (argc != 2){
+		printUsage();
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.open(argv[1])){
+		fprintf(stderr, "%s is not a capture file\n", argv[1]);
+		return 1;
+	}
+
+	CaptureChunk chunk;
+	uint64_t chunks = 0;
+	uint64_t bytes = 0;
+	uint64_t frames = 0;
+	int64_t end = 0;
+
+	while (reader.next(chunk)){
+		chunks++;
+		bytes += chunk.length;
+		frames += countFrames(chunk.data, chunk.length);
+		end = chunk.time;
+	}
+
+	time_t started = time_t(reader.header().startTime / 1000000);
+	char date[32];
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&started));
+
+	double seconds = end / 1e6;
+	printf("started %s\nduration %.1f s\nbytes %llu\nchunks %llu\nframes %llu\n",
+		date, seconds, (unsigned long long)bytes, (unsigned long long)chunks, (unsigned long long)frames);
+
+	if (seconds > 0){
+		printf("rate %.0f B/s, %.1f frames/s\n", bytes / seconds, frames / seconds);
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv){
+	if (argc < 2){
+		printUsage();
+		return 1;
+	}
+
+	signal(SIGINT, requestShutdown);
+	signal(SIGTERM, requestShutdown);
+
+	// Subcommands parse their own options
+	argc--;
+	argv++;
+
+	if (strcmp(argv[0], "record") == 0){
+		return record(argc, argv);
+	}
+	else if (strcmp(argv[0], "replay") == 0){
+		return replay(argc, argv);
+	}
+	else if (strcmp(argv[0], "info") == 0){
+		return info(argc, argv);
+	}
+
+	printUsage();
+	return 1;
+}
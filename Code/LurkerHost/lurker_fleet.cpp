@@ -0,0 +1,463 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Fleet
+//
+// Generates the serial output of a simulated fleet of Lurkers, in the
+// sketches' exact wire formats, for ingestion benchmarks with far more
+// nodes than we have hardware for.
+//
+// Usage:
+//	lurker_fleet [options] [-c capture.cap | -p [-w seconds]]
+//
+//	-n nodes	Fleet size (default 10000)
+//	-s streams	Coordinator ports the nodes are spread over (default 1)
+//	-k n:r:o	Share of nano, relayed and office nodes (default 1:7:2)
+//	-t seconds	Simulated time to cover (default 3600, 0 runs forever)
+//	-b start	Simulated start, YYYY-MM-DD[THH:MM[:SS]] UTC (default now)
+//	-z hours	Site time zone, hours from UTC (default 0)
+//	-S seed	Seed; the same seed and options give the same bytes (default 1)
+//	-D rate	Dropouts per node per hour (default 0.02)
+//	-u share	Share of relayed frames that arrive twice (default 0.005)
+//	-e share	Share of frames cut short (default 0.001)
+//	-L	Log a coordinator request line before every relayed frame
+//	-x speed	Play at this multiple of real time (default 1)
+//	-r frames	Play at this many frames per second instead
+//	-m	Play as fast as the output takes it
+//
+//	Output goes to stdout, to one capture file per stream with -c (written
+//	at full speed, for lurker_capture replay), or to one pty per stream with
+//	-p, whose paths are printed before waiting -w seconds to start.
+//
+// Drive lurkerd with 20000 nodes over 8 ports at 5000 frames/s:
+//	lurker_fleet -n 20000 -s 8 -r 5000 -t 0 -p -w 2 > ports &
+//	lurkerd -d store $(cat ports)
+//
+// Build:
+//	g++ -std=c++11 -O2 -pthread -o lurker_fleet lurker_fleet.cpp fleet_generator.cpp capture_file.cpp pseudo_terminal.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "capture_file.h"
+#include "fleet_generator.h"
+#include "pseudo_terminal.h"
+
+const size_t OUTPUT_BUFFER_SIZE = 16384;	// Bytes gathered per stream before writing
+const int64_t PACING_SLACK = 2000;	// Frames due within this many us are written together
+const int DRAIN_TIMEOUT = 5000000;	// Max wait for readers to take the last bytes, in us
+
+static volatile sig_atomic_t running = 1;
+
+static void requestShutdown(int){
+	running = 0;
+}
+
+static void printUsage(){
+	fprintf(stderr,
+		"Usage: lurker_fleet [-n nodes] [-s streams] [-k nano:relayed:office] [-t seconds] [-b start] [-z hours]\n"
+		"                    [-S seed] [-D dropouts] [-u duplicates] [-e corrupt] [-L]\n"
+		"                    [-x speed | -r frames_per_s | -m] [-c capture.cap | -p [-w seconds]]\n");
+}
+
+/**
+* Sleep until a monotonic time in us
+*/
+static void sleepUntil(int64_t time){
+	struct timespec target = { time_t(time / 1000000), long(time % 1000000) * 1000 };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL) == EINTR && running){
+	}
+}
+
+/**
+* Parse a UTC date as YYYY-MM-DD[THH:MM[:SS]], or "now"
+*/
+static bool parseTime(const char* text, int64_t& time){
+	if (strcmp(text, "now") == 0){
+		time = currentTimeMicros() / 1000;
+		return true;
+	}
+
+	struct tm date;
+	memset(&date, 0, sizeof(date));
+
+	int fields = sscanf(text, "%d-%d-%dT%d:%d:%d", &date.tm_year, &date.tm_mon, &date.tm_mday,
+		&date.tm_hour, &date.tm_min, &date.tm_sec);
+	if (fields != 3 && fields < 5){
+		return false;
+	}
+
+	date.tm_year -= 1900;
+	date.tm_mon -= 1;
+	time = int64_t(timegm(&date)) * 1000;
+	return true;
+}
+
+static bool parseShares(const char* text, FleetConfig& config){
+	return sscanf(text, "%lf:%lf:%lf", &config.kindShare[NODE_NANO], &config.kindShare[NODE_RELAYED],
+		&config.kindShare[NODE_OFFICE]) == 3 &&
+		config.kindShare[NODE_NANO] + config.kindShare[NODE_RELAYED] + config.kindShare[NODE_OFFICE] > 0;
+}
+
+/**
+* Capture file name for one stream: fleet.cap becomes fleet.3.cap
+*/
+static std::string streamPath(const std::string& path, uint32_t stream, uint32_t streams){
+	if (streams == 1){
+		return path;
+	}
+
+	char index[16];
+	snprintf(index, sizeof(index), ".%u", stream);
+
+	size_t dot = path.rfind('.');
+	size_t slash = path.rfind('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)){
+		return path + index;
+	}
+
+	return path.substr(0, dot) + index + path.substr(dot);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Outputs
+
+/**
+* Where the generated bytes go: stdout, ptys or capture files
+*/
+class FleetOutput{
+public:
+	FleetOutput(uint32_t streams) : _buffers(streams){}
+	virtual ~FleetOutput(){}
+
+	bool write(const FleetFrame& frame){
+		std::string& buffer = _buffers[frame.stream];
+		buffer.append(frame.text, frame.length);
+		return buffer.size() < OUTPUT_BUFFER_SIZE || flushStream(frame.stream);
+	}
+
+	bool flush(){
+		for (uint32_t i = 0; i < _buffers.size(); i++){
+			if (!_buffers[i].empty() && !flushStream(i)){
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	* Stamp for the bytes buffered from now on, for outputs that keep time
+	*/
+	virtual void setTime(int64_t){}
+	virtual void close(){}
+
+protected:
+	virtual bool writeStream(uint32_t stream, const std::string& data) = 0;
+
+	bool flushStream(uint32_t stream){
+		bool written = writeStream(stream, _buffers[stream]);
+		_buffers[stream].clear();
+		return written;
+	}
+
+private:
+	std::vector<std::string> _buffers;
+};
+
+class StdoutOutput : public FleetOutput{
+public:
+	StdoutOutput(uint32_t streams) : FleetOutput(streams){}
+
+protected:
+	bool writeStream(uint32_t, const std::string& data){
+		return fwrite(data.data(), 1, data.size(), stdout) == data.size() && fflush(stdout) == 0;
+	}
+};
+
+class TerminalOutput : public FleetOutput{
+public:
+	TerminalOutput(uint32_t streams) : FleetOutput(streams){}
+
+	~TerminalOutput(){
+		close();
+	}
+
+	bool open(uint32_t streams){
+		for (uint32_t i = 0; i < streams; i++){
+			PseudoTerminal* terminal = new PseudoTerminal();
+			_terminals.push_back(terminal);
+
+			if (!terminal->open()){
+				return false;
+			}
+
+			printf("%s\n", terminal->path().c_str());
+		}
+
+		fflush(stdout);
+		return true;
+	}
+
+	void close(){
+		// Closing a pty throws away whatever the reader hasn't taken yet
+		int64_t drainEnd = monotonicMicros() + DRAIN_TIMEOUT;
+		for (size_t i = 0; i < _terminals.size(); i++){
+			while (running && _terminals[i]->pending() > 0 && monotonicMicros() < drainEnd){
+				usleep(10000);
+			}
+			delete _terminals[i];
+		}
+
+		_terminals.clear();
+	}
+
+protected:
+	bool writeStream(uint32_t stream, const std::string& data){
+		return _terminals[stream]->write(data.data(), data.size());
+	}
+
+private:
+	std::vector<PseudoTerminal*> _terminals;
+};
+
+class CaptureOutput : public FleetOutput{
+public:
+	CaptureOutput(uint32_t streams) : FleetOutput(streams), _startTime(0), _time(0){}
+
+	~CaptureOutput(){
+		close();
+	}
+
+	bool open(const std::string& path, uint32_t streams, int64_t startTime){
+		_startTime = startTime;
+
+		for (uint32_t i = 0; i < streams; i++){
+			CaptureWriter* writer = new CaptureWriter();
+			_writers.push_back(writer);
+
+			std::string name = streamPath(path, i, streams);
+			if (!writer->open(name.c_str(), startTime * 1000)){
+				perror(name.c_str());
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void setTime(int64_t time){
+		_time = time;
+	}
+
+	void close(){
+		for (size_t i = 0; i < _writers.size(); i++){
+			delete _writers[i];
+		}
+
+		_writers.clear();
+	}
+
+protected:
+	bool writeStream(uint32_t stream, const std::string& data){
+		// Buffers are flushed whenever the clock moves on, so each chunk holds
+		// the bytes of a single instant
+		return _writers[stream]->write((_time - _startTime) * 1000, data.data(), data.size());
+	}
+
+private:
+	std::vector<CaptureWriter*> _writers;
+	int64_t _startTime;
+	int64_t _time;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// Main
+
+int main(int argc, char** argv){
+	FleetConfig config;
+	config.nodes = 10000;
+	config.startTime = currentTimeMicros() / 1000;
+
+	double duration = 3600;
+	double speed = 1;
+	double rate = 0;
+	double wait = 0;
+	const char* capturePath = NULL;
+	bool terminals = false;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:s:k:t:b:z:S:D:u:e:Lx:r:mc:pw:")) != -1){
+		bool valid = true;
+
+		switch (option){
+		case 'n':
+			config.nodes = strtoul(optarg, NULL, 10);
+			valid = config.nodes > 0;
+			break;
+		case 's':
+			config.streams = strtoul(optarg, NULL, 10);
+			valid = config.streams > 0 && config.streams <= 256;
+			break;
+		case 'k':
+			valid = parseShares(optarg, config);
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		case 'b':
+			valid = parseTime(optarg, config.startTime);
+			break;
+		case 'z':
+			config.utcOffset = atof(optarg);
+			break;
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'D':
+			config.dropoutRate = atof(optarg);
+			break;
+		case 'u':
+			config.duplicateRate = atof(optarg);
+			break;
+		case 'e':
+			config.corruptRate = atof(optarg);
+			break;
+		case 'L':
+			config.requestLines = true;
+			break;
+		case 'x':
+			speed = atof(optarg);
+			valid = speed > 0;
+			break;
+		case 'r':
+			rate = atof(optarg);
+			valid = rate > 0;
+			break;
+		case 'm':
+			speed = 0;
+			break;
+		case 'c':
+			capturePath = optarg;
+			break;
+		case 'p':
+			terminals = true;
+			break;
+		case 'w':
+			wait = atof(optarg);
+			break;
+		default:
+			valid = false;
+			break;
+		}
+
+		if (!valid){
+			fprintf(stderr, "Bad option: -%c %s\n", option, optarg != NULL ? optarg : "");
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (optind != argc || (capturePath != NULL && terminals) || duration < 0 || (capturePath != NULL && duration == 0)){
+		printUsage();
+		return 1;
+	}
+
+	signal(SIGINT, requestShutdown);
+	signal(SIGTERM, requestShutdown);
+	signal(SIGPIPE, SIG_IGN);
+
+	FleetGenerator fleet(config);
+
+	if (rate > 0){
+		speed = rate / fleet.frameRate();
+	}
+
+	fprintf(stderr, "%u nodes (%zu nano, %zu relayed, %zu office) on %u stream%s, %.0f frames/s simulated\n",
+		config.nodes, fleet.nodeCount(NODE_NANO), fleet.nodeCount(NODE_RELAYED), fleet.nodeCount(NODE_OFFICE),
+		config.streams, config.streams == 1 ? "" : "s", fleet.frameRate());
+
+	FleetOutput* output;
+
+	if (capturePath != NULL){
+		CaptureOutput* captures = new CaptureOutput(config.streams);
+		output = captures;
+
+		// Captures carry their own timing
+		speed = 0;
+		if (!captures->open(capturePath, config.streams, config.startTime)){
+			return 1;
+		}
+	}
+	else if (terminals){
+		TerminalOutput* ptys = new TerminalOutput(config.streams);
+		output = ptys;
+
+		if (!ptys->open(config.streams)){
+			perror("posix_openpt");
+			return 1;
+		}
+	}
+	else{
+		output = new StdoutOutput(config.streams);
+	}
+
+	// Give the reader time to open the ports
+	int64_t start = monotonicMicros() + int64_t(wait * 1000000);
+	sleepUntil(start);
+
+	int64_t end = duration > 0 ? config.startTime + int64_t(duration * 1000) : INT64_MAX;
+	int64_t time = config.startTime;
+	uint64_t frames = 0;
+	uint64_t bytes = 0;
+	bool ok = true;
+	FleetFrame frame;
+
+	while (running && ok){
+		fleet.next(frame);
+		if (frame.time >= end){
+			break;
+		}
+
+		if (frame.time != time){
+			if (speed > 0){
+				int64_t due = start + int64_t((frame.time - config.startTime) * 1000 / speed);
+
+				if (due > monotonicMicros() + PACING_SLACK){
+					ok = output->flush();
+					sleepUntil(due);
+				}
+			}
+			else if (capturePath != NULL){
+				ok = output->flush();
+			}
+
+			time = frame.time;
+			output->setTime(time);
+		}
+
+		ok = ok && output->write(frame);
+		frames += memchr(frame.text, PACKET_START, frame.length) != NULL;
+		bytes += frame.length;
+	}
+
+	ok = ok && output->flush();
+	double elapsed = (monotonicMicros() - start) / 1e6;
+	delete output;
+
+	if (!ok && running){
+		fprintf(stderr, "Output closed\n");
+	}
+
+	fprintf(stderr, "%llu bytes, %llu frames, %.1f h simulated in %.2f s (%.2f MB/s, %.0f frames/s)\n",
+		(unsigned long long)bytes, (unsigned long long)frames, (time - config.startTime) / 3600000.0, elapsed,
+		elapsed > 0 ? bytes / elapsed / 1e6 : 0.0, elapsed > 0 ? frames / elapsed : 0.0);
+	return ok || !running ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker OTA
+//
+// Sends a firmware image to one node, or every node, through a
+// coordinator. The coordinator asks for the image a window at a time and
+// reports how each node got on; nodes with a good copy restart into it.
+// Images are Intel HEX as built by the Arduino IDE, or raw binary.
+//
+// Usage:
+//	lurker_ota [-b baud] [-u unit] [-w seconds] port image.hex|image.bin
+//
+//	-u	Node to update (default: every node in the coordinator's table)
+//	-w	Wait after opening the port, for the coordinator to reset (default 3)
+//
+// Build:
+//	g++ -std=c++11 -O2 -I../LurkerNano -o lurker_ota lurker_ota.cpp serial_port.cpp ../LurkerNano/lurker_update.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "lurker_update.h"
+#include "serial_port.h"
+
+const char PACKET_START = '#';
+const int COORDINATOR_TIMEOUT = 30000;	// Silence before giving up, in ms
+const int READ_TIMEOUT = 100;
+
+static void printUsage(){
+	fprintf(stderr, "Usage: lurker_ota [-b baud] [-u unit] [-w seconds] port image.hex|image.bin\n");
+}
+
+static bool endsWith(const char* text, const char* suffix){
+	size_t length = strlen(text);
+	size_t suffixLength = strlen(suffix);
+
+	return length >= suffixLength && strcasecmp(text + length - suffixLength, suffix) == 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Images
+
+static int hexValue(const char* text, int digits){
+	int value = 0;
+
+	for (int i = 0; i < digits; i++){
+		char c = text[i];
+		int digit = c >= '0' && c <= '9' ? c - '0'
+			: c >= 'A' && c <= 'F' ? c - 'A' + 10
+			: c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+
+		if (digit < 0){
+			return -1;
+		}
+		value = (value << 4) | digit;
+	}
+
+	return value;
+}
+
+/**
+* Read an Intel HEX file into a flat image from address 0
+* Gaps are filled with 0xFF, as erased flash reads.
+*/
+static bool loadHex(FILE* file, std::vector<uint8_t>& image){
+	char line[600];
+	uint32_t base = 0;
+	int lineNumber = 0;
+
+	while (fgets(line, sizeof(line), file) != NULL){
+		lineNumber++;
+
+		size_t length = strcspn(line, "\r\n");
+		if (length == 0){
+			continue;
+		}
+
+		int count = hexValue(line + 1, 2);
+		if (line[0] != ':' || count < 0 || length != size_t(11 + count * 2)){
+			fprintf(stderr, "Bad record on line %i\n", lineNumber);
+			return false;
+		}
+
+		// Every byte of a record sums to 0
+		uint8_t bytes[256 + 5];
+		uint8_t sum = 0;
+
+		for (int i = 0; i < count + 5; i++){
+			int value = hexValue(line + 1 + i * 2, 2);
+			if (value < 0){
+				fprintf(stderr, "Bad record on line %i\n", lineNumber);
+				return false;
+			}
+			bytes[i] = uint8_t(value);
+			sum += bytes[i];
+		}
+
+		if (sum != 0){
+			fprintf(stderr, "Bad checksum on line %i\n", lineNumber);
+			return false;
+		}
+
+		uint32_t address = base + ((bytes[1] << 8) | bytes[2]);
+		const uint8_t* data = bytes + 4;
+
+		switch (bytes[3]){
+		case 0x00:
+			if (address + count > image.size()){
+				image.resize(address + count, 0xFF);
+			}
+			memcpy(&image[address], data, count);
+			break;
+		case 0x01:
+			return true;
+		case 0x02:
+			base = ((data[0] << 8) | data[1]) << 4;
+			break;
+		case 0x04:
+			base = uint32_t((data[0] << 8) | data[1]) << 16;
+			break;
+		default:
+			// Start addresses mean nothing to the bootloader
+			break;
+		}
+	}
+
+	return true;
+}
+
+static bool loadImage(const char* path, std::vector<uint8_t>& image){
+	FILE* file = fopen(path, "rb");
+
+	if (file == NULL){
+		perror(path);
+		return false;
+	}
+
+	bool loaded = true;
+
+	if (endsWith(path, ".hex")){
+		loaded = loadHex(file, image);
+	}
+	else{
+		uint8_t buffer[4096];
+		size_t length;
+
+		while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0){
+			image.insert(image.end(), buffer, buffer + length);
+		}
+	}
+
+	fclose(file);
+	return loaded;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Coordinator
+
+/**
+* Number after "key": in a JSON frame, or -1
+*/
+static long jsonNumber(const std::string& frame, const char* key){
+	std::string field = std::string("\"") + key + "\":";
+	size_t position = frame.find(field);
+
+	return position == std::string::npos ? -1 : atol(frame.c_str() + position + field.size());
+}
+
+static bool sendFrame(SerialPort& port, const std::string& frame){
+	return port.write(frame.data(), frame.size());
+}
+
+/**
+* Send a window of the image, as hex 'w' frames
+*/
+static bool sendBlocks(SerialPort& port, const std::vector<uint8_t>& image, long first, long count){
+	for (long block = first; block < first + count; block++){
+		size_t offset = size_t(block) * UPDATE_BLOCK_SIZE;
+		if (offset >= image.size()){
+			return true;
+		}
+
+		char frame[8 + UPDATE_BLOCK_SIZE * 2];
+		int length = snprintf(frame, sizeof(frame), "%c%04lX", UPDATE_DATA_COMMAND, block);
+
+		for (size_t i = offset; i < image.size() && i < offset + UPDATE_BLOCK_SIZE; i++){
+			length += snprintf(frame + length, sizeof(frame) - length, "%02X", image[i]);
+		}
+		frame[length++] = PACKET_END;
+
+		if (!port.write(frame, length)){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv){
+	long baud = 115200;
+	int unit = BROADCAST;
+	double wait = 3;
+	int option;
+
+	while ((option = getopt(argc, argv, "b:u:w:")) != -1){
+		bool valid = true;
+
+		switch (option){
+		case 'b':
+			baud = atol(optarg);
+			break;
+		case 'u':
+			unit = atoi(optarg);
+			valid = unit > COORDINATOR && unit < BROADCAST;
+			break;
+		case 'w':
+			wait = atof(optarg);
+			break;
+		default:
+			valid = false;
+			break;
+		}
+
+		if (!valid){
+			fprintf(stderr, "Bad option: -%c %s\n", option, optarg != NULL ? optarg : "");
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (argc - optind != 2){
+		printUsage();
+		return 1;
+	}
+
+	std::vector<uint8_t> image;
+
+	if (!loadImage(argv[optind + 1], image)){
+		return 1;
+	}
+	if (image.empty() || image.size() > MAX_IMAGE_SIZE){
+		fprintf(stderr, "Image is %zu bytes; it has to fit in %u\n", image.size(), MAX_IMAGE_SIZE);
+		return 1;
+	}
+
+	uint32_t crc = crc32(0, &image[0], image.size());
+	SerialPort port;
+
+	if (!port.open(argv[optind], baud)){
+		perror(argv[optind]);
+		return 1;
+	}
+
+	// Opening the port resets a Nano
+	usleep(useconds_t(wait * 1000000));
+
+	char start[24];
+	snprintf(start, sizeof(start), "%c%02X%04X%08X%c", UPDATE_START, unit, unsigned(image.size()), crc, PACKET_END);
+
+	fprintf(stderr, "Sending %zu bytes, CRC %08X, to %s\n", image.size(), crc,
+		unit == BROADCAST ? "every node" : ("unit " + std::to_string(unit)).c_str());
+
+	if (!sendFrame(port, start)){
+		perror(argv[optind]);
+		return 1;
+	}
+
+	std::string frame;
+	bool inFrame = false;
+	int silence = 0;
+	int verified = 0;
+	int failed = 0;
+	char buffer[256];
+
+	while (true){
+		ssize_t length = port.read(buffer, sizeof(buffer), READ_TIMEOUT);
+
+		if (length < 0){
+			perror(argv[optind]);
+			return 1;
+		}
+
+		if (length == 0){
+			silence += READ_TIMEOUT;
+
+			if (silence >= COORDINATOR_TIMEOUT){
+				fprintf(stderr, "No word from the coordinator; cancelling\n");
+				sendFrame(port, std::string(1, UPDATE_CANCEL_COMMAND) + PACKET_END);
+				return 1;
+			}
+			continue;
+		}
+
+		silence = 0;
+
+		for (ssize_t i = 0; i < length; i++){
+			char c = buffer[i];
+
+			if (c == PACKET_START){
+				frame.clear();
+				inFrame = true;
+			}
+			else if (c == PACKET_END && inFrame){
+				inFrame = false;
+
+				// Sensor frames go by as well
+				if (frame.find("\"ota\":\"blocks\"") != std::string::npos){
+					long first = jsonNumber(frame, "first");
+					long count = jsonNumber(frame, "count");
+
+					fprintf(stderr, "\r%3ld%%", first * UPDATE_BLOCK_SIZE * 100 / long(image.size()));
+
+					if (!sendBlocks(port, image, first, count)){
+						perror(argv[optind]);
+						return 1;
+					}
+				}
+				else if (frame.find("\"ota\":\"done\"") != std::string::npos){
+					bool good = frame.find("\"activated\"") != std::string::npos;
+
+					fprintf(stderr, "\rUnit %ld: %s\n", jsonNumber(frame, "unit"), good ? "updated" : "failed");
+					(good ? verified : failed)++;
+				}
+				else if (frame.find("\"ota\":\"end\"") != std::string::npos){
+					fprintf(stderr, "%i updated, %i failed\n", verified, failed);
+					return verified > 0 && failed == 0 ? 0 : 1;
+				}
+			}
+			else if (inFrame){
+				frame += c;
+			}
+		}
+	}
+}
@@ -0,0 +1,371 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Parse Bench
+//
+// Measures the record parser's throughput on recorded or generated frames,
+// against a general-purpose JSON library doing the same job: turning each
+// frame's text into a Record.
+//
+// Frames are cut from a capture (-c) the way lurkerd cuts them from a
+// port, or taken straight from the fleet generator, and all held in memory
+// first so only parsing is timed. Every parser gets the same frames; the
+// best of several passes is reported, and the library's records are
+// checked against the parser's.
+//
+// Usage:
+//	lurker_parse_bench [-c capture.cap | -n nodes -S seed] [-f frames] [-r passes]
+//
+//	-c capture.cap	Frames from a capture, e.g. one written by lurker_fleet -c
+//	-n nodes	Generated fleet size (default 1000)
+//	-S seed	Fleet seed (default 1)
+//	-f frames	Frames to parse, repeating the capture if it's short (default 2000000)
+//	-r passes	Timed passes per parser (default 5)
+//
+// Build:
+//	g++ -std=c++11 -O2 -o lurker_parse_bench lurker_parse_bench.cpp record_parser.cpp
+//		fleet_generator.cpp capture_file.cpp
+//
+//	Add -DLURKER_WITH_NLOHMANN and the include path of nlohmann/json.hpp
+//	to compare against nlohmann/json.
+//////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "capture_file.h"
+#include "fleet_generator.h"
+#include "record_parser.h"
+
+#ifdef LURKER_WITH_NLOHMANN
+#include <nlohmann/json.hpp>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+* Every frame's text back to back, without the start/end tags
+*/
+struct FrameSet{
+	std::vector<char> text;
+	std::vector<size_t> offsets;	// One past the end is offsets[i + 1]
+	uint64_t bytes;
+};
+
+/**
+* Parse one frame's text into a record
+*/
+typedef bool (*ParseFunction)(const char* text, size_t length, Record& record);
+
+/**
+* What a pass made of the frames, to keep it from being optimised away
+*/
+struct PassResult{
+	uint64_t parsed;
+	uint64_t fields;
+	double sum;
+};
+
+static void printUsage(){
+	fprintf(stderr, "Usage: lurker_parse_bench [-c capture.cap | -n nodes -S seed] [-f frames] [-r passes]\n");
+}
+
+static double millisSince(Clock::time_point start){
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void addFrame(FrameSet& frames, const char* text, size_t length){
+	frames.text.insert(frames.text.end(), text, text + length);
+	frames.offsets.push_back(frames.text.size());
+	frames.bytes += length;
+}
+
+/**
+* Cut frames out of a byte stream as lurkerd does: a start tag begins a new
+* frame, even in the middle of one, and frames too long are dropped
+*/
+class FrameCutter{
+public:
+	FrameCutter(FrameSet& frames, size_t limit) : _frames(frames), _limit(limit), _inFrame(false), _length(0){}
+
+	bool full() const{
+		return _frames.offsets.size() - 1 >= _limit;
+	}
+
+	void add(const uint8_t* data, size_t length){
+		for (size_t i = 0; i < length && !full(); i++){
+			char c = char(data[i]);
+
+			if (c == PACKET_START){
+				_inFrame = true;
+				_length = 0;
+			}
+			else if (!_inFrame){
+				continue;
+			}
+			else if (c == PACKET_END){
+				_inFrame = false;
+				addFrame(_frames, _text, _length);
+			}
+			else if (_length < MAX_FRAME_LENGTH){
+				_text[_length++] = c;
+			}
+			else{
+				_inFrame = false;
+			}
+		}
+	}
+
+private:
+	FrameSet& _frames;
+	size_t _limit;
+	bool _inFrame;
+	size_t _length;
+	char _text[MAX_FRAME_LENGTH];
+};
+
+static bool loadCapture(const char* path, size_t count, FrameSet& frames){
+	CaptureReader reader;
+	if (!reader.open(path)){
+		fprintf(stderr, "Couldn't read %s\n", path);
+		return false;
+	}
+
+	FrameCutter cutter(frames, count);
+	CaptureChunk chunk;
+
+	while (!cutter.full()){
+		size_t before = frames.offsets.size();
+
+		while (!cutter.full() && reader.next(chunk)){
+			cutter.add(chunk.data, chunk.length);
+		}
+
+		// Start again from the top if it's short, unless there's nothing in it
+		if (frames.offsets.size() == before){
+			break;
+		}
+		reader.rewind();
+	}
+
+	return true;
+}
+
+static void generateFrames(const FleetConfig& config, size_t count, FrameSet& frames){
+	FleetGenerator fleet(config);
+	FrameCutter cutter(frames, count);
+	FleetFrame frame;
+
+	while (!cutter.full()){
+		fleet.next(frame);
+		cutter.add((const uint8_t*)frame.text, frame.length);
+	}
+}
+
+static bool parseLurker(const char* text, size_t length, Record& record){
+	return parseRecord(text, length, record);
+}
+
+#ifdef LURKER_WITH_NLOHMANN
+/**
+* The same job through nlohmann/json: build the document, then walk it
+*/
+static bool parseNlohmann(const char* text, size_t length, Record& record){
+	record.id[0] = 0;
+	record.fields = 0;
+	record.unknownFields = 0;
+
+	nlohmann::json document = nlohmann::json::parse(text, text + length, NULL, false);
+	if (document.is_discarded() || !document.is_object()){
+		return false;
+	}
+
+	for (nlohmann::json::const_iterator i = document.begin(); i != document.end(); ++i){
+		const std::string& key = i.key();
+		const nlohmann::json& value = i.value();
+
+		if (key == "id"){
+			std::string id = value.is_string() ? value.get<std::string>() : value.dump();
+			size_t idLength = id.size() < MAX_ID_LENGTH ? id.size() : MAX_ID_LENGTH - 1;
+			memcpy(record.id, id.data(), idLength);
+			record.id[idLength] = 0;
+			continue;
+		}
+
+		int field = 0;
+		while (field < FIELD_COUNT && key != FIELD_NAMES[field]){
+			field++;
+		}
+
+		if (field == FIELD_COUNT){
+			record.unknownFields++;
+		}
+		else if (value.is_number()){
+			record.set(Field(field), value.get<double>());
+		}
+		else if (value.is_boolean()){
+			record.set(Field(field), value.get<bool>() ? 1 : 0);
+		}
+	}
+
+	return true;
+}
+#endif
+
+static PassResult runPass(const FrameSet& frames, ParseFunction parse){
+	PassResult result = { 0, 0, 0 };
+	Record record;
+
+	for (size_t i = 0; i + 1 < frames.offsets.size(); i++){
+		const char* text = &frames.text[frames.offsets[i]];
+		size_t length = frames.offsets[i + 1] - frames.offsets[i];
+
+		if (parse(text, length, record)){
+			result.parsed++;
+
+			for (int field = 0; field < FIELD_COUNT; field++){
+				if (record.has(Field(field))){
+					result.fields++;
+					result.sum += record.values[field];
+				}
+			}
+		}
+	}
+
+	return result;
+}
+
+/**
+* Time a parser over every frame, best of several passes
+* @return Best time in ms
+*/
+static double timeParser(const FrameSet& frames, const char* name, ParseFunction parse, int passes){
+	size_t count = frames.offsets.size() - 1;
+	double best = 0;
+	PassResult result;
+
+	for (int pass = 0; pass < passes; pass++){
+		Clock::time_point start = Clock::now();
+		result = runPass(frames, parse);
+		double elapsed = millisSince(start);
+
+		if (pass == 0 || elapsed < best){
+			best = elapsed;
+		}
+	}
+
+	printf("%-12s %10llu parsed %10llu fields %10.2f ms %8.1f ns/frame %10.0f frames/s %8.1f MB/s\n",
+		name, (unsigned long long)result.parsed, (unsigned long long)result.fields, best,
+		best * 1e6 / count, count / (best / 1000), frames.bytes / (best / 1000) / 1e6);
+	return best;
+}
+
+#ifdef LURKER_WITH_NLOHMANN
+/**
+* Frames the two parsers made different records of
+*/
+static uint64_t compareParsers(const FrameSet& frames, ParseFunction parse, ParseFunction reference){
+	uint64_t differences = 0;
+	Record record;
+	Record expected;
+
+	for (size_t i = 0; i + 1 < frames.offsets.size(); i++){
+		const char* text = &frames.text[frames.offsets[i]];
+		size_t length = frames.offsets[i + 1] - frames.offsets[i];
+
+		bool parsed = parse(text, length, record);
+		if (parsed != reference(text, length, expected)){
+			differences++;
+			continue;
+		}
+		if (!parsed){
+			continue;
+		}
+
+		bool same = record.fields == expected.fields && strcmp(record.id, expected.id) == 0;
+		for (int field = 0; same && field < FIELD_COUNT; field++){
+			same = !record.has(Field(field)) || record.values[field] == expected.values[field];
+		}
+		differences += !same;
+	}
+
+	return differences;
+}
+#endif
+
+int main(int argc, char** argv){
+	FleetConfig config;
+	const char* capturePath = NULL;
+	size_t count = 2000000;
+	int passes = 5;
+	int option;
+
+	while ((option = getopt(argc, argv, "c:n:S:f:r:")) != -1){
+		switch (option){
+		case 'c':
+			capturePath = optarg;
+			break;
+		case 'n':
+			config.nodes = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'f':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			passes = atoi(optarg);
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (config.nodes == 0 || count == 0 || passes <= 0){
+		printUsage();
+		return 1;
+	}
+
+	FrameSet frames;
+	frames.offsets.push_back(0);
+	frames.bytes = 0;
+
+	if (capturePath != NULL){
+		if (!loadCapture(capturePath, count, frames)){
+			return 1;
+		}
+	}
+	else{
+		generateFrames(config, count, frames);
+	}
+
+	size_t loaded = frames.offsets.size() - 1;
+	if (loaded == 0){
+		fprintf(stderr, "No frames\n");
+		return 1;
+	}
+
+	printf("%zu frames, %.1f MB, best of %i passes\n", loaded, frames.bytes / 1e6, passes);
+
+#ifdef LURKER_WITH_NLOHMANN
+	double lurker = timeParser(frames, "lurker", parseLurker, passes);
+	double nlohmann = timeParser(frames, "nlohmann", parseNlohmann, passes);
+	printf("lurker is %.1fx nlohmann/json\n", nlohmann / lurker);
+
+	uint64_t differences = compareParsers(frames, parseLurker, parseNlohmann);
+	if (differences > 0){
+		printf("%llu frames parsed differently\n", (unsigned long long)differences);
+		return 1;
+	}
+#else
+	timeParser(frames, "lurker", parseLurker, passes);
+	printf("built without a JSON library to compare against; see the build notes\n");
+#endif
+
+	return 0;
+}
@@ -0,0 +1,295 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Store Bench
+//
+// Measures the series store on a synthetic fleet: write throughput, then
+// full-scan throughput and query latency over what was written.
+//
+// Frames come from the fleet generator, are parsed and normalised as
+// lurkerd does and appended in batches, but only the store's own work is
+// timed, so the write figure isn't the generator's or the parser's.
+// Simulated time stands in for the arrival time.
+//
+// Usage:
+//	lurker_store_bench [-n nodes] [-t seconds] [-b batch] [-j threads] [-S seed] [-d store_dir]
+//
+//	-n nodes	Fleet size (default 1000)
+//	-t seconds	Simulated time to write (default 86400)
+//	-b batch	Records per append (default 256, lurkerd's batch size)
+//	-j threads	Query threads, 0 for one per core (default 0)
+//	-S seed	Fleet seed (default 1)
+//	-d store_dir	Store to write into; must not exist yet (default a temporary one, removed after)
+//
+// Build:
+//	g++ -std=c++11 -O2 -pthread -o lurker_store_bench lurker_store_bench.cpp fleet_generator.cpp
+//		query_engine.cpp query_kernels.cpp thread_pool.cpp series_store.cpp series_codec.cpp
+//		series_rollup.cpp schema.cpp ingest_pipeline.cpp record_parser.cpp record_sink.cpp serial_port.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "fleet_generator.h"
+#include "query_engine.h"
+#include "record_parser.h"
+
+const int64_t BENCH_START = 1767225600000LL;	// 2026-01-01 00:00 UTC
+const int64_t HOUR = 60 * 60 * 1000LL;
+const int64_t DAY = 24 * HOUR;
+
+typedef std::chrono::steady_clock Clock;
+
+static void printUsage(){
+	fprintf(stderr, "Usage: lurker_store_bench [-n nodes] [-t seconds] [-b batch] [-j threads] [-S seed] [-d store_dir]\n");
+}
+
+static double millisSince(Clock::time_point start){
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/**
+* Parse a generated frame, if it is one - log lines and frames cut short aren't
+*/
+static bool parseFrame(const FleetFrame& frame, Record& record){
+	const char* start = (const char*)memchr(frame.text, PACKET_START, frame.length);
+	if (start == NULL){
+		return false;
+	}
+
+	start++;
+	const char* end = (const char*)memchr(start, PACKET_END, frame.text + frame.length - start);
+	if (end == NULL){
+		return false;
+	}
+
+	if (!parseRecord(start, end - start, record)){
+		return false;
+	}
+
+	record.receivedAt = frame.time;
+	record.port = uint8_t(frame.stream);
+	return true;
+}
+
+/**
+* Time one query
+*/
+static void timeQuery(QueryEngine& engine, const char* name, const Query& query){
+	std::vector<QueryRow> rows;
+	Clock::time_point start = Clock::now();
+
+	engine.run(query, rows);
+
+	printf("query %-24s %8zu rows %10.2f ms\n", name, rows.size(), millisSince(start));
+}
+
+/**
+* Write the fleet into the store, then read it back
+*/
+static void runBench(const FleetConfig& config, double duration, size_t batchSize, size_t threads,
+	const std::string& root){
+	FleetGenerator fleet(config);
+	SchemaNormalizer normalizer;
+	SeriesStore store(root);
+
+	printf("%u nodes, %.1f h simulated, batches of %zu\n", config.nodes, duration / 3600, batchSize);
+
+	// Write
+	int64_t end = config.startTime + int64_t(duration * 1000);
+	RecordBatch records;
+	ColumnBatch columns;
+	FleetFrame frame;
+	uint64_t rows = 0;
+	uint64_t samples = 0;
+	double writeTime = 0;
+
+	records.port = 0;
+	records.records.reserve(batchSize);
+
+	for (bool more = true; more; ){
+		fleet.next(frame);
+		more = frame.time < end;
+
+		if (more){
+			records.records.resize(records.records.size() + 1);
+			if (!parseFrame(frame, records.records.back())){
+				records.records.pop_back();
+			}
+		}
+
+		if (records.records.size() >= batchSize || (!more && !records.records.empty())){
+			normalizer.normalize(records, columns);
+			records.records.clear();
+
+			// What the store will take, as SeriesStore::append() counts it
+			for (size_t i = 0; i < columns.rows; i++){
+				if (columns.device[i] != DEVICE_UNKNOWN){
+					for (int column = 0; column < COLUMN_COUNT; column++){
+						samples += columns.columns[column][i] == columns.columns[column][i];
+					}
+				}
+			}
+			rows += columns.rows;
+
+			Clock::time_point start = Clock::now();
+			store.append(columns);
+			writeTime += millisSince(start);
+		}
+	}
+
+	Clock::time_point flushStart = Clock::now();
+	store.flush();
+	writeTime += millisSince(flushStart);
+
+	printf("write  %10llu records %10llu samples %10.2f ms %12.0f samples/s\n",
+		(unsigned long long)rows, (unsigned long long)samples, writeTime, samples / (writeTime / 1000));
+
+	// Scan every raw series end to end
+	std::vector<std::string> nodes = store.listNodes();
+	uint64_t scanned = 0;
+	uint64_t bytes = 0;
+	Clock::time_point scanStart = Clock::now();
+
+	for (size_t i = 0; i < nodes.size(); i++){
+		for (int column = 0; column < COLUMN_COUNT; column++){
+			SeriesReader reader;
+			if (!store.openReader(nodes[i].c_str(), column, reader)){
+				continue;
+			}
+
+			double sum = 0;
+			scanned += reader.scan(INT64_MIN, INT64_MAX, [&sum](const BlockView& view){
+				for (uint32_t j = 0; j < view.count; j++){
+					sum += view.value[j];
+				}
+			});
+			bytes += reader.stats().storedBytes;
+
+			// Keep the sum from being optimised away
+			if (sum != sum){
+				printf("NaN in %s\n", nodes[i].c_str());
+			}
+		}
+	}
+
+	double scanTime = millisSince(scanStart);
+	printf("scan   %10zu nodes   %10llu samples %10.2f ms %12.0f samples/s, %.1f MB on disk\n",
+		nodes.size(), (unsigned long long)scanned, scanTime, scanned / (scanTime / 1000), bytes / 1e6);
+
+	// Relayed frames that arrive twice, and the like
+	if (scanned != samples){
+		printf("%llu samples rejected as out of order\n", (unsigned long long)(samples - scanned));
+	}
+
+	// Queries
+	ThreadPool pool(threads);
+	QueryEngine engine(store, pool);
+	Query query;
+
+	query.column = COLUMN_AIR_TEMP;
+	query.from = config.startTime;
+	query.to = end;
+
+	query.aggregate = AGGREGATE_MEAN;
+	query.bucket = HOUR;
+	timeQuery(engine, "mean by hour (rollups)", query);
+
+	query.aggregate = AGGREGATE_MAX;
+	query.bucket = DAY;
+	timeQuery(engine, "max by day (rollups)", query);
+
+	query.aggregate = AGGREGATE_PERCENTILE;
+	query.argument = 95;
+	query.bucket = HOUR;
+	timeQuery(engine, "p95 by hour (raw)", query);
+
+	query.aggregate = AGGREGATE_TIME_ABOVE;
+	query.argument = 22;
+	query.bucket = DAY;
+	timeQuery(engine, "above:22 by day (raw)", query);
+
+	query.nodes.push_back(nodes.empty() ? "" : nodes[0]);
+	query.aggregate = AGGREGATE_MEAN;
+	query.bucket = HOUR;
+	timeQuery(engine, "one node, mean by hour", query);
+
+	printf("on %zu query threads\n", pool.size());
+}
+
+int main(int argc, char** argv){
+	FleetConfig config;
+	config.startTime = BENCH_START;
+
+	double duration = 86400;
+	size_t batchSize = 256;
+	size_t threads = 0;
+	const char* storePath = NULL;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:t:b:j:S:d:")) != -1){
+		switch (option){
+		case 'n':
+			config.nodes = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		case 'b':
+			batchSize = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'd':
+			storePath = optarg;
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (config.nodes == 0 || duration <= 0 || batchSize == 0){
+		printUsage();
+		return 1;
+	}
+
+	std::string root;
+	bool temporary = storePath == NULL;
+
+	if (temporary){
+		char path[] = "/tmp/lurker_store_bench.XXXXXX";
+		if (mkdtemp(path) == NULL){
+			perror("mkdtemp");
+			return 1;
+		}
+		root = path;
+	}
+	else{
+		struct stat info;
+		if (stat(storePath, &info) == 0){
+			fprintf(stderr, "%s already exists\n", storePath);
+			return 1;
+		}
+		root = storePath;
+	}
+
+	runBench(config, duration, batchSize, threads, root);
+
+	if (temporary){
+		std::string command = "rm -rf '" + root + "'";
+		if (system(command.c_str()) != 0){
+			fprintf(stderr, "Couldn't remove %s\n", root.c_str());
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Store Info
+//
+// Prints the size of every series in a store, how well it compresses
+// against plain 12-byte samples, and how fast it decodes.
+//
+// Usage:
+//	lurker_store_info store_dir [node...]
+//
+// Build:
+//	g++ -std=c++11 -O2 -pthread -o lurker_store_info lurker_store_info.cpp series_store.cpp
+//		series_codec.cpp schema.cpp ingest_pipeline.cpp record_parser.cpp record_sink.cpp serial_port.cpp
+//		series_rollup.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "series_store.h"
+
+const double RAW_SAMPLE_SIZE = sizeof(int64_t) + sizeof(float);
+
+int main(int argc, char** argv){
+	if (argc < 2){
+		fprintf(stderr, "Usage: lurker_store_info store_dir [node...]\n");
+		return 1;
+	}
+
+	SeriesStore store(argv[1]);
+	std::vector<std::string> nodes;
+
+	for (int i = 2; i < argc; i++){
+		nodes.push_back(argv[i]);
+	}
+	if (nodes.empty()){
+		nodes = store.listNodes();
+	}
+
+	uint64_t totalSamples = 0;
+	uint64_t totalEncoded = 0;
+	uint64_t totalStored = 0;
+	double totalSeconds = 0;
+
+	printf("%-16s %-12s %10s %7s %10s %8s %7s %10s\n",
+		"node", "column", "samples", "blocks", "bytes", "B/sample", "ratio", "decode MB/s");
+
+	for (size_t n = 0; n < nodes.size(); n++){
+		for (int column = 0; column < COLUMN_COUNT; column++){
+			SeriesReader reader;
+
+			if (!store.openReader(nodes[n].c_str(), column, reader)){
+				continue;
+			}
+
+			SeriesStats stats = reader.stats();
+			if (stats.samples == 0){
+				continue;
+			}
+
+			// Time a full decode; the checksum keeps the work from being optimised away
+			double checksum = 0;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			reader.scan(INT64_MIN, INT64_MAX, [&checksum](const BlockView& view){
+				checksum += view.value[view.count - 1] + double(view.time[0]);
+			});
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			double bytesPerSample = double(stats.encodedBytes) / stats.samples;
+
+			printf("%-16s %-12s %10" PRIu64 " %7u %10" PRIu64 " %8.2f %6.1fx %10.0f\n",
+				nodes[n].c_str(), COLUMN_NAMES[column], stats.samples, stats.blocks, stats.encodedBytes,
+				bytesPerSample, RAW_SAMPLE_SIZE / bytesPerSample,
+				seconds > 0 ? stats.samples * RAW_SAMPLE_SIZE / seconds / 1e6 : 0.0);
+
+			totalSamples += stats.samples;
+			totalEncoded += stats.encodedBytes;
+			totalStored += stats.storedBytes;
+			totalSeconds += seconds;
+
+			if (checksum != checksum){
+				fprintf(stderr, "%s/%s decodes to NaN\n", nodes[n].c_str(), COLUMN_NAMES[column]);
+			}
+		}
+	}
+
+	if (totalSamples > 0){
+		printf("\n%" PRIu64 " samples, %.2f encoded B/sample (%.1fx), %.2f on-disk B/sample, decode %.2f GB/s\n",
+			totalSamples, double(totalEncoded) / totalSamples, RAW_SAMPLE_SIZE * totalSamples / totalEncoded,
+			double(totalStored) / totalSamples,
+			totalSeconds > 0 ? totalSamples * RAW_SAMPLE_SIZE / totalSeconds / 1e9 : 0.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Host Daemon
+//
+// Collects the JSON sensor frames printed by one or more Lurker
+// coordinators over serial and passes them on to the storage sinks.
+//
+// Usage:
+//	lurkerd [-b baud] [-s stats_interval] [-o output.csv] [-d store_dir] [-r retention_days] [-t thingspeak.conf] port...
+//
+// Build:
+//	g++ -std=c++11 -O2 -pthread -o lurkerd lurkerd.cpp ingest_pipeline.cpp
+//		record_parser.cpp record_sink.cpp schema.cpp serial_port.cpp series_store.cpp series_codec.cpp
+//		series_rollup.cpp http_client.cpp upload_queue.cpp thingspeak_sink.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ingest_pipeline.h"
+#include "record_sink.h"
+#include "series_store.h"
+#include "thingspeak_sink.h"
+
+const int STORE_FLUSH_INTERVAL = 1000;	// Max rate of partial block writes in ms
+const int64_t DAY_MS = 24 * 60 * 60 * 1000LL;
+
+static volatile sig_atomic_t running = 1;
+
+/**
+* Signal handler - finish up and exit
+*/
+static void requestShutdown(int){
+	running = 0;
+}
+
+static void printUsage(){
+	fprintf(stderr, "Usage: lurkerd [-b baud] [-s stats_interval] [-o output.csv] [-d store_dir] [-r retention_days] [-t thingspeak.conf] port...\n");
+}
+
+int main(int argc, char** argv){
+	IngestConfig config;
+	int statsInterval = 10;
+	const char* outputPath = NULL;
+	const char* storePath = NULL;
+	double retentionDays = 0;
+	const char* thingSpeakPath = NULL;
+	int option;
+
+	while ((option = getopt(argc, argv, "b:s:o:d:r:t:h")) != -1){
+		switch (option){
+		case 'b':
+			config.baud = atol(optarg);
+			break;
+		case 's':
+			statsInterval = atoi(optarg);
+			break;
+		case 'o':
+			outputPath = optarg;
+			break;
+		case 'd':
+			storePath = optarg;
+			break;
+		case 'r':
+			retentionDays = atof(optarg);
+			break;
+		case 't':
+			thingSpeakPath = optarg;
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (optind >= argc){
+		printUsage();
+		return 1;
+	}
+
+	ThingSpeakConfig thingSpeakConfig;
+	if (thingSpeakPath != NULL && !loadThingSpeakConfig(thingSpeakPath, thingSpeakConfig)){
+		fprintf(stderr, "Could not load %s\n", thingSpeakPath);
+		return 1;
+	}
+
+	// CSV goes to stdout unless the records are being stored or uploaded
+	FILE* output = (storePath == NULL && thingSpeakPath == NULL) ? stdout : NULL;
+	if (outputPath != NULL){
+		output = fopen(outputPath, "a");
+		if (output == NULL){
+			perror(outputPath);
+			return 1;
+		}
+	}
+
+	IngestPipeline pipeline(config);
+	CsvSink* csvSink = NULL;
+	SeriesStore* store = NULL;
+	StoreSink* storeSink = NULL;
+	ThingSpeakSink* thingSpeakSink = NULL;
+
+	for (int i = optind; i < argc; i++){
+		pipeline.addPort(argv[i]);
+	}
+
+	if (output != NULL){
+		csvSink = new CsvSink(output);
+		pipeline.addSink(csvSink);
+	}
+
+	if (storePath != NULL){
+		store = new SeriesStore(storePath);
+		store->setRetention(int64_t(retentionDays * DAY_MS));
+		storeSink = new StoreSink(*store, STORE_FLUSH_INTERVAL);
+		pipeline.addSink(storeSink);
+	}
+
+	if (thingSpeakPath != NULL){
+		thingSpeakSink = new ThingSpeakSink(thingSpeakConfig);
+		if (!thingSpeakSink->start()){
+			return 1;
+		}
+		pipeline.addSink(thingSpeakSink);
+	}
+
+	signal(SIGINT, requestShutdown);
+	signal(SIGTERM, requestShutdown);
+
+	if (!pipeline.start()){
+		return 1;
+	}
+
+	fprintf(stderr, "==== Lurker Host - %zu port(s) ====\n", pipeline.portCount());
+
+	int elapsed = 0;
+	while (running){
+		sleep(1);
+
+		if (statsInterval > 0 && ++elapsed >= statsInterval){
+			pipeline.printStats(stderr);
+			if (thingSpeakSink != NULL){
+				thingSpeakSink->printStats(stderr);
+			}
+			elapsed = 0;
+		}
+	}
+
+	pipeline.stop();
+	pipeline.printStats(stderr);
+
+	if (thingSpeakSink != NULL){
+		thingSpeakSink->printStats(stderr);
+		thingSpeakSink->stop();
+	}
+
+	delete thingSpeakSink;
+	delete storeSink;
+	delete store;
+	delete csvSink;
+
+	if (output != NULL && output != stdout){
+		fclose(output);
+	}
+
+	return 0;
+}
@@ -0,0 +1,249 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Query
+//
+// Runs one aggregation over a series store and prints CSV rows of
+// node, bucket start (UTC) and value.
+//
+// Usage:
+//	lurkerq -d store_dir -c column [-a aggregate] [-f from] [-t to] [-b bucket] [-n node]... [-j threads]
+//
+//	aggregate	mean, min, max, count, pNN (percentile, e.g. p95),
+//				above:THRESHOLD (hours above), active[:THRESHOLD] (minutes with a value above, default 0)
+//	from, to	YYYY-MM-DD[THH:MM[:SS]] in UTC, "now", or relative to now: -30d, -12h, -15m
+//	bucket		30s, 15m, 1h, 1d, ...; omit for one row per node
+//	threads		0 (the default) for one per core; never more than there are nodes
+//
+// Hours per day each node was above 26 degrees over the last month:
+//	lurkerq -d store -c airTemp -a above:26 -f -30d -b 1d
+//
+// Build:
+//	g++ -std=c++11 -O2 -pthread -o lurkerq lurkerq.cpp query_engine.cpp query_kernels.cpp thread_pool.cpp
+//		series_store.cpp series_codec.cpp series_rollup.cpp schema.cpp ingest_pipeline.cpp record_parser.cpp
+//		record_sink.cpp serial_port.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#include "ingest_pipeline.h"
+#include "query_engine.h"
+
+static void printUsage(){
+	fprintf(stderr, "Usage: lurkerq -d store_dir -c column [-a aggregate] [-f from] [-t to] [-b bucket] [-n node]... [-j threads]\n");
+}
+
+/**
+* Parse a duration such as 30s, 15m, 1h or 7d
+* @return Duration in ms, or -1 if it doesn't parse
+*/
+static int64_t parseDuration(const char* text){
+	char* end;
+	double amount = strtod(text, &end);
+
+	if (end == text || amount < 0){
+		return -1;
+	}
+
+	switch (*end){
+	case 's':
+		return int64_t(amount * 1000);
+	case 'm':
+		return int64_t(amount * 60 * 1000);
+	case 'h':
+		return int64_t(amount * 60 * 60 * 1000);
+	case 'd':
+		return int64_t(amount * 24 * 60 * 60 * 1000);
+	default:
+		return -1;
+	}
+}
+
+/**
+* Parse an absolute UTC date, "now" or a duration before now
+* @return True if the time parsed
+*/
+static bool parseTime(const char* text, int64_t now, int64_t& time){
+	if (strcmp(text, "now") == 0){
+		time = now;
+		return true;
+	}
+
+	if (text[0] == '-'){
+		int64_t ago = parseDuration(text + 1);
+		time = now - ago;
+		return ago >= 0;
+	}
+
+	struct tm date;
+	memset(&date, 0, sizeof(date));
+
+	int fields = sscanf(text, "%d-%d-%dT%d:%d:%d", &date.tm_year, &date.tm_mon, &date.tm_mday,
+		&date.tm_hour, &date.tm_min, &date.tm_sec);
+	if (fields != 3 && fields < 5){
+		return false;
+	}
+
+	date.tm_year -= 1900;
+	date.tm_mon -= 1;
+	time = int64_t(timegm(&date)) * 1000;
+	return true;
+}
+
+/**
+* Parse an aggregate name with its optional argument
+*/
+static bool parseAggregate(const char* text, Query& query){
+	const char* argument = strchr(text, ':');
+	size_t length = argument != NULL ? size_t(argument - text) : strlen(text);
+
+	if (text[0] == 'p' && text[1] >= '0' && text[1] <= '9'){
+		query.aggregate = AGGREGATE_PERCENTILE;
+		query.argument = atof(text + 1);
+		return true;
+	}
+
+	for (int i = 0; i < AGGREGATE_COUNT; i++){
+		if (strlen(AGGREGATE_NAMES[i]) == length && strncmp(text, AGGREGATE_NAMES[i], length) == 0){
+			query.aggregate = Aggregate(i);
+			query.argument = argument != NULL ? atof(argument + 1) : 0;
+
+			// Time above needs a threshold
+			return i != AGGREGATE_TIME_ABOVE || argument != NULL;
+		}
+	}
+
+	return false;
+}
+
+static int parseColumn(const char* name){
+	for (int i = 0; i < COLUMN_COUNT; i++){
+		if (strcmp(name, COLUMN_NAMES[i]) == 0){
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void printTime(FILE* output, int64_t time){
+	// Unbounded range
+	if (time == INT64_MIN){
+		return;
+	}
+
+	time_t seconds = time_t(time / 1000);
+	struct tm date;
+	char text[32];
+
+	gmtime_r(&seconds, &date);
+	strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &date);
+	fputs(text, output);
+}
+
+int main(int argc, char** argv){
+	Query query;
+	const char* storePath = NULL;
+	const char* column = NULL;
+	size_t threads = 0;
+	int64_t now = currentTimeMillis();
+	int option;
+
+	while ((option = getopt(argc, argv, "d:c:a:f:t:b:n:j:h")) != -1){
+		bool valid = true;
+
+		switch (option){
+		case 'd':
+			storePath = optarg;
+			break;
+		case 'c':
+			column = optarg;
+			break;
+		case 'a':
+			valid = parseAggregate(optarg, query);
+			break;
+		case 'f':
+			valid = parseTime(optarg, now, query.from);
+			break;
+		case 't':
+			valid = parseTime(optarg, now, query.to);
+			break;
+		case 'b':
+			query.bucket = parseDuration(optarg);
+			valid = query.bucket > 0;
+			break;
+		case 'n':
+			query.nodes.push_back(optarg);
+			break;
+		case 'j':{
+			char* end;
+			long count = strtol(optarg, &end, 10);
+			valid = end != optarg && *end == '\0' && count >= 0;
+			threads = size_t(count);
+			break;
+		}
+		default:
+			valid = false;
+			break;
+		}
+
+		if (!valid){
+			fprintf(stderr, "Bad option: -%c %s\n", option, optarg != NULL ? optarg : "");
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (storePath == NULL || column == NULL){
+		printUsage();
+		return 1;
+	}
+
+	query.column = parseColumn(column);
+	if (query.column < 0){
+		fprintf(stderr, "Unknown column: %s\n", column);
+		return 1;
+	}
+
+	SeriesStore store(storePath);
+
+	// Nodes are the unit of work, so more threads than nodes would only idle
+	size_t nodeCount = query.nodes.empty() ? store.listNodes().size() : query.nodes.size();
+	if (threads == 0){
+		threads = std::thread::hardware_concurrency();
+	}
+	if (threads > nodeCount){
+		threads = nodeCount;
+	}
+	if (threads == 0){
+		threads = 1;
+	}
+
+	ThreadPool pool(threads);
+	QueryEngine engine(store, pool);
+	std::vector<QueryRow> rows;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (!engine.run(query, rows)){
+		fprintf(stderr, "Invalid query\n");
+		return 1;
+	}
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	printf("node,start,%s\n", AGGREGATE_NAMES[query.aggregate]);
+	for (size_t i = 0; i < rows.size(); i++){
+		printf("%s,", rows[i].node.c_str());
+		printTime(stdout, rows[i].start);
+		printf(",%.4f\n", rows[i].value);
+	}
+
+	fprintf(stderr, "%zu rows in %.2f ms on %zu threads\n", rows.size(), elapsed, pool.size());
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include "pseudo_terminal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+PseudoTerminal::PseudoTerminal() : _master(-1), _slave(-1){
+}
+
+PseudoTerminal::~PseudoTerminal(){
+	close();
+}
+
+bool PseudoTerminal::open(){
+	close();
+
+	_master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (_master < 0 || grantpt(_master) != 0 || unlockpt(_master) != 0){
+		close();
+		return false;
+	}
+
+	const char* name = ptsname(_master);
+	if (name == NULL){
+		close();
+		return false;
+	}
+	_path = name;
+
+	_slave = ::open(name, O_RDWR | O_NOCTTY);
+	if (_slave < 0){
+		close();
+		return false;
+	}
+
+	// No echo or line editing, or frames would be echoed back and mangled
+	// before the reader has put the port into raw mode itself
+	struct termios options;
+	if (tcgetattr(_slave, &options) == 0){
+		cfmakeraw(&options);
+		tcsetattr(_slave, TCSANOW, &options);
+	}
+
+	return true;
+}
+
+void PseudoTerminal::close(){
+	if (_slave >= 0){
+		::close(_slave);
+	}
+
+	if (_master >= 0){
+		::close(_master);
+	}
+
+	_master = -1;
+	_slave = -1;
+	_path.clear();
+}
+
+bool PseudoTerminal::write(const void* data, size_t length){
+	const char* p = static_cast<const char*>(data);
+
+	while (length > 0){
+		ssize_t count = ::write(_master, p, length);
+
+		if (count < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return false;
+		}
+
+		p += count;
+		length -= count;
+	}
+
+	return true;
+}
+
+size_t PseudoTerminal::pending() const{
+	int count = 0;
+	return (_slave >= 0 && ioctl(_slave, FIONREAD, &count) == 0) ? count : 0;
+}
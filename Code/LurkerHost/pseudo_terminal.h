@@ -0,0 +1,52 @@
+#ifndef LURKER_PSEUDO_TERMINAL_H
+#define LURKER_PSEUDO_TERMINAL_H
+
+#include <stddef.h>
+#include <string>
+
+/**
+* Pseudo-terminal that stands in for a coordinator's serial port
+* Whatever is written to the master side can be read from path() exactly
+* as if it came from a USB serial adapter.
+*/
+class PseudoTerminal{
+public:
+	PseudoTerminal();
+	~PseudoTerminal();
+
+	/**
+	* Create the terminal in raw mode
+	* The slave side is kept open as well, so readers can come and go
+	* without writes failing in between.
+	*/
+	bool open();
+	void close();
+
+	/**
+	* Write the whole buffer, blocking while the reader is behind
+	* @return False on error
+	*/
+	bool write(const void* data, size_t length);
+
+	/**
+	* Bytes written but not read yet
+	*/
+	size_t pending() const;
+
+	/**
+	* Path of the slave side, e.g. /dev/pts/3
+	*/
+	const std::string& path() const{
+		return _path;
+	}
+
+private:
+	PseudoTerminal(const PseudoTerminal&);
+	PseudoTerminal& operator=(const PseudoTerminal&);
+
+	int _master;
+	int _slave;
+	std::string _path;
+};
+
+#endif
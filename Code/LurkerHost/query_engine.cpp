@@ -0,0 +1,306 @@
+#include "query_engine.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include "query_kernels.h"
+
+const char* const AGGREGATE_NAMES[AGGREGATE_COUNT] = {
+	"mean",
+	"min",
+	"max",
+	"count",
+	"percentile",
+	"above",
+	"active"
+};
+
+const int64_t MINUTE = ROLLUP_PERIODS[ROLLUP_MINUTE];
+const double HOUR = 60 * 60 * 1000.0;
+
+//////////////////////////////////////////////////////////////////////////
+// Results
+
+/**
+* Bucket a sample or point falls in
+*/
+static inline int64_t outputStart(const Query& query, int64_t time){
+	return query.bucket > 0 ? bucketStart(time, query.bucket) : query.from;
+}
+
+/**
+* Value of a summary aggregate
+*/
+static double summaryValue(Aggregate aggregate, const RollupPoint& summary){
+	switch (aggregate){
+	case AGGREGATE_MIN:
+		return summary.min;
+	case AGGREGATE_MAX:
+		return summary.max;
+	case AGGREGATE_SAMPLES:
+		return summary.count;
+	default:
+		return summary.mean();
+	}
+}
+
+/**
+* Percentile with linear interpolation between the closest ranks
+* Reorders the values.
+*/
+static double percentile(std::vector<float>& values, double rank){
+	if (values.empty()){
+		return NAN;
+	}
+
+	double position = rank / 100 * (values.size() - 1);
+	size_t below = size_t(position);
+	size_t above = std::min(below + 1, values.size() - 1);
+
+	std::nth_element(values.begin(), values.begin() + below, values.end());
+	double low = values[below];
+
+	if (above == below){
+		return low;
+	}
+
+	// The next rank up is the smallest value above the lower one
+	double high = *std::min_element(values.begin() + above, values.end());
+	return low + (high - low) * (position - below);
+}
+
+/**
+* Coarsest rollup period that both ends of a range fall on
+* @return Period in ms, or 0 if the range is not aligned to any tier
+*/
+static int64_t alignedPeriod(int64_t from, int64_t to){
+	if (to == INT64_MAX){
+		return 0;
+	}
+
+	for (int tier = ROLLUP_TIER_COUNT - 1; tier >= 0; tier--){
+		int64_t period = ROLLUP_PERIODS[tier];
+
+		if (bucketStart(from, period) == from && bucketStart(to + 1, period) == to + 1){
+			return period;
+		}
+	}
+
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Engine
+
+QueryEngine::QueryEngine(const SeriesStore& store, ThreadPool& pool) : _store(store), _pool(pool){
+}
+
+bool QueryEngine::run(const Query& query, std::vector<QueryRow>& rows){
+	if (query.column < 0 || query.column >= COLUMN_COUNT || query.aggregate < 0 || query.aggregate >= AGGREGATE_COUNT ||
+		query.bucket < 0 || query.from > query.to){
+		return false;
+	}
+
+	if (query.aggregate == AGGREGATE_PERCENTILE && (query.argument < 0 || query.argument > 100)){
+		return false;
+	}
+
+	// Active minutes are counted per minute, so buckets have to hold whole minutes
+	if (query.aggregate == AGGREGATE_ACTIVE_MINUTES && query.bucket % MINUTE != 0){
+		return false;
+	}
+
+	Query widened = query;
+	if (query.bucket > 0){
+		widened.from = bucketStart(query.from, query.bucket);
+
+		if (query.to < INT64_MAX - query.bucket){
+			widened.to = bucketStart(query.to, query.bucket) + query.bucket - 1;
+		}
+	}
+
+	std::vector<std::string> nodes = query.nodes.empty() ? _store.listNodes() : query.nodes;
+	std::vector<std::vector<QueryRow> > results(nodes.size());
+
+	_pool.parallelFor(nodes.size(), [this, &widened, &nodes, &results](size_t i){
+		runNode(widened, nodes[i], results[i]);
+	});
+
+	for (size_t i = 0; i < results.size(); i++){
+		rows.insert(rows.end(), results[i].begin(), results[i].end());
+	}
+
+	return true;
+}
+
+void QueryEngine::runNode(const Query& query, const std::string& node, std::vector<QueryRow>& rows) const{
+	switch (query.aggregate){
+	case AGGREGATE_ACTIVE_MINUTES:
+		fromSummaries(query, node, rows);
+		break;
+
+	case AGGREGATE_MEAN:
+	case AGGREGATE_MIN:
+	case AGGREGATE_MAX:
+	case AGGREGATE_SAMPLES:
+		if ((query.bucket > 0 && coarsestTier(query.bucket) >= 0) ||
+			(query.bucket == 0 && alignedPeriod(query.from, query.to) > 0)){
+			fromSummaries(query, node, rows);
+		}
+		else{
+			fromRaw(query, node, rows);
+		}
+		break;
+
+	default:
+		fromRaw(query, node, rows);
+		break;
+	}
+}
+
+/**
+* Answer from the store's rollups
+*/
+void QueryEngine::fromSummaries(const Query& query, const std::string& node, std::vector<QueryRow>& rows) const{
+	int64_t resolution = MINUTE;
+
+	if (query.aggregate != AGGREGATE_ACTIVE_MINUTES){
+		resolution = query.bucket > 0 ? query.bucket : alignedPeriod(query.from, query.to);
+	}
+
+	std::vector<RollupPoint> points;
+	_store.summarize(node.c_str(), query.column, query.from, query.to, resolution, points);
+
+	RollupPoint summary;
+	uint32_t activeMinutes = 0;
+	summary.count = 0;
+
+	for (size_t i = 0; i <= points.size(); i++){
+		int64_t start = i < points.size() ? outputStart(query, points[i].start) : 0;
+
+		// Emit the finished bucket
+		if (summary.count > 0 && (i == points.size() || start != summary.start)){
+			QueryRow row;
+			row.node = node;
+			row.start = summary.start;
+			row.value = query.aggregate == AGGREGATE_ACTIVE_MINUTES ? activeMinutes : summaryValue(query.aggregate, summary);
+			rows.push_back(row);
+
+			summary.count = 0;
+			activeMinutes = 0;
+		}
+
+		if (i == points.size()){
+			break;
+		}
+
+		if (summary.count == 0){
+			summary = points[i];
+			summary.start = start;
+		}
+		else{
+			summary.merge(points[i]);
+		}
+
+		if (points[i].max > query.argument){
+			activeMinutes++;
+		}
+	}
+}
+
+/**
+* Answer by running the kernels over decoded raw blocks
+*/
+void QueryEngine::fromRaw(const Query& query, const std::string& node, std::vector<QueryRow>& rows) const{
+	SeriesReader reader;
+	if (!_store.openReader(node.c_str(), query.column, reader)){
+		return;
+	}
+
+	RollupPoint summary;
+	double heldAbove = 0;
+	std::vector<float> values;
+	std::vector<float> durations;
+	summary.count = 0;
+
+	// The last sample of a block is timed against the first of the next
+	bool pending = false;
+	int64_t pendingTime = 0;
+	float pendingValue = 0;
+
+	float threshold = float(query.argument);
+	float maxHold = float(MAX_HOLD_TIME);
+
+	auto emit = [&](){
+		if (summary.count == 0){
+			return;
+		}
+
+		QueryRow row;
+		row.node = node;
+		row.start = summary.start;
+
+		if (query.aggregate == AGGREGATE_PERCENTILE){
+			row.value = percentile(values, query.argument);
+		}
+		else if (query.aggregate == AGGREGATE_TIME_ABOVE){
+			row.value = heldAbove / HOUR;
+		}
+		else{
+			row.value = summaryValue(query.aggregate, summary);
+		}
+
+		rows.push_back(row);
+		summary.count = 0;
+		heldAbove = 0;
+		values.clear();
+	};
+
+	reader.scan(query.from, query.to, [&](const BlockView& view){
+		if (query.aggregate == AGGREGATE_TIME_ABOVE){
+			if (pending && pendingValue > threshold){
+				heldAbove += std::min<int64_t>(view.time[0] - pendingTime, MAX_HOLD_TIME);
+			}
+
+			durations.resize(view.count);
+			timeDeltas(view.time, view.count, &durations[0]);
+		}
+
+		// Split the block into runs that fall in the same bucket
+		for (uint32_t first = 0; first < view.count;){
+			int64_t start = outputStart(query, view.time[first]);
+			uint32_t last = view.count;
+
+			if (query.bucket > 0){
+				last = std::upper_bound(view.time + first, view.time + view.count, start + query.bucket - 1) - view.time;
+			}
+
+			if (summary.count > 0 && start != summary.start){
+				emit();
+			}
+
+			summary.start = start;
+			uint32_t length = last - first;
+
+			if (query.aggregate == AGGREGATE_PERCENTILE){
+				values.insert(values.end(), view.value + first, view.value + last);
+			}
+
+			if (query.aggregate == AGGREGATE_TIME_ABOVE){
+				// The block's last sample has no duration yet
+				uint32_t timed = std::min(last, view.count - 1) - first;
+				heldAbove += timeAbove(view.value + first, &durations[first], timed, threshold, maxHold);
+			}
+
+			summarizeValues(view.value + first, length, summary);
+			first = last;
+		}
+
+		pending = true;
+		pendingTime = view.time[view.count - 1];
+		pendingValue = view.value[view.count - 1];
+	});
+
+	emit();
+}
@@ -0,0 +1,90 @@
+#ifndef LURKER_QUERY_ENGINE_H
+#define LURKER_QUERY_ENGINE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "series_store.h"
+#include "thread_pool.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Query Engine
+//
+// Aggregates one column of the series store over a time range, per node
+// and per bucket, e.g. "hours per day each node was above 26 degrees":
+//	column = COLUMN_AIR_TEMP, aggregate = AGGREGATE_TIME_ABOVE,
+//	argument = 26, bucket = 1 day
+//
+// Nodes are aggregated in parallel on a thread pool. Mean/min/max/samples
+// and active minutes come from the rollup tiers when the bucket allows it;
+// everything else runs the query kernels over decoded raw blocks, so it
+// only reaches back as far as the raw retention window.
+//
+// Bucketed ranges are widened to whole buckets, aligned to the epoch.
+//////////////////////////////////////////////////////////////////////////
+
+enum Aggregate{
+	AGGREGATE_MEAN,
+	AGGREGATE_MIN,
+	AGGREGATE_MAX,
+	AGGREGATE_SAMPLES,	// Number of samples
+	AGGREGATE_PERCENTILE,	// argument = percentile, 0-100
+	AGGREGATE_TIME_ABOVE,	// argument = threshold; result in hours
+	AGGREGATE_ACTIVE_MINUTES,	// argument = threshold; minutes with any value above it
+	AGGREGATE_COUNT
+};
+
+extern const char* const AGGREGATE_NAMES[AGGREGATE_COUNT];
+
+const int64_t MAX_HOLD_TIME = 5 * 60 * 1000LL;	// Longest a reading counts for when timing, in ms
+
+struct Query{
+	std::vector<std::string> nodes;	// Empty for every node in the store
+	int column;
+	int64_t from;	// Inclusive range in ms since the epoch
+	int64_t to;
+	int64_t bucket;	// Bucket length in ms, or 0 for one result over the whole range
+	Aggregate aggregate;
+	double argument;
+
+	Query() :
+		column(COLUMN_AIR_TEMP),
+		from(INT64_MIN),
+		to(INT64_MAX),
+		bucket(0),
+		aggregate(AGGREGATE_MEAN),
+		argument(0){}
+};
+
+struct QueryRow{
+	std::string node;
+	int64_t start;	// Bucket start, or the range start for unbucketed queries
+	double value;
+};
+
+class QueryEngine{
+public:
+	/**
+	* The engine only reads the store, so it can run next to a writer in another process
+	*/
+	QueryEngine(const SeriesStore& store, ThreadPool& pool);
+
+	/**
+	* Run a query
+	* Rows come out sorted by node, then bucket. Buckets without any samples are left out.
+	*
+	* @return False if the query is invalid
+	*/
+	bool run(const Query& query, std::vector<QueryRow>& rows);
+
+private:
+	void runNode(const Query& query, const std::string& node, std::vector<QueryRow>& rows) const;
+	void fromSummaries(const Query& query, const std::string& node, std::vector<QueryRow>& rows) const;
+	void fromRaw(const Query& query, const std::string& node, std::vector<QueryRow>& rows) const;
+
+	const SeriesStore& _store;
+	ThreadPool& _pool;
+};
+
+#endif
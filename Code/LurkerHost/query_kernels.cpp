@@ -0,0 +1,112 @@
+#include "query_kernels.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__)
+/**
+* Add the four lanes of a float vector to a pair of double accumulators
+*/
+static inline void addWide(__m128 values, __m128d& low, __m128d& high){
+	low = _mm_add_pd(low, _mm_cvtps_pd(values));
+	high = _mm_add_pd(high, _mm_cvtps_pd(_mm_movehl_ps(values, values)));
+}
+
+static inline double sumLanes(__m128d low, __m128d high){
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(low, high));
+	return lanes[0] + lanes[1];
+}
+#endif
+
+void summarizeValues(const float* values, size_t count, RollupPoint& summary){
+	if (count == 0){
+		return;
+	}
+
+	size_t i = 0;
+	double sum = 0;
+	float low = values[0];
+	float high = values[0];
+
+#if defined(__SSE2__)
+	if (count >= 4){
+		__m128 minimum = _mm_loadu_ps(values);
+		__m128 maximum = minimum;
+		__m128d sumLow = _mm_setzero_pd();
+		__m128d sumHigh = _mm_setzero_pd();
+
+		for (; i + 4 <= count; i += 4){
+			__m128 v = _mm_loadu_ps(values + i);
+			minimum = _mm_min_ps(minimum, v);
+			maximum = _mm_max_ps(maximum, v);
+			addWide(v, sumLow, sumHigh);
+		}
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, minimum);
+		low = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+		_mm_storeu_ps(lanes, maximum);
+		high = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+		sum = sumLanes(sumLow, sumHigh);
+	}
+#endif
+
+	for (; i < count; i++){
+		sum += values[i];
+		low = std::min(low, values[i]);
+		high = std::max(high, values[i]);
+	}
+
+	RollupPoint run;
+	run.start = summary.start;
+	run.sum = sum;
+	run.min = low;
+	run.max = high;
+	run.count = count;
+	run.reserved = 0;
+
+	if (summary.count == 0){
+		summary = run;
+	}
+	else{
+		summary.merge(run);
+	}
+}
+
+double timeAbove(const float* values, const float* durations, size_t count, float threshold, float maxDuration){
+	size_t i = 0;
+	double total = 0;
+
+#if defined(__SSE2__)
+	__m128 limit = _mm_set1_ps(threshold);
+	__m128 ceiling = _mm_set1_ps(maxDuration);
+	__m128d totalLow = _mm_setzero_pd();
+	__m128d totalHigh = _mm_setzero_pd();
+
+	for (; i + 4 <= count; i += 4){
+		__m128 above = _mm_cmpgt_ps(_mm_loadu_ps(values + i), limit);
+		__m128 held = _mm_min_ps(_mm_loadu_ps(durations + i), ceiling);
+		addWide(_mm_and_ps(held, above), totalLow, totalHigh);
+	}
+
+	total = sumLanes(totalLow, totalHigh);
+#endif
+
+	for (; i < count; i++){
+		if (values[i] > threshold){
+			total += std::min(durations[i], maxDuration);
+		}
+	}
+
+	return total;
+}
+
+void timeDeltas(const int64_t* times, size_t count, float* durations){
+	for (size_t i = 0; i + 1 < count; i++){
+		durations[i] = float(times[i + 1] - times[i]);
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef LURKER_QUERY_KERNELS_H
+#define LURKER_QUERY_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "series_rollup.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Query Kernels
+//
+// Tight loops over the decoded value arrays of one block. They use SSE2
+// when the compiler targets it (always on x86-64) and plain loops
+// otherwise; both give the same results up to summation order. Sums are
+// carried in doubles so long ranges don't lose precision.
+//////////////////////////////////////////////////////////////////////////
+
+/**
+* Fold a run of values into a summary (sum, min, max, count)
+*/
+void summarizeValues(const float* values, size_t count, RollupPoint& summary);
+
+/**
+* Total time spent above a threshold
+* Each value holds for its duration, capped at a maximum.
+*
+* @param durations Time until the next sample, in ms
+* @return Time in ms
+*/
+double timeAbove(const float* values, const float* durations, size_t count, float threshold, float maxDuration);
+
+/**
+* Gaps between consecutive timestamps, as floats for the kernels
+* @param durations Receives count - 1 gaps
+*/
+void timeDeltas(const int64_t* times, size_t count, float* durations);
+
+#endif
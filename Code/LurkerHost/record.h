@@ -0,0 +1,85 @@
+#ifndef LURKER_RECORD_H
+#define LURKER_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// Lurker Records
+//
+// Host-side representation of the JSON frames printed by the Lurkers:
+//	#{"id":"lurker0","version":0.9,"temperature":21.5,...}$
+//
+// Frames are cut from the serial stream as-is; records are the parsed
+// key/value content of a single frame.
+//////////////////////////////////////////////////////////////////////////
+
+// Serial framing - must match the sketches
+const char PACKET_START = '#';
+const char PACKET_END = '$';
+
+const size_t MAX_FRAME_LENGTH = 246;	// Longest accepted frame, excluding the start/end tags
+const size_t MAX_ID_LENGTH = 16;
+
+/**
+* Raw frame as received from a serial port
+*/
+struct Frame{
+	int64_t receivedAt;	// Host wall-clock time in ms
+	uint16_t length;
+	char text[MAX_FRAME_LENGTH];
+};
+
+/**
+* Known record keys
+* LurkerNano: id, version, temperature, humidity, illuminance, motion
+* OfficeLurker: id, timestamp, air_temp, surface_temp, humidity, illuminance, noise_level, motion
+* LurkerCoordinator (legacy): noise
+*/
+enum Field{
+	FIELD_TEMPERATURE,
+	FIELD_HUMIDITY,
+	FIELD_ILLUMINANCE,
+	FIELD_MOTION,
+	FIELD_VERSION,
+	FIELD_AIR_TEMP,
+	FIELD_SURFACE_TEMP,
+	FIELD_NOISE_LEVEL,
+	FIELD_NOISE,
+	FIELD_TIMESTAMP,
+	FIELD_COUNT
+};
+
+extern const char* const FIELD_NAMES[FIELD_COUNT];
+
+/**
+* Parsed content of one frame
+*/
+struct Record{
+	int64_t receivedAt;	// Host wall-clock time in ms
+	uint8_t port;	// Index of the serial port the frame arrived on
+	char id[MAX_ID_LENGTH];	// Unit identifier, e.g. "lurker0" or "3" for relayed packets
+	uint16_t fields;	// Bitmask of the fields present in the frame
+	uint8_t unknownFields;	// Number of keys that were not recognised
+	double values[FIELD_COUNT];
+
+	bool has(Field field) const{
+		return (fields & (1 << field)) != 0;
+	}
+
+	void set(Field field, double value){
+		fields |= (1 << field);
+		values[field] = value;
+	}
+};
+
+/**
+* Group of records handed from a parser worker to the storage sinks
+*/
+struct RecordBatch{
+	uint8_t port;
+	std::vector<Record> records;
+};
+
+#endif
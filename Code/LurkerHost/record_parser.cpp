@@ -0,0 +1,441 @@
+#include "record_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char* const FIELD_NAMES[FIELD_COUNT] = {
+	"temperature",
+	"humidity",
+	"illuminance",
+	"motion",
+	"version",
+	"air_temp",
+	"surface_temp",
+	"noise_level",
+	"noise",
+	"timestamp"
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Key Hash
+//
+// Every known key hashes to its own slot using only its length and its
+// first and last characters. The slot table is built at compile time and
+// the build fails if a new key collides - pick a different mix then.
+//////////////////////////////////////////////////////////////////////////
+
+const int KEY_ID = -1;	// Field value of the "id" key
+const int KEY_UNKNOWN = -2;
+
+struct KeyEntry{
+	const char* name;
+	size_t length;
+	int field;
+};
+
+constexpr KeyEntry KEYS[] = {
+	{ "id", 2, KEY_ID },
+	{ "temperature", 11, FIELD_TEMPERATURE },
+	{ "humidity", 8, FIELD_HUMIDITY },
+	{ "illuminance", 11, FIELD_ILLUMINANCE },
+	{ "motion", 6, FIELD_MOTION },
+	{ "version", 7, FIELD_VERSION },
+	{ "air_temp", 8, FIELD_AIR_TEMP },
+	{ "surface_temp", 12, FIELD_SURFACE_TEMP },
+	{ "noise_level", 11, FIELD_NOISE_LEVEL },
+	{ "noise", 5, FIELD_NOISE },
+	{ "timestamp", 9, FIELD_TIMESTAMP }
+};
+
+constexpr size_t KEY_COUNT = sizeof(KEYS) / sizeof(KEYS[0]);
+constexpr unsigned KEY_SLOT_COUNT = 32;
+
+constexpr unsigned keyHash(const char* key, size_t length){
+	return (length + (unsigned char)key[0] + ((unsigned char)key[length - 1] << 3)) & (KEY_SLOT_COUNT - 1);
+}
+
+constexpr unsigned keyHash(size_t index){
+	return keyHash(KEYS[index].name, KEYS[index].length);
+}
+
+constexpr bool collidesWithLater(size_t index, size_t other){
+	return other >= KEY_COUNT ? false :
+		(keyHash(index) == keyHash(other) || collidesWithLater(index, other + 1));
+}
+
+constexpr bool hasCollision(size_t index){
+	return index >= KEY_COUNT ? false :
+		(collidesWithLater(index, index + 1) || hasCollision(index + 1));
+}
+
+static_assert(!hasCollision(0), "Record keys collide in the key hash");
+
+/**
+* Find the key that lives in a slot
+* @return Index into KEYS, or -1 for an empty slot
+*/
+constexpr int keyInSlot(unsigned slot, size_t index){
+	return index >= KEY_COUNT ? -1 :
+		(keyHash(index) == slot ? int(index) : keyInSlot(slot, index + 1));
+}
+
+#define KEY_SLOT(n) keyInSlot(n, 0)
+#define KEY_SLOTS_4(n) KEY_SLOT(n), KEY_SLOT(n + 1), KEY_SLOT(n + 2), KEY_SLOT(n + 3)
+
+static const signed char KEY_SLOTS[KEY_SLOT_COUNT] = {
+	KEY_SLOTS_4(0), KEY_SLOTS_4(4), KEY_SLOTS_4(8), KEY_SLOTS_4(12),
+	KEY_SLOTS_4(16), KEY_SLOTS_4(20), KEY_SLOTS_4(24), KEY_SLOTS_4(28)
+};
+
+/**
+* Look up a key
+* @return Field index, KEY_ID or KEY_UNKNOWN
+*/
+static inline int findKey(const char* key, size_t length){
+	if (length == 0){
+		return KEY_UNKNOWN;
+	}
+
+	int index = KEY_SLOTS[keyHash(key, length)];
+	if (index < 0 || KEYS[index].length != length || memcmp(KEYS[index].name, key, length) != 0){
+		return KEY_UNKNOWN;
+	}
+
+	return KEYS[index].field;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Tokenising
+
+static inline const char* skipSpace(const char* p, const char* end){
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')){
+		p++;
+	}
+	return p;
+}
+
+static inline bool isDigit(char c){
+	return c >= '0' && c <= '9';
+}
+
+/**
+* Read a quoted string
+* Escapes are stepped over but not decoded; Lurker keys and IDs never contain them.
+*
+* @return Position after the closing quote, or NULL if the string is unterminated
+*/
+static const char* readString(const char* p, const char* end, TextView& view){
+	if (p >= end || *p != '"'){
+		return NULL;
+	}
+
+	view.text = ++p;
+	while (p < end && *p != '"'){
+		p += (*p == '\\') ? 2 : 1;
+	}
+
+	if (p >= end){
+		return NULL;
+	}
+
+	view.length = p - view.text;
+	return p + 1;
+}
+
+static const double POWERS_OF_TEN[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+const int MAX_EXACT_POWER = 22;
+const int MAX_EXACT_DIGITS = 15;	// Mantissas up to this many digits are exact in a double
+
+/**
+* Decode a JSON number in place
+* Typical sensor values (up to 15 significant digits, small exponents) are
+* decoded exactly with a single multiply or divide. Anything longer goes
+* through strtod on a bounded copy.
+*
+* @return Position after the number, or NULL if there is no number here
+*/
+static const char* readNumber(const char* p, const char* end, double& value){
+	const char* start = p;
+	bool negative = false;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+
+	if (p < end && *p == '-'){
+		negative = true;
+		p++;
+	}
+
+	if (p >= end || !isDigit(*p)){
+		return NULL;
+	}
+
+	while (p < end && isDigit(*p)){
+		if (digits < 19){
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa != 0){
+				digits++;
+			}
+		}
+		else{
+			exponent++;
+		}
+		p++;
+	}
+
+	if (p < end && *p == '.'){
+		p++;
+		while (p < end && isDigit(*p)){
+			if (digits < 19){
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0){
+					digits++;
+				}
+				exponent--;
+			}
+			p++;
+		}
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')){
+		int sign = 1;
+		int power = 0;
+		p++;
+
+		if (p < end && (*p == '+' || *p == '-')){
+			sign = (*p == '-') ? -1 : 1;
+			p++;
+		}
+
+		if (p >= end || !isDigit(*p)){
+			return NULL;
+		}
+
+		while (p < end && isDigit(*p)){
+			if (power < 10000){
+				power = power * 10 + (*p - '0');
+			}
+			p++;
+		}
+		exponent += sign * power;
+	}
+
+	if (digits <= MAX_EXACT_DIGITS && exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER){
+		value = double(mantissa);
+		value = exponent < 0 ? value / POWERS_OF_TEN[-exponent] : value * POWERS_OF_TEN[exponent];
+	}
+
+	// Slow path - too many digits to be exact
+	else{
+		char buffer[64];
+		size_t length = p - start;
+
+		if (length >= sizeof(buffer)){
+			return NULL;
+		}
+
+		memcpy(buffer, start, length);
+		buffer[length] = 0;
+		value = strtod(buffer, NULL);
+		return p;
+	}
+
+	if (negative){
+		value = -value;
+	}
+	return p;
+}
+
+/**
+* Match a literal word (true, false, null)
+*/
+static inline const char* readWord(const char* p, const char* end, const char* word, size_t length){
+	if (size_t(end - p) < length || memcmp(p, word, length) != 0){
+		return NULL;
+	}
+	return p + length;
+}
+
+/**
+* Skip over any value, including nested objects and arrays
+* Used for keys that are not part of the Lurker schema.
+*
+* @return Position after the value, or NULL if the value is malformed
+*/
+static const char* skipValue(const char* p, const char* end){
+	if (p >= end){
+		return NULL;
+	}
+
+	if (*p == '"'){
+		TextView view;
+		return readString(p, end, view);
+	}
+
+	if (*p == '{' || *p == '['){
+		int depth = 0;
+
+		while (p < end){
+			if (*p == '"'){
+				TextView view;
+				p = readString(p, end, view);
+				if (p == NULL){
+					return NULL;
+				}
+				continue;
+			}
+
+			if (*p == '{' || *p == '['){
+				depth++;
+			}
+			else if (*p == '}' || *p == ']'){
+				if (--depth == 0){
+					return p + 1;
+				}
+			}
+			p++;
+		}
+		return NULL;
+	}
+
+	// Number or literal
+	const char* start = p;
+	while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'){
+		p++;
+	}
+	return p > start ? p : NULL;
+}
+
+/**
+* Copy the unit ID into the record
+* The ID may be a name or a plain unit number (relayed packets).
+*/
+static void setId(Record& record, const char* text, size_t length){
+	if (length >= MAX_ID_LENGTH){
+		length = MAX_ID_LENGTH - 1;
+	}
+
+	memcpy(record.id, text, length);
+	record.id[length] = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Parsing
+
+bool parseRecord(const char* text, size_t length, Record& record,
+	UnknownKeyHandler handler, void* context){
+
+	const char* p = text;
+	const char* end = text + length;
+
+	record.id[0] = 0;
+	record.fields = 0;
+	record.unknownFields = 0;
+
+	p = skipSpace(p, end);
+	if (p >= end || *p != '{'){
+		return false;
+	}
+	p = skipSpace(p + 1, end);
+
+	// Empty object
+	if (p < end && *p == '}'){
+		return true;
+	}
+
+	while (p < end){
+		TextView key;
+
+		p = readString(p, end, key);
+		if (p == NULL){
+			return false;
+		}
+
+		p = skipSpace(p, end);
+		if (p >= end || *p != ':'){
+			return false;
+		}
+		p = skipSpace(p + 1, end);
+		if (p >= end){
+			return false;
+		}
+
+		int field = findKey(key.text, key.length);
+		const char* valueStart = p;
+
+		// Known numeric fields - numbers and booleans are stored, null means missing
+		if (field >= 0){
+			double value;
+
+			if (*p == '-' || isDigit(*p)){
+				p = readNumber(p, end, value);
+				if (p != NULL){
+					record.set(Field(field), value);
+				}
+			}
+			else if (*p == 't'){
+				p = readWord(p, end, "true", 4);
+				record.set(Field(field), 1);
+			}
+			else if (*p == 'f'){
+				p = readWord(p, end, "false", 5);
+				record.set(Field(field), 0);
+			}
+			else{
+				p = skipValue(p, end);
+			}
+		}
+
+		else if (field == KEY_ID){
+			if (*p == '"'){
+				TextView id;
+				p = readString(p, end, id);
+				if (p != NULL){
+					setId(record, id.text, id.length);
+				}
+			}
+			else{
+				p = skipValue(p, end);
+				if (p != NULL){
+					setId(record, valueStart, p - valueStart);
+				}
+			}
+		}
+
+		// Generic path
+		else{
+			p = skipValue(p, end);
+			record.unknownFields++;
+
+			if (p != NULL && handler != NULL){
+				TextView value = { valueStart, size_t(p - valueStart) };
+				handler(key, value, context);
+			}
+		}
+
+		if (p == NULL){
+			return false;
+		}
+
+		p = skipSpace(p, end);
+		if (p >= end){
+			return false;
+		}
+
+		if (*p == '}'){
+			return true;
+		}
+
+		if (*p != ','){
+			return false;
+		}
+		p = skipSpace(p + 1, end);
+	}
+
+	return false;
+}
@@ -0,0 +1,40 @@
+#ifndef LURKER_RECORD_PARSER_H
+#define LURKER_RECORD_PARSER_H
+
+#include "record.h"
+
+/**
+* Slice of the frame text
+* Only valid while the frame is - views point straight into it.
+*/
+struct TextView{
+	const char* text;
+	size_t length;
+};
+
+/**
+* Callback for keys the parser does not recognise
+* @param key Key without its quotes
+* @param value Raw value text; strings keep their quotes, objects and arrays their brackets
+*/
+typedef void (*UnknownKeyHandler)(const TextView& key, const TextView& value, void* context);
+
+/**
+* Parse the JSON text of a frame into a record.
+* Frames are flat JSON objects with string or number values.
+*
+* Known keys are matched with a perfect hash and their numbers decoded in
+* place; nothing is copied or allocated. Unknown keys take the generic path:
+* the value is skipped (whatever its type) and reported to the handler.
+*
+* @param text Frame text, starting at the opening brace (not NUL-terminated)
+* @param length Length of the frame text
+* @param record Record to fill; the timestamp and port are left untouched
+* @param handler Optional callback for unknown keys
+* @param context Passed through to the handler
+* @return True if the frame was a well-formed object
+*/
+bool parseRecord(const char* text, size_t length, Record& record,
+	UnknownKeyHandler handler = NULL, void* context = NULL);
+
+#endif
@@ -0,0 +1,35 @@
+#include "record_sink.h"
+
+#include <inttypes.h>
+
+CsvSink::CsvSink(FILE* output) : _output(output){
+	fprintf(_output, "received_at,port,node,device");
+	for (int i = 0; i < COLUMN_COUNT; i++){
+		fprintf(_output, ",%s", COLUMN_NAMES[i]);
+	}
+	fprintf(_output, "\n");
+}
+
+void CsvSink::write(const ColumnBatch& batch){
+	for (size_t row = 0; row < batch.rows; row++){
+		fprintf(_output, "%" PRId64 ",%u,%s,%s", batch.time[row], batch.port,
+			batch.node[row].text, DEVICE_CLASS_NAMES[batch.device[row]]);
+
+		for (int column = 0; column < COLUMN_COUNT; column++){
+			float value = batch.columns[column][row];
+
+			if (value == value){
+				fprintf(_output, ",%g", value);
+			}
+			else{
+				fprintf(_output, ",");
+			}
+		}
+
+		fprintf(_output, "\n");
+	}
+}
+
+void CsvSink::flush(){
+	fflush(_output);
+}
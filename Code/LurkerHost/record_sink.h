@@ -0,0 +1,41 @@
+#ifndef LURKER_RECORD_SINK_H
+#define LURKER_RECORD_SINK_H
+
+#include <stdio.h>
+
+#include "schema.h"
+
+/**
+* Destination for normalised records
+* Sinks are only ever called from the pipeline's sink thread.
+*/
+class RecordSink{
+public:
+	virtual ~RecordSink(){}
+
+	/**
+	* Take a batch of records
+	*/
+	virtual void write(const ColumnBatch& batch) = 0;
+
+	/**
+	* Push out anything buffered; called when the pipeline goes idle and on shutdown
+	*/
+	virtual void flush(){}
+};
+
+/**
+* Print records as CSV lines
+*/
+class CsvSink : public RecordSink{
+public:
+	explicit CsvSink(FILE* output);
+
+	void write(const ColumnBatch& batch);
+	void flush();
+
+private:
+	FILE* _output;
+};
+
+#endif
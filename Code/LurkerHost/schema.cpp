@@ -0,0 +1,208 @@
+#include "schema.h"
+
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+
+const char* const COLUMN_NAMES[COLUMN_COUNT] = {
+	"airTemp",
+	"surfaceTemp",
+	"humidity",
+	"illuminance",
+	"noiseLevel",
+	"motion"
+};
+
+const uint16_t COLUMN_RESOLUTION[COLUMN_COUNT] = {
+	100,	// Sketches print two decimals
+	100,
+	100,
+	1,	// Whole lux
+	100,
+	1
+};
+
+const char* const DEVICE_CLASS_NAMES[DEVICE_CLASS_COUNT] = {
+	"lurker_nano",
+	"relayed_nano",
+	"office_lurker",
+	"legacy_coordinator",
+	"unknown"
+};
+
+const double NOISE_FULL_SCALE = 1023;	// 10-bit ADC counts
+
+//////////////////////////////////////////////////////////////////////////
+// Schema Tables
+
+static const DeviceRule DEVICE_RULES[] = {
+	// device					marker				version		numeric id	prefix
+	{ DEVICE_LURKER_NANO,			FIELD_VERSION,		0.9, 1.9,	false,		NULL },
+	{ DEVICE_OFFICE_LURKER,		FIELD_AIR_TEMP,		0, 0,		false,		NULL },
+	{ DEVICE_LEGACY_COORDINATOR,	FIELD_NOISE,		0, 0,		false,		NULL },
+	{ DEVICE_RELAYED_NANO,		FIELD_COUNT,		0, 0,		true,		"lurker" }
+};
+
+static const SchemaRule SCHEMA_RULES[] = {
+	// device					field					column					scale					offset
+	{ DEVICE_LURKER_NANO,			FIELD_TEMPERATURE,		COLUMN_AIR_TEMP,		1,						0 },
+	{ DEVICE_LURKER_NANO,			FIELD_HUMIDITY,			COLUMN_HUMIDITY,		1,						0 },
+	{ DEVICE_LURKER_NANO,			FIELD_ILLUMINANCE,		COLUMN_ILLUMINANCE,		1,						0 },
+	{ DEVICE_LURKER_NANO,			FIELD_MOTION,			COLUMN_MOTION,			1,						0 },
+
+	{ DEVICE_RELAYED_NANO,		FIELD_TEMPERATURE,		COLUMN_AIR_TEMP,		1,						0 },
+	{ DEVICE_RELAYED_NANO,		FIELD_HUMIDITY,			COLUMN_HUMIDITY,		1,						0 },
+	{ DEVICE_RELAYED_NANO,		FIELD_ILLUMINANCE,		COLUMN_ILLUMINANCE,		1,						0 },
+	{ DEVICE_RELAYED_NANO,		FIELD_MOTION,			COLUMN_MOTION,			1,						0 },
+
+	{ DEVICE_OFFICE_LURKER,		FIELD_AIR_TEMP,			COLUMN_AIR_TEMP,		1,						0 },
+	{ DEVICE_OFFICE_LURKER,		FIELD_SURFACE_TEMP,		COLUMN_SURFACE_TEMP,	1,						0 },
+	{ DEVICE_OFFICE_LURKER,		FIELD_HUMIDITY,			COLUMN_HUMIDITY,		1,						0 },
+	{ DEVICE_OFFICE_LURKER,		FIELD_ILLUMINANCE,		COLUMN_ILLUMINANCE,		1,						0 },
+	{ DEVICE_OFFICE_LURKER,		FIELD_NOISE_LEVEL,		COLUMN_NOISE_LEVEL,		100 / NOISE_FULL_SCALE,	0 },
+	{ DEVICE_OFFICE_LURKER,		FIELD_MOTION,			COLUMN_MOTION,			1,						0 },
+
+	// Legacy coordinator values were already divided down from shifted decimals
+	{ DEVICE_LEGACY_COORDINATOR,	FIELD_TEMPERATURE,		COLUMN_AIR_TEMP,		1,						0 },
+	{ DEVICE_LEGACY_COORDINATOR,	FIELD_HUMIDITY,			COLUMN_HUMIDITY,		1,						0 },
+	{ DEVICE_LEGACY_COORDINATOR,	FIELD_ILLUMINANCE,		COLUMN_ILLUMINANCE,		1,						0 },
+	{ DEVICE_LEGACY_COORDINATOR,	FIELD_NOISE,			COLUMN_NOISE_LEVEL,		100 / NOISE_FULL_SCALE,	0 },
+	{ DEVICE_LEGACY_COORDINATOR,	FIELD_MOTION,			COLUMN_MOTION,			1,						0 }
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// Batches
+
+void ColumnBatch::reset(size_t rowCount){
+	rows = rowCount;
+	time.resize(rowCount);
+	node.resize(rowCount);
+	device.resize(rowCount);
+
+	for (int i = 0; i < COLUMN_COUNT; i++){
+		columns[i].assign(rowCount, std::numeric_limits<float>::quiet_NaN());
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Normaliser
+
+SchemaNormalizer::SchemaNormalizer() :
+	_devices(DEVICE_RULES, DEVICE_RULES + sizeof(DEVICE_RULES) / sizeof(DEVICE_RULES[0])){
+	compile(SCHEMA_RULES, sizeof(SCHEMA_RULES) / sizeof(SCHEMA_RULES[0]));
+}
+
+SchemaNormalizer::SchemaNormalizer(const DeviceRule* devices, size_t deviceCount,
+	const SchemaRule* rules, size_t ruleCount) :
+	_devices(devices, devices + deviceCount){
+	compile(rules, ruleCount);
+}
+
+/**
+* Flatten the rule list into a (device, field) lookup table
+* so normalising a record is one table read per field.
+*/
+void SchemaNormalizer::compile(const SchemaRule* rules, size_t ruleCount){
+	for (int device = 0; device < DEVICE_CLASS_COUNT; device++){
+		for (int field = 0; field < FIELD_COUNT; field++){
+			_mappings[device][field].column = -1;
+		}
+	}
+
+	for (size_t i = 0; i < ruleCount; i++){
+		Mapping& mapping = _mappings[rules[i].device][rules[i].field];
+		mapping.column = rules[i].column;
+		mapping.scale = rules[i].scale;
+		mapping.offset = rules[i].offset;
+	}
+}
+
+/**
+* Check whether an ID is a bare unit number
+*/
+static bool isNumericId(const char* id){
+	if (*id == 0){
+		return false;
+	}
+
+	for (; *id; id++){
+		if (*id < '0' || *id > '9'){
+			return false;
+		}
+	}
+	return true;
+}
+
+DeviceClass SchemaNormalizer::classify(const Record& record) const{
+	bool numericId = isNumericId(record.id);
+
+	for (size_t i = 0; i < _devices.size(); i++){
+		const DeviceRule& rule = _devices[i];
+
+		if (rule.marker != FIELD_COUNT && !record.has(rule.marker)){
+			continue;
+		}
+
+		if (rule.numericId && !numericId){
+			continue;
+		}
+
+		if (rule.maxVersion > 0 && record.has(FIELD_VERSION)){
+			double version = record.values[FIELD_VERSION];
+			if (version < rule.minVersion || version > rule.maxVersion){
+				continue;
+			}
+		}
+
+		return rule.device;
+	}
+
+	return DEVICE_UNKNOWN;
+}
+
+void SchemaNormalizer::setNodeName(const Record& record, DeviceClass device, NodeName& name) const{
+	const char* prefix = NULL;
+
+	for (size_t i = 0; i < _devices.size(); i++){
+		if (_devices[i].device == device){
+			prefix = _devices[i].idPrefix;
+			break;
+		}
+	}
+
+	if (prefix != NULL && isNumericId(record.id)){
+		snprintf(name.text, sizeof(name.text), "%s%s", prefix, record.id);
+	}
+	else{
+		memcpy(name.text, record.id, sizeof(name.text));
+	}
+}
+
+void SchemaNormalizer::normalize(const RecordBatch& records, ColumnBatch& columns) const{
+	size_t count = records.records.size();
+
+	columns.port = records.port;
+	columns.reset(count);
+
+	for (size_t row = 0; row < count; row++){
+		const Record& record = records.records[row];
+		DeviceClass device = classify(record);
+		const Mapping* mappings = _mappings[device];
+
+		columns.time[row] = record.receivedAt;
+		columns.device[row] = device;
+		setNodeName(record, device, columns.node[row]);
+
+		// Walk the set bits of the field mask
+		for (unsigned fields = record.fields; fields != 0; fields &= fields - 1){
+			int field = __builtin_ctz(fields);
+			const Mapping& mapping = mappings[field];
+
+			if (mapping.column >= 0){
+				columns.columns[mapping.column][row] = float(record.values[field] * mapping.scale + mapping.offset);
+			}
+		}
+	}
+}
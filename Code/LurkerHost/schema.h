@@ -0,0 +1,136 @@
+#ifndef LURKER_SCHEMA_H
+#define LURKER_SCHEMA_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "record.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Schema Normalisation
+//
+// The Lurker variants report the same quantities under different keys and
+// scales. Records are classified by device, then every field is mapped to a
+// canonical column with a linear unit conversion, all driven by the tables
+// in schema.cpp. Adding a device variant means adding table rows, not code.
+//
+// Canonical columns use the names from Thingspeak.py.
+//////////////////////////////////////////////////////////////////////////
+
+enum Column{
+	COLUMN_AIR_TEMP,	// deg C
+	COLUMN_SURFACE_TEMP,	// deg C
+	COLUMN_HUMIDITY,	// %RH
+	COLUMN_ILLUMINANCE,	// lux
+	COLUMN_NOISE_LEVEL,	// % of microphone full scale
+	COLUMN_MOTION,	// 1 if motion was detected
+	COLUMN_COUNT
+};
+
+extern const char* const COLUMN_NAMES[COLUMN_COUNT];
+
+// Fixed-point multiplier each column is stored at, e.g. 100 for 0.01 steps
+extern const uint16_t COLUMN_RESOLUTION[COLUMN_COUNT];
+
+enum DeviceClass{
+	DEVICE_LURKER_NANO,	// Local readings from a LurkerNano (coordinator or node on USB)
+	DEVICE_RELAYED_NANO,	// LurkerNano node readings relayed by the coordinator
+	DEVICE_OFFICE_LURKER,
+	DEVICE_LEGACY_COORDINATOR,
+	DEVICE_UNKNOWN,
+	DEVICE_CLASS_COUNT
+};
+
+extern const char* const DEVICE_CLASS_NAMES[DEVICE_CLASS_COUNT];
+
+/**
+* How to recognise a device class
+* Rules are tried in order; the first match wins.
+*/
+struct DeviceRule{
+	DeviceClass device;
+	Field marker;	// Field that must be present, or FIELD_COUNT for none
+	double minVersion;	// Inclusive version range; only checked if the record has a version
+	double maxVersion;
+	bool numericId;	// Only match records whose ID is a bare unit number
+	const char* idPrefix;	// Prepended to bare unit numbers to get the node name, or NULL
+};
+
+/**
+* Mapping of one device field to a canonical column
+*	column = field * scale + offset
+*/
+struct SchemaRule{
+	DeviceClass device;
+	Field field;
+	Column column;
+	double scale;
+	double offset;
+};
+
+/**
+* Fixed-size node name
+*/
+struct NodeName{
+	char text[MAX_ID_LENGTH];
+};
+
+/**
+* Normalised batch in column-major layout
+* Missing values are NaN.
+*/
+struct ColumnBatch{
+	uint8_t port;
+	size_t rows;
+	std::vector<int64_t> time;	// Host wall-clock time in ms
+	std::vector<NodeName> node;
+	std::vector<uint8_t> device;
+	std::vector<float> columns[COLUMN_COUNT];
+
+	ColumnBatch() : port(0), rows(0){}
+
+	/**
+	* Size every column for the given number of rows, with all values missing
+	*/
+	void reset(size_t rowCount);
+};
+
+class SchemaNormalizer{
+public:
+	/**
+	* Build a normaliser from the built-in device and schema tables
+	*/
+	SchemaNormalizer();
+
+	/**
+	* Build a normaliser from custom tables
+	*/
+	SchemaNormalizer(const DeviceRule* devices, size_t deviceCount,
+		const SchemaRule* rules, size_t ruleCount);
+
+	/**
+	* Work out which device a record came from
+	*/
+	DeviceClass classify(const Record& record) const;
+
+	/**
+	* Normalise a whole batch of records into columns
+	* Safe to call from several threads at once.
+	*/
+	void normalize(const RecordBatch& records, ColumnBatch& columns) const;
+
+private:
+	struct Mapping{
+		int column;	// -1 if the field is not mapped for the device
+		double scale;
+		double offset;
+	};
+
+	void compile(const SchemaRule* rules, size_t ruleCount);
+	void setNodeName(const Record& record, DeviceClass device, NodeName& name) const;
+
+	std::vector<DeviceRule> _devices;
+	Mapping _mappings[DEVICE_CLASS_COUNT][FIELD_COUNT];
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "serial_port.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+* Convert a numeric baud rate to its termios constant
+*/
+static speed_t toSpeed(long baud){
+	switch (baud){
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	default: return 0;
+	}
+}
+
+SerialPort::SerialPort() : _fd(-1){
+}
+
+SerialPort::~SerialPort(){
+	close();
+}
+
+bool SerialPort::open(const char* path, long baud){
+	close();
+
+	_fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (_fd < 0){
+		return false;
+	}
+
+	// Raw mode - no echo, no line editing, no CR/LF translation
+	struct termios options;
+	if (tcgetattr(_fd, &options) == 0){
+		cfmakeraw(&options);
+		options.c_cflag |= (CLOCAL | CREAD);
+		options.c_cc[VMIN] = 0;
+		options.c_cc[VTIME] = 0;
+
+		speed_t speed = toSpeed(baud);
+		if (speed != 0){
+			cfsetispeed(&options, speed);
+			cfsetospeed(&options, speed);
+		}
+
+		tcsetattr(_fd, TCSANOW, &options);
+	}
+
+	return true;
+}
+
+void SerialPort::close(){
+	if (_fd >= 0){
+		::close(_fd);
+		_fd = -1;
+	}
+}
+
+ssize_t SerialPort::read(char* buffer, size_t length, int timeout){
+	struct pollfd request;
+	request.fd = _fd;
+	request.events = POLLIN;
+	request.revents = 0;
+
+	int ready = poll(&request, 1, timeout);
+	if (ready < 0){
+		return errno == EINTR ? 0 : -1;
+	}
+
+	if (ready == 0){
+		return 0;
+	}
+
+	ssize_t count = ::read(_fd, buffer, length);
+	if (count < 0){
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	}
+
+	// Readable with nothing to read - the other end hung up
+	if (count == 0){
+		return -1;
+	}
+
+	return count;
+}
+
+bool SerialPort::write(const char* buffer, size_t length){
+	while (length > 0){
+		ssize_t count = ::write(_fd, buffer, length);
+
+		if (count < 0){
+			if (errno == EAGAIN || errno == EINTR){
+				struct pollfd request;
+				request.fd = _fd;
+				request.events = POLLOUT;
+				poll(&request, 1, 100);
+				continue;
+			}
+			return false;
+		}
+
+		buffer += count;
+		length -= count;
+	}
+
+	return true;
+}
@@ -0,0 +1,53 @@
+#ifndef LURKER_SERIAL_PORT_H
+#define LURKER_SERIAL_PORT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+* Raw, non-blocking serial port
+* Works with real USB serial adapters as well as pseudo-terminals.
+*/
+class SerialPort{
+public:
+	SerialPort();
+	~SerialPort();
+
+	/**
+	* Open the port in raw 8N1 mode
+	* @param path Device path, e.g. /dev/ttyUSB0 or /dev/pts/3
+	* @param baud Baud rate; ignored if not a standard rate
+	* @return False if the device could not be opened
+	*/
+	bool open(const char* path, long baud);
+	void close();
+
+	/**
+	* Wait for data and read whatever is available
+	* @param timeout Maximum wait in ms
+	* @return Number of bytes read, 0 on timeout, -1 on error or hang-up
+	*/
+	ssize_t read(char* buffer, size_t length, int timeout);
+
+	/**
+	* Write the whole buffer, blocking until done
+	* @return False on error
+	*/
+	bool write(const char* buffer, size_t length);
+
+	bool isOpen() const{
+		return _fd >= 0;
+	}
+
+	int fd() const{
+		return _fd;
+	}
+
+private:
+	SerialPort(const SerialPort&);
+	SerialPort& operator=(const SerialPort&);
+
+	int _fd;
+};
+
+#endif
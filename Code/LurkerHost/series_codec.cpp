@@ -0,0 +1,388 @@
+#include "series_codec.h"
+
+#include <math.h>
+#include <string.h>
+
+const int MAX_SAMPLE_BITS = (4 + 64) + (4 + 5 + 5 + 32);	// Worst case for one sample
+
+// Bits in each fixed-point delta code, by layout
+const int DELTA_BITS[2][3] = {
+	{ 6, 12, 20 },	// VALUES_FIXED
+	{ 4, 8, 20 }	// VALUES_GRID
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static inline uint64_t zigzag(int64_t value){
+	return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value){
+	return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+static inline uint32_t floatBits(float value){
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline float bitsToFloat(uint32_t bits){
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static inline int64_t greatestDivisor(int64_t a, int64_t b){
+	while (b != 0){
+		int64_t remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+/**
+* Whether a value fits a zigzag code of the given width
+*/
+static inline bool fits(int64_t value, int bits){
+	int64_t limit = int64_t(1) << (bits - 1);
+	return value > -limit && value < limit;
+}
+
+/**
+* Convert a fixed-point value back to a float, exactly as the decoder does
+*/
+static inline float fixedToFloat(int64_t fixed, uint16_t scale){
+	return float(double(fixed) / scale);
+}
+
+/**
+* MSB-first bit reader
+* Loads 8 bytes at a time; the encoder leaves CODEC_SLACK_BYTES at the end
+* of every payload, and the decoder checks for overrun after every field,
+* so loads stay inside the block even for corrupt data.
+*/
+class BitReader{
+public:
+	BitReader(const uint8_t* data, uint32_t lengthBits) :
+		_data(data), _position(0), _lengthBits(lengthBits){}
+
+	/**
+	* Look at up to 57 bits without consuming them
+	*/
+	inline uint64_t peek(int count) const{
+		const uint8_t* p = _data + (_position >> 3);
+		uint64_t word = (uint64_t(p[0]) << 56) | (uint64_t(p[1]) << 48) | (uint64_t(p[2]) << 40) |
+			(uint64_t(p[3]) << 32) | (uint64_t(p[4]) << 24) | (uint64_t(p[5]) << 16) |
+			(uint64_t(p[6]) << 8) | uint64_t(p[7]);
+
+		return (word << (_position & 7)) >> (64 - count);
+	}
+
+	/**
+	* Read up to 57 bits
+	*/
+	inline uint64_t read(int count){
+		uint64_t bits = peek(count);
+		_position += count;
+		return bits;
+	}
+
+	inline uint64_t read64(){
+		uint64_t high = read(32);
+		return (high << 32) | read(32);
+	}
+
+	/**
+	* Read a control code - up to four leading 1 bits, terminated by a 0
+	* @return Number of 1 bits
+	*/
+	inline int readControl(){
+		static const uint8_t LEADING_ONES[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 4 };
+		int ones = LEADING_ONES[peek(4)];
+		_position += ones < 4 ? ones + 1 : 4;
+		return ones;
+	}
+
+	inline bool overrun() const{
+		return _position > _lengthBits;
+	}
+
+private:
+	const uint8_t* _data;
+	uint32_t _position;
+	uint32_t _lengthBits;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// Encoder
+
+BlockEncoder::BlockEncoder() :
+	_payload(NULL), _capacityBits(0), _bitPosition(0), _scale(1), _layout(VALUES_GRID),
+	_previousTime(0), _previousDelta(0), _previousValue(0), _previousFixed(0), _step(1){
+}
+
+void BlockEncoder::begin(uint8_t* payload, uint32_t length, int64_t firstTime, uint16_t scale,
+	ValueLayout layout){
+	_payload = payload;
+	_capacityBits = (length - CODEC_SLACK_BYTES) * 8;
+	_bitPosition = 0;
+	_scale = scale > 0 ? scale : 1;
+	_layout = layout;
+	_step = layout == VALUES_GRID ? _scale : 1;
+
+	_previousTime = firstTime;
+	_previousDelta = 0;
+	_previousValue = 0;
+	_previousFixed = 0;
+}
+
+bool BlockEncoder::resume(uint8_t* payload, uint32_t length, int64_t firstTime, uint16_t scale, uint32_t count,
+	ValueLayout layout){
+	begin(payload, length, firstTime, scale, layout);
+
+	if (count == 0){
+		return true;
+	}
+
+	// Replay the block to recover the encoder state
+	std::vector<int64_t> times(count);
+	std::vector<float> values(count);
+
+	if (!decodeBlock(payload, length, firstTime, scale, count, &times[0], &values[0], layout)){
+		return false;
+	}
+
+	BlockEncoder replay;
+	std::vector<uint8_t> scratch(length, 0);
+	replay.begin(&scratch[0], length, firstTime, scale, layout);
+
+	for (uint32_t i = 0; i < count; i++){
+		replay.append(times[i], values[i]);
+	}
+
+	_bitPosition = replay._bitPosition;
+	_previousTime = replay._previousTime;
+	_previousDelta = replay._previousDelta;
+	_previousValue = replay._previousValue;
+	_previousFixed = replay._previousFixed;
+	_step = replay._step;
+	return true;
+}
+
+bool BlockEncoder::append(int64_t time, float value){
+	if (_bitPosition + MAX_SAMPLE_BITS > _capacityBits){
+		return false;
+	}
+
+	encodeTime(time);
+	encodeValue(value);
+	return true;
+}
+
+/**
+* Append bits MSB-first, OR-ing into the (zeroed) payload
+*/
+void BlockEncoder::writeBits(uint64_t bits, int count){
+	while (count > 0){
+		int free = 8 - (_bitPosition & 7);
+		int take = count < free ? count : free;
+		uint8_t chunk = uint8_t((bits >> (count - take)) & ((1u << take) - 1));
+
+		_payload[_bitPosition >> 3] |= uint8_t(chunk << (free - take));
+		_bitPosition += take;
+		count -= take;
+	}
+}
+
+void BlockEncoder::encodeTime(int64_t time){
+	int64_t delta = time - _previousTime;
+	int64_t dod = delta - _previousDelta;
+
+	if (dod == 0){
+		writeBits(0, 1);
+	}
+	else if (dod > -64 && dod < 64){
+		writeBits(0x2, 2);
+		writeBits(zigzag(dod), 7);
+	}
+	else if (dod > -512 && dod < 512){
+		writeBits(0x6, 3);
+		writeBits(zigzag(dod), 10);
+	}
+	else if (dod > -32768 && dod < 32768){
+		writeBits(0xE, 4);
+		writeBits(zigzag(dod), 16);
+	}
+	else{
+		writeBits(0xF, 4);
+		writeBits(uint64_t(dod) >> 32, 32);
+		writeBits(uint64_t(dod) & 0xFFFFFFFF, 32);
+	}
+
+	_previousTime = time;
+	_previousDelta = delta;
+}
+
+void BlockEncoder::encodeValue(float value){
+	uint32_t bits = floatBits(value);
+
+	if (bits == floatBits(_previousValue)){
+		writeBits(0, 1);
+		return;
+	}
+
+	// Fixed-point path, only if it round-trips exactly
+	double scaled = double(value) * _scale;
+	if (fabs(scaled) < 1e15){
+		int64_t fixed = llround(scaled);
+		int64_t delta = fixed - _previousFixed;
+
+		if (floatBits(fixedToFloat(fixed, _scale)) == bits){
+			const int* widths = DELTA_BITS[_layout];
+			int64_t steps = delta / _step;
+			bool onGrid = steps * _step == delta;
+			bool encoded = true;
+
+			if (onGrid && fits(steps, widths[0])){
+				writeBits(0x2, 2);
+				writeBits(zigzag(steps), widths[0]);
+			}
+			else if (onGrid && fits(steps, widths[1])){
+				writeBits(0x6, 3);
+				writeBits(zigzag(steps), widths[1]);
+			}
+			else if (fits(delta, widths[2])){
+				writeBits(0xE, 4);
+				writeBits(zigzag(delta), widths[2]);
+
+				if (_layout == VALUES_GRID && delta != 0){
+					_step = greatestDivisor(_step, delta < 0 ? -delta : delta);
+				}
+			}
+			else{
+				encoded = false;
+			}
+
+			if (encoded){
+				_previousFixed = fixed;
+				_previousValue = value;
+				return;
+			}
+		}
+	}
+
+	// XOR path
+	uint32_t xored = bits ^ floatBits(_previousValue);
+	int leading = __builtin_clz(xored);
+	int trailing = __builtin_ctz(xored);
+	if (leading > 31){
+		leading = 31;
+	}
+	int length = 32 - leading - trailing;
+
+	writeBits(0xF, 4);
+	writeBits(leading, 5);
+	writeBits(length - 1, 5);
+	writeBits(xored >> trailing, length);
+
+	_previousValue = value;
+	_previousFixed = isfinite(scaled) && fabs(scaled) < 1e15 ? llround(scaled) : 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Decoder
+
+bool decodeBlock(const uint8_t* payload, uint32_t length, int64_t firstTime, uint16_t scale,
+	uint32_t count, int64_t* times, float* values, ValueLayout layout){
+
+	BitReader reader(payload, (length - CODEC_SLACK_BYTES) * 8);
+	int64_t time = firstTime;
+	int64_t delta = 0;
+	uint32_t valueBits = 0;
+	int64_t fixed = 0;
+
+	if (scale == 0){
+		scale = 1;
+	}
+
+	const int* widths = DELTA_BITS[layout];
+	bool grid = layout == VALUES_GRID;
+	int64_t step = grid ? scale : 1;
+
+	for (uint32_t i = 0; i < count; i++){
+		// Timestamp
+		switch (reader.readControl()){
+		case 0:
+			break;
+		case 1:
+			delta += unzigzag(reader.read(7));
+			break;
+		case 2:
+			delta += unzigzag(reader.read(10));
+			break;
+		case 3:
+			delta += unzigzag(reader.read(16));
+			break;
+		default:
+			delta += int64_t(reader.read64());
+			break;
+		}
+		time += delta;
+		times[i] = time;
+
+		if (reader.overrun()){
+			return false;
+		}
+
+		// Value
+		switch (reader.readControl()){
+		case 0:
+			break;
+		case 1:
+			fixed += unzigzag(reader.read(widths[0])) * step;
+			valueBits = floatBits(fixedToFloat(fixed, scale));
+			break;
+		case 2:
+			fixed += unzigzag(reader.read(widths[1])) * step;
+			valueBits = floatBits(fixedToFloat(fixed, scale));
+			break;
+		case 3:{
+			int64_t change = unzigzag(reader.read(widths[2]));
+			fixed += change;
+			valueBits = floatBits(fixedToFloat(fixed, scale));
+
+			if (grid && change != 0){
+				step = greatestDivisor(step, change < 0 ? -change : change);
+			}
+			break;
+		}
+		default:{
+			int leading = int(reader.read(5));
+			int significant = int(reader.read(5)) + 1;
+			int trailing = 32 - leading - significant;
+
+			if (trailing < 0){
+				return false;
+			}
+
+			valueBits ^= uint32_t(reader.read(significant)) << trailing;
+
+			double scaled = double(bitsToFloat(valueBits)) * scale;
+			fixed = isfinite(scaled) && fabs(scaled) < 1e15 ? llround(scaled) : 0;
+			break;
+		}
+		}
+		values[i] = bitsToFloat(valueBits);
+
+		if (reader.overrun()){
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,114 @@
+#ifndef LURKER_SERIES_CODEC_H
+#define LURKER_SERIES_CODEC_H
+
+#include <stdint.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// Series Block Codec
+//
+// Gorilla-style compression for one store block.
+//
+// Timestamps - delta-of-delta against the previous sample:
+//	0							dod == 0
+//	10   + 7 bits				|dod| < 64
+//	110  + 10 bits				|dod| < 512
+//	1110 + 16 bits				|dod| < 32768
+//	1111 + 64 bits				anything else
+//
+// Values - fixed-point delta at the column's resolution, XOR fallback.
+// Grid blocks count their short deltas in the block's step, the grid the
+// values have been seen on so far:
+//	0							same value as the previous sample
+//	10   + 4 bits				delta in steps, |delta| < 8
+//	110  + 8 bits				|delta| < 128
+//	1110 + 20 bits				delta at the column's resolution, |delta| < 524288
+//	1111 + 5 + 5 + n bits		XOR with the previous float (leading zeros, length - 1, bits)
+//
+// The step starts at one whole unit, and a 20-bit delta that's off the
+// grid brings it down to the greatest common divisor of the two. Sensors
+// coarser than the column's resolution (0.1 % humidity, 1/16 C
+// temperature) then cost a few bits a sample less. Fixed blocks, from
+// stores written before grid blocks, keep the step at the resolution and
+// use 6 and 12 bits for the short deltas.
+//
+// Deltas are zigzag encoded. A value only takes the fixed-point path if it
+// decodes back to exactly the same float, so the round trip is lossless.
+//
+// Bits are appended MSB-first and never rewritten, so a block can be
+// flushed while partly full and extended in place later.
+//////////////////////////////////////////////////////////////////////////
+
+const uint32_t CODEC_SLACK_BYTES = 16;	// Unused tail so the reader's 8-byte loads stay inside the payload
+
+enum ValueLayout{
+	VALUES_FIXED,	// Short deltas at the column's resolution
+	VALUES_GRID	// Short deltas in the block's step
+};
+
+/**
+* Appends samples to a compressed block payload
+*/
+class BlockEncoder{
+public:
+	BlockEncoder();
+
+	/**
+	* Start a new, empty payload
+	* @param payload Zeroed payload buffer
+	* @param length Payload size in bytes
+	* @param firstTime Time of the first sample, as stored in the block header
+	* @param scale Fixed-point multiplier, e.g. 100 for 0.01 resolution
+	*/
+	void begin(uint8_t* payload, uint32_t length, int64_t firstTime, uint16_t scale,
+		ValueLayout layout = VALUES_GRID);
+
+	/**
+	* Continue a payload written earlier, e.g. after a restart
+	* @return False if the payload does not decode
+	*/
+	bool resume(uint8_t* payload, uint32_t length, int64_t firstTime, uint16_t scale, uint32_t count,
+		ValueLayout layout = VALUES_GRID);
+
+	/**
+	* Add a sample
+	* @return False if the block has no room left for it
+	*/
+	bool append(int64_t time, float value);
+
+	/**
+	* Payload bytes in use
+	*/
+	uint32_t bytesUsed() const{
+		return (_bitPosition + 7) / 8;
+	}
+
+private:
+	void writeBits(uint64_t bits, int count);
+	void encodeTime(int64_t time);
+	void encodeValue(float value);
+
+	uint8_t* _payload;
+	uint32_t _capacityBits;
+	uint32_t _bitPosition;
+	uint16_t _scale;
+	ValueLayout _layout;
+
+	int64_t _previousTime;
+	int64_t _previousDelta;
+	float _previousValue;
+	int64_t _previousFixed;
+	int64_t _step;	// Grid of the fixed-point values so far
+};
+
+/**
+* Decode a whole compressed payload
+* @param count Number of samples in the block
+* @param times Receives count timestamps
+* @param values Receives count values
+* @return False if the payload is corrupt
+*/
+bool decodeBlock(const uint8_t* payload, uint32_t length, int64_t firstTime, uint16_t scale,
+	uint32_t count, int64_t* times, float* values, ValueLayout layout = VALUES_GRID);
+
+#endif
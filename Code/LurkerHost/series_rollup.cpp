@@ -0,0 +1,255 @@
+#include "series_rollup.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const int64_t ROLLUP_PERIODS[ROLLUP_TIER_COUNT] = {
+	60 * 1000LL,
+	60 * 60 * 1000LL,
+	24 * 60 * 60 * 1000LL
+};
+
+const char* const ROLLUP_SUFFIXES[ROLLUP_TIER_COUNT] = {
+	".1m",
+	".1h",
+	".1d"
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Points
+
+void RollupPoint::reset(int64_t bucketStart, float value){
+	start = bucketStart;
+	sum = value;
+	min = value;
+	max = value;
+	count = 1;
+	reserved = 0;
+}
+
+void RollupPoint::add(float value){
+	sum += value;
+	min = std::min(min, value);
+	max = std::max(max, value);
+	count++;
+}
+
+void RollupPoint::merge(const RollupPoint& other){
+	sum += other.sum;
+	min = std::min(min, other.min);
+	max = std::max(max, other.max);
+	count += other.count;
+}
+
+int coarsestTier(int64_t resolution){
+	for (int tier = ROLLUP_TIER_COUNT - 1; tier >= 0; tier--){
+		if (resolution >= ROLLUP_PERIODS[tier] && resolution % ROLLUP_PERIODS[tier] == 0){
+			return tier;
+		}
+	}
+
+	return -1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Writer
+
+RollupWriter::RollupWriter(){
+	for (int i = 0; i < ROLLUP_TIER_COUNT; i++){
+		_tiers[i].fd = -1;
+		_tiers[i].position = 0;
+		_tiers[i].open.count = 0;
+		_tiers[i].dirty = false;
+	}
+}
+
+RollupWriter::~RollupWriter(){
+	close();
+}
+
+bool RollupWriter::open(const std::string& basePath){
+	close();
+
+	for (int i = 0; i < ROLLUP_TIER_COUNT; i++){
+		Tier& tier = _tiers[i];
+
+		tier.fd = ::open((basePath + ROLLUP_SUFFIXES[i]).c_str(), O_RDWR | O_CREAT, 0644);
+		if (tier.fd < 0){
+			close();
+			return false;
+		}
+
+		// A torn last record is dropped; the bucket is rebuilt by later samples
+		struct stat info;
+		uint64_t points = fstat(tier.fd, &info) == 0 ? info.st_size / sizeof(RollupPoint) : 0;
+
+		tier.position = 0;
+		tier.open.count = 0;
+		tier.dirty = false;
+
+		if (points > 0 &&
+			pread(tier.fd, &tier.open, sizeof(RollupPoint), (points - 1) * sizeof(RollupPoint)) == sizeof(RollupPoint)){
+			tier.position = points - 1;
+		}
+	}
+
+	return true;
+}
+
+void RollupWriter::close(){
+	for (int i = 0; i < ROLLUP_TIER_COUNT; i++){
+		if (_tiers[i].fd >= 0){
+			writeOpen(_tiers[i]);
+			::close(_tiers[i].fd);
+		}
+
+		_tiers[i].fd = -1;
+	}
+}
+
+bool RollupWriter::empty() const{
+	for (int i = 0; i < ROLLUP_TIER_COUNT; i++){
+		if (_tiers[i].open.count > 0){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+* Write the open bucket of a tier in place
+*/
+bool RollupWriter::writeOpen(Tier& tier){
+	if (!tier.dirty){
+		return true;
+	}
+
+	if (pwrite(tier.fd, &tier.open, sizeof(RollupPoint), tier.position * sizeof(RollupPoint)) != sizeof(RollupPoint)){
+		return false;
+	}
+
+	tier.dirty = false;
+	return true;
+}
+
+void RollupWriter::append(int64_t time, float value){
+	for (int i = 0; i < ROLLUP_TIER_COUNT; i++){
+		Tier& tier = _tiers[i];
+
+		if (tier.fd < 0){
+			continue;
+		}
+
+		int64_t start = bucketStart(time, ROLLUP_PERIODS[i]);
+
+		if (tier.open.count > 0 && start == tier.open.start){
+			tier.open.add(value);
+		}
+		else{
+			// Close the finished bucket and open the next one after it
+			if (tier.open.count > 0){
+				writeOpen(tier);
+				tier.position++;
+			}
+
+			tier.open.reset(start, value);
+		}
+
+		tier.dirty = true;
+	}
+}
+
+bool RollupWriter::flush(){
+	bool written = true;
+
+	for (int i = 0; i < ROLLUP_TIER_COUNT; i++){
+		if (_tiers[i].fd >= 0){
+			written &= writeOpen(_tiers[i]);
+		}
+	}
+
+	return written;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Reader
+
+RollupReader::RollupReader() : _points(NULL), _count(0), _mappedSize(0){
+}
+
+RollupReader::~RollupReader(){
+	close();
+}
+
+bool RollupReader::open(const std::string& basePath, int tier){
+	close();
+
+	if (tier < 0 || tier >= ROLLUP_TIER_COUNT){
+		return false;
+	}
+
+	int fd = ::open((basePath + ROLLUP_SUFFIXES[tier]).c_str(), O_RDONLY);
+	if (fd < 0){
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0){
+		::close(fd);
+		return false;
+	}
+
+	_count = info.st_size / sizeof(RollupPoint);
+
+	if (_count > 0){
+		_mappedSize = info.st_size;
+		void* data = mmap(NULL, _mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+		_points = data == MAP_FAILED ? NULL : static_cast<const RollupPoint*>(data);
+	}
+
+	::close(fd);
+
+	if (_count > 0 && _points == NULL){
+		_count = 0;
+		_mappedSize = 0;
+		return false;
+	}
+
+	return true;
+}
+
+void RollupReader::close(){
+	if (_points != NULL){
+		munmap(const_cast<RollupPoint*>(_points), _mappedSize);
+	}
+
+	_points = NULL;
+	_count = 0;
+	_mappedSize = 0;
+}
+
+size_t RollupReader::scan(int64_t from, int64_t to, const RollupVisitor& visitor) const{
+	const RollupPoint* end = _points + _count;
+	const RollupPoint* point = std::lower_bound(_points, end, from, [](const RollupPoint& p, int64_t time){
+		return p.start < time;
+	});
+	size_t visited = 0;
+
+	for (; point != end && point->start <= to; point++){
+		// Skip a half-written open bucket
+		if (point->count == 0){
+			continue;
+		}
+
+		visitor(*point);
+		visited++;
+	}
+
+	return visited;
+}
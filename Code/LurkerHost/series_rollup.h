@@ -0,0 +1,155 @@
+#ifndef LURKER_SERIES_ROLLUP_H
+#define LURKER_SERIES_ROLLUP_H
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// Series Rollups
+//
+// Every series keeps min/max/mean/count summaries at three resolutions
+// next to its raw blocks:
+//	<root>/<node>/<column>.1m	- one point per minute with any samples
+//	<root>/<node>/<column>.1h
+//	<root>/<node>/<column>.1d
+//
+// Points are fixed-size records sorted by bucket start, so a tier file is
+// a plain array that is memory-mapped and binary searched. Buckets are
+// aligned to the epoch (UTC). The open bucket of each tier is the last
+// record and is rewritten in place until a sample lands in a later bucket,
+// the same way the last raw block is.
+//
+// Rollups are updated as samples are appended and are never expired, so
+// they outlive the raw retention window.
+//////////////////////////////////////////////////////////////////////////
+
+enum RollupTier{
+	ROLLUP_MINUTE,
+	ROLLUP_HOUR,
+	ROLLUP_DAY,
+	ROLLUP_TIER_COUNT
+};
+
+extern const int64_t ROLLUP_PERIODS[ROLLUP_TIER_COUNT];	// Bucket length in ms
+extern const char* const ROLLUP_SUFFIXES[ROLLUP_TIER_COUNT];	// File extension of each tier
+
+/**
+* Summary of the samples in one bucket
+* The sum is kept rather than the mean so buckets can be merged exactly.
+*/
+struct RollupPoint{
+	int64_t start;	// Bucket start in ms since the epoch
+	double sum;
+	float min;
+	float max;
+	uint32_t count;
+	uint32_t reserved;
+
+	double mean() const{
+		return count > 0 ? sum / count : 0;
+	}
+
+	/**
+	* Start a bucket holding a single sample
+	*/
+	void reset(int64_t bucketStart, float value);
+
+	void add(float value);
+	void merge(const RollupPoint& other);
+};
+
+typedef std::function<void(const RollupPoint& point)> RollupVisitor;
+
+/**
+* Start of the bucket a time falls in
+*/
+inline int64_t bucketStart(int64_t time, int64_t period){
+	int64_t offset = time % period;
+	return offset < 0 ? time - offset - period : time - offset;
+}
+
+/**
+* Pick the coarsest tier whose buckets tile the requested resolution
+* @return Tier, or -1 if only raw samples are fine enough
+*/
+int coarsestTier(int64_t resolution);
+
+/**
+* Keeps the rollup tiers of one series up to date
+*/
+class RollupWriter{
+public:
+	RollupWriter();
+	~RollupWriter();
+
+	/**
+	* Open the tier files of a series, creating them if needed
+	* The last point of each tier becomes the open bucket again.
+	*/
+	bool open(const std::string& basePath);
+	void close();
+
+	/**
+	* True if no tier has any points yet, e.g. for a store written before rollups existed
+	*/
+	bool empty() const;
+
+	/**
+	* Add a sample; samples must arrive in time order
+	*/
+	void append(int64_t time, float value);
+
+	/**
+	* Write out the open buckets
+	*/
+	bool flush();
+
+private:
+	RollupWriter(const RollupWriter&);
+	RollupWriter& operator=(const RollupWriter&);
+
+	struct Tier{
+		int fd;
+		uint64_t position;	// Record number of the open bucket
+		RollupPoint open;
+		bool dirty;
+	};
+
+	bool writeOpen(Tier& tier);
+
+	Tier _tiers[ROLLUP_TIER_COUNT];
+};
+
+/**
+* Reads one tier of a series through a memory map
+*/
+class RollupReader{
+public:
+	RollupReader();
+	~RollupReader();
+
+	bool open(const std::string& basePath, int tier);
+	void close();
+
+	size_t size() const{
+		return _count;
+	}
+
+	/**
+	* Call the visitor for every bucket starting in [from, to]
+	* @return Number of points visited
+	*/
+	size_t scan(int64_t from, int64_t to, const RollupVisitor& visitor) const;
+
+private:
+	RollupReader(const RollupReader&);
+	RollupReader& operator=(const RollupReader&);
+
+	const RollupPoint* _points;
+	size_t _count;
+	size_t _mappedSize;
+};
+
+#endif
@@ -0,0 +1,911 @@
+#include "series_store.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ingest_pipeline.h"
+
+static const char SERIES_MAGIC[8] = { 'L', 'K', 'S', 'E', 'R', 'I', 'E', 'S' };
+
+//////////////////////////////////////////////////////////////////////////
+// Blocks
+
+static inline BlockHeader* blockHeader(uint8_t* block){
+	return reinterpret_cast<BlockHeader*>(block);
+}
+
+static inline const BlockHeader* blockHeader(const uint8_t* block){
+	return reinterpret_cast<const BlockHeader*>(block);
+}
+
+static inline const int64_t* rawTimes(const uint8_t* block){
+	return reinterpret_cast<const int64_t*>(block + sizeof(BlockHeader));
+}
+
+static inline const float* rawValues(const uint8_t* block){
+	return reinterpret_cast<const float*>(block + sizeof(BlockHeader) + RAW_BLOCK_CAPACITY * sizeof(int64_t));
+}
+
+/**
+* Value layout of a compressed block
+*/
+static inline ValueLayout valueLayout(uint16_t encoding){
+	return encoding == ENCODING_GORILLA ? VALUES_FIXED : VALUES_GRID;
+}
+
+/**
+* Write the whole buffer at an offset
+*/
+static bool writeAt(int fd, const void* data, size_t length, off_t offset){
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+
+	while (length > 0){
+		ssize_t count = pwrite(fd, p, length, offset);
+
+		if (count < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return false;
+		}
+
+		p += count;
+		offset += count;
+		length -= count;
+	}
+
+	return true;
+}
+
+static off_t fileSize(int fd){
+	struct stat info;
+	return fstat(fd, &info) == 0 ? info.st_size : -1;
+}
+
+/**
+* Rewrite the index from the block headers
+*/
+static bool rebuildIndex(int dataFd, int indexFd, uint32_t blocks){
+	std::vector<BlockIndexEntry> entries(blocks);
+
+	for (uint32_t block = 0; block < blocks; block++){
+		BlockHeader header;
+		if (pread(dataFd, &header, sizeof(header), FILE_HEADER_SIZE + off_t(block) * BLOCK_SIZE) != sizeof(header)){
+			return false;
+		}
+
+		entries[block].firstTime = header.firstTime;
+		entries[block].lastTime = header.lastTime;
+		entries[block].block = block;
+		entries[block].count = header.count;
+	}
+
+	return ftruncate(indexFd, 0) == 0 &&
+		(blocks == 0 || writeAt(indexFd, &entries[0], entries.size() * sizeof(BlockIndexEntry), 0));
+}
+
+/**
+* Check that the index describes the data file
+* The last entry may trail by one block if the writer stopped between the two writes.
+*/
+static bool indexMatches(int dataFd, int indexFd, uint32_t blocks){
+	uint64_t entries = fileSize(indexFd) / sizeof(BlockIndexEntry);
+
+	if (entries > blocks || entries + 1 < blocks){
+		return false;
+	}
+
+	if (entries == 0){
+		return true;
+	}
+
+	BlockIndexEntry entry;
+	BlockHeader header;
+	off_t last = off_t(entries - 1);
+
+	return pread(indexFd, &entry, sizeof(entry), last * sizeof(entry)) == sizeof(entry) &&
+		pread(dataFd, &header, sizeof(header), FILE_HEADER_SIZE + last * BLOCK_SIZE) == sizeof(header) &&
+		entry.block == last && entry.firstTime == header.firstTime;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Writer
+
+SeriesWriter::SeriesWriter() :
+	_dataFd(-1), _indexFd(-1), _scale(1), _block(0), _buffer(BLOCK_SIZE), _dirty(false),
+	_lastTime(INT64_MIN), _rejected(0){
+}
+
+SeriesWriter::~SeriesWriter(){
+	close();
+}
+
+bool SeriesWriter::open(const std::string& basePath, const char* node, int column){
+	close();
+
+	_scale = (column >= 0 && column < COLUMN_COUNT) ? COLUMN_RESOLUTION[column] : 1;
+	_dataFd = ::open((basePath + ".dat").c_str(), O_RDWR | O_CREAT, 0644);
+	_indexFd = ::open((basePath + ".idx").c_str(), O_RDWR | O_CREAT, 0644);
+	if (_dataFd < 0 || _indexFd < 0){
+		close();
+		return false;
+	}
+
+	off_t size = fileSize(_dataFd);
+
+	// New series - write the file header
+	if (size < off_t(FILE_HEADER_SIZE)){
+		std::vector<uint8_t> header(FILE_HEADER_SIZE, 0);
+		SeriesFileHeader* fileHeader = reinterpret_cast<SeriesFileHeader*>(&header[0]);
+
+		memcpy(fileHeader->magic, SERIES_MAGIC, sizeof(SERIES_MAGIC));
+		fileHeader->version = SERIES_VERSION;
+		fileHeader->blockSize = BLOCK_SIZE;
+		fileHeader->column = column;
+		strncpy(fileHeader->node, node, sizeof(fileHeader->node) - 1);
+
+		if (!writeAt(_dataFd, &header[0], header.size(), 0) || ftruncate(_indexFd, 0) != 0){
+			close();
+			return false;
+		}
+
+		_block = 0;
+		startBlock();
+		return _rollups.open(basePath);
+	}
+
+	// Existing series - carry on in the last block if it has room
+	SeriesFileHeader fileHeader;
+	if (pread(_dataFd, &fileHeader, sizeof(fileHeader), 0) != sizeof(fileHeader) ||
+		memcmp(fileHeader.magic, SERIES_MAGIC, sizeof(SERIES_MAGIC)) != 0 ||
+		fileHeader.blockSize != BLOCK_SIZE){
+		close();
+		return false;
+	}
+
+	uint32_t blocks = (size - FILE_HEADER_SIZE) / BLOCK_SIZE;
+
+	// Retention rewrites the data file first; an index left behind by a crash is rebuilt
+	if (!indexMatches(_dataFd, _indexFd, blocks) && !rebuildIndex(_dataFd, _indexFd, blocks)){
+		close();
+		return false;
+	}
+
+	if (!_rollups.open(basePath)){
+		close();
+		return false;
+	}
+
+	if (blocks == 0){
+		_block = 0;
+		startBlock();
+		return true;
+	}
+
+	_block = blocks - 1;
+	if (pread(_dataFd, &_buffer[0], BLOCK_SIZE, FILE_HEADER_SIZE + off_t(_block) * BLOCK_SIZE) != BLOCK_SIZE){
+		close();
+		return false;
+	}
+
+	BlockHeader* header = blockHeader(&_buffer[0]);
+	_lastTime = header->count > 0 ? header->lastTime : INT64_MIN;
+
+	// Carry on in a compressed block; raw (old) or damaged blocks are left as they are
+	bool resumed = (header->encoding == ENCODING_GORILLA || header->encoding == ENCODING_GRID) &&
+		_encoder.resume(&_buffer[sizeof(BlockHeader)], BLOCK_PAYLOAD_SIZE, header->firstTime, header->scale, header->count,
+			valueLayout(header->encoding));
+
+	if (header->count > 0 && !resumed){
+		_block++;
+		startBlock();
+	}
+	else if (header->count == 0){
+		startBlock();
+	}
+
+	// Series written before rollups existed get them built from the raw history
+	if (_rollups.empty()){
+		SeriesReader reader;
+
+		if (reader.open(basePath)){
+			reader.scan(INT64_MIN, INT64_MAX, [this](const BlockView& view){
+				for (uint32_t i = 0; i < view.count; i++){
+					_rollups.append(view.time[i], view.value[i]);
+				}
+			});
+		}
+
+		_rollups.flush();
+	}
+
+	return true;
+}
+
+void SeriesWriter::close(){
+	if (_dataFd >= 0){
+		flush();
+		::close(_dataFd);
+	}
+
+	if (_indexFd >= 0){
+		::close(_indexFd);
+	}
+
+	_rollups.close();
+	_dataFd = -1;
+	_indexFd = -1;
+}
+
+/**
+* Clear the buffer for a fresh block
+*/
+void SeriesWriter::startBlock(){
+	std::fill(_buffer.begin(), _buffer.end(), 0);
+	blockHeader(&_buffer[0])->encoding = ENCODING_GRID;
+	blockHeader(&_buffer[0])->scale = _scale;
+	_dirty = false;
+}
+
+bool SeriesWriter::append(int64_t time, float value){
+	if (_dataFd < 0 || time < _lastTime){
+		_rejected++;
+		return false;
+	}
+
+	BlockHeader* header = blockHeader(&_buffer[0]);
+
+	if (header->count == 0){
+		header->firstTime = time;
+		_encoder.begin(&_buffer[sizeof(BlockHeader)], BLOCK_PAYLOAD_SIZE, time, _scale);
+	}
+
+	// Seal the full block and move on
+	if (!_encoder.append(time, value)){
+		if (!writeBlock()){
+			return false;
+		}
+
+		_block++;
+		startBlock();
+
+		header->firstTime = time;
+		_encoder.begin(&_buffer[sizeof(BlockHeader)], BLOCK_PAYLOAD_SIZE, time, _scale);
+		_encoder.append(time, value);
+	}
+
+	header->count++;
+	header->lastTime = time;
+	header->length = _encoder.bytesUsed();
+
+	_rollups.append(time, value);
+	_lastTime = time;
+	_dirty = true;
+	return true;
+}
+
+bool SeriesWriter::flush(){
+	if (_dataFd < 0 || !_dirty){
+		return true;
+	}
+
+	return writeBlock() && _rollups.flush();
+}
+
+/**
+* Write the current block and its index entry
+* The payload goes first so readers never see a count ahead of the data.
+*/
+bool SeriesWriter::writeBlock(){
+	const BlockHeader* header = blockHeader(&_buffer[0]);
+	off_t offset = FILE_HEADER_SIZE + off_t(_block) * BLOCK_SIZE;
+
+	if (!writeAt(_dataFd, &_buffer[sizeof(BlockHeader)], BLOCK_SIZE - sizeof(BlockHeader), offset + sizeof(BlockHeader)) ||
+		!writeAt(_dataFd, header, sizeof(BlockHeader), offset)){
+		return false;
+	}
+
+	BlockIndexEntry entry;
+	entry.firstTime = header->firstTime;
+	entry.lastTime = header->lastTime;
+	entry.block = _block;
+	entry.count = header->count;
+
+	if (!writeAt(_indexFd, &entry, sizeof(entry), off_t(_block) * sizeof(entry))){
+		return false;
+	}
+
+	_dirty = false;
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Reader
+
+SeriesReader::SeriesReader() :
+	_data(NULL), _index(NULL), _dataSize(0), _indexSize(0), _blockCount(0), _indexCount(0){
+}
+
+SeriesReader::~SeriesReader(){
+	close();
+}
+
+bool SeriesReader::open(const std::string& basePath){
+	close();
+	_basePath = basePath;
+	return map();
+}
+
+void SeriesReader::close(){
+	unmap();
+	_basePath.clear();
+}
+
+bool SeriesReader::refresh(){
+	unmap();
+	return map();
+}
+
+/**
+* Map both files read-only
+*/
+bool SeriesReader::map(){
+	int dataFd = ::open((_basePath + ".dat").c_str(), O_RDONLY);
+	if (dataFd < 0){
+		return false;
+	}
+
+	int indexFd = ::open((_basePath + ".idx").c_str(), O_RDONLY);
+	if (indexFd < 0){
+		::close(dataFd);
+		return false;
+	}
+
+	_dataSize = fileSize(dataFd);
+	_indexSize = fileSize(indexFd);
+	bool mapped = true;
+
+	if (_dataSize > 0){
+		void* data = mmap(NULL, _dataSize, PROT_READ, MAP_SHARED, dataFd, 0);
+		_data = data == MAP_FAILED ? NULL : static_cast<const uint8_t*>(data);
+		mapped = _data != NULL;
+	}
+
+	if (mapped && _indexSize >= sizeof(BlockIndexEntry)){
+		void* index = mmap(NULL, _indexSize, PROT_READ, MAP_SHARED, indexFd, 0);
+		_index = index == MAP_FAILED ? NULL : static_cast<const BlockIndexEntry*>(index);
+		mapped = _index != NULL;
+	}
+
+	::close(dataFd);
+	::close(indexFd);
+
+	if (!mapped || _dataSize < FILE_HEADER_SIZE ||
+		memcmp(reinterpret_cast<const SeriesFileHeader*>(_data)->magic, SERIES_MAGIC, sizeof(SERIES_MAGIC)) != 0){
+		unmap();
+		return false;
+	}
+
+	_blockCount = (_dataSize - FILE_HEADER_SIZE) / BLOCK_SIZE;
+	_indexCount = std::min<uint64_t>(_indexSize / sizeof(BlockIndexEntry), _blockCount);
+
+	// Scans read blocks front to back
+	madvise(const_cast<uint8_t*>(_data), _dataSize, MADV_SEQUENTIAL);
+	return true;
+}
+
+void SeriesReader::unmap(){
+	if (_data != NULL){
+		munmap(const_cast<uint8_t*>(_data), _dataSize);
+	}
+
+	if (_index != NULL){
+		munmap(const_cast<BlockIndexEntry*>(_index), _indexSize);
+	}
+
+	_data = NULL;
+	_index = NULL;
+	_dataSize = 0;
+	_indexSize = 0;
+	_blockCount = 0;
+	_indexCount = 0;
+}
+
+/**
+* Binary search the index for the first block that ends at or after a time
+*/
+uint32_t SeriesReader::firstBlockEndingAfter(int64_t from) const{
+	uint32_t low = 0;
+	uint32_t high = _indexCount;
+
+	while (low < high){
+		uint32_t middle = low + (high - low) / 2;
+
+		if (_index[middle].lastTime < from){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+
+	// Blocks past the end of the index (not yet indexed) are checked one by one
+	return low;
+}
+
+/**
+* Get the samples of a block
+* Raw blocks are used in place, compressed blocks are decoded into the scratch buffers.
+*
+* @return False if the block is empty, corrupt or uses an unknown encoding
+*/
+bool SeriesReader::viewBlock(uint32_t block, BlockView& view){
+	const uint8_t* data = _data + FILE_HEADER_SIZE + uint64_t(block) * BLOCK_SIZE;
+	const BlockHeader* header = blockHeader(data);
+
+	if (header->count == 0){
+		return false;
+	}
+
+	if (header->encoding == ENCODING_RAW && header->count <= RAW_BLOCK_CAPACITY){
+		view.count = header->count;
+		view.time = rawTimes(data);
+		view.value = rawValues(data);
+		return true;
+	}
+
+	if ((header->encoding == ENCODING_GORILLA || header->encoding == ENCODING_GRID) && header->count <= MAX_BLOCK_SAMPLES){
+		if (_times.size() < header->count){
+			_times.resize(MAX_BLOCK_SAMPLES);
+			_values.resize(MAX_BLOCK_SAMPLES);
+		}
+
+		if (!decodeBlock(data + sizeof(BlockHeader), BLOCK_PAYLOAD_SIZE, header->firstTime, header->scale,
+			header->count, &_times[0], &_values[0], valueLayout(header->encoding))){
+			return false;
+		}
+
+		view.count = header->count;
+		view.time = &_times[0];
+		view.value = &_values[0];
+		return true;
+	}
+
+	return false;
+}
+
+SeriesStats SeriesReader::stats() const{
+	SeriesStats stats = { _blockCount, 0, 0, _dataSize + _indexSize };
+
+	for (uint32_t block = 0; block < _blockCount; block++){
+		const BlockHeader* header = blockHeader(_data + FILE_HEADER_SIZE + uint64_t(block) * BLOCK_SIZE);
+		stats.samples += header->count;
+		stats.encodedBytes += sizeof(BlockHeader) + header->length;
+	}
+
+	return stats;
+}
+
+size_t SeriesReader::scan(int64_t from, int64_t to, const BlockVisitor& visitor){
+	size_t visited = 0;
+
+	for (uint32_t block = firstBlockEndingAfter(from); block < _blockCount; block++){
+		const BlockHeader* header = blockHeader(_data + FILE_HEADER_SIZE + uint64_t(block) * BLOCK_SIZE);
+
+		if (header->count == 0 || header->lastTime < from){
+			continue;
+		}
+
+		if (header->firstTime > to){
+			break;
+		}
+
+		BlockView view;
+		if (!viewBlock(block, view)){
+			continue;
+		}
+
+		// Trim to the range
+		const int64_t* first = std::lower_bound(view.time, view.time + view.count, from);
+		const int64_t* last = std::upper_bound(first, view.time + view.count, to);
+
+		BlockView trimmed;
+		trimmed.count = last - first;
+		trimmed.time = first;
+		trimmed.value = view.value + (first - view.time);
+
+		if (trimmed.count > 0){
+			visitor(trimmed);
+			visited += trimmed.count;
+		}
+	}
+
+	return visited;
+}
+
+size_t SeriesReader::query(int64_t from, int64_t to, std::vector<Sample>& samples){
+	return scan(from, to, [&samples](const BlockView& view){
+		for (uint32_t i = 0; i < view.count; i++){
+			Sample sample = { view.time[i], view.value[i] };
+			samples.push_back(sample);
+		}
+	});
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Store
+
+/**
+* Make a node name safe to use as a directory name
+*/
+static std::string safeName(const char* name){
+	std::string safe;
+
+	for (; *name; name++){
+		char c = *name;
+		bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+		safe += allowed ? c : '_';
+	}
+
+	return safe.empty() ? "_" : safe;
+}
+
+SeriesStore::SeriesStore(const std::string& root) : _root(root), _retention(0), _maxWriters(1){
+	mkdir(_root.c_str(), 0755);
+
+	// Writers are most of what the process keeps open, so take all the files it's allowed
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max){
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY){
+		if (files.rlim_cur > rlim_t(RESERVED_FILES + SERIES_FILES)){
+			_maxWriters = (files.rlim_cur - RESERVED_FILES) / SERIES_FILES;
+		}
+	}
+	else{
+		_maxWriters = SIZE_MAX;
+	}
+}
+
+SeriesStore::~SeriesStore(){
+	for (std::map<std::string, OpenSeries>::iterator i = _writers.begin(); i != _writers.end(); ++i){
+		delete i->second.writer;
+	}
+}
+
+void SeriesStore::setRetention(int64_t retention){
+	_retention = retention;
+}
+
+std::string SeriesStore::seriesPath(const char* node, int column) const{
+	return _root + "/" + safeName(node) + "/" + COLUMN_NAMES[column];
+}
+
+/**
+* Get the writer for a series, opening it if it isn't open
+* @return NULL if the series could not be opened; it's tried again next time
+*/
+SeriesWriter* SeriesStore::writer(const char* node, int column){
+	std::string path = seriesPath(node, column);
+	std::map<std::string, OpenSeries>::iterator found = _writers.find(path);
+
+	if (found != _writers.end()){
+		_recent.splice(_recent.begin(), _recent, found->second.recent);
+		return found->second.writer;
+	}
+
+	// Make room under the open file limit
+	if (_writers.size() >= _maxWriters){
+		closeWriter(_writers.find(_recent.back()));
+	}
+
+	mkdir((_root + "/" + safeName(node)).c_str(), 0755);
+
+	SeriesWriter* writer = new SeriesWriter();
+	if (!writer->open(path, node, column)){
+		delete writer;
+		return NULL;
+	}
+
+	_recent.push_front(path);
+	OpenSeries& series = _writers[path];
+	series.writer = writer;
+	series.recent = _recent.begin();
+	return writer;
+}
+
+/**
+* Close a writer, flushing it first
+*/
+void SeriesStore::closeWriter(std::map<std::string, OpenSeries>::iterator series){
+	delete series->second.writer;
+	_recent.erase(series->second.recent);
+	_writers.erase(series);
+}
+
+bool SeriesStore::append(const char* node, int column, int64_t time, float value){
+	SeriesWriter* series = writer(node, column);
+	return series != NULL && series->append(time, value);
+}
+
+void SeriesStore::append(const ColumnBatch& batch){
+	for (size_t row = 0; row < batch.rows; row++){
+		// Records nobody could identify have no series to go to
+		if (batch.device[row] == DEVICE_UNKNOWN){
+			continue;
+		}
+
+		for (int column = 0; column < COLUMN_COUNT; column++){
+			float value = batch.columns[column][row];
+
+			if (value == value){
+				append(batch.node[row].text, column, batch.time[row], value);
+			}
+		}
+	}
+}
+
+void SeriesStore::flush(){
+	for (std::map<std::string, OpenSeries>::iterator i = _writers.begin(); i != _writers.end(); ++i){
+		i->second.writer->flush();
+	}
+}
+
+bool SeriesStore::openReader(const char* node, int column, SeriesReader& reader) const{
+	return reader.open(seriesPath(node, column));
+}
+
+std::vector<std::string> SeriesStore::listNodes() const{
+	std::vector<std::string> nodes;
+	DIR* directory = opendir(_root.c_str());
+
+	if (directory == NULL){
+		return nodes;
+	}
+
+	struct dirent* entry;
+	while ((entry = readdir(directory)) != NULL){
+		if (entry->d_name[0] != '.'){
+			nodes.push_back(entry->d_name);
+		}
+	}
+
+	closedir(directory);
+	std::sort(nodes.begin(), nodes.end());
+	return nodes;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Sink
+
+StoreSink::StoreSink(SeriesStore& store, int flushInterval) :
+	_store(store), _flushInterval(flushInterval), _lastFlush(0), _lastExpiry(0){
+}
+
+void StoreSink::write(const ColumnBatch& batch){
+	_store.append(batch);
+}
+
+void StoreSink::flush(){
+	int64_t now = currentTimeMillis();
+
+	if (now - _lastFlush >= _flushInterval){
+		_store.flush();
+		_lastFlush = now;
+	}
+
+	if (_store.retention() > 0 && now - _lastExpiry >= RETENTION_CHECK_INTERVAL){
+		_store.expire(now);
+		_lastExpiry = now;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Retention
+
+/**
+* Count the leading blocks that end before a time
+* The last block is always kept so the writer knows where the series stands.
+*/
+static uint32_t expiredBlocks(const std::string& basePath, int64_t before){
+	int fd = ::open((basePath + ".dat").c_str(), O_RDONLY);
+	if (fd < 0){
+		return 0;
+	}
+
+	off_t size = fileSize(fd);
+	uint32_t blocks = size > off_t(FILE_HEADER_SIZE) ? (size - FILE_HEADER_SIZE) / BLOCK_SIZE : 0;
+	uint32_t expired = 0;
+
+	while (expired + 1 < blocks){
+		BlockHeader header;
+		if (pread(fd, &header, sizeof(header), FILE_HEADER_SIZE + off_t(expired) * BLOCK_SIZE) != sizeof(header) ||
+			(header.count > 0 && header.lastTime >= before)){
+			break;
+		}
+		expired++;
+	}
+
+	::close(fd);
+	return expired;
+}
+
+/**
+* Copy a file from an offset into a new file
+*/
+static bool copyTail(int from, int to, off_t offset, off_t size){
+	std::vector<uint8_t> buffer(BLOCK_SIZE);
+	off_t written = lseek(to, 0, SEEK_END);
+
+	for (; offset < size; offset += BLOCK_SIZE){
+		if (pread(from, &buffer[0], BLOCK_SIZE, offset) != BLOCK_SIZE ||
+			!writeAt(to, &buffer[0], BLOCK_SIZE, written)){
+			return false;
+		}
+		written += BLOCK_SIZE;
+	}
+
+	return true;
+}
+
+/**
+* Rewrite a series without its first blocks
+* New files are written alongside and renamed over the old ones, so open
+* readers keep their mapping of the old files until they reopen.
+*/
+static bool dropBlocks(const std::string& basePath, uint32_t count){
+	std::string dataPath = basePath + ".dat";
+	std::string indexPath = basePath + ".idx";
+	std::string tempData = dataPath + ".tmp";
+	std::string tempIndex = indexPath + ".tmp";
+
+	int dataFd = ::open(dataPath.c_str(), O_RDONLY);
+	int newDataFd = ::open(tempData.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	int newIndexFd = ::open(tempIndex.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	off_t size = dataFd >= 0 ? fileSize(dataFd) : 0;
+	uint32_t blocks = size > off_t(FILE_HEADER_SIZE) ? (size - FILE_HEADER_SIZE) / BLOCK_SIZE : 0;
+
+	bool copied = dataFd >= 0 && newDataFd >= 0 && newIndexFd >= 0 && count < blocks &&
+		copyTail(dataFd, newDataFd, 0, FILE_HEADER_SIZE) &&
+		copyTail(dataFd, newDataFd, FILE_HEADER_SIZE + off_t(count) * BLOCK_SIZE, FILE_HEADER_SIZE + off_t(blocks) * BLOCK_SIZE) &&
+		rebuildIndex(newDataFd, newIndexFd, blocks - count) &&
+		fsync(newDataFd) == 0 && fsync(newIndexFd) == 0;
+
+	if (dataFd >= 0){
+		::close(dataFd);
+	}
+	if (newDataFd >= 0){
+		::close(newDataFd);
+	}
+	if (newIndexFd >= 0){
+		::close(newIndexFd);
+	}
+
+	if (!copied || rename(tempData.c_str(), dataPath.c_str()) != 0 || rename(tempIndex.c_str(), indexPath.c_str()) != 0){
+		unlink(tempData.c_str());
+		unlink(tempIndex.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+size_t SeriesStore::expire(int64_t now){
+	if (_retention <= 0){
+		return 0;
+	}
+
+	int64_t before = now - _retention;
+	std::vector<std::string> nodes = listNodes();
+	size_t dropped = 0;
+
+	flush();
+
+	for (size_t n = 0; n < nodes.size(); n++){
+		for (int column = 0; column < COLUMN_COUNT; column++){
+			std::string path = seriesPath(nodes[n].c_str(), column);
+			uint32_t expired = expiredBlocks(path, before);
+
+			if (expired == 0){
+				continue;
+			}
+
+			// The writer is reopened on the next append, against the new files
+			std::map<std::string, OpenSeries>::iterator found = _writers.find(path);
+			if (found != _writers.end()){
+				closeWriter(found);
+			}
+
+			if (dropBlocks(path, expired)){
+				dropped += expired;
+			}
+		}
+	}
+
+	return dropped;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Summaries
+
+size_t SeriesStore::summarize(const char* node, int column, int64_t from, int64_t to, int64_t resolution,
+	std::vector<RollupPoint>& points) const{
+	if (resolution <= 0){
+		return 0;
+	}
+
+	size_t before = points.size();
+	RollupPoint bucket;
+	bucket.count = 0;
+
+	// Fold finer points into buckets of the requested resolution
+	RollupVisitor add = [&points, &bucket, resolution](const RollupPoint& point){
+		int64_t start = bucketStart(point.start, resolution);
+
+		if (bucket.count > 0 && bucket.start == start){
+			bucket.merge(point);
+			return;
+		}
+
+		if (bucket.count > 0){
+			points.push_back(bucket);
+		}
+
+		bucket = point;
+		bucket.start = start;
+	};
+
+	std::string path = seriesPath(node, column);
+	int tier = coarsestTier(resolution);
+	RollupReader rollup;
+
+	// Tier buckets tile the resolution, so both start on the same boundary
+	from = bucketStart(from, resolution);
+	if (to < INT64_MAX - resolution){
+		to = bucketStart(to, resolution) + resolution - 1;
+	}
+
+	// Stores without rollups yet fall back to the raw samples
+	if (tier >= 0 && rollup.open(path, tier) && rollup.size() > 0){
+		rollup.scan(from, to, add);
+	}
+	else{
+		SeriesReader reader;
+
+		if (!reader.open(path)){
+			return 0;
+		}
+
+		reader.scan(from, to, [&add](const BlockView& view){
+			RollupPoint point;
+
+			for (uint32_t i = 0; i < view.count; i++){
+				point.reset(view.time[i], view.value[i]);
+				add(point);
+			}
+		});
+	}
+
+	if (bucket.count > 0){
+		points.push_back(bucket);
+	}
+
+	return points.size() - before;
+}
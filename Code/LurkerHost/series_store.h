@@ -0,0 +1,326 @@
+#ifndef LURKER_SERIES_STORE_H
+#define LURKER_SERIES_STORE_H
+
+#include <functional>
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "record_sink.h"
+#include "schema.h"
+#include "series_codec.h"
+#include "series_rollup.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Series Store
+//
+// Append-only columnar history, one series per (node, column):
+//	<root>/<node>/<column>.dat	- file header, then fixed-size sample blocks
+//	<root>/<node>/<column>.idx	- one index entry per block
+//
+// Each series also keeps 1-minute, 1-hour and 1-day rollups (see
+// series_rollup.h). Raw blocks can be limited to a retention window; the
+// rollups are kept for good.
+//
+// Blocks are page-sized and page-aligned, so readers memory-map the data
+// file. New blocks are compressed (see series_codec.h) and decoded into a
+// scratch buffer per block; raw blocks from older stores are used in place.
+// The index is small enough to stay in cache and is binary searched to
+// find the first block of a time range.
+//
+// The last block is rewritten in place until it is full. Its payload is
+// written before its header, so a concurrent reader only ever sees samples
+// that are completely on disk.
+//////////////////////////////////////////////////////////////////////////
+
+const uint32_t BLOCK_SIZE = 4096;
+const uint32_t FILE_HEADER_SIZE = BLOCK_SIZE;
+const uint32_t SERIES_VERSION = 2;
+const int64_t RETENTION_CHECK_INTERVAL = 60 * 60 * 1000LL;	// How often the sink drops expired blocks, in ms
+const int SERIES_FILES = 5;	// Open files per writer: data, index and three rollup tiers
+const int RESERVED_FILES = 64;	// Left for ports, sockets and readers
+
+enum BlockEncoding{
+	ENCODING_RAW = 0,	// Timestamp array followed by value array
+	ENCODING_GORILLA = 1,	// Delta-of-delta timestamps, fixed-point/XOR values
+	ENCODING_GRID = 2	// As ENCODING_GORILLA, with short value deltas in the block's grid step
+};
+
+struct SeriesFileHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t blockSize;
+	int32_t column;
+	uint32_t reserved;
+	char node[MAX_ID_LENGTH];
+};
+
+struct BlockHeader{
+	int64_t firstTime;
+	int64_t lastTime;
+	uint32_t count;
+	uint16_t encoding;
+	uint16_t scale;	// Fixed-point multiplier of compressed values
+	uint32_t length;	// Payload bytes in use
+	uint32_t reserved2;
+};
+
+struct BlockIndexEntry{
+	int64_t firstTime;
+	int64_t lastTime;
+	uint32_t block;
+	uint32_t count;
+};
+
+const uint32_t BLOCK_PAYLOAD_SIZE = BLOCK_SIZE - sizeof(BlockHeader);
+const uint32_t RAW_BLOCK_CAPACITY = BLOCK_PAYLOAD_SIZE / (sizeof(int64_t) + sizeof(float));
+const uint32_t MAX_BLOCK_SAMPLES = BLOCK_PAYLOAD_SIZE * 8 / 2;	// At least two bits per compressed sample
+
+struct Sample{
+	int64_t time;	// ms since the epoch
+	float value;
+};
+
+/**
+* Samples of one block, trimmed to the requested range
+* Only valid until the visitor returns.
+*/
+struct BlockView{
+	uint32_t count;
+	const int64_t* time;
+	const float* value;
+};
+
+typedef std::function<void(const BlockView& view)> BlockVisitor;
+
+/**
+* Size summary of a series
+*/
+struct SeriesStats{
+	uint32_t blocks;
+	uint64_t samples;
+	uint64_t encodedBytes;	// Block headers plus payload in use
+	uint64_t storedBytes;	// Data and index files on disk
+};
+
+/**
+* Appends samples to one series
+*/
+class SeriesWriter{
+public:
+	SeriesWriter();
+	~SeriesWriter();
+
+	/**
+	* Open a series, creating it if it does not exist yet
+	* Appending continues in the last block if it has room.
+	*/
+	bool open(const std::string& basePath, const char* node, int column);
+	void close();
+
+	/**
+	* Add a sample
+	* Samples must arrive in time order; older samples are rejected.
+	* @return False if the sample was rejected or could not be written
+	*/
+	bool append(int64_t time, float value);
+
+	/**
+	* Write out the partly filled block and its index entry
+	*/
+	bool flush();
+
+	uint64_t rejected() const{
+		return _rejected;
+	}
+
+private:
+	SeriesWriter(const SeriesWriter&);
+	SeriesWriter& operator=(const SeriesWriter&);
+
+	bool writeBlock();
+	void startBlock();
+
+	int _dataFd;
+	int _indexFd;
+	uint16_t _scale;
+	uint32_t _block;	// Number of the block being filled
+	std::vector<uint8_t> _buffer;
+	BlockEncoder _encoder;
+	RollupWriter _rollups;
+	bool _dirty;
+	int64_t _lastTime;
+	uint64_t _rejected;
+};
+
+/**
+* Reads one series through a memory map
+*/
+class SeriesReader{
+public:
+	SeriesReader();
+	~SeriesReader();
+
+	bool open(const std::string& basePath);
+	void close();
+
+	/**
+	* Pick up blocks written since the series was opened
+	*/
+	bool refresh();
+
+	uint32_t blockCount() const{
+		return _blockCount;
+	}
+
+	/**
+	* Call the visitor for every block overlapping [from, to], trimmed to the range
+	* @return Number of samples visited
+	*/
+	size_t scan(int64_t from, int64_t to, const BlockVisitor& visitor);
+
+	/**
+	* Copy all samples in [from, to]
+	* @return Number of samples added
+	*/
+	size_t query(int64_t from, int64_t to, std::vector<Sample>& samples);
+
+	/**
+	* Walk the block headers for sample counts and sizes
+	*/
+	SeriesStats stats() const;
+
+private:
+	SeriesReader(const SeriesReader&);
+	SeriesReader& operator=(const SeriesReader&);
+
+	bool map();
+	void unmap();
+	uint32_t firstBlockEndingAfter(int64_t from) const;
+	bool viewBlock(uint32_t block, BlockView& view);
+
+	std::string _basePath;
+	const uint8_t* _data;
+	const BlockIndexEntry* _index;
+	uint64_t _dataSize;
+	uint64_t _indexSize;
+	uint32_t _blockCount;
+	uint32_t _indexCount;
+
+	std::vector<int64_t> _times;	// Decoded samples of the current block
+	std::vector<float> _values;
+};
+
+/**
+* Collection of series under one root directory
+* Writers are kept open between appends, as many as the open file limit
+* allows; past that the least recently used one is closed, and reopened
+* (carrying on in its last block) when it's next needed.
+*/
+class SeriesStore{
+public:
+	explicit SeriesStore(const std::string& root);
+	~SeriesStore();
+
+	/**
+	* Append every value of a normalised batch to its series
+	*/
+	void append(const ColumnBatch& batch);
+
+	/**
+	* Append a single sample
+	*/
+	bool append(const char* node, int column, int64_t time, float value);
+
+	/**
+	* Flush all open series
+	*/
+	void flush();
+
+	/**
+	* Open a series for reading
+	* @return False if the series does not exist
+	*/
+	bool openReader(const char* node, int column, SeriesReader& reader) const;
+
+	/**
+	* Summarise [from, to] into buckets of the given resolution
+	* Reads the coarsest rollup tier that tiles the resolution, or the raw
+	* samples if none does. The range is widened to whole buckets.
+	*
+	* @param resolution Bucket length in ms
+	* @return Number of points added
+	*/
+	size_t summarize(const char* node, int column, int64_t from, int64_t to, int64_t resolution,
+		std::vector<RollupPoint>& points) const;
+
+	/**
+	* Keep raw samples for this long, in ms; 0 keeps everything
+	*/
+	void setRetention(int64_t retention);
+
+	int64_t retention() const{
+		return _retention;
+	}
+
+	/**
+	* Drop raw blocks that ended more than the retention window before now
+	* @return Number of blocks dropped
+	*/
+	size_t expire(int64_t now);
+
+	/**
+	* List the nodes that have any history
+	*/
+	std::vector<std::string> listNodes() const;
+
+	const std::string& root() const{
+		return _root;
+	}
+
+	/**
+	* Path of a series without its file extension
+	*/
+	std::string seriesPath(const char* node, int column) const;
+
+private:
+	SeriesStore(const SeriesStore&);
+	SeriesStore& operator=(const SeriesStore&);
+
+	struct OpenSeries{
+		SeriesWriter* writer;
+		std::list<std::string>::iterator recent;
+	};
+
+	SeriesWriter* writer(const char* node, int column);
+	void closeWriter(std::map<std::string, OpenSeries>::iterator series);
+
+	std::string _root;
+	int64_t _retention;
+	std::map<std::string, OpenSeries> _writers;
+	std::list<std::string> _recent;	// Open series, most recently used first
+	size_t _maxWriters;
+};
+
+/**
+* Pipeline sink that writes into a series store
+* Partial blocks are flushed at most once per flush interval, and expired
+* blocks are dropped once per retention check interval.
+*/
+class StoreSink : public RecordSink{
+public:
+	StoreSink(SeriesStore& store, int flushInterval);
+
+	void write(const ColumnBatch& batch);
+	void flush();
+
+private:
+	SeriesStore& _store;
+	int _flushInterval;
+	int64_t _lastFlush;
+	int64_t _lastExpiry;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef LURKER_SPSC_QUEUE_H
+#define LURKER_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// SPSC Queue
+//
+// Lock-free ring buffer for exactly one producer thread and one consumer
+// thread. Slots are claimed and released in place, so large items (frames)
+// can be written by the producer and read by the consumer without copying.
+//
+// Each side keeps a cached copy of the other side's index and only touches
+// the shared atomic when the cache says the ring is full/empty.
+//////////////////////////////////////////////////////////////////////////
+
+const size_t CACHE_LINE_SIZE = 64;
+
+template <typename T>
+class SpscQueue{
+public:
+	/**
+	* Create a queue holding at least the requested number of items.
+	* The capacity is rounded up to a power of two.
+	*/
+	explicit SpscQueue(size_t capacity) :
+		_tail(0), _cachedHead(0), _head(0), _cachedTail(0){
+		size_t size = 2;
+		while (size < capacity){
+			size <<= 1;
+		}
+
+		_slots.resize(size);
+		_mask = size - 1;
+	}
+
+	/**
+	* Producer - Get the next free slot without publishing it
+	* @return Pointer to the free slot, or NULL if the queue is full
+	*/
+	T* claim(){
+		size_t tail = _tail.load(std::memory_order_relaxed);
+
+		if (tail - _cachedHead > _mask){
+			_cachedHead = _head.load(std::memory_order_acquire);
+
+			if (tail - _cachedHead > _mask){
+				return NULL;
+			}
+		}
+
+		return &_slots[tail & _mask];
+	}
+
+	/**
+	* Producer - Publish the slot returned by the last claim()
+	*/
+	void publish(){
+		_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/**
+	* Producer - Copy an item into the queue
+	* @return False if the queue is full
+	*/
+	bool push(const T& item){
+		T* slot = claim();
+
+		if (slot == NULL){
+			return false;
+		}
+
+		*slot = item;
+		publish();
+		return true;
+	}
+
+	/**
+	* Consumer - Get the oldest item without removing it
+	* @return Pointer to the item, or NULL if the queue is empty
+	*/
+	T* front(){
+		size_t head = _head.load(std::memory_order_relaxed);
+
+		if (head == _cachedTail){
+			_cachedTail = _tail.load(std::memory_order_acquire);
+
+			if (head == _cachedTail){
+				return NULL;
+			}
+		}
+
+		return &_slots[head & _mask];
+	}
+
+	/**
+	* Consumer - Release the item returned by the last front()
+	*/
+	void pop(){
+		_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/**
+	* Consumer - Move the oldest item out of the queue
+	* @return False if the queue is empty
+	*/
+	bool tryPop(T& item){
+		T* slot = front();
+
+		if (slot == NULL){
+			return false;
+		}
+
+		item = *slot;
+		pop();
+		return true;
+	}
+
+	/**
+	* Approximate number of queued items; exact only from the consumer or producer thread
+	*/
+	size_t size() const{
+		return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const{
+		return _mask + 1;
+	}
+
+private:
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+
+	std::vector<T> _slots;
+	size_t _mask;
+
+	// Producer and consumer indices padded onto separate cache lines
+	char _padding0[CACHE_LINE_SIZE];
+	std::atomic<size_t> _tail;
+	size_t _cachedHead;
+
+	char _padding1[CACHE_LINE_SIZE];
+	std::atomic<size_t> _head;
+	size_t _cachedTail;
+	char _padding2[CACHE_LINE_SIZE];
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include "thingspeak_sink.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "ingest_pipeline.h"
+
+const int UPLOAD_IDLE_WAIT = 100;	// ms between checks for due channels
+
+//////////////////////////////////////////////////////////////////////////
+// Config
+
+bool loadThingSpeakConfig(const char* path, ThingSpeakConfig& config){
+	FILE* file = fopen(path, "r");
+	if (file == NULL){
+		return false;
+	}
+
+	char line[256];
+	int number = 0;
+	bool valid = true;
+
+	while (valid && fgets(line, sizeof(line), file) != NULL){
+		char key[32];
+		char first[128];
+		char second[128];
+		char third[128];
+
+		number++;
+
+		char* comment = strchr(line, '#');
+		if (comment != NULL){
+			*comment = 0;
+		}
+
+		int fields = sscanf(line, "%31s %127s %127s %127s", key, first, second, third);
+		if (fields <= 0){
+			continue;
+		}
+
+		if (strcmp(key, "server") == 0 && fields >= 2){
+			config.host = first;
+			config.port = fields >= 3 ? atoi(second) : 80;
+		}
+		else if (strcmp(key, "queue") == 0 && fields == 2){
+			config.queuePath = first;
+		}
+		else if (strcmp(key, "interval") == 0 && fields == 2){
+			config.interval = int(atof(first) * 1000);
+		}
+		else if (strcmp(key, "batch") == 0 && fields == 2){
+			config.batchSize = atoi(first);
+			valid = config.batchSize > 0;
+		}
+		else if (strcmp(key, "channel") == 0 && fields == 4){
+			ThingSpeakChannel channel;
+			channel.node = first;
+			channel.id = second;
+			channel.writeKey = third;
+			config.channels.push_back(channel);
+		}
+		else{
+			valid = false;
+		}
+
+		if (!valid){
+			fprintf(stderr, "%s:%d: bad setting\n", path, number);
+		}
+	}
+
+	fclose(file);
+	return valid;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Sink
+
+ThingSpeakSink::ThingSpeakSink(const ThingSpeakConfig& config) :
+	_config(config), _client(config.host, config.port, THINGSPEAK_TIMEOUT), _lastSync(0), _running(false){
+	for (size_t i = 0; i < config.channels.size(); i++){
+		Channel* channel = new Channel();
+		channel->settings = config.channels[i];
+		channel->nextAttempt = 0;
+		channel->backoff = 0;
+
+		_channels.push_back(channel);
+		_nodes[channel->settings.node] = channel;
+	}
+}
+
+ThingSpeakSink::~ThingSpeakSink(){
+	stop();
+
+	for (size_t i = 0; i < _channels.size(); i++){
+		delete _channels[i];
+	}
+}
+
+bool ThingSpeakSink::start(){
+	mkdir(_config.queuePath.c_str(), 0755);
+
+	for (size_t i = 0; i < _channels.size(); i++){
+		if (!_channels[i]->queue.open(_config.queuePath + "/" + _channels[i]->settings.id)){
+			fprintf(stderr, "Could not open upload queue for channel %s\n", _channels[i]->settings.id.c_str());
+			return false;
+		}
+	}
+
+	_running = true;
+	_thread = std::thread(&ThingSpeakSink::upload, this);
+	return true;
+}
+
+void ThingSpeakSink::stop(){
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_running){
+			return;
+		}
+		_running = false;
+	}
+
+	_wake.notify_all();
+	_thread.join();
+
+	for (size_t i = 0; i < _channels.size(); i++){
+		_channels[i]->queue.close();
+	}
+}
+
+void ThingSpeakSink::write(const ColumnBatch& batch){
+	for (size_t row = 0; row < batch.rows; row++){
+		std::map<std::string, Channel*>::iterator found = _nodes.find(batch.node[row].text);
+
+		if (found == _nodes.end()){
+			continue;
+		}
+
+		QueuedRecord record;
+		record.time = batch.time[row];
+		for (int column = 0; column < COLUMN_COUNT; column++){
+			record.values[column] = batch.columns[column][row];
+		}
+
+		found->second->pending.push_back(record);
+	}
+
+	// One append per channel per batch
+	for (size_t i = 0; i < _channels.size(); i++){
+		Channel* channel = _channels[i];
+
+		if (!channel->pending.empty()){
+			if (channel->queue.push(&channel->pending[0], channel->pending.size())){
+				_stats.queued += channel->pending.size();
+			}
+			channel->pending.clear();
+		}
+	}
+}
+
+void ThingSpeakSink::flush(){
+	int64_t now = currentTimeMillis();
+
+	if (now - _lastSync < THINGSPEAK_SYNC_INTERVAL){
+		return;
+	}
+
+	for (size_t i = 0; i < _channels.size(); i++){
+		_channels[i]->queue.sync();
+	}
+
+	_lastSync = now;
+	_wake.notify_all();
+}
+
+void ThingSpeakSink::printStats(FILE* output){
+	uint64_t waiting = 0;
+
+	for (size_t i = 0; i < _channels.size(); i++){
+		waiting += _channels[i]->queue.size();
+	}
+
+	fprintf(output,
+		"[thingspeak] queued=%" PRIu64 " uploaded=%" PRIu64 " rejected=%" PRIu64 " requests=%" PRIu64
+		" failures=%" PRIu64 " connects=%lu waiting=%" PRIu64 "\n",
+		uint64_t(_stats.queued), uint64_t(_stats.uploaded), uint64_t(_stats.rejected), uint64_t(_stats.requests),
+		uint64_t(_stats.failures), _client.connects(), waiting);
+}
+
+/**
+* Build a bulk update body
+*	{"write_api_key":"KEY","updates":[{"created_at":"2016-01-01T00:00:00Z","field1":21.5,...},...]}
+*/
+static void buildBulkUpdate(const std::string& writeKey, const std::vector<QueuedRecord>& records, std::string& body){
+	char text[64];
+
+	body.clear();
+	body += "{\"write_api_key\":\"" + writeKey + "\",\"updates\":[";
+
+	for (size_t i = 0; i < records.size(); i++){
+		const QueuedRecord& record = records[i];
+		time_t seconds = time_t(record.time / 1000);
+		struct tm date;
+
+		gmtime_r(&seconds, &date);
+		strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &date);
+
+		body += i == 0 ? "{\"created_at\":\"" : ",{\"created_at\":\"";
+		body += text;
+		body += "\"";
+
+		for (int column = 0; column < COLUMN_COUNT; column++){
+			if (record.values[column] == record.values[column]){
+				snprintf(text, sizeof(text), ",\"field%d\":%g", column + 1, record.values[column]);
+				body += text;
+			}
+		}
+
+		body += "}";
+	}
+
+	body += "]}";
+}
+
+/**
+* Send the front of one channel's queue
+* @return True if the channel has more to send right away
+*/
+bool ThingSpeakSink::uploadChannel(Channel& channel, std::vector<QueuedRecord>& records, std::string& body){
+	size_t count = channel.queue.peek(records, _config.batchSize);
+	if (count == 0){
+		return false;
+	}
+
+	buildBulkUpdate(channel.settings.writeKey, records, body);
+
+	int64_t now = currentTimeMillis();
+	int status = _client.post("/channels/" + channel.settings.id + "/bulk_update.json", "application/json", body, NULL);
+	_stats.requests++;
+
+	bool retry = status < 0 || status >= 500 || status == 408 || status == 429;
+
+	if (retry){
+		channel.backoff = channel.backoff == 0 ? THINGSPEAK_MIN_BACKOFF : std::min(channel.backoff * 2, THINGSPEAK_MAX_BACKOFF);
+		channel.nextAttempt = now + channel.backoff;
+		_stats.failures++;
+		return false;
+	}
+
+	// Anything else is final; a request the server refuses will never go through
+	if (status >= 200 && status < 300){
+		_stats.uploaded += count;
+	}
+	else{
+		fprintf(stderr, "ThingSpeak channel %s refused %zu records (HTTP %d)\n", channel.settings.id.c_str(), count, status);
+		_stats.rejected += count;
+	}
+
+	channel.queue.commit(count);
+	channel.backoff = 0;
+	channel.nextAttempt = now + _config.interval;
+	return channel.queue.size() > 0 && _config.interval <= 0;
+}
+
+/**
+* Upload thread - visit the channels that are due, round robin
+*/
+void ThingSpeakSink::upload(){
+	std::vector<QueuedRecord> records;
+	std::string body;
+
+	for (;;){
+		bool busy = false;
+
+		for (size_t i = 0; i < _channels.size(); i++){
+			if (currentTimeMillis() >= _channels[i]->nextAttempt){
+				busy |= uploadChannel(*_channels[i], records, body);
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (!_running){
+			break;
+		}
+
+		if (!busy){
+			_wake.wait_for(lock, std::chrono::milliseconds(UPLOAD_IDLE_WAIT));
+		}
+	}
+
+	_client.close();
+}
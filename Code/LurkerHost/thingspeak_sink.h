@@ -0,0 +1,137 @@
+#ifndef LURKER_THINGSPEAK_SINK_H
+#define LURKER_THINGSPEAK_SINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_client.h"
+#include "record_sink.h"
+#include "upload_queue.h"
+
+//////////////////////////////////////////////////////////////////////////
+// ThingSpeak Uploads
+//
+// Every node is uploaded to its own ThingSpeak channel, with the columns
+// mapped to fields in the order of Thingspeak.py (airTemp -> field1 ...).
+//
+//	[sink thread] -> per-channel UploadQueue on disk -> [upload thread] -> bulk_update.json
+//
+// The sink only appends to the queues, so a slow or unreachable server
+// never holds up ingestion. The upload thread sends up to batchSize
+// records per channel in one bulk update over a kept-alive connection,
+// at most once per interval, and backs off exponentially while the
+// server is failing. Queues live on disk, so nothing is lost across
+// restarts or outages.
+//
+// Config file, one setting per line, '#' for comments:
+//	server api.thingspeak.com 80
+//	queue /var/lib/lurker/thingspeak
+//	interval 15
+//	batch 960
+//	channel lurker0 123456 WRITEAPIKEY
+//////////////////////////////////////////////////////////////////////////
+
+const int THINGSPEAK_MIN_BACKOFF = 1000;	// ms
+const int THINGSPEAK_MAX_BACKOFF = 5 * 60 * 1000;
+const int THINGSPEAK_TIMEOUT = 10000;	// HTTP timeout in ms
+const int THINGSPEAK_SYNC_INTERVAL = 1000;	// Max rate of queue syncs in ms
+
+struct ThingSpeakChannel{
+	std::string node;
+	std::string id;
+	std::string writeKey;
+};
+
+struct ThingSpeakConfig{
+	std::string host;
+	int port;
+	std::string queuePath;	// Directory for the upload queues
+	int interval;	// Min time between bulk updates of a channel, in ms
+	size_t batchSize;	// Max records per bulk update
+	std::vector<ThingSpeakChannel> channels;
+
+	ThingSpeakConfig() :
+		host("api.thingspeak.com"),
+		port(80),
+		queuePath("thingspeak"),
+		interval(15000),
+		batchSize(960){}
+};
+
+/**
+* Read a config file
+* @return False if the file can't be read or has a bad line
+*/
+bool loadThingSpeakConfig(const char* path, ThingSpeakConfig& config);
+
+struct ThingSpeakStats{
+	std::atomic<uint64_t> queued;
+	std::atomic<uint64_t> uploaded;
+	std::atomic<uint64_t> rejected;	// Refused by the server and dropped
+	std::atomic<uint64_t> requests;
+	std::atomic<uint64_t> failures;	// Requests that will be retried
+
+	ThingSpeakStats() : queued(0), uploaded(0), rejected(0), requests(0), failures(0){}
+};
+
+class ThingSpeakSink : public RecordSink{
+public:
+	explicit ThingSpeakSink(const ThingSpeakConfig& config);
+	~ThingSpeakSink();
+
+	/**
+	* Open the queues and start uploading
+	* @return False if a queue could not be opened
+	*/
+	bool start();
+
+	/**
+	* Stop uploading; whatever is left stays queued for next time
+	*/
+	void stop();
+
+	void write(const ColumnBatch& batch);
+	void flush();
+
+	const ThingSpeakStats& stats() const{
+		return _stats;
+	}
+
+	void printStats(FILE* output);
+
+private:
+	ThingSpeakSink(const ThingSpeakSink&);
+	ThingSpeakSink& operator=(const ThingSpeakSink&);
+
+	struct Channel{
+		ThingSpeakChannel settings;
+		UploadQueue queue;
+		std::vector<QueuedRecord> pending;	// Rows of the batch being written
+		int64_t nextAttempt;
+		int backoff;
+	};
+
+	void upload();
+	bool uploadChannel(Channel& channel, std::vector<QueuedRecord>& records, std::string& body);
+
+	ThingSpeakConfig _config;
+	std::vector<Channel*> _channels;
+	std::map<std::string, Channel*> _nodes;
+	HttpClient _client;
+	ThingSpeakStats _stats;
+	int64_t _lastSync;
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _running;
+};
+
+#endif
@@ -0,0 +1,318 @@
+//////////////////////////////////////////////////////////////////////////
+// ThingSpeak Stub Server
+//
+// Local stand-in for the ThingSpeak bulk update API, for testing the
+// uploader's throughput and outage recovery offline. Accepts
+//	POST /channels/<id>/bulk_update.json
+// on kept-alive connections, answers 202 and counts the updates.
+//
+// Usage:
+//	thingspeak_stub [-p port] [-o down:up] [-x] [-l latency_ms] [-w updates.csv] [-s stats_interval]
+//
+//	-o	Cycle through outages: down for `down` seconds, then up for `up` seconds
+//	-x	During outages drop connections instead of answering 503
+//	-w	Log every update as channel,created_at to check for losses and duplicates
+//
+// Point the uploader at it with "server localhost 8080" in its config.
+//
+// Build:
+//	g++ -std=c++11 -O2 -o thingspeak_stub thingspeak_stub.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+const size_t MAX_REQUEST_SIZE = 4 * 1024 * 1024;
+
+static volatile sig_atomic_t running = 1;
+
+struct Connection{
+	int fd;
+	std::string buffer;
+};
+
+struct StubStats{
+	unsigned long connections;
+	unsigned long requests;
+	unsigned long updates;
+	unsigned long refused;
+	unsigned long long bytes;
+};
+
+static void requestShutdown(int){
+	running = 0;
+}
+
+static void printUsage(){
+	fprintf(stderr, "Usage: thingspeak_stub [-p port] [-o down:up] [-x] [-l latency_ms] [-w updates.csv] [-s stats_interval]\n");
+}
+
+static double now(){
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void sendAll(int fd, const std::string& data){
+	size_t sent = 0;
+
+	while (sent < data.size()){
+		ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (count <= 0){
+			return;
+		}
+		sent += count;
+	}
+}
+
+static void respond(int fd, int status, const char* reason, const char* body){
+	char response[256];
+	snprintf(response, sizeof(response),
+		"HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: keep-alive\r\n\r\n%s",
+		status, reason, strlen(body), body);
+	sendAll(fd, response);
+}
+
+/**
+* Log every update of a bulk update body
+*/
+static unsigned long logUpdates(FILE* log, const std::string& channel, const std::string& body){
+	unsigned long updates = 0;
+	const char* key = "\"created_at\":\"";
+
+	for (size_t at = body.find(key); at != std::string::npos; at = body.find(key, at + 1)){
+		size_t start = at + strlen(key);
+		size_t end = body.find('"', start);
+
+		if (log != NULL && end != std::string::npos){
+			fprintf(log, "%s,%s\n", channel.c_str(), body.substr(start, end - start).c_str());
+		}
+		updates++;
+	}
+
+	return updates;
+}
+
+/**
+* Handle every complete request in a connection's buffer
+* @return False if the connection should be closed
+*/
+static bool handleRequests(Connection& connection, bool down, bool dropWhenDown, int latency, FILE* log, StubStats& stats){
+	for (;;){
+		size_t headerEnd = connection.buffer.find("\r\n\r\n");
+		if (headerEnd == std::string::npos){
+			return connection.buffer.size() < MAX_REQUEST_SIZE;
+		}
+
+		std::string header = connection.buffer.substr(0, headerEnd);
+		size_t contentLength = 0;
+
+		for (size_t line = header.find("\r\n"); line != std::string::npos; line = header.find("\r\n", line + 2)){
+			if (strncasecmp(header.c_str() + line + 2, "Content-Length:", 15) == 0){
+				contentLength = strtoul(header.c_str() + line + 17, NULL, 10);
+			}
+		}
+
+		if (contentLength > MAX_REQUEST_SIZE){
+			return false;
+		}
+
+		if (connection.buffer.size() < headerEnd + 4 + contentLength){
+			return true;
+		}
+
+		std::string body = connection.buffer.substr(headerEnd + 4, contentLength);
+		connection.buffer.erase(0, headerEnd + 4 + contentLength);
+
+		stats.requests++;
+		stats.bytes += headerEnd + 4 + contentLength;
+
+		if (down){
+			stats.refused++;
+			if (dropWhenDown){
+				return false;
+			}
+			respond(connection.fd, 503, "Service Unavailable", "{\"error\":\"down\"}");
+			continue;
+		}
+
+		// POST /channels/<id>/bulk_update.json HTTP/1.1
+		char channel[64];
+		if (strncmp(header.c_str(), "POST ", 5) != 0 ||
+			sscanf(header.c_str(), "POST /channels/%63[^/]/bulk_update.json", channel) != 1){
+			respond(connection.fd, 404, "Not Found", "{\"error\":\"not found\"}");
+			continue;
+		}
+
+		if (body.find("\"write_api_key\"") == std::string::npos){
+			respond(connection.fd, 400, "Bad Request", "{\"error\":\"no write_api_key\"}");
+			continue;
+		}
+
+		if (latency > 0){
+			usleep(latency * 1000);
+		}
+
+		stats.updates += logUpdates(log, channel, body);
+		respond(connection.fd, 202, "Accepted", "{\"success\":true}");
+	}
+}
+
+int main(int argc, char** argv){
+	int port = 8080;
+	double downTime = 0;
+	double upTime = 0;
+	bool dropWhenDown = false;
+	int latency = 0;
+	int statsInterval = 5;
+	FILE* log = NULL;
+	int option;
+
+	while ((option = getopt(argc, argv, "p:o:xl:w:s:h")) != -1){
+		switch (option){
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'o':
+			if (sscanf(optarg, "%lf:%lf", &downTime, &upTime) != 2){
+				printUsage();
+				return 1;
+			}
+			break;
+		case 'x':
+			dropWhenDown = true;
+			break;
+		case 'l':
+			latency = atoi(optarg);
+			break;
+		case 'w':
+			log = fopen(optarg, "w");
+			if (log == NULL){
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			statsInterval = atoi(optarg);
+			break;
+		default:
+			printUsage();
+			return 1;
+		}
+	}
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+
+	if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0){
+		perror("bind");
+		return 1;
+	}
+
+	signal(SIGINT, requestShutdown);
+	signal(SIGTERM, requestShutdown);
+
+	fprintf(stderr, "==== ThingSpeak stub on port %d ====\n", port);
+
+	std::vector<Connection> connections;
+	StubStats stats = { 0, 0, 0, 0, 0 };
+	double started = now();
+	double lastStats = started;
+	unsigned long lastUpdates = 0;
+
+	while (running){
+		std::vector<struct pollfd> pollers(connections.size() + 1);
+
+		pollers[0].fd = listener;
+		pollers[0].events = POLLIN;
+		for (size_t i = 0; i < connections.size(); i++){
+			pollers[i + 1].fd = connections[i].fd;
+			pollers[i + 1].events = POLLIN;
+		}
+
+		if (poll(&pollers[0], pollers.size(), 200) < 0 && errno != EINTR){
+			break;
+		}
+
+		double elapsed = now() - started;
+		bool down = downTime > 0 && fmod(elapsed, downTime + upTime) < downTime;
+
+		// Serve existing connections first; new ones are appended after the loop
+		for (size_t i = connections.size(); i-- > 0;){
+			if (!(pollers[i + 1].revents & (POLLIN | POLLHUP | POLLERR))){
+				continue;
+			}
+
+			char chunk[16384];
+			ssize_t count = recv(connections[i].fd, chunk, sizeof(chunk), 0);
+
+			bool open = count > 0;
+			if (open){
+				connections[i].buffer.append(chunk, count);
+				open = handleRequests(connections[i], down, dropWhenDown, latency, log, stats);
+			}
+
+			if (!open){
+				close(connections[i].fd);
+				connections.erase(connections.begin() + i);
+			}
+		}
+
+		if (pollers[0].revents & POLLIN){
+			int fd = accept(listener, NULL, NULL);
+
+			if (fd >= 0){
+				Connection connection;
+				connection.fd = fd;
+				connections.push_back(connection);
+				stats.connections++;
+			}
+		}
+
+		double current = now();
+		if (statsInterval > 0 && current - lastStats >= statsInterval){
+			fprintf(stderr, "%s connections=%lu requests=%lu updates=%lu (%.0f/s) refused=%lu bytes=%llu\n",
+				down ? "[down]" : "[up]  ", stats.connections, stats.requests, stats.updates,
+				(stats.updates - lastUpdates) / (current - lastStats), stats.refused, stats.bytes);
+
+			if (log != NULL){
+				fflush(log);
+			}
+
+			lastStats = current;
+			lastUpdates = stats.updates;
+		}
+	}
+
+	for (size_t i = 0; i < connections.size(); i++){
+		close(connections[i].fd);
+	}
+	close(listener);
+
+	if (log != NULL){
+		fclose(log);
+	}
+
+	fprintf(stderr, "connections=%lu requests=%lu updates=%lu refused=%lu\n",
+		stats.connections, stats.requests, stats.updates, stats.refused);
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) :
+	_task(NULL), _count(0), _next(0), _busy(0), _generation(0), _stopping(false){
+	if (threads == 0){
+		threads = std::thread::hardware_concurrency();
+	}
+
+	try{
+		for (size_t i = 1; i < threads; i++){
+			_threads.push_back(std::thread(&ThreadPool::work, this));
+		}
+	}
+	catch (...){
+		// The destructor won't run, and joinable threads can't be destroyed
+		stop();
+		throw;
+	}
+}
+
+ThreadPool::~ThreadPool(){
+	stop();
+}
+
+void ThreadPool::stop(){
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+
+	_wake.notify_all();
+
+	for (size_t i = 0; i < _threads.size(); i++){
+		_threads[i].join();
+	}
+}
+
+/**
+* Take task indices until there are none left
+*/
+void ThreadPool::runTasks(){
+	for (size_t i = _next++; i < _count; i = _next++){
+		(*_task)(i);
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& task){
+	if (count == 0){
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_task = &task;
+		_count = count;
+		_next = 0;
+		_busy = _threads.size();
+		_generation++;
+	}
+
+	_wake.notify_all();
+	runTasks();
+
+	// The task has to outlive every worker that might still be calling it
+	std::unique_lock<std::mutex> lock(_mutex);
+	_done.wait(lock, [this]{ return _busy == 0; });
+	_task = NULL;
+}
+
+void ThreadPool::work(){
+	uint64_t generation = 0;
+
+	for (;;){
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this, generation]{ return _stopping || _generation != generation; });
+
+			if (_stopping){
+				return;
+			}
+
+			generation = _generation;
+		}
+
+		runTasks();
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (--_busy == 0){
+			_done.notify_one();
+		}
+	}
+}
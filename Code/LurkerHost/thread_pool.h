@@ -0,0 +1,56 @@
+#ifndef LURKER_THREAD_POOL_H
+#define LURKER_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+/**
+* Fixed set of worker threads for parallel loops
+* Tasks are handed out one index at a time, so uneven tasks (e.g. nodes
+* with more history than others) still spread across the workers.
+*/
+class ThreadPool{
+public:
+	/**
+	* @param threads Number of threads to run tasks on, including the caller; 0 for one per core
+	*/
+	explicit ThreadPool(size_t threads = 0);
+	~ThreadPool();
+
+	/**
+	* Call task(i) for every i in [0, count) and wait for all of them
+	* The calling thread works through tasks too. Not reentrant.
+	*/
+	void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+	size_t size() const{
+		return _threads.size() + 1;
+	}
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void stop();
+	void work();
+	void runTasks();
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+
+	const std::function<void(size_t)>* _task;
+	size_t _count;
+	std::atomic<size_t> _next;
+	size_t _busy;	// Workers still inside the current loop
+	uint64_t _generation;	// Bumped for every loop so workers join each one once
+	bool _stopping;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "upload_queue.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+UploadQueue::UploadQueue() : _logFd(-1), _offsetFd(-1), _head(0), _tail(0){
+}
+
+UploadQueue::~UploadQueue(){
+	close();
+}
+
+bool UploadQueue::open(const std::string& path){
+	close();
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_logFd = ::open((path + ".log").c_str(), O_RDWR | O_CREAT, 0644);
+	_offsetFd = ::open((path + ".offset").c_str(), O_RDWR | O_CREAT, 0644);
+	if (_logFd < 0 || _offsetFd < 0){
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(_logFd, &info) != 0){
+		return false;
+	}
+
+	// Drop a record torn by a crash mid-write
+	_tail = info.st_size - info.st_size % sizeof(QueuedRecord);
+	if (uint64_t(info.st_size) != _tail && ftruncate(_logFd, _tail) != 0){
+		return false;
+	}
+
+	uint64_t offset = 0;
+	if (pread(_offsetFd, &offset, sizeof(offset), 0) != sizeof(offset)){
+		offset = 0;
+	}
+
+	_head = offset <= _tail ? offset - offset % sizeof(QueuedRecord) : 0;
+	return true;
+}
+
+void UploadQueue::close(){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_logFd >= 0){
+		fdatasync(_logFd);
+		::close(_logFd);
+	}
+
+	if (_offsetFd >= 0){
+		::close(_offsetFd);
+	}
+
+	_logFd = -1;
+	_offsetFd = -1;
+	_head = 0;
+	_tail = 0;
+}
+
+bool UploadQueue::writeOffset(uint64_t offset){
+	return pwrite(_offsetFd, &offset, sizeof(offset), 0) == sizeof(offset) && fdatasync(_offsetFd) == 0;
+}
+
+bool UploadQueue::push(const QueuedRecord* records, size_t count){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_logFd < 0){
+		return false;
+	}
+
+	const char* p = reinterpret_cast<const char*>(records);
+	size_t length = count * sizeof(QueuedRecord);
+
+	while (length > 0){
+		ssize_t written = pwrite(_logFd, p, length, _tail);
+
+		if (written < 0){
+			if (errno == EINTR){
+				continue;
+			}
+
+			// Cut back to the last whole record
+			_tail -= _tail % sizeof(QueuedRecord);
+			return false;
+		}
+
+		p += written;
+		length -= written;
+		_tail += written;
+	}
+
+	return true;
+}
+
+bool UploadQueue::sync(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _logFd >= 0 && fdatasync(_logFd) == 0;
+}
+
+size_t UploadQueue::peek(std::vector<QueuedRecord>& records, size_t max){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	size_t count = std::min<uint64_t>(max, (_tail - _head) / sizeof(QueuedRecord));
+	records.resize(count);
+
+	if (count > 0 && pread(_logFd, &records[0], count * sizeof(QueuedRecord), _head) != ssize_t(count * sizeof(QueuedRecord))){
+		records.clear();
+		return 0;
+	}
+
+	return count;
+}
+
+bool UploadQueue::commit(size_t count){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	uint64_t head = std::min<uint64_t>(_head + count * sizeof(QueuedRecord), _tail);
+
+	// Everything sent - start the log over. The offset is reset first: a
+	// crash in between resends the old log rather than skipping new records.
+	if (head == _tail){
+		if (!writeOffset(0) || ftruncate(_logFd, 0) != 0){
+			return false;
+		}
+
+		_head = 0;
+		_tail = 0;
+		return true;
+	}
+
+	if (!writeOffset(head)){
+		return false;
+	}
+
+	_head = head;
+	return true;
+}
+
+uint64_t UploadQueue::size(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	return (_tail - _head) / sizeof(QueuedRecord);
+}
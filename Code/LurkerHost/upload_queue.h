@@ -0,0 +1,78 @@
+#ifndef LURKER_UPLOAD_QUEUE_H
+#define LURKER_UPLOAD_QUEUE_H
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+
+/**
+* One queued reading of a node
+* Missing values are NaN.
+*/
+struct QueuedRecord{
+	int64_t time;	// ms since the epoch
+	float values[COLUMN_COUNT];
+};
+
+/**
+* Persistent FIFO of records waiting to be uploaded
+*	<path>.log		- records, appended
+*	<path>.offset	- byte offset of the first record not yet uploaded
+*
+* Records are only removed once the upload has been confirmed, so a
+* restart resends anything that was in flight: duplicates are possible,
+* losses are not. The log is truncated whenever it has been fully sent.
+*
+* push() and the reading side may be called from different threads.
+*/
+class UploadQueue{
+public:
+	UploadQueue();
+	~UploadQueue();
+
+	bool open(const std::string& path);
+	void close();
+
+	/**
+	* Append records to the log
+	*/
+	bool push(const QueuedRecord* records, size_t count);
+
+	/**
+	* Make pushed records durable
+	*/
+	bool sync();
+
+	/**
+	* Copy up to max records from the front of the queue without removing them
+	* @return Number of records copied
+	*/
+	size_t peek(std::vector<QueuedRecord>& records, size_t max);
+
+	/**
+	* Remove records from the front once they have been uploaded
+	*/
+	bool commit(size_t count);
+
+	/**
+	* Number of records waiting
+	*/
+	uint64_t size();
+
+private:
+	UploadQueue(const UploadQueue&);
+	UploadQueue& operator=(const UploadQueue&);
+
+	bool writeOffset(uint64_t offset);
+
+	std::mutex _mutex;
+	int _logFd;
+	int _offsetFd;
+	uint64_t _head;	// Byte offset of the first waiting record
+	uint64_t _tail;	// End of the log
+};
+
+#endif
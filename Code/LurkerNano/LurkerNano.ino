@@ -1,20 +1,28 @@
 #include <dht.h>
-#include <CommandHandler.h>
 #include <RF24_config.h>
 #include <RF24.h>
 #include <nRF24L01.h>
 #include <Logging.h>
 #include <SPI.h>
-#include <StraightBuffer.h>
 #include <SimpleTimer.h>
-#include <Wire.h>
+#include <AsyncTwi.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
-#include <BH1750FVI.h>
 #include <JsonGenerator.h>
+#include <SPIFlash.h>
+#include <EEPROM.h>
 #include "avr/wdt.h"
 #include "avr/pgmspace.h"
 #include "lurker_settings.h"
+#include "lurker_bench.h"
+#include "lurker_memory.h"
+#include "lurker_dispatch.h"
+#include "lurker_network.h"
+#include "lurker_update.h"
+#include "lurker_group.h"
+#include "lurker_ir.h"
+#include "lurker_pattern.h"
+#include "lurker_health.h"
 
 using namespace ArduinoJson::Generator;
 
@@ -31,69 +39,148 @@ const float LURKER_VERSION = 0.9;
 //	- Humidity
 //	- Illuminance
 //	- Motion
-//	- IR Receiver (not implemented)
+//	- IR Receiver
 //
 // Actuators:
-//	- Buzzer (active)
+//	- Buzzer (passive)
 //	- IR Blaster
 //	- 2 LEDs
 //
 //////////////////////////////////////////////////////////////////////////
 // Hardware Config
 
-// Temperature
+// Temperature - conversions run on the probe, and are read back from the loop
 OneWire oneWire(TEMPERATURE_PIN);
 DallasTemperature tempSensor(&oneWire);
+DeviceAddress temperatureAddress;
+float temperatureReading;	// Last reading, in degrees Celsius
+unsigned long temperatureReadTime;
+unsigned long sampleTime;	// When the sample timer last ran
+bool temperatureConverting;	// Started at temperatureReadTime, not yet read back
+bool temperatureValid;	// temperatureReading holds a reading
 
 // Humidity
 dht humiditySensor;
 
-// Illuminance
-BH1750FVI lightSensor;
+// Illuminance - TWI transactions, finished off by its interrupt
+const uint8_t BH1750_POWER_ON = 0x01;
+const uint8_t BH1750_CONTINUOUS_HIGH_RES = 0x10;
+const uint8_t lightCommands[] = { BH1750_POWER_ON, BH1750_CONTINUOUS_HIGH_RES };
+uint8_t lightData[2];
+void lightReadFinished(TwiTransaction& transaction);
+TwiTransaction lightPowerOn = { LIGHT_ADDRESS, &lightCommands[0], 1, 0, 0, 0 };
+TwiTransaction lightMode = { LIGHT_ADDRESS, &lightCommands[1], 1, 0, 0, 0 };
+TwiTransaction lightRead = { LIGHT_ADDRESS, 0, 0, lightData, sizeof(lightData), lightReadFinished };
+volatile uint16_t lightCount;	// Last reading, in the sensor's counts
+unsigned long lightReadTime;
+bool lightReadQueued;	// Not yet counted towards the sensor's health
+volatile bool lightValid;	// lightCount holds a reading
+
+// Sensor health - sensors that keep failing are left out of samples
+const HealthConfig healthConfig = { SENSOR_FAILURE_LIMIT, SENSOR_FIRST_RETRY, SENSOR_MAX_RETRY };
+SensorHealth temperatureHealth(healthConfig);
+SensorHealth humidityHealth(healthConfig);
+SensorHealth illuminanceHealth(healthConfig);
 
 // Motion
 bool motionDetected;
 long timeOfLastMotion;
 
+// IR receiver - pulses are queued by the pin-change interrupt and decoded in the loop
+IrPulseQueue irPulses;
+IrDecoder irDecoder;
+
+// IR blaster - the Timer2 interrupt plays codes out a carrier cycle at a time
+IrPlayer irPlayer;
+volatile uint16_t irCyclesLeft;
+
 // Buzzer
 RF24 radio(CE_PIN, CSN_PIN);
 
 // Lights
 int leds[] = { LED0, LED1, LED_BUILTIN };
 
+// Light and buzzer patterns - the Timer1 interrupt plays them
+class PatternOutput : public PatternHandler{
+public:
+	void output(uint8_t channel, uint16_t value);
+};
+
+PatternOutput patternOutput;
+PatternChannel patternChannels[NUM_PATTERN_CHANNELS];
+PatternPlayer patterns(patternOutput, patternChannels, NUM_PATTERN_CHANNELS);
+volatile bool toneOn;
+volatile uint16_t patternPeriod;	// us between interrupts
+volatile uint16_t patternTime;	// us towards the next ms
+
+// Firmware image store, for the bootloader to flash from
+SPIFlash flash(FLASH_CS_PIN, FLASH_JEDEC_ID);
+bool flashFound;
+
 
 //////////////////////////////////////////////////////////////////////////
 // Soft Config
 
 // Sample Timer
 SimpleTimer timer;
-int joinTimerID;
-int networkTimeoutTimerID;
 int printDataTimerID;
 int motionTimerId;
 
 // Communication
-bool connectedToNetwork = false;
-
 String received = "";
 bool recording = false;
 
-// Radio Buffer
-byte _readBuffer[BUFFER_LENGTH];
-byte _writeBuffer[BUFFER_LENGTH];
-StraightBuffer readBuffer(_readBuffer, BUFFER_LENGTH);
-StraightBuffer writeBuffer(_writeBuffer, BUFFER_LENGTH);
-
-// Coordinator - Routing table
-int routingTable[MAX_NETWORK_SIZE];
+// Radio Buffer - packets are received into it and handled where they lie
+uint8_t radioPayload[NETWORK_PAYLOAD_SIZE];
+
+// Network - runs the radio protocol, calling back into the sketch
+class RadioHandler : public NetworkHandler, public UpdateHandler, public GroupHandler{
+public:
+	void transmit(uint8_t unit, const uint8_t* packet, uint8_t length);
+	void readSensors(SensorReading& reading);
+	void readingReceived(const SensorReading& reading);
+	void networkEvent(NetworkEvent event, uint8_t unit);
+
+	bool eraseImage(uint16_t size);
+	void writeImage(uint16_t offset, const uint8_t* data, uint8_t length);
+	void readImage(uint16_t offset, uint8_t* data, uint8_t length);
+	void activateImage(uint16_t size, uint32_t crc);
+	uint32_t installedImage();
+	void requestBlocks(uint16_t first, uint8_t count);
+	void targetFinished(uint8_t unit, UpdateState state);
+	void updateFinished();
+
+	void groupCommand(const uint8_t* command, uint8_t length);
+};
+
+RadioHandler radioHandler;
+NetworkRoute routingTable[MAX_NETWORK_SIZE];
+const NetworkConfig networkConfig = { NODE_TIMEOUT, NETWORK_JOIN_INTERVAL, POLL_INTERVAL };
+LurkerNetwork network(UNIT_NUMBER, networkConfig, radioHandler, routingTable, MAX_NETWORK_SIZE);
+
+// Firmware updates - the coordinator sends them, nodes receive them
+UpdateTarget updateTargets[UPDATE_TARGETS];
+uint8_t updateWindow[UPDATE_WINDOW_BUFFER];
+const UpdateConfig updateConfig = { UPDATE_START_DELAY, UPDATE_POLL_TIMEOUT, UPDATE_POLL_RETRIES,
+	UPDATE_WINDOW_ROUNDS, UPDATE_HOST_TIMEOUT, UPDATE_ACTIVATE_TIMEOUT };
+UpdateSender updateSender(updateConfig, radioHandler, routingTable, updateTargets,
+	UNIT_NUMBER == COORDINATOR ? UPDATE_TARGETS : 0, updateWindow);
+UpdateReceiver updateReceiver(UNIT_NUMBER, radioHandler);
+
+// Group commands - one broadcast for many nodes
+const GroupConfig groupConfig = { GROUP_REPEATS, GROUP_REPEAT_INTERVAL, GROUP_DUPLICATE_WINDOW };
+uint8_t groupBroadcast[GROUP_SEND_BUFFER];
+GroupCaster groupCaster(UNIT_GROUPS, groupConfig, radioHandler, UNIT_NUMBER == COORDINATOR ? groupBroadcast : 0);
 
 // Sensor data object
+SensorReading localReading;
 JsonObject<8> sensorData;
 JsonObject<5> remoteData;
 
-// Command handlers
-char _commandCache[BUFFER_LENGTH];
-CommandHandler commandHandler(_commandCache, BUFFER_LENGTH);
+// Frame dispatch - serial commands and radio packets
+uint8_t _serialFrame[SERIAL_FRAME_LENGTH];
+FrameRoute frameRoutes[FRAME_HANDLERS];
+FrameDispatcher dispatcher(PACKET_END, frameRoutes, FRAME_HANDLERS);
 
 // Logger 
 char p_buffer[80];
@@ -115,20 +202,37 @@ void setup()
 
 	// Start all the things
 	startSensors();
+	startIrReceiver();
 	initialiseBuzzer();
+	startIrBlaster();
 	initialiseRadio();
 	initialiseLights();
-	startCommandHandler();
+	startImageStore();
+	startDispatcher();
+	startMemoryMonitor();
 }
 
 /**
 * Main Loop
 */
 void loop(){
+	BENCH_BEGIN(BENCH_LOOP);
+
+	BENCH_BEGIN(BENCH_TIMER);
 	timer.run();
+	network.update(millis());
+	updateSender.update(millis());
+	groupCaster.update(millis());
+	BENCH_END(BENCH_TIMER);
 
 	checkSerial();
-	//checkRadio();
+	checkRadio();
+	checkIr();
+	checkTemperature();
+	checkIlluminance();
+	retrySensors();
+
+	BENCH_END(BENCH_LOOP);
 }
 
 
@@ -136,16 +240,29 @@ void loop(){
 // Communication - Wired
 
 // Periodic function - Transmit sensor data over serial
+/**
+* Take the periodic sample, noting when so the next temperature
+* conversion can be lined up with the one after
+*/
+void sampleSensors(){
+	sampleTime = millis();
+	printSensorData();
+}
+
 /**
 * Send sensor data to the connected device
 * Sensor data is structured in JSON format
 */
 void printSensorData(){
+	BENCH_BEGIN(BENCH_READ_SENSORS);
 	readSensors();
+	BENCH_END(BENCH_READ_SENSORS);
 
+	BENCH_BEGIN(BENCH_PRINT_JSON);
 	Serial.print(PACKET_START);
 	Serial.print(sensorData);
 	Serial.println(PACKET_END);
+	BENCH_END(BENCH_PRINT_JSON);
 }
 
 /**
@@ -153,59 +270,145 @@ void printSensorData(){
 */
 void checkSerial(){
 	while (Serial.available()){
-		char inChar = Serial.read();
-		commandHandler.readIn(inChar);
+		uint8_t inByte = Serial.read();
+
+		BENCH_BEGIN(BENCH_SERIAL_COMMAND);
+		dispatcher.readIn(FRAME_SERIAL, inByte);
+		BENCH_END(BENCH_SERIAL_COMMAND);
 	}
 }
 
 /**
-* Bind commands for the serial and rf24 interface
+* Bind the serial commands and radio packets to their handlers
+* Each source only reaches the handlers registered for it, so a radio
+* packet can't run a serial command or the other way round.
 */
-void startCommandHandler(){
+void startDispatcher(){
 	Log.Debug(P("Adding commands"));
 
-	commandHandler.setTerminator(PACKET_END);
+	dispatcher.attachBuffer(FRAME_SERIAL, _serialFrame, sizeof(_serialFrame));
 	Log.Info(P("Terminate characters with a '%c' character"), PACKET_END);
-	commandHandler.setDefaultHandler(commandNotRecognised);
+	dispatcher.setDefaultHandler(commandNotRecognised);
 
 	// User functions
-	commandHandler.addCommand(BUZZER_ON_CODE, buzzerOn);
-	Log.Info(P("%c - Buzzer ON"), BUZZER_ON_CODE);
+	addRoute(BUZZER_ON_CODE, FROM_SERIAL | FROM_GROUP, buzzerOnCommand);
+	Log.Info(P("%c - Buzzer ON, or %c1-%i for other tones"), BUZZER_ON_CODE, BUZZER_ON_CODE, NUM_BUZZER_PATTERNS - 1);
 
-	commandHandler.addCommand(BUZZER_OFF_CODE, buzzerOff);
+	addRoute(BUZZER_OFF_CODE, FROM_SERIAL | FROM_GROUP, buzzerOffCommand);
 	Log.Info(P("%c - Buzzer OFF"), BUZZER_OFF_CODE);
 
-	commandHandler.addCommand(SENSOR_READ_REQUEST, printSensorData);
+	addRoute(IR_SEND_CODE, FROM_SERIAL | FROM_GROUP, irSendCommand);
+	Log.Info(P("%c - Send IR code, e.g. %c0"), IR_SEND_CODE, IR_SEND_CODE);
+
+	addRoute(SENSOR_READ_REQUEST, FROM_SERIAL, sensorReadCommand);
 	Log.Info(P("%c - Read sensors"), SENSOR_READ_REQUEST);
 
-	// Internal functions
+	addRoute(STATUS_CODE, FROM_SERIAL, printStatus);
+	Log.Info(P("%c - Memory status"), STATUS_CODE);
+
+	// Commands for the coordinator to pass on
 	if (UNIT_NUMBER == COORDINATOR){
-		commandHandler.addCommand(NETWORK_JOIN_REQUEST, addNodeToNetwork);
-		commandHandler.addCommand(DATA_TRANSMIT_RESPONSE, resetRemoteDataStorage);
-		commandHandler.addCommand(UNIT_ID_CODE, readRemoteUnitNumber);
-		commandHandler.addCommand(TEMPERATURE_CODE, readRemoteTemperature);
-		commandHandler.addCommand(HUMIDITY_CODE, readRemoteHumidity);
-		commandHandler.addCommand(ILLUMINANCE_CODE, readRemoteIlluminance);
-		commandHandler.addCommand(MOTION_CODE, readRemoteMotion);
-		commandHandler.addCommand(DATA_PACKET_FINISHED, processRemoteDataPacket);
+		addRoute(GROUP_COMMAND, FROM_SERIAL, groupSerialCommand);
+		Log.Info(P("%c - Group command, e.g. %c01%c"), GROUP_COMMAND, GROUP_COMMAND, BUZZER_ON_CODE);
+
+		addRoute(UPDATE_START, FROM_SERIAL, updateCommand);
+		addRoute(UPDATE_DATA_COMMAND, FROM_SERIAL, updateCommand);
+		addRoute(UPDATE_CANCEL_COMMAND, FROM_SERIAL, updateCommand);
+		Log.Info(P("%c - Firmware update"), UPDATE_START);
+	}
+
+#ifdef LURKER_BENCH
+	addRoute(BENCH_PACKET_CODE, FROM_SERIAL, benchPreparePacket);
+#endif
+
+	// Network protocol
+	addRoute(NETWORK_JOIN_REQUEST, FROM_RADIO, networkPacket);
+	addRoute(NETWORK_JOIN_CONFIRM, FROM_RADIO, networkPacket);
+	addRoute(DATA_TRANSMIT_REQUEST, FROM_RADIO, networkPacket);
+	addRoute(DATA_TRANSMIT_RESPONSE, FROM_RADIO, networkPacket);
+	addRoute(UPDATE_START, FROM_RADIO, updatePacket);
+	addRoute(UPDATE_BLOCK, FROM_RADIO, updatePacket);
+	addRoute(UPDATE_POLL, FROM_RADIO, updatePacket);
+	addRoute(UPDATE_ACTIVATE, FROM_RADIO, updatePacket);
+	addRoute(UPDATE_STATUS, FROM_RADIO, updateStatusPacket);
+	addRoute(GROUP_CODE, FROM_RADIO, groupPacket);
+	addRoute(IR_EVENT_CODE, FROM_RADIO, irEventPacket);
+}
+
+/**
+* Add a handler to the dispatcher, saying so if it's dropped
+* A handler the table has no room for leaves its command dead, so
+* FRAME_HANDLERS has to count every call.
+*/
+void addRoute(char code, uint8_t sources, FrameHandler handler){
+	if (!dispatcher.addHandler(code, sources, handler)){
+		Log.Error(P("Error - No room for the [%c] handler; raise FRAME_HANDLERS"), code);
 	}
+}
 
+void buzzerOnCommand(const FrameView& frame){
+	uint8_t index;
+
+	if (readIndex(frame, NUM_BUZZER_PATTERNS, index)){
+		playPattern(BUZZER_CHANNEL, (const PatternStep*)pgm_read_word(&BUZZER_PATTERNS[index]));
+		Log.Debug(P("Buzzer On, tone %i"), index);
+	}
 	else{
-		commandHandler.addCommand(NETWORK_JOIN_CONFIRM, processNetworkJoin);
-		commandHandler.addCommand(DATA_TRANSMIT_REQUEST, transmitDataPacket);
+		Log.Error(P("No such tone, there are %i"), NUM_BUZZER_PATTERNS);
 	}
 }
 
+void buzzerOffCommand(const FrameView&){
+	stopPattern(BUZZER_CHANNEL);
+	Log.Debug(P("Buzzer Off"));
+}
+
+void sensorReadCommand(const FrameView&){
+	printSensorData();
+}
+
+/**
+* Callback for a frame nothing handles
+*/
+void commandNotRecognised(const FrameView& frame){
+	Log.Error(P("Warning - Unknown command [%c] from source %i"), frame.code(), frame.source);
+}
+
 /**
-* Callback for an unknown command
+* Read the decimal index after a command's code, e.g. the 2 in X2
+*
+* Arguments:
+*	frame - Command, with or without an index; without, it's 0
+*	count - Number of things it can index
+*	index - Set to the index read
+*
+* Returns:
+*	False if the index isn't a number, or is out of range
 */
-void commandNotRecognised(const char command){
-	Log.Error(P("Warning - Unknown command [%c]"), char(command));
+bool readIndex(const FrameView& frame, uint8_t count, uint8_t& index){
+	unsigned int value = 0;
+
+	for (uint8_t i = 1; i + 1 < frame.length; i++){
+		if (frame.data[i] < '0' || frame.data[i] > '9'){
+			return false;
+		}
+
+		value = value * 10 + (frame.data[i] - '0');
+		if (value >= count){
+			return false;
+		}
+	}
+
+	index = value;
+	return value < count;
 }
 
 
 //////////////////////////////////////////////////////////////////////////
 // Communication - Wireless
+//
+// The protocol itself is in lurker_network.cpp; this is the glue to the
+// RF24 and the rest of the sketch.
 
 /**
 * Initialise the RF24 radio
@@ -216,23 +419,20 @@ void initialiseRadio(){
 	radio.setDataRate(RF24_1MBPS);
 	radio.setPALevel(RF24_PA_MAX);
 	radio.setRetries(15, 15);
-	connectedToNetwork = false;
-
-	// Open communication channels
-	radio.openWritingPipe(BASE_PIPE);
 
-	radio.openReadingPipe(1, UNIT_PIPE);
-	Log.Debug(P("Reading pipe: %l"), UNIT_PIPE);
+	// Packets are only as long as their frame, on air and when read
+	radio.enableDynamicPayloads();
 
-	radio.openReadingPipe(2, BROADCAST_PIPE);
-	Log.Debug(P("Reading pipe: %l"), BROADCAST_PIPE);
+	// Broadcasts go unacknowledged rather than retried to exhaustion
+	radio.enableDynamicAck();
 
-	// Set up network joining
-	if (UNIT_NUMBER != COORDINATOR){
-		timer.setInterval(NETWORK_JOIN_INTERVAL, joinNetwork);
-	}
+	// Open communication channels
+	radio.openReadingPipe(UNIT_READING_PIPE, UNIT_PIPE);
+	radio.openReadingPipe(BROADCAST_READING_PIPE, BROADCAST_PIPE);
+	Log.Debug(P("Reading pipes: unit %i and broadcast"), UNIT_NUMBER);
 
 	radio.startListening();
+	network.begin(millis());
 
 	Log.Debug(P("Radio started"));
 }
@@ -241,305 +441,310 @@ void initialiseRadio(){
 * Check the radio for any incoming packets.
 */
 void checkRadio(){
-	if (radio.available()){
-
-		Log.Info(P("Packet received"));
-		readRadioPacket();
+	uint8_t pipe;
 
-		// Get rid of any unfinished serial commands in the buffer
-		commandHandler.clearCache();
+	if (radio.available(&pipe)){
+		uint8_t length = readRadioPacket();
+		Log.Debug(P("Packet of %i bytes received on pipe %i"), length, pipe);
 
-		// Read in the packet, one byte at a time
-		char command = readBuffer.read();
-		while (readBuffer.available() && command != 0){
-			command = readBuffer.read();
-			commandHandler.readIn(command);
-
-			Log.Debug(P("Command: [%i]"), command);
+		if (length > 0){
+			dispatcher.dispatch(pipe == BROADCAST_READING_PIPE ? FRAME_BROADCAST : FRAME_RADIO,
+				radioPayload, length);
 		}
 	}
 }
 
 /**
-* Read the incoming radio packet into the read buffer
+* Read the incoming radio packet into the payload buffer
+*
+* Returns:
+*	Payload length, or 0 if the radio reported a corrupt one
 */
-void readRadioPacket(){
-	radio.read(readBuffer.getBufferAddress(), BUFFER_LENGTH);
-	readBuffer.setWritePosition(BUFFER_LENGTH);
+uint8_t readRadioPacket(){
+	uint8_t length = radio.getDynamicPayloadSize();
+
+	// The driver flushes corrupt payloads and reports them as empty
+	if (length == 0 || length > sizeof(radioPayload)){
+		Log.Error(P("Warning - Bad radio payload length %i"), length);
+		return 0;
+	}
+
+	radio.read(radioPayload, length);
+	return length;
 }
 
 /**
-* Transmit a character to the specified node
+* Hand a radio packet to the network protocol
 */
-void transmitChar(char message){
-	radio.stopListening();
-	radio.write(&message, 1);
-	radio.startListening();
-
-	Log.Verbose(P("Sending: %c"), message);
+void networkPacket(const FrameView& frame){
+	network.receive(frame.data, frame.length, millis());
 }
 
-
-//////////////////////////////////////////////////////////////////////////
-// Coordinator Functions
-
 /**
-* Change a units' status to active in the routing table
+* Hand a firmware update packet to the node's receiver
 */
-void addNodeToNetwork(){
-	char unitNum = commandHandler.next();
-
-	// Units are numbered sequentially, make sure the number is not too high
-	if (unitNum <= MAX_NETWORK_SIZE){
-		routingTable[unitNum] = timer.setTimeout(NODE_TIMEOUT, cleanRoutingTable);
-		Log.Info(P("Unit %i joined the network"), unitNum);
-	}
+void updatePacket(const FrameView& frame){
+	updateReceiver.receive(frame.data, frame.length);
 }
 
 /**
-* Go through the routing table and disable units that have timed out
+* Hand a node's update status to the coordinator's sender
 */
-void cleanRoutingTable(){
-	for (int i = 0; i < MAX_NETWORK_SIZE; i++){
-
-		// Active units have a timer ID higher than -1.
-		if (routingTable[i] >= 0){
-
-			// Clear any units from the routing table that are non-responsive
-			if (!timer.isEnabled(routingTable[i])){
-				Log.Info(P("Unit %i timed out"), i);
-				routingTable[i] = -1;
-			}
-		}
-	}
+void updateStatusPacket(const FrameView& frame){
+	updateSender.receive(frame.data, frame.length, millis());
 }
 
 /**
-* Reset the remote data values to prepare for a new packet
+* Hand a group command packet to the group caster
 */
-void resetRemoteDataStorage(){
-	remoteData[ID] = "None";
-	remoteData[TEMPERATURE] = 0.0;
-	remoteData[HUMIDITY] = 0;
-	remoteData[ILLUMINANCE] = 0;
-	remoteData[MOTION] = false;
+void groupPacket(const FrameView& frame){
+	groupCaster.receive(frame.data, frame.length, millis());
 }
 
 /**
-* Read in the unit number from the received packet
+* Transmit a packet to the specified unit
 */
-void readRemoteUnitNumber(){
-	char arg = commandHandler.next();
-	int unitNumber = byte(arg);
+void RadioHandler::transmit(uint8_t unit, const uint8_t* packet, uint8_t length){
+	radio.stopListening();
+	radio.openWritingPipe(BASE_PIPE + unit);
+	radio.write(packet, length, unit == BROADCAST);
+	radio.startListening();
+}
 
-	if (unitNumber < MAX_NETWORK_SIZE){
-		remoteData[ID] = unitNumber;
+void RadioHandler::readSensors(SensorReading& reading){
+	prepareDataPacket(reading);
+}
 
-		// Reset the timeout of the sender
-		resetTimeout(unitNumber);
-	}
+void RadioHandler::readingReceived(const SensorReading& reading){
+	processRemoteDataPacket(reading);
 }
 
 /**
-* Read in the temperature from the received packet
+* Erase the image store ahead of a new image
+* The bootloader's header isn't written until the image checks out, so an
+* interrupted update leaves nothing for it to flash.
+*
+* Returns:
+*	False if there's no flash chip to store the image in
 */
-void readRemoteTemperature(){
-	char argHigh = commandHandler.next();
-	char argLow = commandHandler.next();
-	float temperature = word(argHigh, argLow);
-	temperature /= 100.0;
+bool RadioHandler::eraseImage(uint16_t size){
+	if (!flashFound){
+		Log.Error(P("Warning - No flash for a %i byte update"), size);
+		return false;
+	}
 
-	remoteData[TEMPERATURE] = temperature;
+	Log.Info(P("Receiving a %i byte update"), size);
+	flash.blockErase32K(0);
+	return true;
 }
 
-/**
-* Read in the humidity from the received packet
-*/
-void readRemoteHumidity(){
-	char argHigh = commandHandler.next();
-	char argLow = commandHandler.next();
-	float humidity = word(argHigh, argLow);
-	humidity /= 100.0;
+void RadioHandler::writeImage(uint16_t offset, const uint8_t* data, uint8_t length){
+	flash.writeBytes(FLASH_IMAGE_OFFSET + offset, data, length);
+}
 
-	remoteData[HUMIDITY] = humidity;
+void RadioHandler::readImage(uint16_t offset, uint8_t* data, uint8_t length){
+	flash.readBytes(FLASH_IMAGE_OFFSET + offset, data, length);
 }
 
 /**
-* Read in the illuminance from the received packet
+* Mark the checked image for the bootloader and restart into it
+* Its CRC is kept so the new firmware can confirm it to the coordinator.
 */
-void readRemoteIlluminance(){
-	char argHigh = commandHandler.next();
-	char argLow = commandHandler.next();
-	int illuminance = word(argHigh, argLow);
+void RadioHandler::activateImage(uint16_t size, uint32_t crc){
+	Log.Info(P("Update checks out - restarting"));
 
-	remoteData[ILLUMINANCE] = illuminance;
-}
+	EEPROM.put(INSTALLED_IMAGE_ADDRESS, crc);
 
-/**
-* Read in the motion detector status from the received packet
-*/
-void readRemoteMotion(){
-	bool motion = commandHandler.next();
+	const uint8_t header[FLASH_IMAGE_OFFSET] = { 'F', 'L', 'X', 'I', 'M', 'G', ':', uint8_t(size >> 8), uint8_t(size), ':' };
+	flash.writeBytes(0, header, sizeof(header));
+	while (flash.busy());
 
-	remoteData[MOTION] = motion;
+	// The watchdog reset lands in the bootloader, which flashes the image
+	wdt_enable(WDTO_15MS);
+	while (true);
+}
+
+uint32_t RadioHandler::installedImage(){
+	uint32_t crc;
+	EEPROM.get(INSTALLED_IMAGE_ADDRESS, crc);
+	return crc;
 }
 
 /**
-* Print the received data values to the buffer
+* Ask the host for the next window of the image
 */
-void processRemoteDataPacket(){
+void RadioHandler::requestBlocks(uint16_t first, uint8_t count){
+	JsonObject<3> request;
+	request["ota"] = "blocks";
+	request["first"] = long(first);
+	request["count"] = long(count);
+
 	Serial.print(PACKET_START);
-	Serial.print(remoteData);
+	Serial.print(request);
 	Serial.println(PACKET_END);
 }
 
 /**
-* Reset the timeout of a node
+* Tell the host how the update went for one node
 */
-void resetTimeout(int unitNumber){
-	timer.restartTimer(routingTable[unitNumber]);
-}
+void RadioHandler::targetFinished(uint8_t unit, UpdateState state){
+	JsonObject<3> result;
+	result["ota"] = "done";
+	result["unit"] = long(unit);
+	result["state"] = state == UPDATE_ACTIVATED ? "activated" : "failed";
 
-/**
-* Callback function
-* Request a data packet from a remote node.
-*
-* Requests are made sequentially through the routing table.
-* If a node is not active, nothing happens, rather than skipping ahead to an active node.
-* It's a lot less spammy that way...
-*
-* Also, the coordinator will be in its own routing table, but the coordinator has no methods
-* to join its own network. It should be fine...
-* The break in requests gives the coordinator a chance to upload its own data.
-*/
-void requestNodeData(){
-	static int index = 0;
+	Serial.print(PACKET_START);
+	Serial.print(result);
+	Serial.println(PACKET_END);
+}
 
-	// Get data from the next connected node
-	if (routingTable[index] >= 0){
-		Log.Info(P("Requesting data from Unit %i"), index);
-		sendPacketRequest(index);
-	}
+void RadioHandler::updateFinished(){
+	JsonObject<1> result;
+	result["ota"] = "end";
 
-	// Increment node number or loop back to start
-	if (index < MAX_NETWORK_SIZE){
-		index++;
-	}
-	else{
-		index = 0;
-	}
+	Serial.print(PACKET_START);
+	Serial.print(result);
+	Serial.println(PACKET_END);
 }
 
 /**
-* Send a data packet request to the specified node
-* @param unitNumber Unit number of the destination node
+* A command for one of this unit's groups; only handlers registered for
+* group commands take it
 */
-void sendPacketRequest(int unitNumber){
-	writeBuffer.reset();
-
-	writeBuffer.write(DATA_TRANSMIT_REQUEST);
-	writeBuffer.write(PACKET_END);
-
-	radio.openWritingPipe(BASE_PIPE + unitNumber);
-	transmitWriteBuffer();
+void RadioHandler::groupCommand(const uint8_t* command, uint8_t length){
+	dispatcher.dispatch(FRAME_GROUP, command, length);
 }
 
-//////////////////////////////////////////////////////////////////////////
-// Node Functions
-
 /**
-* Callback function
-* Join the RF24 network if not already connected.
-* The network coordinator holds the networking table and does not need to join.
+* Log what the network is up to
 */
-void joinNetwork(){
-	if (!connectedToNetwork && UNIT_NUMBER != COORDINATOR){
-		transmitJoinRequest();
+void RadioHandler::networkEvent(NetworkEvent event, uint8_t unit){
+	switch (event){
+	case NETWORK_JOIN_ATTEMPT:
+		Log.Debug(P("Attempting network join"));
+		break;
+	case NETWORK_JOINED:
+		Log.Info(P("Joined network"));
+		break;
+	case NETWORK_TIMED_OUT:
+		Log.Info(P("Timed out from network"));
+		break;
+	case NETWORK_DATA_REQUESTED:
+		Log.Info(P("Data request received"));
+		break;
+	case NETWORK_NODE_JOINED:
+		Log.Info(P("Unit %i joined the network"), unit);
+		break;
+	case NETWORK_NODE_TIMED_OUT:
+		Log.Info(P("Unit %i timed out"), unit);
+		break;
+	case NETWORK_NODE_POLLED:
+		Log.Info(P("Requesting data from Unit %i"), unit);
+		break;
+	case NETWORK_VERSION_MISMATCH:
+		Log.Error(P("Warning - Unit %i runs another protocol version; update its firmware"), unit);
+		break;
+	default:
+		Log.Error(P("Warning - Bad packet from Unit %i"), unit);
+		break;
 	}
 }
 
+
+//////////////////////////////////////////////////////////////////////////
+// Coordinator Functions
+
 /**
-* Callback function
-* The node's network connection has timed out (no requests from coordinator)
-* Reset the node's RF24 network membership
+* A node has heard an IR code
 */
-void resetNodeNetworkConnection(){
-	Log.Info(P("Timed out from network"));
-	connectedToNetwork = false;
+void irEventPacket(const FrameView& frame){
+	uint8_t unit;
+	IrCode code;
+
+	if (IrDecoder::decodeEvent(frame.data, frame.length, unit, code)){
+		printIrCode(unit, code);
+	}
 }
 
 /**
-* Send a network request to the network coordinator
+* Print an IR code to the connected device
+* Codes are printed in hex, as remote code tables list them.
 */
-void transmitJoinRequest(){
-	writeBuffer.reset();
-
-	writeBuffer.write(NETWORK_JOIN_REQUEST);
-	writeBuffer.write(UNIT_NUMBER);
-
-	writeBuffer.write(PACKET_END);
+void printIrCode(uint8_t unit, const IrCode& code){
+	static const char* const PROTOCOL_NAMES[] = { "none", "nec", "sony", "hash" };
+	char value[9];
+	snprintf(value, sizeof(value), "%08lX", (unsigned long)code.value);
+
+	JsonObject<4> event;
+	if (unit == UNIT_NUMBER){
+		event[ID] = unitID.c_str();
+	}
+	else{
+		event[ID] = int(unit);
+	}
+	event["ir"] = PROTOCOL_NAMES[code.protocol];
+	event["bits"] = int(code.bits);
+	event["code"] = value;
 
-	transmitWriteBuffer();
-	Log.Debug(P("Attempting network join"));
+	Serial.print(PACKET_START);
+	Serial.print(event);
+	Serial.println(PACKET_END);
 }
 
 /**
-* Transmit the collected sensor data to the network coordinator
+* Host command to broadcast a command to a group of nodes
 */
-void transmitDataPacket(){
-	// Senpai noticed us! Restart the timeout
-	timer.restartTimer(networkTimeoutTimerID);
-	Log.Info(P("Data request received"));
-
-	prepareDataPacket();
-	transmitWriteBuffer();
+void groupSerialCommand(const FrameView& frame){
+	groupCaster.command(frame.data, frame.length, millis());
 }
 
 /**
-* Transmit the contents of the write buffer using the RF24 network
+* Host command to start, feed or cancel a firmware update
 */
-void transmitWriteBuffer(){
-	radio.stopListening();
-	radio.write(writeBuffer.getBufferAddress(), writeBuffer.getWritePosition());
-	radio.startListening();
+void updateCommand(const FrameView& frame){
+	updateSender.command(frame.data, frame.length, millis());
 }
 
 /**
-* Load the sensor data to the write buffer
+* Print a node's data to the connected device
+* Relayed packets carry the numeric unit number as their ID.
 */
-void prepareDataPacket(){
-	writeBuffer.reset();
-	writeBuffer.write(DATA_TRANSMIT_RESPONSE);
-
-	writeBuffer.write(UNIT_ID_CODE);
-	writeBuffer.write(UNIT_NUMBER);
-
-	writeBuffer.write(TEMPERATURE_CODE);
-	writeBuffer.writeInt(int(int(sensorData[TEMPERATURE]) * 100));
+void processRemoteDataPacket(const SensorReading& reading){
+	remoteData[ID] = int(reading.unit);
+	setReading(remoteData[TEMPERATURE], reading.temperature, reading.valid & VALID_TEMPERATURE);
+	setReading(remoteData[HUMIDITY], reading.humidity, reading.valid & VALID_HUMIDITY);
+	setReading(remoteData[ILLUMINANCE], long(reading.illuminance), reading.valid & VALID_ILLUMINANCE);
+	remoteData[MOTION] = reading.motion;
 
-	writeBuffer.write(HUMIDITY_CODE);
-	writeBuffer.write(int(sensorData[HUMIDITY]));
-
-	writeBuffer.write(ILLUMINANCE_CODE);
-	writeBuffer.writeInt(int(sensorData[ILLUMINANCE]));
+	Serial.print(PACKET_START);
+	Serial.print(remoteData);
+	Serial.println(PACKET_END);
+}
 
-	writeBuffer.write(MOTION_CODE);
-	writeBuffer.write(int(sensorData[MOTION]));
 
-	writeBuffer.write(DATA_PACKET_FINISHED);
+//////////////////////////////////////////////////////////////////////////
+// Node Functions
 
-	writeBuffer.write(PACKET_END);
+/**
+* Hand the latest sensor data to the network for a data response
+* The coordinator gets the values of the last periodic sample.
+*/
+void prepareDataPacket(SensorReading& reading){
+	reading = localReading;
 }
 
+#ifdef LURKER_BENCH
+uint8_t benchPacket[NETWORK_PAYLOAD_SIZE];
+
 /**
-* Confirm the RF24 network has been joined so we can stop spamming the coordinator
+* Encode a data response without sending it, for timing
 */
-void processNetworkJoin(){
-	connectedToNetwork = true;
-	networkTimeoutTimerID = timer.setTimeout(NODE_TIMEOUT, resetNodeNetworkConnection);
-
-	Log.Info(P("Joined network"));
+void benchPreparePacket(const FrameView&){
+	BENCH_BEGIN(BENCH_PREPARE_PACKET);
+	LurkerNetwork::encodeReading(localReading, benchPacket);
+	BENCH_END(BENCH_PREPARE_PACKET);
 }
+#endif
 
 
 //////////////////////////////////////////////////////////////////////////
@@ -560,38 +765,214 @@ void startSensors(){
 	startMotion();
 
 	// Set up periodic sensor reads
-	printDataTimerID = timer.setInterval(SAMPLE_INTERVAL, printSensorData);
+	sampleTime = millis();
+	printDataTimerID = timer.setInterval(SAMPLE_INTERVAL, sampleSensors);
 }
 
 /**
 * Read all sensors
 */
 void readSensors(){
-	sensorData[TEMPERATURE] = readTemperature();
-	sensorData[HUMIDITY] = readHumidity();
-	sensorData[ILLUMINANCE] = readIlluminance();
-	sensorData[MOTION] = motionDetected;
+	localReading.unit = UNIT_NUMBER;
+	localReading.temperature = 0;
+	localReading.humidity = 0;
+	localReading.illuminance = 0;
+	localReading.motion = motionDetected;
+	localReading.valid = 0;
+
+	// Sensors that keep failing are only tried by retrySensors()
+	if (readTemperature(localReading.temperature)){
+		localReading.valid |= VALID_TEMPERATURE;
+	}
+	if (humidityHealth.healthy()
+		&& countRead(humidityHealth, readHumidity(localReading.humidity), HUMIDITY)){
+		localReading.valid |= VALID_HUMIDITY;
+	}
+	if (readIlluminance(localReading.illuminance)){
+		localReading.valid |= VALID_ILLUMINANCE;
+	}
+
+	setReading(sensorData[TEMPERATURE], localReading.temperature, localReading.valid & VALID_TEMPERATURE);
+	setReading(sensorData[HUMIDITY], localReading.humidity, localReading.valid & VALID_HUMIDITY);
+	setReading(sensorData[ILLUMINANCE], long(localReading.illuminance), localReading.valid & VALID_ILLUMINANCE);
+	sensorData[MOTION] = localReading.motion;
 
 	flashSensorReadLight();
 }
 
+/**
+* Set a reading in a JSON object, or null if the sensor couldn't give one
+*/
+void setReading(JsonValue& field, float value, bool valid){
+	if (valid){
+		field = value;
+	}
+	else{
+		field = (const char*)0;
+	}
+}
+
+void setReading(JsonValue& field, long value, bool valid){
+	if (valid){
+		field = value;
+	}
+	else{
+		field = (const char*)0;
+	}
+}
+
+/**
+* Count a read towards a sensor's health
+*
+* Arguments:
+*	health - The sensor's circuit breaker
+*	worked - The read gave a real value
+*	name - For the log
+*
+* Returns:
+*	worked
+*/
+bool countRead(SensorHealth& health, bool worked, const char* name){
+	bool wasHealthy = health.healthy();
+
+	if (worked){
+		if (!wasHealthy){
+			Log.Info(P("%s sensor is back"), name);
+		}
+		health.success();
+	}
+	else{
+		health.failure(millis());
+
+		if (wasHealthy && !health.healthy()){
+			Log.Error(P("Warning - %s sensor failed %i times; left out of samples"), name, health.failures());
+		}
+	}
+
+	return worked;
+}
+
+/**
+* Try the sensors that have been left out of samples, when they're due
+* The wait between tries doubles each time, so a sensor that's gone
+* hardly costs the loop anything. The temperature and light sensors'
+* retries are started by checkTemperature() and checkIlluminance().
+*/
+void retrySensors(){
+	unsigned long now = millis();
+	float value;
+
+	if (humidityHealth.retryDue(now)){
+		countRead(humidityHealth, readHumidity(value), HUMIDITY);
+	}
+}
+
 /**
 * Start the temperature sensor
+* A conversion is started TEMPERATURE_LEAD_TIME before each sample and
+* read back once it's had time to finish, so the sample finds it at hand.
 */
 void startTemperature(){
-	tempSensor.begin();
+	findTemperatureProbe();
 	Log.Debug(P("Temperature started..."));
 }
 
+/**
+* Search the bus for the probe
+* Conversions are left to run on their own rather than waited on.
+*
+* Returns:
+*	False if there's no probe on the bus
+*/
+bool findTemperatureProbe(){
+	tempSensor.begin();
+	tempSensor.setWaitForConversion(false);
+
+	return tempSensor.getDeviceCount() > 0 && tempSensor.getAddress(temperatureAddress, 0);
+}
+
+/**
+* Start a temperature conversion ahead of the next sample, and read it
+* back once it's had TEMPERATURE_CONVERSION_TIME to finish
+* Only starting the conversion and reading the scratchpad hold up the
+* loop, a few ms each. Once the probe's left out, conversions are only
+* tried when a retry is due.
+*/
+void checkTemperature(){
+	unsigned long now = millis();
+	unsigned long sinceRead = now - temperatureReadTime;
+
+	if (temperatureConverting){
+		if (sinceRead < TEMPERATURE_CONVERSION_TIME){
+			return;
+		}
+
+		temperatureConverting = false;
+		temperatureValid = finishTemperature(temperatureReading);
+		countRead(temperatureHealth, temperatureValid, TEMPERATURE);
+	}
+
+	// One conversion a sample, started in time to finish just before it
+	unsigned long sinceSample = now - sampleTime;
+	bool due = sinceSample >= SAMPLE_INTERVAL - TEMPERATURE_LEAD_TIME && sinceRead > sinceSample;
+
+	if (temperatureHealth.healthy() ? due : temperatureHealth.retryDue(now)){
+		temperatureReadTime = now;
+
+		// With no probe on the bus there's nothing to wait for, so that fails straight away
+		if (tempSensor.getDeviceCount() == 0 && !findTemperatureProbe()){
+			temperatureValid = false;
+			countRead(temperatureHealth, false, TEMPERATURE);
+			return;
+		}
+
+		tempSensor.requestTemperatures();
+		temperatureConverting = true;
+	}
+}
+
+/**
+* Read back a finished conversion
+*
+* Arguments:
+*	temperature - Set to the reading in degrees Celsius
+*
+* Returns:
+*	False if the probe's gone, or gave its power-on value
+*/
+bool finishTemperature(float& temperature){
+	float reading = tempSensor.getTempC(temperatureAddress);
+
+	if (reading == DEVICE_DISCONNECTED_C){
+		tempSensor.begin();	// Forget it, so the next try fails fast if it's gone
+		return false;
+	}
+
+	// 85 is what the scratchpad holds before a conversion, e.g. after a brown-out
+	if (reading == 85){
+		return false;
+	}
+
+	temperature = reading;
+	return true;
+}
+
 /**
 * Take a temperature reading
 *
+* Arguments:
+*	temperature - Set to the reading in degrees Celsius, from the latest conversion
+*
 * Returns:
-*	Temperature reading in degrees Celsius
+*	False if there's no reading, or the probe's been left out
 */
-float readTemperature(){
-	tempSensor.requestTemperatures();
-	return tempSensor.getTempCByIndex(0);;
+bool readTemperature(float& temperature){
+	if (!temperatureValid || !temperatureHealth.healthy()){
+		return false;
+	}
+
+	temperature = temperatureReading;
+	return true;
 }
 
 /**
@@ -605,43 +986,184 @@ void startHumidity(){
 * Take a humidity reading.
 * May take up to 2 seconds with the DHT11 sensor
 *
+* Arguments:
+*	humidity - Set to the relative humidity as a floating percentage
+*
 * Returns:
-*	Relative humidity as a floating percentage
+*	False if the read failed
 */
-float readHumidity(){
-	float humidity = 0;
+bool readHumidity(float& humidity){
 	int status = humiditySensor.read11(HUMIDITY_PIN);
 
-	// Grab the data if read was successful
-	if (status == DHTLIB_OK){
-		humidity = humiditySensor.humidity;
-	}
-	else{
+	if (status != DHTLIB_OK){
 		Log.Error(P("Error reading humidity sensor. Error [%i]"), status);
+		return false;
 	}
 
-	return humidity;
+	humidity = humiditySensor.humidity;
+	return true;
 }
 
 /**
 * Initialise the light sensor
+* It's left measuring continuously, and read every LIGHT_READ_INTERVAL
+* from the loop, so a reading is always at hand.
 */
 void startIlluminance(){
-	lightSensor.begin();
-	lightSensor.SetAddress(Device_Address_L);
-	lightSensor.SetMode(Continuous_H_resolution_Mode);
+	twi.begin(TWI_FAST);
+	twi.queue(lightPowerOn);
+	twi.queue(lightMode);
+	lightReadTime = millis();
 
 	Log.Debug(P("Illuminance started"));
 }
 
+/**
+* Start a light sensor read when one is due, and count the last one
+* towards the sensor's health
+* The read finishes in the background, whatever the loop is doing. Once
+* the sensor's left out, reads are only tried when a retry is due, and
+* set it up again first in case it's been reset.
+*/
+void checkIlluminance(){
+	unsigned long now = millis();
+	unsigned long sinceRead = now - lightReadTime;
+
+	if (lightRead.pending()){
+		// Something is holding the bus
+		if (sinceRead >= LIGHT_TIMEOUT){
+			Log.Error(P("Light sensor read timed out; resetting TWI"));
+			twi.reset();
+		}
+		return;
+	}
+
+	if (lightReadQueued){
+		lightReadQueued = false;
+		countRead(illuminanceHealth, lightRead.status == TWI_DONE, ILLUMINANCE);
+	}
+
+	if (illuminanceHealth.healthy() ? sinceRead >= LIGHT_READ_INTERVAL : illuminanceHealth.retryDue(now)){
+		if (!illuminanceHealth.healthy()){
+			twi.queue(lightPowerOn);
+			twi.queue(lightMode);
+		}
+
+		twi.queue(lightRead);
+		lightReadQueued = true;
+		lightReadTime = now;
+	}
+}
+
+/**
+* Callback from the TWI interrupt - keep the reading, if there is one
+*/
+void lightReadFinished(TwiTransaction& transaction){
+	if (transaction.status == TWI_DONE){
+		lightCount = (uint16_t(lightData[0]) << 8) | lightData[1];
+		lightValid = true;
+	}
+	else{
+		lightValid = false;
+	}
+}
+
 /**
 * Take an illuminance reading
 *
+* Arguments:
+*	illuminance - Set to the illuminance in lux, from the latest read
+*
 * Returns:
-*	Illuminance in lux
+*	False if there's no reading, or the sensor's been left out
+*/
+bool readIlluminance(uint16_t& illuminance){
+	noInterrupts();
+	uint16_t count = lightCount;
+	bool valid = lightValid;
+	interrupts();
+
+	if (!valid || !illuminanceHealth.healthy()){
+		return false;
+	}
+
+	// 1.2 counts a lux in high resolution mode
+	illuminance = long(count) * 5 / 6;
+	return true;
+}
+
+/**
+* Start timing the IR receiver's pulses
+*/
+void startIrReceiver(){
+	pinMode(IR_RECEIVE_PIN, INPUT);
+
+	*digitalPinToPCMSK(IR_RECEIVE_PIN) |= bit(digitalPinToPCMSKbit(IR_RECEIVE_PIN));
+	PCICR |= bit(digitalPinToPCICRbit(IR_RECEIVE_PIN));
+
+	Log.Debug(P("IR receiver started"));
+}
+
+/**
+* Pin change on the IR receiver
+* Its output is low while it sees the carrier, so a rising edge ends a mark.
 */
-long readIlluminance(){
-	return lightSensor.GetLightIntensity();
+ISR(PCINT2_vect){
+	irPulses.edge(micros(), digitalRead(IR_RECEIVE_PIN) == HIGH);
+}
+
+/**
+* Decode whatever pulses have come in since the last loop
+* A frame ends in silence rather than an edge, so one that's gone quiet
+* for long enough is finished off here.
+*/
+void checkIr(){
+	uint16_t pulse;
+	IrCode code;
+
+	// Don't decode the blaster's own codes
+	if (irPlayer.busy()){
+		while (irPulses.pop(pulse)){
+		}
+		irDecoder.end(code);
+		return;
+	}
+
+	while (irPulses.pop(pulse)){
+		if (irDecoder.pulse(pulse, code)){
+			irCodeReceived(code);
+		}
+	}
+
+	if (irDecoder.active()){
+		noInterrupts();
+		unsigned long lastEdge = irPulses.lastEdge();
+		interrupts();
+
+		if (micros() - lastEdge >= IR_FRAME_GAP && irDecoder.end(code)){
+			irCodeReceived(code);
+		}
+	}
+}
+
+/**
+* Pass a code on to the coordinator, or print it if this is the coordinator
+* A held button's repeats aren't passed on.
+*/
+void irCodeReceived(const IrCode& code){
+	if (code.repeat){
+		return;
+	}
+
+	Log.Debug(P("IR code %l, protocol %i"), code.value, code.protocol);
+
+	if (UNIT_NUMBER == COORDINATOR){
+		printIrCode(UNIT_NUMBER, code);
+	}
+	else{
+		uint8_t packet[IR_EVENT_SIZE];
+		radioHandler.transmit(COORDINATOR, packet, IrDecoder::encodeEvent(UNIT_NUMBER, code, packet));
+	}
 }
 
 /**
@@ -707,24 +1229,200 @@ void endMotionCooldown(){
 */
 void initialiseBuzzer(){
 	pinMode(BUZZER_PIN, OUTPUT);
-	buzzerOff();
+	digitalWrite(BUZZER_PIN, LOW);
 	Log.Debug(P("Buzzer started..."));
 }
 
 /**
-* Turn on the buzzer
+* Set the tone the pattern timer toggles the buzzer at
+* The timer interrupts every half cycle of the tone, or every ms in
+* silence, and counts the time for the patterns either way.
+*
+* Arguments:
+*	frequency - Tone in Hz, 0 for silence
+*/
+void setBuzzerTone(uint16_t frequency){
+	toneOn = frequency > 0;
+
+	if (toneOn){
+		patternPeriod = 500000UL / constrain(frequency, 31, 10000);
+	}
+	else{
+		patternPeriod = 1000;
+		digitalWrite(BUZZER_PIN, LOW);
+	}
+
+	// CTC with a /8 prescaler
+	OCR1A = uint16_t(F_CPU / 8000000UL * patternPeriod) - 1;
+	TCNT1 = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Patterns
+//
+// Light blinks and buzzer tones are played by PatternPlayer off Timer1,
+// so they take no SimpleTimer slots and carry on whatever the loop is
+// doing. The timer only runs while something's playing.
+
+/**
+* Start a light or buzzer pattern, in place of whatever the channel was playing
+*
+* Arguments:
+*	channel - BUZZER_CHANNEL, or LIGHT_CHANNEL + the LED's number
+*	pattern - Steps in PROGMEM
+*/
+void playPattern(uint8_t channel, const PatternStep* pattern){
+	noInterrupts();
+	patterns.play(channel, pattern);
+
+	if (!(TIMSK1 & bit(OCIE1A))){
+		TCCR1A = 0;
+		TCCR1B = bit(WGM12) | bit(CS11);
+		setBuzzerTone(0);
+		patternTime = 0;
+
+		TIFR1 = bit(OCF1A);
+		TIMSK1 = bit(OCIE1A);
+	}
+	interrupts();
+}
+
+/**
+* Cut a channel's pattern short, leaving its output off
 */
-void buzzerOn(){
-	digitalWrite(BUZZER_PIN, HIGH);
-	Log.Debug(P("Buzzer On"));
+void stopPattern(uint8_t channel){
+	noInterrupts();
+	patterns.stop(channel);
+	interrupts();
 }
 
 /**
-* Turn the buzzer off
+* Pattern timer - toggle the buzzer if it's sounding, and move the
+* patterns on for every ms that's passed
 */
-void buzzerOff(){
-	digitalWrite(BUZZER_PIN, LOW);
-	Log.Debug(P("Buzzer Off"));
+ISR(TIMER1_COMPA_vect){
+	if (toneOn){
+		*portInputRegister(digitalPinToPort(BUZZER_PIN)) = digitalPinToBitMask(BUZZER_PIN);
+	}
+
+	patternTime += patternPeriod;
+	while (patternTime >= 1000){
+		patternTime -= 1000;
+		patterns.tick();
+	}
+
+	if (!patterns.active()){
+		TIMSK1 = 0;
+		TCCR1B = 0;
+	}
+}
+
+/**
+* Set a pattern's output; called from the timer interrupt, so no logging
+*/
+void PatternOutput::output(uint8_t channel, uint16_t value){
+	if (channel == BUZZER_CHANNEL){
+		setBuzzerTone(value);
+	}
+	else if (channel - LIGHT_CHANNEL < NUM_LEDS){
+		digitalWrite(leds[channel - LIGHT_CHANNEL], value ? ON : OFF);
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// IR Blaster
+//
+// Timer2 runs phase-correct PWM at the carrier frequency, with OC2B
+// driving the LED. The compare interrupt comes once a carrier cycle; it
+// counts down the pulse being sent and, at the end of it, takes the next
+// one and connects OC2B for a mark or disconnects it for a space. The
+// loop only loads the code, so nothing waits while it goes out.
+
+/**
+* Initialise the IR LED, off
+*/
+void startIrBlaster(){
+	pinMode(IR_SEND_PIN, OUTPUT);
+	digitalWrite(IR_SEND_PIN, LOW);
+	Log.Debug(P("IR blaster started"));
+}
+
+/**
+* Start sending an IR code
+*
+* Returns:
+*	False if a code is still going out, or this one can't be sent
+*/
+bool sendIr(const IrCode& code){
+	if (!irPlayer.load(code)){
+		return false;
+	}
+
+	// Phase-correct PWM counts up to OCR2A and back, so a cycle is 2 * OCR2A ticks
+	uint8_t top = F_CPU / 2000 / irPlayer.carrier();
+
+	TIMSK2 = 0;
+	TCCR2A = bit(WGM20);
+	TCCR2B = bit(WGM22) | bit(CS20);
+	OCR2A = top;
+	OCR2B = top / 3;	// 33% duty
+	TCNT2 = 0;
+
+	irCyclesLeft = 1;
+	TIFR2 = bit(OCF2A);
+	TIMSK2 = bit(OCIE2A);
+
+	Log.Debug(P("IR sending %l, protocol %i"), code.value, code.protocol);
+	return true;
+}
+
+/**
+* Once a carrier cycle - start the next pulse when this one's done
+*/
+ISR(TIMER2_COMPA_vect){
+	if (--irCyclesLeft > 0){
+		return;
+	}
+
+	uint16_t pulse;
+
+	if (irPlayer.next(pulse)){
+		irCyclesLeft = pulse & IR_MAX_PULSE;
+
+		if (pulse & IR_MARK){
+			TCCR2A |= bit(COM2B1);
+		}
+		else{
+			TCCR2A &= ~bit(COM2B1);
+		}
+	}
+	else{
+		// The pin goes back to its port output, low
+		TIMSK2 = 0;
+		TCCR2A = 0;
+		TCCR2B = 0;
+	}
+}
+
+/**
+* Send one of the stored IR codes, by its index, e.g. X0
+*/
+void irSendCommand(const FrameView& frame){
+	uint8_t index;
+
+	if (!readIndex(frame, NUM_IR_CODES, index)){
+		Log.Error(P("No such IR code, there are %i"), NUM_IR_CODES);
+		return;
+	}
+
+	IrCode code;
+	memcpy_P(&code, &IR_CODES[index], sizeof(code));
+
+	if (!sendIr(code)){
+		Log.Error(P("IR blaster busy"));
+	}
 }
 
 
@@ -762,34 +1460,81 @@ void switchLight(int ledNum, bool state){
 * Briefly flash the motion sensor indicator
 */
 void flashMotionLight(){
-	switchLight(MOTION_LED, ON);
+	playPattern(LIGHT_CHANNEL + MOTION_LED, FLASH_PATTERN);
+}
+
+/**
+* Flash the sensor read indicator
+*/
+void flashSensorReadLight(){
+	playPattern(LIGHT_CHANNEL + SENSOR_READ_LED, FLASH_PATTERN);
+}
 
-	timer.setTimeout(FLASH_TIME, endMotionLightFlash);
 
+//////////////////////////////////////////////////////////////////////////
+// Image Store
+
+/**
+* Look for the SPI flash that firmware updates are stored in
+* Without one the node still runs, but turns updates down.
+*/
+void startImageStore(){
+	flashFound = flash.initialize();
+
+	if (flashFound){
+		Log.Debug(P("Image store started"));
+	}
+	else{
+		Log.Error(P("Warning - No image store; updates disabled"));
+	}
 }
 
+
+//////////////////////////////////////////////////////////////////////////
+// Memory
+
 /**
-* Callback for the flashMotionLight timer
-* Turn the motion light off after the timer expires
+* Start the periodic stack high-water check
 */
-void endMotionLightFlash(){
-	switchLight(MOTION_LED, OFF);
+void startMemoryMonitor(){
+	timer.setInterval(MEMORY_CHECK_INTERVAL, checkMemory);
+	Log.Debug(P("Memory monitor started - %i bytes free"), minimumFreeMemory());
 }
 
 /**
-* Flash the sensor read indicator
+* Callback function - Warn if the stack has come close to the heap
+* The warning is only repeated when the low-water mark drops further.
 */
-void flashSensorReadLight(){
-	switchLight(SENSOR_READ_LED, ON);
+void checkMemory(){
+	static unsigned int lowestReported = LOW_MEMORY_WARNING;
+	unsigned int minimum = minimumFreeMemory();
 
-	timer.setTimeout(FLASH_TIME, endSensorReadFlash);
+	if (minimum < lowestReported){
+		Log.Error(P("Low memory - %i bytes between heap and stack at worst"), minimum);
+		lowestReported = minimum;
+	}
 }
 
 /**
-* Callback for the flashSensorReadLight function
-* Turns the read light off after the timer elapses
+* Send the memory status to the connected device
+* Free RAM, the least there has been since boot, the largest block that
+* can still be allocated and how fragmented the heap is.
 */
-void endSensorReadFlash(){
-	switchLight(SENSOR_READ_LED, OFF);
+void printStatus(const FrameView&){
+	MemoryStats stats;
+	readMemoryStats(stats);
+
+	JsonObject<7> status;
+	status[ID] = unitID.c_str();
+	status["free_ram"] = long(stats.freeRam);
+	status["min_free_ram"] = long(stats.minimumFree);
+	status["largest_block"] = long(stats.largestBlock);
+	status["free_blocks"] = long(stats.freeBlocks);
+	status["heap"] = long(stats.heapSize);
+	status["stack_peak"] = long(stats.stackPeak);
+
+	Serial.print(PACKET_START);
+	Serial.print(status);
+	Serial.println(PACKET_END);
 }
 
@@ -0,0 +1,40 @@
+#ifndef LURKER_BENCH_H
+#define LURKER_BENCH_H
+
+//////////////////////////////////////////////////////////////////////////
+// Benchmark Markers
+//
+// Built with LURKER_BENCH defined, BENCH_BEGIN and BENCH_END write an
+// operation number to GPIOR0, a general purpose I/O register that nothing
+// else uses. Each marker is a single OUT instruction, so it costs one
+// cycle and touches no pins. The simavr harness in Code/LurkerBench
+// watches the register and counts the cycles between the marker pairs.
+//
+// Normal builds compile the markers away.
+//////////////////////////////////////////////////////////////////////////
+
+enum BenchOperation{
+	BENCH_LOOP = 1,
+	BENCH_TIMER,
+	BENCH_SERIAL_COMMAND,
+	BENCH_READ_SENSORS,
+	BENCH_PRINT_JSON,
+	BENCH_PREPARE_PACKET,
+	BENCH_OPERATION_COUNT
+};
+
+const unsigned char BENCH_END_FLAG = 0x80;
+
+// Serial command that encodes a radio data packet, so the harness can
+// time it without a radio
+const char BENCH_PACKET_CODE = 'P';
+
+#ifdef LURKER_BENCH
+#define BENCH_BEGIN(operation) (GPIOR0 = (operation))
+#define BENCH_END(operation) (GPIOR0 = (operation) | BENCH_END_FLAG)
+#else
+#define BENCH_BEGIN(operation)
+#define BENCH_END(operation)
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+#include "lurker_dispatch.h"
+
+FrameDispatcher::FrameDispatcher(char terminator, FrameRoute* routes, uint8_t routeCount) :
+	_terminator(terminator),
+	_routes(routes),
+	_maxRoutes(routes != 0 ? routeCount : 0),
+	_routeCount(0),
+	_defaultHandler(0){
+	for (uint8_t i = 0; i < FRAME_SOURCE_COUNT; i++){
+		_streams[i].buffer = 0;
+		_streams[i].size = 0;
+		_streams[i].length = 0;
+		_streams[i].overflowed = false;
+		_streams[i].overflows = 0;
+	}
+}
+
+void FrameDispatcher::attachBuffer(FrameSource source, uint8_t* buffer, uint8_t size){
+	Stream& stream = _streams[source];
+
+	stream.buffer = buffer;
+	stream.size = buffer != 0 ? size : 0;
+	stream.length = 0;
+	stream.overflowed = false;
+}
+
+bool FrameDispatcher::addHandler(char code, uint8_t sources, FrameHandler handler){
+	if (_routeCount >= _maxRoutes){
+		return false;
+	}
+
+	_routes[_routeCount].code = code;
+	_routes[_routeCount].sources = sources;
+	_routes[_routeCount].handler = handler;
+	_routeCount++;
+
+	return true;
+}
+
+void FrameDispatcher::readIn(FrameSource source, uint8_t value){
+	Stream& stream = _streams[source];
+
+	if (char(value) == _terminator){
+		if (stream.overflowed){
+			stream.overflowed = false;
+		}
+		else if (stream.length > 0){
+			stream.buffer[stream.length++] = value;
+			dispatch(source, stream.buffer, stream.length);
+		}
+
+		stream.length = 0;
+		return;
+	}
+
+	if (stream.length == 0 && (value == '\r' || value == '\n')){
+		return;
+	}
+
+	// Room is kept for the terminator
+	if (stream.overflowed || stream.length + 1 >= stream.size){
+		if (!stream.overflowed && stream.size > 0){
+			stream.overflows++;
+		}
+
+		stream.overflowed = true;
+		stream.length = 0;
+		return;
+	}
+
+	stream.buffer[stream.length++] = value;
+}
+
+void FrameDispatcher::dispatch(FrameSource source, const uint8_t* data, uint8_t length){
+	if (length == 0){
+		return;
+	}
+
+	FrameView frame = { source, data, length };
+
+	for (uint8_t i = 0; i < _routeCount; i++){
+		if (_routes[i].code == frame.code() && (_routes[i].sources & (1 << source))){
+			_routes[i].handler(frame);
+			return;
+		}
+	}
+
+	if (_defaultHandler != 0){
+		_defaultHandler(frame);
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef LURKER_DISPATCH_H
+#define LURKER_DISPATCH_H
+
+#include <stdint.h>
+
+#include "lurker_frame.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Frame Dispatch
+//
+// One place for commands and packets to come in, whatever they arrived
+// over. Radio packets arrive whole and are dispatched where they lie;
+// byte streams like the serial port are collected into a reassembly
+// buffer of their own until the frame's terminator, so bytes from one
+// source can never end up in another's half-finished frame.
+//
+// Frames are a code byte, its fields and the terminator. Handlers are
+// registered by code for the sources they accept, and get a view of the
+// frame that points straight into the radio or reassembly buffer. It is
+// only valid until the handler returns. The table they're kept in is the
+// caller's, sized for the handlers it registers.
+//////////////////////////////////////////////////////////////////////////
+
+// Source masks for handler registration
+const uint8_t FROM_SERIAL = 1 << FRAME_SERIAL;
+const uint8_t FROM_RADIO = (1 << FRAME_RADIO) | (1 << FRAME_BROADCAST);
+const uint8_t FROM_RELAY = 1 << FRAME_RELAY;
+const uint8_t FROM_GROUP = 1 << FRAME_GROUP;
+const uint8_t FROM_ANY = 0xFF;
+
+typedef void(*FrameHandler)(const FrameView& frame);
+
+struct FrameRoute{
+	char code;
+	uint8_t sources;
+	FrameHandler handler;
+};
+
+class FrameDispatcher{
+public:
+	/**
+	* @param routes Table for routeCount handlers
+	*/
+	FrameDispatcher(char terminator, FrameRoute* routes, uint8_t routeCount);
+
+	/**
+	* Give a byte-stream source somewhere to reassemble its frames
+	* Frames that don't fit are dropped whole.
+	*/
+	void attachBuffer(FrameSource source, uint8_t* buffer, uint8_t size);
+
+	/**
+	* @return False if the handler table is full
+	*/
+	bool addHandler(char code, uint8_t sources, FrameHandler handler);
+
+	/**
+	* Handler for frames nothing else takes
+	*/
+	void setDefaultHandler(FrameHandler handler){
+		_defaultHandler = handler;
+	}
+
+	/**
+	* Add a byte from a stream source, dispatching the frame it completes
+	* Line endings between frames are skipped.
+	*/
+	void readIn(FrameSource source, uint8_t value);
+
+	/**
+	* Dispatch a whole frame in place
+	*/
+	void dispatch(FrameSource source, const uint8_t* data, uint8_t length);
+
+	/**
+	* Frames dropped from a source for overflowing its buffer
+	*/
+	uint16_t overflows(FrameSource source) const{
+		return _streams[source].overflows;
+	}
+
+private:
+	FrameDispatcher(const FrameDispatcher&);
+	FrameDispatcher& operator=(const FrameDispatcher&);
+
+	struct Stream{
+		uint8_t* buffer;
+		uint8_t size;
+		uint8_t length;
+		bool overflowed;	// Discarding until the next terminator
+		uint16_t overflows;
+	};
+
+	char _terminator;
+	FrameRoute* _routes;
+	uint8_t _maxRoutes;
+	uint8_t _routeCount;
+	FrameHandler _defaultHandler;
+	Stream _streams[FRAME_SOURCE_COUNT];
+};
+
+#endif
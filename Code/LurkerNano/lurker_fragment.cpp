@@ -0,0 +1,270 @@
+#include <string.h>
+
+#include "lurker_fragment.h"
+
+static bool elapsed(NetworkTime now, NetworkTime since, NetworkTime interval){
+	return NetworkTime(now - since) >= interval;
+}
+
+static uint8_t allFragments(uint8_t count){
+	return uint8_t((1 << count) - 1);
+}
+
+Fragmenter::Fragmenter(uint8_t unit, const FragmentConfig& config, FragmentHandler& handler,
+	FragmentSlot* slots, uint8_t slotCount) :
+	_unit(unit),
+	_config(config),
+	_handler(handler),
+	_slots(slots),
+	_slotCount(slots != 0 ? slotCount : 0),
+	_sendBuffer(0),
+	_sendLength(0),
+	_sendUnit(0),
+	_sendMessage(0),
+	_sendCount(0),
+	_sendRetries(0),
+	_sendMissing(0),
+	_lastSent(0),
+	_nextMessage(0){
+	if (_config.retryInterval == 0){
+		_config.retryInterval = FRAGMENT_RETRY_INTERVAL;
+	}
+	if (_config.retries == 0){
+		_config.retries = FRAGMENT_RETRIES;
+	}
+	if (_config.slotTimeout == 0){
+		_config.slotTimeout = FRAGMENT_SLOT_TIMEOUT;
+	}
+
+	for (uint8_t i = 0; i < _slotCount; i++){
+		_slots[i].active = false;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Sending
+
+int Fragmenter::send(uint8_t unit, const uint8_t* message, uint16_t length, NetworkTime now){
+	if (sending() || length == 0 || length > MAX_MESSAGE_SIZE){
+		return -1;
+	}
+
+	_sendBuffer = message;
+	_sendLength = length;
+	_sendUnit = unit;
+	_sendMessage = _nextMessage++;
+	_sendCount = (length + FRAGMENT_DATA_SIZE - 1) / FRAGMENT_DATA_SIZE;
+	_sendRetries = 0;
+	_sendMissing = allFragments(_sendCount);
+	_lastSent = now;
+
+	// All at once; the status report says what to resend
+	for (uint8_t i = 0; i < _sendCount; i++){
+		sendFragment(i);
+	}
+
+	int sent = _sendMessage;
+
+	if (unit == BROADCAST){
+		finishSending(true);
+	}
+
+	return sent;
+}
+
+void Fragmenter::sendFragment(uint8_t index){
+	uint16_t offset = uint16_t(index) * FRAGMENT_DATA_SIZE;
+	uint8_t size = _sendLength - offset < FRAGMENT_DATA_SIZE ? _sendLength - offset : FRAGMENT_DATA_SIZE;
+
+	uint8_t packet[NETWORK_PAYLOAD_SIZE];
+	FrameBuilder frame(packet, sizeof(packet));
+
+	frame.byte(FRAGMENT_CODE).byte(_unit).byte(_sendMessage).byte(index).byte(_sendCount);
+	for (uint8_t i = 0; i < size; i++){
+		frame.byte(_sendBuffer[offset + i]);
+	}
+
+	_handler.transmit(_sendUnit, packet, frame.finish());
+}
+
+void Fragmenter::finishSending(bool delivered){
+	_sendBuffer = 0;
+	_handler.messageSent(_sendMessage, delivered);
+}
+
+void Fragmenter::receiveStatus(const uint8_t* packet, uint8_t length, NetworkTime now){
+	FrameReader fields(packet + 1, length - 1);
+	uint8_t unit = fields.byte();
+	uint8_t message = fields.byte();
+	uint8_t missing = fields.byte();
+
+	if (!fields.ok() || !sending() || unit != _sendUnit || message != _sendMessage){
+		return;
+	}
+
+	missing &= allFragments(_sendCount);
+
+	if (missing == 0){
+		finishSending(true);
+		return;
+	}
+
+	// Asking again only counts against the message while it gets no closer
+	if ((missing & ~_sendMissing) == 0 && missing != _sendMissing){
+		_sendMissing = missing;
+		_sendRetries = 0;
+	}
+
+	// Only what didn't make it
+	for (uint8_t i = 0; i < _sendCount; i++){
+		if (missing & (1 << i)){
+			sendFragment(i);
+		}
+	}
+
+	_lastSent = now;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Receiving
+
+void Fragmenter::receive(const uint8_t* packet, uint8_t length, NetworkTime now){
+	if (length == 0){
+		return;
+	}
+
+	if (packet[0] == FRAGMENT_CODE){
+		receiveFragment(packet, length, now);
+	}
+	else if (packet[0] == FRAGMENT_STATUS_CODE){
+		receiveStatus(packet, length, now);
+	}
+}
+
+void Fragmenter::receiveFragment(const uint8_t* packet, uint8_t length, NetworkTime now){
+	if (length < FRAGMENT_HEADER_SIZE + 2 || packet[length - 1] != PACKET_END){
+		return;
+	}
+
+	FrameReader fields(packet + 1, length - 1);
+	uint8_t unit = fields.byte();
+	uint8_t message = fields.byte();
+	uint8_t index = fields.byte();
+	uint8_t count = fields.byte();
+	uint8_t size = length - FRAGMENT_HEADER_SIZE - 1;
+
+	// Only the last fragment may be short
+	if (count == 0 || count > MAX_FRAGMENTS || index >= count
+		|| size > FRAGMENT_DATA_SIZE || (index + 1 < count && size != FRAGMENT_DATA_SIZE)){
+		return;
+	}
+
+	FragmentSlot* slot = findSlot(unit, message, now);
+
+	if (slot == 0){
+		return;
+	}
+
+	// A different count means the sender has started over
+	if (!slot->active || count != slot->count){
+		slot->active = true;
+		slot->complete = false;
+		slot->unit = unit;
+		slot->message = message;
+		slot->count = count;
+		slot->received = 0;
+		slot->lastLength = 0;
+	}
+
+	slot->lastHeard = now;
+
+	if (!slot->complete){
+		memcpy(slot->data + uint16_t(index) * FRAGMENT_DATA_SIZE, packet + FRAGMENT_HEADER_SIZE, size);
+		slot->received |= 1 << index;
+
+		if (index + 1 == count){
+			slot->lastLength = size;
+		}
+
+		if (slot->received == allFragments(count)){
+			slot->complete = true;
+			_handler.messageReceived(unit, slot->data, uint16_t(count - 1) * FRAGMENT_DATA_SIZE + slot->lastLength);
+			sendStatus(*slot);
+			return;
+		}
+	}
+
+	// The last fragment, sent first time round or to ask again, gets a
+	// report; so does anything for a message that's already whole, in case
+	// the first report was lost
+	if (index + 1 == count || slot->complete){
+		sendStatus(*slot);
+	}
+}
+
+void Fragmenter::sendStatus(const FragmentSlot& slot){
+	uint8_t packet[FRAGMENT_HEADER_SIZE];
+	FrameBuilder frame(packet, sizeof(packet));
+
+	frame.byte(FRAGMENT_STATUS_CODE).byte(_unit).byte(slot.message).byte(allFragments(slot.count) & ~slot.received);
+	_handler.transmit(slot.unit, packet, frame.finish());
+}
+
+/**
+* Slot for a message: the one it already has, a free one, or the one
+* heard from least recently
+*/
+FragmentSlot* Fragmenter::findSlot(uint8_t unit, uint8_t message, NetworkTime now){
+	FragmentSlot* oldest = 0;
+
+	for (uint8_t i = 0; i < _slotCount; i++){
+		FragmentSlot& slot = _slots[i];
+
+		if (slot.active && slot.unit == unit && slot.message == message){
+			return &slot;
+		}
+	}
+
+	for (uint8_t i = 0; i < _slotCount; i++){
+		FragmentSlot& slot = _slots[i];
+
+		if (!slot.active){
+			return &slot;
+		}
+		if (oldest == 0 || NetworkTime(now - slot.lastHeard) > NetworkTime(now - oldest->lastHeard)){
+			oldest = &slot;
+		}
+	}
+
+	if (oldest != 0){
+		oldest->active = false;
+	}
+
+	return oldest;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Timers
+
+void Fragmenter::update(NetworkTime now){
+	if (sending() && elapsed(now, _lastSent, _config.retryInterval)){
+		if (_sendRetries >= _config.retries){
+			finishSending(false);
+		}
+		else{
+			// The last fragment always gets a status report
+			_sendRetries++;
+			_lastSent = now;
+			sendFragment(_sendCount - 1);
+		}
+	}
+
+	for (uint8_t i = 0; i < _slotCount; i++){
+		if (_slots[i].active && elapsed(now, _slots[i].lastHeard, _config.slotTimeout)){
+			_slots[i].active = false;
+		}
+	}
+}
@@ -0,0 +1,150 @@
+#ifndef LURKER_FRAGMENT_H
+#define LURKER_FRAGMENT_H
+
+#include <stdint.h>
+
+#include "lurker_network.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Fragmentation
+//
+// Messages too long for one radio payload are cut into numbered
+// fragments and put back together at the other end. The sender sends
+// every fragment at once and keeps the message until the receiver
+// reports it whole; the receiver reports which fragments it is missing
+// whenever the last one arrives, and the sender resends just those. If
+// the report is lost, the sender resends the last fragment to ask again.
+//
+// The receiver reassembles into a small pool of slots, one per message
+// in flight, each with a bitmap of the fragments it has. A slot that goes
+// quiet is freed; with every slot busy the one heard from least recently
+// is given up.
+//
+// Packets:
+//	f <unit> <message> <index> <count> <data...> $
+//		Fragment; unit is the sender, data FRAGMENT_DATA_SIZE bytes
+//		except in the last fragment
+//	n <unit> <message> <missing> $
+//		Missing fragments bitmap, receiver to sender; 0 once the
+//		message is whole
+//////////////////////////////////////////////////////////////////////////
+
+const char FRAGMENT_CODE = 'f';
+const char FRAGMENT_STATUS_CODE = 'n';
+
+const uint8_t FRAGMENT_HEADER_SIZE = 5;
+const uint8_t FRAGMENT_DATA_SIZE = NETWORK_PAYLOAD_SIZE - FRAGMENT_HEADER_SIZE - 1;
+const uint8_t MAX_FRAGMENTS = 8;	// One bit each in the bitmaps
+const uint16_t MAX_MESSAGE_SIZE = MAX_FRAGMENTS * FRAGMENT_DATA_SIZE;
+
+// Defaults for FragmentConfig fields left at 0. A round trip gets through
+// 81% of the time at 10% loss, so 5 retries still lose a delivered
+// message's last report about one time in 4000; 8 make that one in 600,000.
+const NetworkTime FRAGMENT_RETRY_INTERVAL = 100;
+const uint8_t FRAGMENT_RETRIES = 8;
+const NetworkTime FRAGMENT_SLOT_TIMEOUT = 2000;
+
+/**
+* Timing for a Fragmenter; any field left at 0 takes its default
+*/
+struct FragmentConfig{
+	NetworkTime retryInterval;	// Wait for a status report before asking again
+	uint8_t retries;	// Times to ask in a row, unanswered or no closer, before giving up on a message
+	NetworkTime slotTimeout;	// Silence before a half-received message is dropped
+};
+
+/**
+* Reassembly buffer for one message
+*/
+struct FragmentSlot{
+	uint8_t unit;
+	uint8_t message;
+	uint8_t count;
+	uint8_t received;	// Bitmap
+	uint8_t lastLength;	// Data in the last fragment
+	bool active;
+	bool complete;
+	NetworkTime lastHeard;
+	uint8_t data[MAX_MESSAGE_SIZE];
+};
+
+class FragmentHandler{
+public:
+	virtual void transmit(uint8_t unit, const uint8_t* packet, uint8_t length) = 0;
+
+	/**
+	* A whole message has arrived
+	* It stays in its slot until the handler returns.
+	*/
+	virtual void messageReceived(uint8_t unit, const uint8_t* message, uint16_t length) = 0;
+
+	/**
+	* The message being sent is finished with; its buffer is free again
+	*/
+	virtual void messageSent(uint8_t, bool){}
+};
+
+class Fragmenter{
+public:
+	/**
+	* @param slots Reassembly buffers, one per message that can arrive at once
+	*/
+	Fragmenter(uint8_t unit, const FragmentConfig& config, FragmentHandler& handler,
+		FragmentSlot* slots, uint8_t slotCount);
+
+	/**
+	* Start sending a message
+	* It is sent from the caller's buffer, which has to stay put until
+	* messageSent(). Messages to BROADCAST get no status reports, so they
+	* are sent once and finished with straight away.
+	*
+	* @return The message number, or -1 if a message is still being sent or
+	*	this one is too long
+	*/
+	int send(uint8_t unit, const uint8_t* message, uint16_t length, NetworkTime now);
+
+	/**
+	* Handle a fragment or status report
+	* Anything malformed is dropped.
+	*/
+	void receive(const uint8_t* packet, uint8_t length, NetworkTime now);
+
+	/**
+	* Resend, give up and free slots as they come due
+	*/
+	void update(NetworkTime now);
+
+	bool sending() const{
+		return _sendBuffer != 0;
+	}
+
+private:
+	Fragmenter(const Fragmenter&);
+	Fragmenter& operator=(const Fragmenter&);
+
+	void sendFragment(uint8_t index);
+	void sendStatus(const FragmentSlot& slot);
+	void finishSending(bool delivered);
+	void receiveFragment(const uint8_t* packet, uint8_t length, NetworkTime now);
+	void receiveStatus(const uint8_t* packet, uint8_t length, NetworkTime now);
+	FragmentSlot* findSlot(uint8_t unit, uint8_t message, NetworkTime now);
+
+	uint8_t _unit;
+	FragmentConfig _config;
+	FragmentHandler& _handler;
+	FragmentSlot* _slots;
+	uint8_t _slotCount;
+
+	// Sending
+	const uint8_t* _sendBuffer;
+	uint16_t _sendLength;
+	uint8_t _sendUnit;
+	uint8_t _sendMessage;
+	uint8_t _sendCount;
+	uint8_t _sendRetries;
+	uint8_t _sendMissing;
+	NetworkTime _lastSent;
+	uint8_t _nextMessage;
+};
+
+#endif
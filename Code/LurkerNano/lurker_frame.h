@@ -0,0 +1,136 @@
+#ifndef LURKER_FRAME_H
+#define LURKER_FRAME_H
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Frames
+//
+// Frames are a code byte, its fields and a terminator, with 16-bit
+// fields big-endian. FrameBuilder writes them straight into the buffer
+// they are sent from, and FrameReader reads them where they were
+// received, both checking every field against the frame's real length.
+//
+// Neither stops at the first bad field: a read past the end returns 0,
+// a write past the end is dropped, and ok() says whether it happened, so
+// a frame is checked once rather than field by field.
+//////////////////////////////////////////////////////////////////////////
+
+const char PACKET_END = '$';
+
+enum FrameSource{
+	FRAME_SERIAL,
+	FRAME_RADIO,	// Unit pipe
+	FRAME_BROADCAST,	// Broadcast pipe
+	FRAME_RELAY,
+	FRAME_GROUP,	// Group command, out of a broadcast
+	FRAME_SOURCE_COUNT
+};
+
+class FrameReader{
+public:
+	FrameReader(const uint8_t* data, uint8_t length) :
+		_data(data), _length(length), _position(0), _ok(true){}
+
+	uint8_t byte(){
+		if (_position >= _length){
+			_ok = false;
+			return 0;
+		}
+		return _data[_position++];
+	}
+
+	uint16_t word(){
+		uint16_t high = byte();
+		return (high << 8) | byte();
+	}
+
+	/**
+	* Next byte without reading it, or 0 at the end
+	*/
+	uint8_t peek() const{
+		return _position < _length ? _data[_position] : 0;
+	}
+
+	uint8_t remaining() const{
+		return _length - _position;
+	}
+
+	/**
+	* Every read so far was inside the frame
+	*/
+	bool ok() const{
+		return _ok;
+	}
+
+private:
+	const uint8_t* _data;
+	uint8_t _length;
+	uint8_t _position;
+	bool _ok;
+};
+
+class FrameBuilder{
+public:
+	/**
+	* @param buffer Where the frame is built, e.g. the radio payload
+	*/
+	FrameBuilder(uint8_t* buffer, uint8_t capacity) :
+		_buffer(buffer), _capacity(capacity), _length(0), _ok(true){}
+
+	FrameBuilder& byte(uint8_t value){
+		if (_length >= _capacity){
+			_ok = false;
+		}
+		else{
+			_buffer[_length++] = value;
+		}
+		return *this;
+	}
+
+	FrameBuilder& word(uint16_t value){
+		return byte(value >> 8).byte(value & 0xFF);
+	}
+
+	/**
+	* Terminate the frame
+	* @return Frame length, or 0 if it didn't fit
+	*/
+	uint8_t finish(){
+		byte(PACKET_END);
+		return _ok ? _length : 0;
+	}
+
+	bool ok() const{
+		return _ok;
+	}
+
+private:
+	uint8_t* _buffer;
+	uint8_t _capacity;
+	uint8_t _length;
+	bool _ok;
+};
+
+/**
+* A received frame, where it was received
+* Only valid until the handler it was passed to returns.
+*/
+struct FrameView{
+	FrameSource source;
+	const uint8_t* data;
+	uint8_t length;	// Terminator included
+
+	char code() const{
+		return char(data[0]);
+	}
+
+	/**
+	* Reader for the fields after the code
+	*/
+	FrameReader fields() const{
+		return FrameReader(data + 1, length - 1);
+	}
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "lurker_group.h"
+
+static bool elapsed(NetworkTime now, NetworkTime since, NetworkTime interval){
+	return NetworkTime(now - since) >= interval;
+}
+
+static int hexDigit(uint8_t c){
+	if (c >= '0' && c <= '9'){
+		return c - '0';
+	}
+	if (c >= 'A' && c <= 'F'){
+		return c - 'A' + 10;
+	}
+	if (c >= 'a' && c <= 'f'){
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+GroupCaster::GroupCaster(uint8_t groups, const GroupConfig& config, GroupHandler& handler, uint8_t* packet) :
+	_groups(groups),
+	_config(config),
+	_handler(handler),
+	_packet(packet),
+	_length(0),
+	_repeatsLeft(0),
+	_sequence(0),
+	_lastSent(0),
+	_heard(false),
+	_lastSequence(0),
+	_lastHeard(0){
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Sending
+
+bool GroupCaster::send(uint8_t group, const uint8_t* command, uint8_t length, NetworkTime now){
+	if (_packet == 0 || length < 2 || length > MAX_GROUP_COMMAND || command[length - 1] != PACKET_END){
+		return false;
+	}
+
+	FrameBuilder frame(_packet, NETWORK_PAYLOAD_SIZE);
+
+	frame.byte(GROUP_CODE).byte(group).byte(++_sequence);
+	for (uint8_t i = 0; i + 1 < length; i++){
+		frame.byte(command[i]);
+	}
+
+	_length = frame.finish();
+	_repeatsLeft = _config.repeats;
+	_lastSent = now;
+
+	_handler.transmit(BROADCAST, _packet, _length);
+
+	if (member(group)){
+		_handler.groupCommand(command, length);
+	}
+
+	return true;
+}
+
+void GroupCaster::command(const uint8_t* frame, uint8_t length, NetworkTime now){
+	if (length < 5){
+		return;
+	}
+
+	int high = hexDigit(frame[1]);
+	int low = hexDigit(frame[2]);
+
+	if (high >= 0 && low >= 0){
+		send(uint8_t((high << 4) | low), frame + 3, length - 3, now);
+	}
+}
+
+void GroupCaster::update(NetworkTime now){
+	if (_repeatsLeft > 0 && elapsed(now, _lastSent, _config.repeatInterval)){
+		_repeatsLeft--;
+		_lastSent = now;
+		_handler.transmit(BROADCAST, _packet, _length);
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Receiving
+
+void GroupCaster::receive(const uint8_t* packet, uint8_t length, NetworkTime now){
+	// Header, a command code and the terminator
+	if (length < GROUP_HEADER_SIZE + 2 || packet[0] != GROUP_CODE || packet[length - 1] != PACKET_END){
+		return;
+	}
+
+	uint8_t group = packet[1];
+	uint8_t sequence = packet[2];
+
+	// Sequence numbers wrap, so only recent ones count as repeats
+	bool repeat = _heard && sequence == _lastSequence && !elapsed(now, _lastHeard, _config.duplicateWindow);
+
+	_heard = true;
+	_lastSequence = sequence;
+	_lastHeard = now;
+
+	if (!repeat && member(group)){
+		_handler.groupCommand(packet + GROUP_HEADER_SIZE, length - GROUP_HEADER_SIZE);
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef LURKER_GROUP_H
+#define LURKER_GROUP_H
+
+#include <stdint.h>
+
+#include "lurker_network.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Group Commands
+//
+// One command for many nodes at once, e.g. every buzzer for an alarm.
+// Nodes belong to up to eight groups, set in their config. The
+// coordinator wraps the command in one broadcast frame naming the group
+// and a sequence number, and repeats it a few times a little apart, since
+// broadcasts go unacknowledged. Nodes in the group carry out the first
+// copy they hear and drop the repeats.
+//
+// Radio packets:
+//	g <group> <sequence> <command...> $
+//		Group is 0-7, or ALL_GROUPS; the command is a whole frame less
+//		its terminator
+// Serial commands, host to coordinator:
+//	G<group in hex><command>$	e.g. G01B$ sounds group 1's buzzers
+//////////////////////////////////////////////////////////////////////////
+
+const char GROUP_CODE = 'g';
+const char GROUP_COMMAND = 'G';
+
+const uint8_t ALL_GROUPS = 0xFF;
+const uint8_t GROUP_HEADER_SIZE = 3;
+const uint8_t MAX_GROUP_COMMAND = NETWORK_PAYLOAD_SIZE - GROUP_HEADER_SIZE;	// Terminator included
+
+struct GroupConfig{
+	uint8_t repeats;	// Copies sent after the first
+	NetworkTime repeatInterval;	// Time between copies
+	NetworkTime duplicateWindow;	// A sequence number heard again within this is a repeat
+};
+
+class GroupHandler{
+public:
+	virtual void transmit(uint8_t unit, const uint8_t* packet, uint8_t length) = 0;
+
+	/**
+	* Carry out a command sent to one of this unit's groups
+	* @param command Whole frame, terminator included
+	*/
+	virtual void groupCommand(const uint8_t*, uint8_t){}
+};
+
+class GroupCaster{
+public:
+	/**
+	* @param groups Bitmap of the groups this unit belongs to
+	* @param packet NETWORK_PAYLOAD_SIZE bytes for the broadcast being
+	* repeated, or 0 on a unit that only receives
+	*/
+	GroupCaster(uint8_t groups, const GroupConfig& config, GroupHandler& handler, uint8_t* packet);
+
+	/**
+	* Broadcast a command to a group
+	* A command still being repeated is cut short by the next one. The
+	* sender carries it out itself if it's in the group.
+	*
+	* @param command Frame to send, terminator included
+	* @return False if the command is empty or too long, or this unit only
+	* receives
+	*/
+	bool send(uint8_t group, const uint8_t* command, uint8_t length, NetworkTime now);
+
+	/**
+	* Handle a G command from the host
+	*/
+	void command(const uint8_t* frame, uint8_t length, NetworkTime now);
+
+	/**
+	* Handle a group packet
+	*/
+	void receive(const uint8_t* packet, uint8_t length, NetworkTime now);
+
+	/**
+	* Send repeats as they come due
+	*/
+	void update(NetworkTime now);
+
+	bool member(uint8_t group) const{
+		return group == ALL_GROUPS || (group < 8 && (_groups & (1 << group)));
+	}
+
+private:
+	GroupCaster(const GroupCaster&);
+	GroupCaster& operator=(const GroupCaster&);
+
+	uint8_t _groups;
+	GroupConfig _config;
+	GroupHandler& _handler;
+
+	// Sending
+	uint8_t* _packet;
+	uint8_t _length;
+	uint8_t _repeatsLeft;
+	uint8_t _sequence;
+	NetworkTime _lastSent;
+
+	// Receiving
+	bool _heard;
+	uint8_t _lastSequence;
+	NetworkTime _lastHeard;
+};
+
+#endif
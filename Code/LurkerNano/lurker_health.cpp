@@ -0,0 +1,39 @@
+#include "lurker_health.h"
+
+SensorHealth::SensorHealth(const HealthConfig& config) :
+	_config(config),
+	_failures(0),
+	_lastFailure(0),
+	_retryInterval(0){
+}
+
+bool SensorHealth::retryDue(uint32_t now) const{
+	return !healthy() && uint32_t(now - _lastFailure) >= _retryInterval;
+}
+
+void SensorHealth::success(){
+	_failures = 0;
+	_retryInterval = 0;
+}
+
+void SensorHealth::failure(uint32_t now){
+	if (_failures < 0xFF){
+		_failures++;
+	}
+	_lastFailure = now;
+
+	if (healthy()){
+		return;
+	}
+
+	// Just taken out, or another try that didn't work
+	if (_retryInterval == 0){
+		_retryInterval = _config.firstRetry;
+	}
+	else if (_retryInterval < _config.maxRetry / 2){
+		_retryInterval *= 2;
+	}
+	else{
+		_retryInterval = _config.maxRetry;
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef LURKER_HEALTH_H
+#define LURKER_HEALTH_H
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Sensor Health
+//
+// A circuit breaker for each sensor. A sensor that fails a few reads in a
+// row is taken out of the samples, which then report its value as
+// invalid rather than waiting on it to time out again. It's tried again
+// now and then, outside the samples, with the wait doubling after every
+// try that fails; the first read that works puts it back.
+//
+// Plain C++; the time is passed in, in ms, wrapping like millis().
+//////////////////////////////////////////////////////////////////////////
+
+struct HealthConfig{
+	uint8_t failureLimit;	// Failures in a row before the sensor's taken out
+	uint32_t firstRetry;	// Wait before the first try once it's out
+	uint32_t maxRetry;	// Longest the wait grows to
+};
+
+class SensorHealth{
+public:
+	SensorHealth(const HealthConfig& config);
+
+	/**
+	* Still in the samples
+	*/
+	bool healthy() const{
+		return _failures < _config.failureLimit;
+	}
+
+	/**
+	* Taken out, and due another try
+	*/
+	bool retryDue(uint32_t now) const;
+
+	void success();
+	void failure(uint32_t now);
+
+	uint8_t failures() const{
+		return _failures;
+	}
+
+	/**
+	* Current wait between tries; 0 while healthy
+	*/
+	uint32_t retryInterval() const{
+		return _retryInterval;
+	}
+
+private:
+	const HealthConfig& _config;
+	uint8_t _failures;	// In a row
+	uint32_t _lastFailure;
+	uint32_t _retryInterval;
+};
+
+#endif
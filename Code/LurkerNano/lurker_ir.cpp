@@ -0,0 +1,427 @@
+#include "lurker_ir.h"
+
+// NEC timing, in us
+const uint16_t NEC_HEADER_MARK = 9000;
+const uint16_t NEC_HEADER_SPACE = 4500;
+const uint16_t NEC_REPEAT_SPACE = 2250;
+const uint16_t NEC_BIT_MARK = 560;
+const uint16_t NEC_ONE_SPACE = 1690;
+const uint16_t NEC_ZERO_SPACE = 560;
+const uint8_t NEC_BITS = 32;
+const uint32_t NEC_FRAME_PERIOD = 108000;
+const uint8_t NEC_CARRIER = 38;	// kHz
+
+// Sony SIRC timing, in us
+const uint16_t SONY_HEADER_MARK = 2400;
+const uint16_t SONY_SPACE = 600;
+const uint16_t SONY_ONE_MARK = 1200;
+const uint16_t SONY_ZERO_MARK = 600;
+const uint8_t SONY_MAX_BITS = 20;
+const uint32_t SONY_FRAME_PERIOD = 45000;
+const uint8_t SONY_CARRIER = 40;	// kHz
+const uint8_t SONY_FRAMES = 3;	// Receivers want to see a code more than once
+
+// The same, in carrier cycles for the blaster
+const uint16_t NEC_HEADER_MARK_CYCLES = (uint32_t(NEC_HEADER_MARK) * NEC_CARRIER + 500) / 1000;
+const uint16_t NEC_HEADER_SPACE_CYCLES = (uint32_t(NEC_HEADER_SPACE) * NEC_CARRIER + 500) / 1000;
+const uint16_t NEC_BIT_MARK_CYCLES = (uint32_t(NEC_BIT_MARK) * NEC_CARRIER + 500) / 1000;
+const uint16_t NEC_ONE_SPACE_CYCLES = (uint32_t(NEC_ONE_SPACE) * NEC_CARRIER + 500) / 1000;
+const uint16_t NEC_ZERO_SPACE_CYCLES = (uint32_t(NEC_ZERO_SPACE) * NEC_CARRIER + 500) / 1000;
+const uint8_t NEC_PULSES = 2 + 2 * NEC_BITS + 2;	// Header, bits, stop bit and gap
+
+const uint16_t SONY_HEADER_MARK_CYCLES = (uint32_t(SONY_HEADER_MARK) * SONY_CARRIER + 500) / 1000;
+const uint16_t SONY_SPACE_CYCLES = (uint32_t(SONY_SPACE) * SONY_CARRIER + 500) / 1000;
+const uint16_t SONY_ONE_MARK_CYCLES = (uint32_t(SONY_ONE_MARK) * SONY_CARRIER + 500) / 1000;
+const uint16_t SONY_ZERO_MARK_CYCLES = (uint32_t(SONY_ZERO_MARK) * SONY_CARRIER + 500) / 1000;
+
+const uint8_t HASH_MIN_PULSES = 6;
+const uint32_t FNV_BASIS = 2166136261UL;
+const uint32_t FNV_PRIME = 16777619UL;
+
+/**
+* Close enough to the nominal timing; receivers stretch marks and shorten
+* spaces by up to 100 us or so
+*/
+static bool matches(uint16_t duration, uint16_t expected){
+	uint16_t tolerance = (expected >> 2) + 64;
+	return duration + tolerance >= expected && duration <= expected + tolerance;
+}
+
+static bool sonyBits(uint8_t bits){
+	return bits == 12 || bits == 15 || bits == 20;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Pulse Queue
+
+IrPulseQueue::IrPulseQueue() :
+	_head(0),
+	_tail(0),
+	_lost(false),
+	_lastEdge(0){
+}
+
+void IrPulseQueue::edge(uint32_t now, bool mark){
+	uint32_t duration = now - _lastEdge;
+	_lastEdge = now;
+
+	uint8_t next = (_head + 1) & (IR_QUEUE_SIZE - 1);
+
+	if (next == _tail){
+		_lost = true;
+		return;
+	}
+
+	_pulses[_head] = uint16_t(duration > IR_MAX_PULSE ? IR_MAX_PULSE : duration) | (mark ? IR_MARK : 0);
+	_head = next;
+}
+
+bool IrPulseQueue::pop(uint16_t& pulse){
+	if (_tail == _head){
+		if (_lost){
+			_lost = false;
+			pulse = IR_MAX_PULSE;
+			return true;
+		}
+		return false;
+	}
+
+	pulse = _pulses[_tail];
+	_tail = (_tail + 1) & (IR_QUEUE_SIZE - 1);
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Decoder
+
+IrDecoder::IrDecoder() :
+	_necLast(0){
+	reset();
+}
+
+void IrDecoder::reset(){
+	_count = 0;
+	_done = false;
+	_nec = true;
+	_necRepeat = false;
+	_necValue = 0;
+	_sony = true;
+	_sonyBits = 0;
+	_sonyValue = 0;
+	_hash = FNV_BASIS;
+	_previous[0] = 0;
+	_previous[1] = 0;
+}
+
+bool IrDecoder::pulse(uint16_t pulse, IrCode& code){
+	bool mark = pulse & IR_MARK;
+	uint16_t duration = pulse & IR_MAX_PULSE;
+
+	// The silence between frames
+	if (!mark && duration >= IR_FRAME_GAP){
+		return end(code);
+	}
+
+	// Frames start with a mark
+	if (_done || (_count == 0 && !mark) || _count == 0xFF){
+		return false;
+	}
+
+	bool finished = false;
+
+	if (_nec){
+		decodeNec(duration, mark, code);
+		finished = _done;
+	}
+	if (_sony){
+		decodeSony(duration, mark);
+	}
+
+	addToHash(duration);
+	_count++;
+
+	return finished;
+}
+
+bool IrDecoder::end(IrCode& code){
+	bool decoded = false;
+
+	if (!_done && _count > 0){
+		code.repeat = false;
+
+		// A mark for the header, then a space and a mark for each bit
+		if (_sony && sonyBits(_sonyBits) && _count == 1 + 2 * _sonyBits){
+			code.protocol = IR_SONY;
+			code.bits = _sonyBits;
+			code.value = _sonyValue;
+			decoded = true;
+		}
+		else if (_count >= HASH_MIN_PULSES){
+			code.protocol = IR_HASH;
+			code.bits = 32;
+			code.value = _hash;
+			decoded = true;
+		}
+	}
+
+	reset();
+	return decoded;
+}
+
+/**
+* Header mark and space, 32 bits least significant first, each a mark and
+* a long or short space, and a closing mark; or a header mark, a short
+* space and a closing mark to repeat the last code
+*/
+void IrDecoder::decodeNec(uint16_t duration, bool mark, IrCode& code){
+	uint8_t index = _count;
+
+	if (index == 0){
+		_nec = mark && matches(duration, NEC_HEADER_MARK);
+	}
+	else if (index == 1){
+		_necRepeat = matches(duration, NEC_REPEAT_SPACE);
+		_nec = _necRepeat || matches(duration, NEC_HEADER_SPACE);
+	}
+	else if (mark){
+		_nec = matches(duration, NEC_BIT_MARK);
+
+		if (_nec && (_necRepeat || index == 2 + 2 * NEC_BITS)){
+			uint8_t command = _necValue >> 16;
+			uint8_t inverse = _necValue >> 24;
+
+			// Repeats are only any use after a code
+			if (_necRepeat ? _necLast != 0 : command == uint8_t(~inverse)){
+				code.protocol = IR_NEC;
+				code.bits = NEC_BITS;
+				code.repeat = _necRepeat;
+				code.value = _necRepeat ? _necLast : _necValue;
+				_necLast = code.value;
+				_done = true;
+			}
+			else{
+				_nec = false;
+			}
+		}
+	}
+	else if (index < 2 + 2 * NEC_BITS){
+		uint32_t bit = uint32_t(1) << ((index - 2) / 2);
+
+		if (matches(duration, NEC_ONE_SPACE)){
+			_necValue |= bit;
+		}
+		else{
+			_nec = matches(duration, NEC_ZERO_SPACE);
+		}
+	}
+	else{
+		_nec = false;
+	}
+}
+
+/**
+* Header mark, then a space and a long or short mark for each of 12, 15
+* or 20 bits, least significant first; the frame ends in silence
+*/
+void IrDecoder::decodeSony(uint16_t duration, bool mark){
+	if (_count == 0){
+		_sony = mark && matches(duration, SONY_HEADER_MARK);
+	}
+	else if (!mark){
+		_sony = matches(duration, SONY_SPACE);
+	}
+	else if (_sonyBits >= SONY_MAX_BITS){
+		_sony = false;
+	}
+	else if (matches(duration, SONY_ONE_MARK)){
+		_sonyValue |= uint32_t(1) << _sonyBits++;
+	}
+	else if (matches(duration, SONY_ZERO_MARK)){
+		_sonyBits++;
+	}
+	else{
+		_sony = false;
+	}
+}
+
+/**
+* Fold a pulse into the hash: shorter, about the same or longer than the
+* pulse two before, which is the same kind
+*/
+void IrDecoder::addToHash(uint16_t duration){
+	if (_count >= 2){
+		uint16_t before = _previous[_count & 1];
+		uint8_t value = 1;
+
+		if (uint32_t(duration) * 10 < uint32_t(before) * 8){
+			value = 0;
+		}
+		else if (uint32_t(before) * 10 < uint32_t(duration) * 8){
+			value = 2;
+		}
+
+		_hash = (_hash * FNV_PRIME) ^ value;
+	}
+
+	_previous[_count & 1] = duration;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Event Packets
+
+uint8_t IrDecoder::encodeEvent(uint8_t unit, const IrCode& code, uint8_t* packet){
+	FrameBuilder frame(packet, IR_EVENT_SIZE);
+
+	frame.byte(IR_EVENT_CODE).byte(unit).byte(code.protocol | (code.repeat ? 0x80 : 0)).byte(code.bits)
+		.word(code.value >> 16).word(code.value & 0xFFFF);
+	return frame.finish();
+}
+
+bool IrDecoder::decodeEvent(const uint8_t* packet, uint8_t length, uint8_t& unit, IrCode& code){
+	if (length != IR_EVENT_SIZE || packet[0] != IR_EVENT_CODE || packet[length - 1] != PACKET_END){
+		return false;
+	}
+
+	FrameReader fields(packet + 1, length - 2);
+	unit = fields.byte();
+	uint8_t protocol = fields.byte();
+	code.bits = fields.byte();
+	code.value = uint32_t(fields.word()) << 16;
+	code.value |= fields.word();
+
+	code.repeat = protocol & 0x80;
+	protocol &= 0x7F;
+
+	if (protocol == IR_NONE || protocol > IR_HASH || code.bits == 0 || code.bits > 32){
+		return false;
+	}
+
+	code.protocol = IrProtocol(protocol);
+	return fields.ok();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Player
+
+IrPlayer::IrPlayer() :
+	_value(0),
+	_bits(0),
+	_gap(0),
+	_protocol(IR_NONE),
+	_length(0),
+	_carrier(NEC_CARRIER),
+	_frames(0),
+	_position(0),
+	_framesLeft(0){
+}
+
+bool IrPlayer::load(const IrCode& code){
+	if (busy()){
+		return false;
+	}
+
+	uint32_t frameTime;
+
+	if (code.protocol == IR_NEC && code.bits == NEC_BITS){
+		_carrier = NEC_CARRIER;
+		_frames = 1;
+		_length = NEC_PULSES;
+		frameTime = NEC_HEADER_MARK + NEC_HEADER_SPACE + uint32_t(NEC_BITS + 1) * NEC_BIT_MARK;
+
+		for (uint8_t i = 0; i < NEC_BITS; i++){
+			frameTime += (code.value >> i) & 1 ? NEC_ONE_SPACE : NEC_ZERO_SPACE;
+		}
+		setGap(NEC_FRAME_PERIOD, frameTime);
+	}
+	else if (code.protocol == IR_SONY && sonyBits(code.bits) && (code.value >> code.bits) == 0){
+		_carrier = SONY_CARRIER;
+		_frames = SONY_FRAMES;
+		_length = 1 + 2 * code.bits + 1;
+		frameTime = SONY_HEADER_MARK + uint32_t(code.bits) * SONY_SPACE;
+
+		for (uint8_t i = 0; i < code.bits; i++){
+			frameTime += (code.value >> i) & 1 ? SONY_ONE_MARK : SONY_ZERO_MARK;
+		}
+		setGap(SONY_FRAME_PERIOD, frameTime);
+	}
+	else{
+		return false;
+	}
+
+	_protocol = code.protocol;
+	_value = code.value;
+	_position = 0;
+	_framesLeft = _frames;
+	return true;
+}
+
+/**
+* Space out to the protocol's frame period, so frames sent back to back
+* are as far apart as the remote would have them
+*/
+void IrPlayer::setGap(uint32_t period, uint32_t frameTime){
+	_gap = uint16_t(((period - frameTime) * _carrier + 500) / 1000);
+}
+
+bool IrPlayer::next(uint16_t& pulse){
+	if (_framesLeft == 0){
+		return false;
+	}
+
+	if (_position == _length){
+		if (--_framesLeft == 0){
+			return false;
+		}
+		_position = 0;
+	}
+
+	uint8_t position = _position++;
+
+	if (position + 1 == _length){
+		pulse = _gap;
+	}
+	else if (_protocol == IR_NEC){
+		// Header, then a mark before every bit's space and one to stop
+		if (position == 0){
+			_bits = _value;
+			pulse = NEC_HEADER_MARK_CYCLES | IR_MARK;
+		}
+		else if (position == 1){
+			pulse = NEC_HEADER_SPACE_CYCLES;
+		}
+		else if (position % 2 == 0){
+			pulse = NEC_BIT_MARK_CYCLES | IR_MARK;
+		}
+		else{
+			pulse = nextBit(NEC_ONE_SPACE_CYCLES, NEC_ZERO_SPACE_CYCLES);
+		}
+	}
+	else{
+		// Header, then a space before every bit's mark
+		if (position == 0){
+			_bits = _value;
+			pulse = SONY_HEADER_MARK_CYCLES | IR_MARK;
+		}
+		else if (position % 2 == 1){
+			pulse = SONY_SPACE_CYCLES;
+		}
+		else{
+			pulse = nextBit(SONY_ONE_MARK_CYCLES, SONY_ZERO_MARK_CYCLES) | IR_MARK;
+		}
+	}
+
+	return true;
+}
+
+/**
+* Length of the pulse for the next bit of the value, lowest first
+*/
+uint16_t IrPlayer::nextBit(uint16_t one, uint16_t zero){
+	bool set = _bits & 1;
+	_bits >>= 1;
+	return set ? one : zero;
+}
@@ -0,0 +1,198 @@
+#ifndef LURKER_IR_H
+#define LURKER_IR_H
+
+#include <stdint.h>
+
+#include "lurker_frame.h"
+
+//////////////////////////////////////////////////////////////////////////
+// IR Receiver
+//
+// The receiver's output interrupts on every edge. The interrupt only
+// times the pulse that just ended and queues it, marks (carrier on) with
+// the top bit set; the loop takes them off the queue and decodes them a
+// pulse at a time, so nothing waits for a frame to finish.
+//
+// NEC and Sony SIRC codes are decoded in full. Anything else long enough
+// is reduced to a hash of its timing, which is the same for every press
+// of the same button, so any remote can still be told apart.
+//
+// Radio packets:
+//	e <unit> <protocol> <bits> <code(4)> $	Code received, node to coordinator
+//
+// IR Blaster
+//
+// A code is played out by a timer interrupt: the timer makes the
+// carrier, and the interrupt counts its cycles and switches it on or off
+// at the end of each pulse. Pulses, counted in carrier cycles, are worked
+// out from the code as they're needed rather than kept in a buffer. The
+// codes are the ones the receiver decodes, so a code printed by a
+// receiver can be sent back out as it is.
+//////////////////////////////////////////////////////////////////////////
+
+const char IR_EVENT_CODE = 'e';
+const uint8_t IR_EVENT_SIZE = 9;
+
+const uint16_t IR_MARK = 0x8000;	// Pulse flag: carrier on
+const uint16_t IR_MAX_PULSE = 0x7FFF;	// us; longer pulses are cut short to this
+const uint16_t IR_FRAME_GAP = 6000;	// us of silence that ends a frame; less than the gap between Sony frames
+const uint8_t IR_QUEUE_SIZE = 32;	// Pulses; a power of 2
+
+enum IrProtocol{
+	IR_NONE,
+	IR_NEC,
+	IR_SONY,
+	IR_HASH	// Unknown protocol; the code is a hash of the timing
+};
+
+struct IrCode{
+	IrProtocol protocol;
+	uint8_t bits;
+	bool repeat;	// NEC's short frame for a held button
+	uint32_t value;
+};
+
+/**
+* Pulses from the interrupt to the loop
+* One writer, the interrupt, and one reader, the loop; the indexes are a
+* byte each, so neither needs the other locked out.
+*/
+class IrPulseQueue{
+public:
+	IrPulseQueue();
+
+	/**
+	* Interrupt - the input changed
+	* @param now Time in us
+	* @param mark The pulse that just ended was a mark
+	*/
+	void edge(uint32_t now, bool mark);
+
+	/**
+	* Take the oldest pulse
+	* After an overflow the queue hands out a frame gap, so the decoder
+	* drops the frame it was missing pulses from.
+	*
+	* @return False if there are none
+	*/
+	bool pop(uint16_t& pulse);
+
+	/**
+	* Time of the last edge, in us; read it with interrupts off
+	*/
+	uint32_t lastEdge() const{
+		return _lastEdge;
+	}
+
+private:
+	volatile uint16_t _pulses[IR_QUEUE_SIZE];
+	volatile uint8_t _head;
+	volatile uint8_t _tail;
+	volatile bool _lost;
+	volatile uint32_t _lastEdge;
+};
+
+class IrDecoder{
+public:
+	IrDecoder();
+
+	/**
+	* Decode the next pulse
+	* @return True if it finished a code
+	*/
+	bool pulse(uint16_t pulse, IrCode& code);
+
+	/**
+	* The frame has ended without a gap pulse to say so, e.g. the
+	* receiver's been quiet for IR_FRAME_GAP
+	* @return True if the frame was a code
+	*/
+	bool end(IrCode& code);
+
+	/**
+	* Part way through a frame
+	*/
+	bool active() const{
+		return _count > 0 && !_done;
+	}
+
+	static uint8_t encodeEvent(uint8_t unit, const IrCode& code, uint8_t* packet);
+	static bool decodeEvent(const uint8_t* packet, uint8_t length, uint8_t& unit, IrCode& code);
+
+private:
+	void reset();
+	void decodeNec(uint16_t duration, bool mark, IrCode& code);
+	void decodeSony(uint16_t duration, bool mark);
+	void addToHash(uint16_t duration);
+
+	uint8_t _count;	// Pulses in this frame
+	bool _done;	// Finished early; the rest of the frame is ignored
+
+	bool _nec;
+	bool _necRepeat;
+	uint32_t _necValue;
+	uint32_t _necLast;	// For repeats
+
+	bool _sony;
+	uint8_t _sonyBits;
+	uint32_t _sonyValue;
+
+	uint32_t _hash;
+	uint16_t _previous[2];	// The last two pulses, for the hash
+};
+
+/**
+* Pulses from the loop to the interrupt
+* The loop loads a code while the player is idle and the interrupt plays
+* it; once the last pulse is out the player is idle again. Only the code
+* and the gap after each frame are kept, not the pulses.
+*/
+class IrPlayer{
+public:
+	IrPlayer();
+
+	/**
+	* Encode a code to be played
+	* @return False if the player's busy, or the code can't be sent; hashed
+	* codes can't be turned back into pulses
+	*/
+	bool load(const IrCode& code);
+
+	/**
+	* Interrupt - take the next pulse, in carrier cycles, marks with
+	* IR_MARK set; only constants and shifts, no arithmetic on the timing
+	* @return False once the code has been played, every frame of it
+	*/
+	bool next(uint16_t& pulse);
+
+	/**
+	* Loaded and not yet played out
+	*/
+	bool busy() const{
+		return _framesLeft > 0;
+	}
+
+	/**
+	* Carrier frequency of the loaded code, in kHz
+	*/
+	uint8_t carrier() const{
+		return _carrier;
+	}
+
+private:
+	void setGap(uint32_t period, uint32_t frameTime);
+	uint16_t nextBit(uint16_t one, uint16_t zero);
+
+	uint32_t _value;
+	uint32_t _bits;	// Interrupt - what's left of the value this frame, next bit lowest
+	uint16_t _gap;	// Carrier cycles after each frame
+	uint8_t _protocol;
+	uint8_t _length;	// Pulses per frame, the gap included
+	uint8_t _carrier;
+	uint8_t _frames;	// Times the frame is sent
+
+	volatile uint8_t _position;
+	volatile uint8_t _framesLeft;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include <avr/io.h>
+#include <stdlib.h>
+#include "lurker_memory.h"
+
+// avr-libc's allocator state
+struct __freelist{
+	size_t sz;
+	struct __freelist* nx;
+};
+
+extern "C" {
+	extern char __heap_start;
+	extern char* __brkval;
+	extern size_t __malloc_margin;
+	extern struct __freelist* __flp;
+}
+
+/**
+* Paint the memory between the static data and the top of RAM
+* Runs in .init1, before the stack pointer is set up and before r1 is
+* cleared, so it can't be C and mustn't touch the stack. .data and .bss
+* are below __heap_start and are filled in afterwards.
+*/
+void paintStack() __attribute__((naked, used, section(".init1")));
+
+void paintStack(){
+	__asm volatile(
+		"	ldi r30, lo8(__heap_start)\n"
+		"	ldi r31, hi8(__heap_start)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		"	breq 1b\n"
+		:: "i" (STACK_CANARY));
+}
+
+/**
+* Current top of the heap
+*/
+static char* heapEnd(){
+	return __brkval != 0 ? __brkval : &__heap_start;
+}
+
+/**
+* Find the paint that is left between the heap and the stack
+* @param start Set to the first painted byte
+* @return Byte above the paint, the lowest the stack has reached
+*/
+static char* findPaint(char*& start){
+	char* p = heapEnd();
+	char* stack = (char*)SP;
+
+	// Memory the heap has given back sits just above its end and isn't
+	// painted any more
+	while (p < stack && *p != (char)STACK_CANARY){
+		p++;
+	}
+
+	start = p;
+
+	while (p < stack && *p == (char)STACK_CANARY){
+		p++;
+	}
+
+	return p;
+}
+
+unsigned int minimumFreeMemory(){
+	char* start;
+	char* end = findPaint(start);
+
+	return end - start;
+}
+
+void readMemoryStats(MemoryStats& stats){
+	char* heap = heapEnd();
+	unsigned int gap = (char*)SP - heap;
+	unsigned int largest = gap > __malloc_margin ? gap - __malloc_margin : 0;
+
+	stats.freeRam = gap;
+	stats.freeBlocks = 0;
+
+	for (struct __freelist* chunk = __flp; chunk != 0; chunk = chunk->nx){
+		stats.freeRam += chunk->sz + sizeof(size_t);
+		stats.freeBlocks++;
+
+		if (chunk->sz > largest){
+			largest = chunk->sz;
+		}
+	}
+
+	stats.largestBlock = largest;
+	stats.heapSize = heap - &__heap_start;
+
+	char* paint;
+	char* stackLow = findPaint(paint);
+	stats.minimumFree = stackLow - paint;
+	stats.stackPeak = (char*)RAMEND + 1 - stackLow;
+}
@@ -0,0 +1,37 @@
+#ifndef LURKER_MEMORY_H
+#define LURKER_MEMORY_H
+
+//////////////////////////////////////////////////////////////////////////
+// Memory Monitor
+//
+// The Nano has 2 KB of SRAM for static data, the heap (Strings) and the
+// stack, which grow towards each other. Before the C runtime starts,
+// everything above the static data is painted with STACK_CANARY. Whatever
+// paint is left later is memory that neither the heap nor the stack has
+// ever reached, so the low-water mark includes interrupts and the deepest
+// call chains, not just the moments we happened to look.
+//////////////////////////////////////////////////////////////////////////
+
+const unsigned char STACK_CANARY = 0xC5;
+
+struct MemoryStats{
+	unsigned int freeRam;	// Gap between heap and stack, plus the heap's free list
+	unsigned int minimumFree;	// Smallest gap between heap and stack since boot
+	unsigned int largestBlock;	// Largest single malloc() that would succeed now
+	unsigned int freeBlocks;	// Chunks on the free list; more means more fragmented
+	unsigned int heapSize;
+	unsigned int stackPeak;	// Deepest the stack has been since boot
+};
+
+/**
+* Take a snapshot of the memory use
+* Scans the painted area, so costs up to a millisecond or so.
+*/
+void readMemoryStats(MemoryStats& stats);
+
+/**
+* Smallest gap there has been between the heap and the stack since boot
+*/
+unsigned int minimumFreeMemory();
+
+#endif
@@ -0,0 +1,392 @@
+#include "lurker_network.h"
+
+const uint8_t DATA_PACKET_LENGTH = 17;
+const uint8_t JOIN_PACKET_LENGTH = 4;
+
+// Fields a data response has to carry
+const uint8_t FIELD_UNIT = 1 << 0;
+const uint8_t FIELD_TEMPERATURE = 1 << 1;
+const uint8_t FIELD_HUMIDITY = 1 << 2;
+const uint8_t FIELD_ILLUMINANCE = 1 << 3;
+const uint8_t FIELD_MOTION = 1 << 4;
+const uint8_t ALL_FIELDS = FIELD_UNIT | FIELD_TEMPERATURE | FIELD_HUMIDITY | FIELD_ILLUMINANCE | FIELD_MOTION;
+
+/**
+* True once an interval has passed since the given time; wrap-safe
+*/
+static bool elapsed(NetworkTime now, NetworkTime since, NetworkTime interval){
+	return NetworkTime(now - since) >= interval;
+}
+
+/**
+* Fixed point for the radio; the lowest value is kept for INVALID_HUNDREDTHS
+*/
+static uint16_t toHundredths(float value, bool valid){
+	if (!valid){
+		return INVALID_HUNDREDTHS;
+	}
+
+	float hundredths = value * 100 + (value < 0 ? -0.5f : 0.5f);
+	if (hundredths < -32767){
+		hundredths = -32767;
+	}
+	else if (hundredths > 32767){
+		hundredths = 32767;
+	}
+
+	return uint16_t(int16_t(hundredths));
+}
+
+static float fromHundredths(uint16_t field, uint8_t flag, uint8_t& valid){
+	if (field == INVALID_HUNDREDTHS){
+		valid &= ~flag;
+		return 0;
+	}
+
+	valid |= flag;
+	return int16_t(field) / 100.0f;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////
+// Network
+
+LurkerNetwork::LurkerNetwork(uint8_t unit, const NetworkConfig& config, NetworkHandler& handler,
+	NetworkRoute* routes, uint8_t routeCount) :
+	_unit(unit),
+	_config(config),
+	_handler(handler),
+	_routes(routes),
+	_routeCount(routes != 0 ? routeCount : 0),
+	_pollIndex(0),
+	_lastPoll(0),
+	_connected(false),
+	_lastRequest(0),
+	_lastJoinAttempt(0){
+}
+
+void LurkerNetwork::begin(NetworkTime now){
+	for (uint8_t i = 0; i < _routeCount; i++){
+		_routes[i].active = false;
+		_routes[i].lastHeard = now;
+	}
+
+	_pollIndex = 0;
+	_lastPoll = now;
+	_connected = false;
+	_lastRequest = now;
+
+	// First join attempt a full interval after start-up, as before
+	_lastJoinAttempt = now;
+}
+
+void LurkerNetwork::update(NetworkTime now){
+	if (isCoordinator()){
+		updateCoordinator(now);
+	}
+	else{
+		updateNode(now);
+	}
+}
+
+NetworkTime LurkerNetwork::nextUpdate(NetworkTime now) const{
+	NetworkTime next;
+
+	if (isCoordinator()){
+		next = _lastPoll + _config.pollInterval;
+
+		for (uint8_t i = 0; i < _routeCount; i++){
+			NetworkTime timeout = _routes[i].lastHeard + _config.nodeTimeout;
+
+			if (_routes[i].active && NetworkTime(timeout - now) < NetworkTime(next - now)){
+				next = timeout;
+			}
+		}
+	}
+	else{
+		next = _connected ? _lastRequest + _config.nodeTimeout : _lastJoinAttempt + _config.joinInterval;
+	}
+
+	// Already overdue
+	if (NetworkTime(next - now) > NetworkTime(~0UL) / 2){
+		return now;
+	}
+
+	return next;
+}
+
+uint8_t LurkerNetwork::activeNodes() const{
+	uint8_t count = 0;
+
+	for (uint8_t i = 0; i < _routeCount; i++){
+		count += _routes[i].active;
+	}
+
+	return count;
+}
+
+void LurkerNetwork::receive(const uint8_t* packet, uint8_t length, NetworkTime now){
+	if (length == 0){
+		return;
+	}
+
+	if (isCoordinator()){
+		receiveCoordinator(packet, length, now);
+	}
+	else{
+		receiveNode(packet, length, now);
+	}
+}
+
+void LurkerNetwork::sendCommand(uint8_t unit, char command){
+	uint8_t packet[3];
+	_handler.transmit(unit, packet, FrameBuilder(packet, sizeof(packet)).byte(command).byte(PROTOCOL_VERSION).finish());
+}
+
+/**
+* Every packet has its command, the version and PACKET_END, so anything
+* shorter is from the first firmware or broken
+*/
+bool LurkerNetwork::versionMatches(const uint8_t* packet, uint8_t length){
+	return length >= 3 && packet[1] == PROTOCOL_VERSION;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Coordinator
+
+/**
+* Drop silent nodes and poll the next unit in the routing table
+*
+* Polls go round the table one slot per interval. A slot that isn't active
+* is skipped without sending anything rather than moving straight on to the
+* next active node; it's a lot less spammy that way. The coordinator has a
+* slot of its own that is never active, which leaves it a break to send its
+* own data.
+*/
+void LurkerNetwork::updateCoordinator(NetworkTime now){
+	for (uint8_t i = 0; i < _routeCount; i++){
+		if (_routes[i].active && elapsed(now, _routes[i].lastHeard, _config.nodeTimeout)){
+			_routes[i].active = false;
+			_handler.networkEvent(NETWORK_NODE_TIMED_OUT, i);
+		}
+	}
+
+	if (!elapsed(now, _lastPoll, _config.pollInterval)){
+		return;
+	}
+
+	// Kept up to date with no table too, or nextUpdate() is always overdue
+	_lastPoll = now;
+
+	if (_routeCount == 0){
+		return;
+	}
+
+	_pollIndex = _pollIndex + 1 < _routeCount ? _pollIndex + 1 : 0;
+
+	if (_routes[_pollIndex].active){
+		_handler.networkEvent(NETWORK_NODE_POLLED, _pollIndex);
+		sendCommand(_pollIndex, DATA_TRANSMIT_REQUEST);
+	}
+}
+
+void LurkerNetwork::receiveCoordinator(const uint8_t* packet, uint8_t length, NetworkTime now){
+	switch (packet[0]){
+	case NETWORK_JOIN_REQUEST:{
+		if (!versionMatches(packet, length)){
+			// The first firmware's j <unit> $ names the unit
+			_handler.networkEvent(NETWORK_VERSION_MISMATCH, length == JOIN_PACKET_LENGTH - 1 ? packet[1] : COORDINATOR);
+			return;
+		}
+
+		FrameReader fields(packet + 2, length - 2);
+		uint8_t unit = fields.byte();
+
+		if (unit == COORDINATOR || unit >= _routeCount){
+			_handler.networkEvent(NETWORK_PACKET_REJECTED, unit);
+			return;
+		}
+
+		if (!_routes[unit].active){
+			_routes[unit].active = true;
+			_handler.networkEvent(NETWORK_NODE_JOINED, unit);
+		}
+		_routes[unit].lastHeard = now;
+
+		// Confirm every request, in case an earlier confirmation was lost
+		sendCommand(unit, NETWORK_JOIN_CONFIRM);
+		break;
+	}
+
+	case DATA_TRANSMIT_RESPONSE:{
+		SensorReading reading;
+
+		if (!versionMatches(packet, length)){
+			// The first firmware's readings start d Z <unit>
+			_handler.networkEvent(NETWORK_VERSION_MISMATCH,
+				length >= 3 && packet[1] == UNIT_ID_CODE ? packet[2] : COORDINATOR);
+			return;
+		}
+
+		// Only nodes in the table are polled; anything else is stale or bogus
+		if (!decodeReading(packet, length, reading) || reading.unit >= _routeCount || !_routes[reading.unit].active){
+			_handler.networkEvent(NETWORK_PACKET_REJECTED, length >= 4 ? packet[3] : COORDINATOR);
+			return;
+		}
+
+		_routes[reading.unit].lastHeard = now;
+		_handler.readingReceived(reading);
+		break;
+	}
+
+	default:
+		_handler.networkEvent(NETWORK_PACKET_REJECTED, COORDINATOR);
+		break;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Node
+
+void LurkerNetwork::updateNode(NetworkTime now){
+	// Senpai hasn't noticed us in a while; start over
+	if (_connected && elapsed(now, _lastRequest, _config.nodeTimeout)){
+		_connected = false;
+		_handler.networkEvent(NETWORK_TIMED_OUT, _unit);
+	}
+
+	if (!_connected && elapsed(now, _lastJoinAttempt, _config.joinInterval)){
+		_lastJoinAttempt = now;
+
+		uint8_t packet[JOIN_PACKET_LENGTH];
+		_handler.transmit(COORDINATOR, packet,
+			FrameBuilder(packet, sizeof(packet)).byte(NETWORK_JOIN_REQUEST).byte(PROTOCOL_VERSION).byte(_unit).finish());
+		_handler.networkEvent(NETWORK_JOIN_ATTEMPT, _unit);
+	}
+}
+
+void LurkerNetwork::receiveNode(const uint8_t* packet, uint8_t length, NetworkTime now){
+	bool known = packet[0] == NETWORK_JOIN_CONFIRM || packet[0] == DATA_TRANSMIT_REQUEST;
+
+	// A coordinator on other firmware; answering it would only be misread
+	if (known && !versionMatches(packet, length)){
+		_handler.networkEvent(NETWORK_VERSION_MISMATCH, COORDINATOR);
+		return;
+	}
+
+	switch (packet[0]){
+	case NETWORK_JOIN_CONFIRM:
+		if (!_connected){
+			_connected = true;
+			_handler.networkEvent(NETWORK_JOINED, _unit);
+		}
+		_lastRequest = now;
+		break;
+
+	case DATA_TRANSMIT_REQUEST:{
+		// Being polled means the coordinator has us in its table, even if
+		// the join confirmation never arrived
+		if (!_connected){
+			_connected = true;
+			_handler.networkEvent(NETWORK_JOINED, _unit);
+		}
+		_lastRequest = now;
+		_handler.networkEvent(NETWORK_DATA_REQUESTED, _unit);
+
+		SensorReading reading;
+		_handler.readSensors(reading);
+		reading.unit = _unit;
+
+		uint8_t response[NETWORK_PAYLOAD_SIZE];
+		_handler.transmit(COORDINATOR, response, encodeReading(reading, response));
+		break;
+	}
+
+	default:
+		_handler.networkEvent(NETWORK_PACKET_REJECTED, _unit);
+		break;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Data Packets
+
+/**
+* Write a data response
+* @param packet At least NETWORK_PAYLOAD_SIZE bytes
+* @return Packet length
+*/
+uint8_t LurkerNetwork::encodeReading(const SensorReading& reading, uint8_t* packet){
+	FrameBuilder frame(packet, NETWORK_PAYLOAD_SIZE);
+
+	frame.byte(DATA_TRANSMIT_RESPONSE).byte(PROTOCOL_VERSION)
+		.byte(UNIT_ID_CODE).byte(reading.unit)
+		.byte(TEMPERATURE_CODE).word(toHundredths(reading.temperature, reading.valid & VALID_TEMPERATURE))
+		.byte(HUMIDITY_CODE).word(toHundredths(reading.humidity, reading.valid & VALID_HUMIDITY))
+		.byte(ILLUMINANCE_CODE).word(!(reading.valid & VALID_ILLUMINANCE) ? INVALID_ILLUMINANCE
+			: reading.illuminance == INVALID_ILLUMINANCE ? INVALID_ILLUMINANCE - 1 : reading.illuminance)
+		.byte(MOTION_CODE).byte(reading.motion)
+		.byte(DATA_PACKET_FINISHED);
+
+	return frame.finish();
+}
+
+/**
+* Read a data response
+* Every field has to be there, once the packet is finished, and nothing is
+* read past length.
+*/
+bool LurkerNetwork::decodeReading(const uint8_t* packet, uint8_t length, SensorReading& reading){
+	if (length < DATA_PACKET_LENGTH || packet[0] != DATA_TRANSMIT_RESPONSE || packet[1] != PROTOCOL_VERSION){
+		return false;
+	}
+
+	FrameReader fields(packet + 2, length - 2);
+	uint8_t found = 0;
+	reading.valid = 0;
+
+	while (fields.ok() && fields.remaining() > 0 && fields.peek() != DATA_PACKET_FINISHED){
+		switch (fields.byte()){
+		case UNIT_ID_CODE:
+			reading.unit = fields.byte();
+			found |= FIELD_UNIT;
+			break;
+
+		case TEMPERATURE_CODE:
+			reading.temperature = fromHundredths(fields.word(), VALID_TEMPERATURE, reading.valid);
+			found |= FIELD_TEMPERATURE;
+			break;
+
+		case HUMIDITY_CODE:
+			reading.humidity = fromHundredths(fields.word(), VALID_HUMIDITY, reading.valid);
+			found |= FIELD_HUMIDITY;
+			break;
+
+		case ILLUMINANCE_CODE:
+			reading.illuminance = fields.word();
+			if (reading.illuminance == INVALID_ILLUMINANCE){
+				reading.illuminance = 0;
+				reading.valid &= ~VALID_ILLUMINANCE;
+			}
+			else{
+				reading.valid |= VALID_ILLUMINANCE;
+			}
+			found |= FIELD_ILLUMINANCE;
+			break;
+
+		case MOTION_CODE:
+			reading.motion = fields.byte() != 0;
+			found |= FIELD_MOTION;
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return fields.ok() && fields.remaining() > 0 && found == ALL_FIELDS;
+}
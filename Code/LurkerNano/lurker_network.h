@@ -0,0 +1,210 @@
+#ifndef LURKER_NETWORK_H
+#define LURKER_NETWORK_H
+
+#include <stdint.h>
+
+#include "lurker_frame.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Lurker Network
+//
+// Star network over the nRF24L01+. The coordinator (unit 0) keeps a
+// routing table of the nodes that have joined and polls them for data in
+// turn. Nodes ask to join until the coordinator confirms, answer its data
+// requests, and start over when it hasn't been heard from for a while.
+//
+// Plain C++ with no Arduino dependencies: the time is passed in, and the
+// radio, sensors and output sit behind NetworkHandler. The sketch runs it
+// on millis() and the RF24; Code/LurkerSim runs hundreds of copies on a
+// virtual clock and radio medium.
+//
+// Packets are a command byte, the protocol version, its fields and
+// PACKET_END:
+//	j <version> <unit> $	Join request, node to coordinator
+//	J <version> $	Join confirmation
+//	D <version> $	Data request
+//	d <version> Z <unit> T <temperature> H <humidity> I <illuminance> M <motion> F $
+//		Data response; temperature and humidity in signed hundredths,
+//		16-bit fields big-endian. A reading the sensor couldn't give is
+//		sent as INVALID_HUNDREDTHS, or INVALID_ILLUMINANCE.
+//
+// Packets of any other version are turned away with
+// NETWORK_VERSION_MISMATCH. That includes the first firmware's, which have
+// no version byte (j <unit> $, J $, D $, and whole-degree readings with a
+// one-byte humidity), so a network of mixed firmware shows up in the log
+// rather than as readings decoded wrong.
+//////////////////////////////////////////////////////////////////////////
+
+typedef uint32_t NetworkTime;	// ms, wrapping like millis()
+
+const uint8_t COORDINATOR = 0;
+const uint8_t BROADCAST = 0xFF;	// Unit number of the broadcast pipe
+const uint64_t BASE_PIPE = 0x9090909000LL;	// Unit n listens on BASE_PIPE + n
+const uint64_t BROADCAST_PIPE = BASE_PIPE + BROADCAST;
+const uint8_t NETWORK_PAYLOAD_SIZE = 32;
+const uint8_t PROTOCOL_VERSION = 2;	// The first firmware, without a version byte, counts as 1
+
+// Comm Tags - frames end in PACKET_END, from lurker_frame.h
+const char NETWORK_JOIN_REQUEST = 'j';
+const char NETWORK_JOIN_CONFIRM = 'J';
+const char NETWORK_CONNECTION_RESET = 'R';
+const char DATA_TRANSMIT_REQUEST = 'D';
+const char DATA_TRANSMIT_RESPONSE = 'd';
+const char DATA_PACKET_FINISHED = 'F';
+
+const char UNIT_ID_CODE = 'Z';
+const char TEMPERATURE_CODE = 'T';
+const char HUMIDITY_CODE = 'H';
+const char ILLUMINANCE_CODE = 'I';
+const char MOTION_CODE = 'M';
+
+// In place of readings the sensor couldn't give; neither can come from a real one
+const uint16_t INVALID_HUNDREDTHS = 0x8000;
+const uint16_t INVALID_ILLUMINANCE = 0xFFFF;
+
+struct NetworkConfig{
+	NetworkTime nodeTimeout;	// Silence before a node is dropped from the routing table, or drops out itself
+	NetworkTime joinInterval;	// Time between join attempts
+	NetworkTime pollInterval;	// Time between data requests from the coordinator
+};
+
+/**
+* Routing table entry, one per unit number
+*/
+struct NetworkRoute{
+	NetworkTime lastHeard;
+	bool active;
+};
+
+// SensorReading::valid flags
+const uint8_t VALID_TEMPERATURE = 1 << 0;
+const uint8_t VALID_HUMIDITY = 1 << 1;
+const uint8_t VALID_ILLUMINANCE = 1 << 2;
+const uint8_t ALL_VALID = VALID_TEMPERATURE | VALID_HUMIDITY | VALID_ILLUMINANCE;
+
+struct SensorReading{
+	uint8_t unit;
+	float temperature;
+	float humidity;
+	uint16_t illuminance;
+	bool motion;
+	uint8_t valid;	// The readings the sensors gave; the rest are 0
+};
+
+enum NetworkEvent{
+	// Node
+	NETWORK_JOIN_ATTEMPT,
+	NETWORK_JOINED,	// Confirmed, or polled before the confirmation arrived
+	NETWORK_TIMED_OUT,
+	NETWORK_DATA_REQUESTED,
+
+	// Coordinator
+	NETWORK_NODE_JOINED,
+	NETWORK_NODE_TIMED_OUT,
+	NETWORK_NODE_POLLED,
+
+	NETWORK_PACKET_REJECTED,
+	NETWORK_VERSION_MISMATCH	// From another protocol version; the unit is a guess for the first firmware's packets
+};
+
+/**
+* What the network needs from the device it runs on
+*/
+class NetworkHandler{
+public:
+	/**
+	* Send a packet to a unit's pipe, or to BROADCAST
+	*/
+	virtual void transmit(uint8_t unit, const uint8_t* packet, uint8_t length) = 0;
+
+	/**
+	* Fill in the latest sensor values for a data response
+	*/
+	virtual void readSensors(SensorReading& reading) = 0;
+
+	/**
+	* Coordinator only - a node's data response has arrived
+	*/
+	virtual void readingReceived(const SensorReading&){}
+
+	virtual void networkEvent(NetworkEvent, uint8_t){}
+};
+
+class LurkerNetwork{
+public:
+	/**
+	* @param routes Routing table for the coordinator, indexed by unit number
+	* @param routeCount Length of the routing table; units at or above it can't join
+	*/
+	LurkerNetwork(uint8_t unit, const NetworkConfig& config, NetworkHandler& handler,
+		NetworkRoute* routes = 0, uint8_t routeCount = 0);
+
+	void begin(NetworkTime now);
+
+	/**
+	* Run whatever is due: join attempts, polls and timeouts
+	*/
+	void update(NetworkTime now);
+
+	/**
+	* Handle a received packet
+	* Anything malformed is dropped without touching the network state.
+	*/
+	void receive(const uint8_t* packet, uint8_t length, NetworkTime now);
+
+	/**
+	* Time update() next has something to do, for event-driven callers
+	*/
+	NetworkTime nextUpdate(NetworkTime now) const;
+
+	bool isCoordinator() const{
+		return _unit == COORDINATOR;
+	}
+
+	/**
+	* Node - joined and hearing from the coordinator
+	*/
+	bool connected() const{
+		return _connected;
+	}
+
+	/**
+	* Coordinator - number of nodes in the routing table
+	*/
+	uint8_t activeNodes() const;
+
+	static uint8_t encodeReading(const SensorReading& reading, uint8_t* packet);
+	static bool decodeReading(const uint8_t* packet, uint8_t length, SensorReading& reading);
+
+	/**
+	* The packet carries this firmware's PROTOCOL_VERSION
+	*/
+	static bool versionMatches(const uint8_t* packet, uint8_t length);
+
+private:
+	LurkerNetwork(const LurkerNetwork&);
+	LurkerNetwork& operator=(const LurkerNetwork&);
+
+	void sendCommand(uint8_t unit, char command);
+	void updateCoordinator(NetworkTime now);
+	void updateNode(NetworkTime now);
+	void receiveCoordinator(const uint8_t* packet, uint8_t length, NetworkTime now);
+	void receiveNode(const uint8_t* packet, uint8_t length, NetworkTime now);
+
+	uint8_t _unit;
+	NetworkConfig _config;
+	NetworkHandler& _handler;
+
+	// Coordinator
+	NetworkRoute* _routes;
+	uint8_t _routeCount;
+	uint8_t _pollIndex;
+	NetworkTime _lastPoll;
+
+	// Node
+	bool _connected;
+	NetworkTime _lastRequest;
+	NetworkTime _lastJoinAttempt;
+};
+
+#endif
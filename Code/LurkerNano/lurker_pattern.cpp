@@ -0,0 +1,76 @@
+#include "lurker_pattern.h"
+
+static void readStep(const PatternStep* from, PatternStep& step){
+	step.value = pgm_read_word(&from->value);
+	step.duration = pgm_read_word(&from->duration);
+}
+
+PatternPlayer::PatternPlayer(PatternHandler& handler, PatternChannel* channels, uint8_t channelCount) :
+	_handler(handler),
+	_channels(channels),
+	_channelCount(channelCount){
+
+	for (uint8_t i = 0; i < _channelCount; i++){
+		_channels[i].pattern = 0;
+		_channels[i].step = 0;
+		_channels[i].left = 0;
+	}
+}
+
+void PatternPlayer::play(uint8_t channel, const PatternStep* pattern){
+	if (channel >= _channelCount){
+		return;
+	}
+
+	_channels[channel].pattern = pattern;
+	_channels[channel].step = 0;
+	_channels[channel].left = 0;
+}
+
+void PatternPlayer::stop(uint8_t channel){
+	if (channel < _channelCount && _channels[channel].pattern){
+		_channels[channel].pattern = 0;
+		_handler.output(channel, 0);
+	}
+}
+
+void PatternPlayer::tick(){
+	for (uint8_t i = 0; i < _channelCount; i++){
+		PatternChannel& channel = _channels[i];
+
+		if (channel.pattern && (channel.left == 0 || --channel.left == 0)){
+			nextStep(i);
+		}
+	}
+}
+
+bool PatternPlayer::active() const{
+	for (uint8_t i = 0; i < _channelCount; i++){
+		if (_channels[i].pattern){
+			return true;
+		}
+	}
+	return false;
+}
+
+void PatternPlayer::nextStep(uint8_t index){
+	PatternChannel& channel = _channels[index];
+	PatternStep step;
+
+	readStep(channel.pattern + channel.step, step);
+
+	// A pattern that's only a loop would go round forever
+	if (step.duration == 0 && step.value == PATTERN_LOOP && channel.step > 0){
+		channel.step = 0;
+		readStep(channel.pattern, step);
+	}
+
+	if (step.duration == 0){
+		stop(index);
+		return;
+	}
+
+	channel.step++;
+	channel.left = step.duration;
+	_handler.output(index, step.value);
+}
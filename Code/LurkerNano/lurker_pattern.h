@@ -0,0 +1,86 @@
+#ifndef LURKER_PATTERN_H
+#define LURKER_PATTERN_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Light and Buzzer Patterns
+//
+// Blinks, beeps and melodies are lists of steps kept in PROGMEM, each an
+// output value held for a number of ms: a tone in Hz for the buzzer, or
+// on and off for a light. Every output has a channel of its own, so a
+// light can blink while the buzzer plays. One timer interrupt moves all
+// the channels on a ms at a time; nothing in the loop waits on them.
+//
+// A step with no duration ends the pattern, or starts it over if its
+// value is PATTERN_LOOP.
+//////////////////////////////////////////////////////////////////////////
+
+const uint16_t PATTERN_LOOP = 0xFFFF;
+
+struct PatternStep{
+	uint16_t value;	// Hz for a tone, 0 for silence; non-zero for a light on
+	uint16_t duration;	// ms; 0 ends the pattern
+};
+
+struct PatternChannel{
+	const PatternStep* pattern;	// PROGMEM; null when idle
+	uint8_t step;	// The next one
+	uint16_t left;	// ms of the current step
+};
+
+class PatternHandler{
+public:
+	/**
+	* Set an output; called from the timer interrupt, and with 0 when a
+	* pattern ends or is stopped
+	*/
+	virtual void output(uint8_t channel, uint16_t value) = 0;
+};
+
+/**
+* Plays patterns on a set of channels
+* play() and stop() share the channels with tick(), so call them with
+* interrupts off.
+*/
+class PatternPlayer{
+public:
+	PatternPlayer(PatternHandler& handler, PatternChannel* channels, uint8_t channelCount);
+
+	/**
+	* Play a pattern from the next tick, cutting short whatever the
+	* channel was playing
+	*/
+	void play(uint8_t channel, const PatternStep* pattern);
+
+	void stop(uint8_t channel);
+
+	/**
+	* Interrupt - a ms has passed
+	*/
+	void tick();
+
+	/**
+	* Any channel still playing; the timer can stop when none are
+	*/
+	bool active() const;
+
+private:
+	PatternPlayer(const PatternPlayer&);
+	PatternPlayer& operator=(const PatternPlayer&);
+
+	void nextStep(uint8_t channel);
+
+	PatternHandler& _handler;
+	PatternChannel* _channels;
+	uint8_t _channelCount;
+};
+
+#endif
@@ -1,29 +1,48 @@
 #include <Arduino.h>
 #include "avr/pgmspace.h"
+#include "lurker_network.h"
+#include "lurker_update.h"
+#include "lurker_group.h"
+#include "lurker_ir.h"
+#include "lurker_pattern.h"
+#include "lurker_health.h"
 
 //////////////////////////////////////////////////////////////////////////
 // Network Config
 
-const byte COORDINATOR = 0;
 const long NODE_TIMEOUT = 120000;	// Period before the routing table is reset and nodes need to rejoin
 const byte MAX_NETWORK_SIZE = 5;
 
 //////////////////////////////////////////////////////////////////////////
 // Unit-Specific Config
 const byte UNIT_NUMBER = 0;
+const byte UNIT_GROUPS = 0x01;	// Bitmap of the command groups (0-7) this unit is in
 String unitClass = "lurker";
 String unitID = unitClass + UNIT_NUMBER;
 
 //////////////////////////////////////////////////////////////////////////
 
 const long SAMPLE_INTERVAL = 20000;	// Sample interval in ms
+const long POLL_INTERVAL = SAMPLE_INTERVAL / MAX_NETWORK_SIZE;	// Time between coordinator data requests in ms
 
-// DS18B20 Temperature Probe
+// Sensor health - a sensor that keeps failing is left out of samples and retried less and less often
+const byte SENSOR_FAILURE_LIMIT = 3;	// Failed reads in a row before it's left out
+const long SENSOR_FIRST_RETRY = SAMPLE_INTERVAL;	// in ms; doubles after every retry that fails
+const long SENSOR_MAX_RETRY = 900000;	// 15 minutes
+
+// DS18B20 Temperature Probe - converts once a sample, in the background
 const byte TEMPERATURE_PIN = 7;
+const long TEMPERATURE_CONVERSION_TIME = 750;	// in ms, at the probe's default 12 bits
+const long TEMPERATURE_LEAD_TIME = 1000;	// Conversions start this long before a sample, in ms
 
 // DHT11 Humidity Sensor
 const byte HUMIDITY_PIN = 8;
 
+// BH1750FVI Illuminance sensor - read in the background over TWI
+const byte LIGHT_ADDRESS = 0x23;	// ADDR pin low
+const long LIGHT_READ_INTERVAL = 1000;	// Time between reads in ms; it measures every 120 ms
+const long LIGHT_TIMEOUT = 100;	// A read still pending after this many ms has the bus reset
+
 // PIR Motion detector
 const byte MOTION_PIN = 2;
 const int MOTION_INITIALISATION_TIME = 2000; // Initialisation period in ms
@@ -31,8 +50,25 @@ const long MOTION_COOLOFF = 5000;	//Cool off period in ms
 const int MOTION_CHECK_INTERVAL = 100;	// Period between motion detector checks in ms
 const byte MOTION_DETECTED = HIGH;
 
-// Passive buzzer
+// IR receiver - pin-change interrupt, so it has to be on port D (pins 0-7)
+const byte IR_RECEIVE_PIN = 4;
+
+// IR blaster - Timer2 makes the carrier, so the LED has to be on its OC2B output
+const byte IR_SEND_PIN = 3;
+
+// IR codes for the blaster, sent by their index; copy them from what the
+// receiver prints
+const IrCode IR_CODES[] PROGMEM = {
+	{ IR_NEC, 32, false, 0xF708FB04 },	// LG TV power
+	{ IR_SONY, 12, false, 0x095 },	// Sony TV power
+	{ IR_SONY, 12, false, 0x092 },	// Sony TV volume up
+	{ IR_SONY, 12, false, 0x093 },	// Sony TV volume down
+};
+const byte NUM_IR_CODES = sizeof(IR_CODES) / sizeof(IR_CODES[0]);
+
+// Passive buzzer - not on a timer output; the pattern timer toggles it
 const byte BUZZER_PIN = 5;
+const uint16_t BUZZER_TONE = 2700;	// Hz; about where small buzzers are loudest
 
 // LEDs
 const byte LED0 = A1;
@@ -44,6 +80,29 @@ const byte SENSOR_READ_LED = 0;
 const long FLASH_TIME = 500;
 const byte NUM_LEDS = 3;
 
+// Light and buzzer patterns - steps of { tone in Hz or light ON/OFF, ms }
+const byte BUZZER_CHANNEL = 0;
+const byte LIGHT_CHANNEL = 1;	// The first LED's; the others follow in order
+const byte NUM_PATTERN_CHANNELS = LIGHT_CHANNEL + NUM_LEDS;
+
+const PatternStep FLASH_PATTERN[] PROGMEM = { { ON, FLASH_TIME }, { 0, 0 } };
+
+const PatternStep BUZZER_ON_PATTERN[] PROGMEM = { { BUZZER_TONE, 1000 }, { PATTERN_LOOP, 0 } };
+const PatternStep SIREN_PATTERN[] PROGMEM = { { 2200, 400 }, { 1400, 400 }, { PATTERN_LOOP, 0 } };
+const PatternStep ALERT_PATTERN[] PROGMEM = { { 3000, 100 }, { 0, 100 }, { 3000, 100 }, { 0, 700 }, { PATTERN_LOOP, 0 } };
+const PatternStep CHIME_PATTERN[] PROGMEM = { { 1047, 150 }, { 1319, 150 }, { 1568, 150 }, { 2093, 300 }, { 0, 0 } };
+const PatternStep BEEP_PATTERN[] PROGMEM = { { BUZZER_TONE, 100 }, { 0, 0 } };
+
+// Played by the buzzer command, by their index; the looping ones sound until it's switched off
+const PatternStep* const BUZZER_PATTERNS[] PROGMEM = {
+	BUZZER_ON_PATTERN,
+	SIREN_PATTERN,
+	ALERT_PATTERN,
+	CHIME_PATTERN,
+	BEEP_PATTERN,
+};
+const byte NUM_BUZZER_PATTERNS = sizeof(BUZZER_PATTERNS) / sizeof(BUZZER_PATTERNS[0]);
+
 // Radio
 const byte CE_PIN = 9;
 const byte CSN_PIN = 10;
@@ -51,33 +110,50 @@ const byte CSN_PIN = 10;
 const long SERIAL_BAUD = 115200;
 const long NETWORK_JOIN_INTERVAL = 60000; // Time between network join attempts in ms
 
+// Firmware updates - images are kept in SPI flash in DualOptiboot's layout
+const byte FLASH_CS_PIN = A3;
+const uint16_t FLASH_JEDEC_ID = 0xEF30;	// Winbond W25X40
+const uint8_t FLASH_IMAGE_OFFSET = 10;	// After the bootloader's "FLXIMG:<size>:" header
+const long UPDATE_START_DELAY = 1000;	// Time for nodes to erase their image store, in ms
+const long UPDATE_POLL_TIMEOUT = 50;	// Wait for a node's status, in ms
+const byte UPDATE_POLL_RETRIES = 5;
+const byte UPDATE_WINDOW_ROUNDS = 20;	// Resends of one window before stragglers are dropped
+const long UPDATE_HOST_TIMEOUT = 1000;	// Wait for the host to send a window before asking again, in ms
+const long UPDATE_ACTIVATE_TIMEOUT = 3000;	// Wait for a node to confirm an activate; it may be restarting, in ms
+const int INSTALLED_IMAGE_ADDRESS = 0;	// EEPROM, CRC-32 of the image last activated
+// The sending side's buffers are the coordinator's alone; nodes get a placeholder
+const unsigned int UPDATE_WINDOW_BUFFER = UNIT_NUMBER == COORDINATOR ? UPDATE_WINDOW * UPDATE_BLOCK_SIZE : 1;
+const byte UPDATE_TARGETS = UNIT_NUMBER == COORDINATOR ? MAX_NETWORK_SIZE : 1;
+
+// Group commands - broadcasts are unacknowledged, so they're sent more than once
+const byte GROUP_REPEATS = 3;
+const long GROUP_REPEAT_INTERVAL = 4;	// Time between copies, in ms
+const long GROUP_DUPLICATE_WINDOW = 1000;	// A sequence number heard again within this is a repeat, in ms
+const byte GROUP_SEND_BUFFER = UNIT_NUMBER == COORDINATOR ? NETWORK_PAYLOAD_SIZE : 1;	// Only the coordinator sends
+
 // Logging
 const int LOGGER_LEVEL = LOG_LEVEL_INFOS;
 
+// Memory monitor
+const long MEMORY_CHECK_INTERVAL = 10000;	// Time between stack high-water checks in ms
+const unsigned int LOW_MEMORY_WARNING = 100;	// Warn when the stack comes this close to the heap, in bytes
+
+
+// Serial commands
+// Longest command, terminator included; the coordinator's are a whole update block in hex
+const uint8_t SERIAL_FRAME_LENGTH = UNIT_NUMBER == COORDINATOR ? 64 : 32;
+const uint8_t FRAME_HANDLERS = UNIT_NUMBER == COORDINATOR ? 21 : 17;	// One per addHandler() in startDispatcher(), LURKER_BENCH's included
 
 // Communication Pipes
-PROGMEM const long BROADCAST_PIPE = 0x90909090FFLL;
-PROGMEM const long BASE_PIPE = 0x9090909000LL;
-PROGMEM const long UNIT_PIPE = BASE_PIPE + UNIT_NUMBER;
+const uint64_t UNIT_PIPE = BASE_PIPE + UNIT_NUMBER;
+const uint8_t UNIT_READING_PIPE = 1;
+const uint8_t BROADCAST_READING_PIPE = 2;
 
-// Comm Tags
+// Comm Tags - radio packet tags are in lurker_network.h
 const char PACKET_START = '#';
-const char PACKET_END = '$';
 const char DELIMITER = ' ';
 
-const char NETWORK_JOIN_REQUEST = 'j';
-const char NETWORK_JOIN_CONFIRM = 'J';
-const char NETWORK_CONNECTION_RESET = 'R';
 const char SENSOR_READ_REQUEST = 'r';
-const char DATA_TRANSMIT_REQUEST = 'D';
-const char DATA_TRANSMIT_RESPONSE = 'd';
-const char DATA_PACKET_FINISHED = 'F';
-
-const char UNIT_ID_CODE = 'Z';
-const char TEMPERATURE_CODE = 'T';
-const char HUMIDITY_CODE = 'H';
-const char ILLUMINANCE_CODE = 'I';
-const char MOTION_CODE = 'M';
 
 const char BUZZER_ON_CODE = 'B';
 const char BUZZER_OFF_CODE = 'b';
@@ -85,6 +161,10 @@ const char BUZZER_OFF_CODE = 'b';
 const char LIGHT_ON_CODE = 'L';
 const char LIGHT_OFF_CODE = 'l';
 
+const char STATUS_CODE = 'S';
+
+const char IR_SEND_CODE = 'X';
+
 const char ID[] = "id";
 const char TEMPERATURE[] = "temperature";
 const char HUMIDITY[] = "humidity";
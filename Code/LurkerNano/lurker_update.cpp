@@ -0,0 +1,689 @@
+#include "lurker_update.h"
+
+static bool elapsed(NetworkTime now, NetworkTime since, NetworkTime interval){
+	return NetworkTime(now - since) >= interval;
+}
+
+/**
+* Blocks in a window; the last window may be short
+*/
+static uint8_t blockCount(uint16_t blocks, uint16_t window){
+	return blocks - window < UPDATE_WINDOW ? blocks - window : UPDATE_WINDOW;
+}
+
+/**
+* Bitmap of the blocks in a window
+*/
+static uint8_t blockMask(uint16_t blocks, uint16_t window){
+	return uint8_t((1 << blockCount(blocks, window)) - 1);
+}
+
+static bool readHex(const uint8_t* text, uint8_t digits, uint32_t& value){
+	value = 0;
+
+	for (uint8_t i = 0; i < digits; i++){
+		uint8_t c = text[i];
+		uint8_t digit;
+
+		if (c >= '0' && c <= '9'){
+			digit = c - '0';
+		}
+		else if (c >= 'A' && c <= 'F'){
+			digit = c - 'A' + 10;
+		}
+		else if (c >= 'a' && c <= 'f'){
+			digit = c - 'a' + 10;
+		}
+		else{
+			return false;
+		}
+
+		value = (value << 4) | digit;
+	}
+
+	return true;
+}
+
+/**
+* CRC-16/CCITT-FALSE; start from 0xFFFF
+*/
+uint16_t crc16(uint16_t crc, const uint8_t* data, uint8_t length){
+	for (uint8_t i = 0; i < length; i++){
+		crc ^= uint16_t(data[i]) << 8;
+
+		for (uint8_t bit = 0; bit < 8; bit++){
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+
+	return crc;
+}
+
+/**
+* CRC-32 as in zlib; start from 0 and carry on from the last result
+*/
+uint32_t crc32(uint32_t crc, const uint8_t* data, uint16_t length){
+	crc = ~crc;
+
+	for (uint16_t i = 0; i < length; i++){
+		crc ^= data[i];
+
+		for (uint8_t bit = 0; bit < 8; bit++){
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+		}
+	}
+
+	return ~crc;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Receiver
+
+UpdateReceiver::UpdateReceiver(uint8_t unit, UpdateHandler& handler) :
+	_unit(unit),
+	_handler(handler),
+	_state(UPDATE_IDLE),
+	_size(0),
+	_crc(0),
+	_blocks(0),
+	_window(0),
+	_received(0){
+}
+
+void UpdateReceiver::receive(const uint8_t* packet, uint8_t length){
+	if (length < 2 || packet[length - 1] != PACKET_END){
+		return;
+	}
+
+	FrameReader fields(packet + 1, length - 2);
+
+	switch (packet[0]){
+	case UPDATE_START:
+		receiveStart(fields);
+		break;
+
+	case UPDATE_BLOCK:
+		receiveBlock(packet, length);
+		break;
+
+	case UPDATE_POLL:{
+		uint16_t window = fields.word();
+
+		if (fields.ok()){
+			moveToWindow(window);
+			sendStatus(window);
+		}
+		break;
+	}
+
+	case UPDATE_ACTIVATE:
+		receiveActivate(fields);
+		break;
+	}
+}
+
+void UpdateReceiver::receiveStart(FrameReader& fields){
+	uint16_t size = fields.word();
+	uint32_t crc = uint32_t(fields.word()) << 16;
+	crc |= fields.word();
+
+	if (!fields.ok() || size == 0 || size > MAX_IMAGE_SIZE){
+		return;
+	}
+
+	// Starts are repeated for nodes that missed them
+	if (_state == UPDATE_RECEIVING && size == _size && crc == _crc){
+		return;
+	}
+
+	_size = size;
+	_crc = crc;
+	_blocks = (size + UPDATE_BLOCK_SIZE - 1) / UPDATE_BLOCK_SIZE;
+	_window = 0;
+	_received = 0;
+	_state = _handler.eraseImage(size) ? UPDATE_RECEIVING : UPDATE_FAILED;
+}
+
+void UpdateReceiver::receiveBlock(const uint8_t* packet, uint8_t length){
+	// Code, block number, data, CRC and end
+	if (_state != UPDATE_RECEIVING || length < 7){
+		return;
+	}
+
+	uint8_t size = length - 6;
+	FrameReader fields(packet + 1, length - 2);
+	uint16_t block = fields.word();
+
+	if (size > UPDATE_BLOCK_SIZE || block >= _blocks){
+		return;
+	}
+
+	const uint8_t* data = packet + 3;
+	FrameReader check(data + size, 2);
+	uint16_t crc = check.word();
+
+	uint16_t offset = block * UPDATE_BLOCK_SIZE;
+	uint8_t expected = _size - offset < UPDATE_BLOCK_SIZE ? _size - offset : UPDATE_BLOCK_SIZE;
+
+	// Over the block number and data
+	if (size != expected || crc != crc16(0xFFFF, packet + 1, size + 2)){
+		return;
+	}
+
+	uint16_t window = block - block % UPDATE_WINDOW;
+	uint8_t bit = 1 << (block - window);
+
+	if (!moveToWindow(window) || (_received & bit)){
+		return;
+	}
+
+	_handler.writeImage(offset, data, size);
+	_received |= bit;
+
+	if (_received == windowMask(_window) && _window + UPDATE_WINDOW >= _blocks){
+		verify();
+	}
+}
+
+/**
+* Answer before restarting into the image; if the answer is lost, the
+* coordinator asks again and the new firmware answers for it
+*/
+void UpdateReceiver::receiveActivate(FrameReader& fields){
+	uint32_t crc = uint32_t(fields.word()) << 16;
+	crc |= fields.word();
+
+	if (!fields.ok()){
+		return;
+	}
+
+	if (_state == UPDATE_VERIFIED && crc == _crc){
+		_state = UPDATE_ACTIVATED;
+		sendStatus(_window);
+		_handler.activateImage(_size, _crc);
+	}
+	else if (_state == UPDATE_IDLE && crc == _handler.installedImage()){
+		_state = UPDATE_ACTIVATED;
+		sendStatus(_window);
+	}
+}
+
+/**
+* Follow the coordinator on to the next window
+* It only moves on once every node has the window, so a window that's
+* skipped or left unfinished means this node has been dropped.
+*
+* @return False if the window isn't the one being received
+*/
+bool UpdateReceiver::moveToWindow(uint16_t window){
+	if (_state != UPDATE_RECEIVING || window < _window){
+		return false;
+	}
+
+	if (window > _window){
+		if (window != _window + UPDATE_WINDOW || _received != windowMask(_window)){
+			_state = UPDATE_FAILED;
+			return false;
+		}
+
+		_window = window;
+		_received = 0;
+	}
+
+	return true;
+}
+
+uint8_t UpdateReceiver::windowMask(uint16_t window) const{
+	return blockMask(_blocks, window);
+}
+
+/**
+* Check the stored image against the CRC it was announced with
+*/
+void UpdateReceiver::verify(){
+	uint8_t buffer[UPDATE_BLOCK_SIZE];
+	uint32_t crc = 0;
+
+	for (uint16_t offset = 0; offset < _size; offset += UPDATE_BLOCK_SIZE){
+		uint8_t length = _size - offset < UPDATE_BLOCK_SIZE ? _size - offset : UPDATE_BLOCK_SIZE;
+
+		_handler.readImage(offset, buffer, length);
+		crc = crc32(crc, buffer, length);
+	}
+
+	_state = crc == _crc ? UPDATE_VERIFIED : UPDATE_FAILED;
+}
+
+void UpdateReceiver::sendStatus(uint16_t window){
+	uint8_t missing = 0;
+
+	if (_state == UPDATE_RECEIVING && window == _window){
+		missing = windowMask(window) & ~_received;
+	}
+
+	uint8_t packet[7];
+	FrameBuilder frame(packet, sizeof(packet));
+
+	frame.byte(UPDATE_STATUS).byte(_unit).word(window).byte(missing).byte(_state);
+	_handler.transmit(COORDINATOR, packet, frame.finish());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Sender
+
+UpdateSender::UpdateSender(const UpdateConfig& config, UpdateHandler& handler, const NetworkRoute* routes,
+	UpdateTarget* targets, uint8_t routeCount, uint8_t* window) :
+	_config(config),
+	_handler(handler),
+	_routes(routes),
+	_targets(targets),
+	_routeCount(routes != 0 && targets != 0 ? routeCount : 0),
+	_windowData(window),
+	_phase(PHASE_IDLE),
+	_size(0),
+	_crc(0),
+	_blocks(0),
+	_window(0),
+	_loaded(0),
+	_rounds(0),
+	_polling(0),
+	_since(0){
+	for (uint8_t i = 0; i < _routeCount; i++){
+		_targets[i].state = UPDATE_IDLE;
+	}
+}
+
+void UpdateSender::command(const uint8_t* frame, uint8_t length, NetworkTime now){
+	if (length < 2 || frame[length - 1] != PACKET_END){
+		return;
+	}
+
+	const uint8_t* text = frame + 1;
+	uint8_t digits = length - 2;
+	uint32_t unit, size, crc, block;
+
+	switch (frame[0]){
+	case UPDATE_START:
+		if (digits == 14 && readHex(text, 2, unit) && readHex(text + 2, 4, size) && readHex(text + 6, 8, crc)){
+			start(uint8_t(unit), uint16_t(size), crc, now);
+		}
+		else if (!active()){
+			_handler.updateFinished();
+		}
+		break;
+
+	case UPDATE_DATA_COMMAND:{
+		if (_phase != PHASE_LOADING || digits < 6 || digits % 2 != 0 || !readHex(text, 4, block)
+			|| block < _window || block >= uint32_t(_window) + UPDATE_WINDOW || block >= _blocks){
+			return;
+		}
+
+		uint8_t index = block - _window;
+		uint16_t offset = block * UPDATE_BLOCK_SIZE;
+		uint8_t expected = _size - offset < UPDATE_BLOCK_SIZE ? _size - offset : UPDATE_BLOCK_SIZE;
+
+		if ((digits - 4) / 2 != expected){
+			return;
+		}
+
+		uint8_t* data = _windowData + index * UPDATE_BLOCK_SIZE;
+		for (uint8_t i = 0; i < expected; i++){
+			uint32_t value;
+			if (!readHex(text + 4 + i * 2, 2, value)){
+				return;
+			}
+			data[i] = uint8_t(value);
+		}
+
+		_loaded |= 1 << index;
+		_since = now;
+
+		if (_loaded == windowMask(_window)){
+			_rounds = 0;
+			sendWindow(_loaded, now);
+		}
+		break;
+	}
+
+	case UPDATE_CANCEL_COMMAND:
+		if (active()){
+			for (uint8_t i = 0; i < _routeCount; i++){
+				if (_targets[i].state == UPDATE_RECEIVING || _targets[i].state == UPDATE_VERIFIED){
+					dropTarget(i, UPDATE_FAILED);
+				}
+			}
+			finish();
+		}
+		break;
+	}
+}
+
+void UpdateSender::start(uint8_t unit, uint16_t size, uint32_t crc, NetworkTime now){
+	// One update at a time
+	if (active()){
+		return;
+	}
+
+	if (size == 0 || size > MAX_IMAGE_SIZE){
+		_handler.updateFinished();
+		return;
+	}
+
+	_size = size;
+	_crc = crc;
+	_blocks = (size + UPDATE_BLOCK_SIZE - 1) / UPDATE_BLOCK_SIZE;
+
+	// One node, or every node in the table
+	for (uint8_t i = 0; i < _routeCount; i++){
+		bool target = i != COORDINATOR && _routes[i].active && (unit == BROADCAST || unit == i);
+
+		_targets[i].state = target ? UPDATE_RECEIVING : UPDATE_IDLE;
+		_targets[i].missing = 0;
+		_targets[i].misses = 0;
+		_targets[i].answered = false;
+
+		if (target){
+			sendStart(i);
+		}
+	}
+
+	if (remainingTargets() == 0){
+		_handler.updateFinished();
+		return;
+	}
+
+	_phase = PHASE_STARTING;
+	_since = now;
+}
+
+void UpdateSender::sendStart(uint8_t unit){
+	uint8_t packet[8];
+	FrameBuilder frame(packet, sizeof(packet));
+
+	frame.byte(UPDATE_START).word(_size).word(_crc >> 16).word(_crc & 0xFFFF);
+	_handler.transmit(unit, packet, frame.finish());
+}
+
+void UpdateSender::loadWindow(uint16_t window, NetworkTime now){
+	_phase = PHASE_LOADING;
+	_window = window;
+	_loaded = 0;
+	_rounds = 0;
+	_since = now;
+
+	_handler.requestBlocks(window, blockCount(_blocks, window));
+}
+
+/**
+* Send blocks of the window back to back, without waiting on each
+*/
+void UpdateSender::sendWindow(uint8_t blocks, NetworkTime now){
+	uint8_t unit = BROADCAST;
+
+	if (remainingTargets() == 1){
+		for (uint8_t i = 0; i < _routeCount; i++){
+			if (_targets[i].state == UPDATE_RECEIVING){
+				unit = i;
+			}
+		}
+	}
+
+	for (uint8_t index = 0; index < UPDATE_WINDOW; index++){
+		if (!(blocks & (1 << index))){
+			continue;
+		}
+
+		uint16_t block = _window + index;
+		uint16_t offset = block * UPDATE_BLOCK_SIZE;
+		uint8_t size = _size - offset < UPDATE_BLOCK_SIZE ? _size - offset : UPDATE_BLOCK_SIZE;
+		const uint8_t* data = _windowData + index * UPDATE_BLOCK_SIZE;
+
+		uint8_t packet[NETWORK_PAYLOAD_SIZE];
+		FrameBuilder frame(packet, sizeof(packet));
+
+		frame.byte(UPDATE_BLOCK).word(block);
+		for (uint8_t i = 0; i < size; i++){
+			frame.byte(data[i]);
+		}
+
+		// Over the block number and data
+		frame.word(crc16(0xFFFF, packet + 1, size + 2));
+		_handler.transmit(unit, packet, frame.finish());
+	}
+
+	startPolling(now);
+}
+
+void UpdateSender::startPolling(NetworkTime now){
+	for (uint8_t i = 0; i < _routeCount; i++){
+		_targets[i].answered = false;
+		_targets[i].missing = 0;
+	}
+
+	_phase = PHASE_POLLING;
+	pollNext(now);
+}
+
+/**
+* Poll the next node that hasn't answered for this window
+*/
+void UpdateSender::pollNext(NetworkTime now){
+	for (uint8_t i = 0; i < _routeCount; i++){
+		if (_targets[i].state == UPDATE_RECEIVING && !_targets[i].answered){
+			_polling = i;
+			_since = now;
+
+			uint8_t packet[4];
+			FrameBuilder frame(packet, sizeof(packet));
+
+			frame.byte(UPDATE_POLL).word(_window);
+			_handler.transmit(i, packet, frame.finish());
+			return;
+		}
+	}
+
+	finishWindow(now);
+}
+
+void UpdateSender::receive(const uint8_t* packet, uint8_t length, NetworkTime now){
+	if (length < 2 || packet[0] != UPDATE_STATUS){
+		return;
+	}
+
+	FrameReader fields(packet + 1, length - 1);
+	uint8_t unit = fields.byte();
+	uint16_t window = fields.word();
+	uint8_t missing = fields.byte();
+	uint8_t state = fields.byte();
+
+	if (!fields.ok() || unit != _polling){
+		return;
+	}
+
+	if (_phase == PHASE_ACTIVATING){
+		if (state == UPDATE_ACTIVATED && _targets[unit].state == UPDATE_VERIFIED){
+			_targets[unit].state = UPDATE_ACTIVATED;
+			_handler.targetFinished(unit, UPDATE_ACTIVATED);
+			activateNext(now);
+		}
+		return;
+	}
+
+	if (_phase != PHASE_POLLING || window != _window){
+		return;
+	}
+
+	UpdateTarget& target = _targets[unit];
+	target.answered = true;
+	target.misses = 0;
+
+	switch (state){
+	case UPDATE_RECEIVING:
+		target.missing = missing & windowMask(_window);
+		break;
+
+	case UPDATE_VERIFIED:
+		target.state = UPDATE_VERIFIED;
+		break;
+
+	case UPDATE_IDLE:
+		// Missed the start; it can still catch up at the first window
+		if (_window == 0){
+			sendStart(unit);
+			target.missing = windowMask(_window);
+			break;
+		}
+		dropTarget(unit, UPDATE_FAILED);
+		break;
+
+	default:
+		dropTarget(unit, UPDATE_FAILED);
+		break;
+	}
+
+	pollNext(now);
+}
+
+/**
+* Every node has answered: resend what's missing, or move on
+*/
+void UpdateSender::finishWindow(NetworkTime now){
+	uint8_t missing = 0;
+
+	for (uint8_t i = 0; i < _routeCount; i++){
+		if (_targets[i].state == UPDATE_RECEIVING){
+			missing |= _targets[i].missing;
+		}
+	}
+
+	if (missing != 0 && ++_rounds > _config.windowRounds){
+		for (uint8_t i = 0; i < _routeCount; i++){
+			if (_targets[i].state == UPDATE_RECEIVING && _targets[i].missing != 0){
+				dropTarget(i, UPDATE_FAILED);
+			}
+		}
+		missing = 0;
+	}
+
+	if (missing != 0){
+		sendWindow(missing, now);
+		return;
+	}
+
+	if (remainingTargets() > 0 && _window + UPDATE_WINDOW < _blocks){
+		loadWindow(_window + UPDATE_WINDOW, now);
+		return;
+	}
+
+	// Done; every node still in has checked its image by now
+	_phase = PHASE_ACTIVATING;
+
+	for (uint8_t i = 0; i < _routeCount; i++){
+		if (_targets[i].state == UPDATE_RECEIVING){
+			dropTarget(i, UPDATE_FAILED);
+		}
+		_targets[i].misses = 0;
+	}
+
+	activateNext(now);
+}
+
+/**
+* Tell the next node with a good image to activate it, or finish
+*/
+void UpdateSender::activateNext(NetworkTime now){
+	for (uint8_t i = 0; i < _routeCount; i++){
+		if (_targets[i].state == UPDATE_VERIFIED){
+			_polling = i;
+			_since = now;
+
+			uint8_t packet[6];
+			FrameBuilder frame(packet, sizeof(packet));
+
+			frame.byte(UPDATE_ACTIVATE).word(_crc >> 16).word(_crc & 0xFFFF);
+			_handler.transmit(i, packet, frame.finish());
+			return;
+		}
+	}
+
+	finish();
+}
+
+void UpdateSender::dropTarget(uint8_t unit, UpdateState state){
+	_targets[unit].state = state;
+	_handler.targetFinished(unit, state);
+}
+
+void UpdateSender::finish(){
+	_phase = PHASE_IDLE;
+
+	for (uint8_t i = 0; i < _routeCount; i++){
+		_targets[i].state = UPDATE_IDLE;
+	}
+
+	_handler.updateFinished();
+}
+
+uint8_t UpdateSender::windowMask(uint16_t window) const{
+	return blockMask(_blocks, window);
+}
+
+uint8_t UpdateSender::remainingTargets() const{
+	uint8_t count = 0;
+
+	for (uint8_t i = 0; i < _routeCount; i++){
+		count += _targets[i].state == UPDATE_RECEIVING;
+	}
+
+	return count;
+}
+
+void UpdateSender::update(NetworkTime now){
+	switch (_phase){
+	case PHASE_STARTING:
+		if (elapsed(now, _since, _config.startDelay)){
+			loadWindow(0, now);
+		}
+		break;
+
+	case PHASE_LOADING:
+		// Serial frames get lost too; ask again before giving up on the host
+		if (elapsed(now, _since, _config.hostTimeout) && _rounds < _config.pollRetries){
+			_rounds++;
+			_since = now;
+			_handler.requestBlocks(_window, blockCount(_blocks, _window));
+		}
+		else if (elapsed(now, _since, _config.hostTimeout)){
+			for (uint8_t i = 0; i < _routeCount; i++){
+				if (_targets[i].state == UPDATE_RECEIVING || _targets[i].state == UPDATE_VERIFIED){
+					dropTarget(i, UPDATE_FAILED);
+				}
+			}
+			finish();
+		}
+		break;
+
+	case PHASE_POLLING:
+		if (elapsed(now, _since, _config.pollTimeout)){
+			if (++_targets[_polling].misses > _config.pollRetries){
+				dropTarget(_polling, UPDATE_FAILED);
+			}
+			pollNext(now);
+		}
+		break;
+
+	case PHASE_ACTIVATING:
+		if (elapsed(now, _since, _config.activateTimeout)){
+			if (++_targets[_polling].misses > _config.pollRetries){
+				dropTarget(_polling, UPDATE_FAILED);
+			}
+			activateNext(now);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
@@ -0,0 +1,229 @@
+#ifndef LURKER_UPDATE_H
+#define LURKER_UPDATE_H
+
+#include <stdint.h>
+
+#include "lurker_network.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Firmware Update
+//
+// Over-the-air firmware updates, streamed from the host through the
+// coordinator to one node or to every node at once.
+//
+// The image goes out in windows of UPDATE_WINDOW blocks. The coordinator
+// asks the host for a window over serial, sends all of its blocks back to
+// back, to BROADCAST if more than one node is updating, then polls each
+// node for the blocks it is missing and resends only those, until every
+// node has the whole window. Nodes write blocks to external flash as they
+// arrive, each checked against its own CRC, and check the whole image
+// against the CRC-32 it was announced with once the last one is in. When
+// every node is done, the coordinator tells the ones with a good image to
+// activate it, one at a time: the node answers, marks the image for the
+// bootloader and restarts. An activate that goes unanswered is sent again,
+// up to pollRetries times; a node whose answer was lost answers the next
+// one from the new image, which it remembers the CRC of, so the host only
+// hears of success once a node has confirmed it.
+//
+// An image that doesn't check out is never marked, so the node carries on
+// with the firmware it has. A node that stops answering polls is dropped
+// from the update and the rest carry on without it.
+//
+// Radio packets:
+//	U <size> <crc32> $	Start, coordinator to node
+//	o <block> <data...> <crc16> $	Image block
+//	q <window> $	Poll for the blocks missing from a window
+//	O <unit> <window> <missing> <state> $
+//		Missing blocks bitmap and UpdateState, node to coordinator
+//	A <crc32> $	Activate the image with this CRC, answered with an O
+// Serial commands, host to coordinator, fields in hex:
+//	U<unit><size><crc32>$	Start; unit FF updates every node in the table
+//	w<block><data>$	Image block, answering a request for a window
+//	u$	Cancel
+//////////////////////////////////////////////////////////////////////////
+
+const char UPDATE_START = 'U';
+const char UPDATE_BLOCK = 'o';
+const char UPDATE_POLL = 'q';
+const char UPDATE_STATUS = 'O';
+const char UPDATE_ACTIVATE = 'A';
+const char UPDATE_DATA_COMMAND = 'w';
+const char UPDATE_CANCEL_COMMAND = 'u';
+
+const uint8_t UPDATE_BLOCK_SIZE = 24;
+const uint8_t UPDATE_WINDOW = 8;	// Blocks; one bit each in the missing bitmap
+const uint16_t MAX_IMAGE_SIZE = 31744;	// ATmega328 flash less a 1 KB bootloader
+
+enum UpdateState{
+	UPDATE_IDLE,
+	UPDATE_RECEIVING,
+	UPDATE_VERIFIED,
+	UPDATE_FAILED,
+	UPDATE_ACTIVATED
+};
+
+struct UpdateConfig{
+	NetworkTime startDelay;	// Time for nodes to erase their flash before the first window
+	NetworkTime pollTimeout;	// Wait for a node to answer a poll
+	uint8_t pollRetries;	// Unanswered polls before a node is dropped
+	uint8_t windowRounds;	// Resends of one window before nodes still missing blocks are dropped
+	NetworkTime hostTimeout;	// Wait for the host to send a window before asking again, up to pollRetries times
+	NetworkTime activateTimeout;	// Wait for a node to confirm an activate, up to pollRetries times; long enough for it to restart
+};
+
+/**
+* Coordinator - per-node progress, indexed by unit number
+*/
+struct UpdateTarget{
+	UpdateState state;
+	uint8_t missing;
+	uint8_t misses;
+	bool answered;
+};
+
+/**
+* What an update needs from the device it runs on
+*/
+class UpdateHandler{
+public:
+	virtual void transmit(uint8_t unit, const uint8_t* packet, uint8_t length) = 0;
+
+	// Node - the image store, with the image at offset 0
+	virtual bool eraseImage(uint16_t){ return false; }
+	virtual void writeImage(uint16_t, const uint8_t*, uint8_t){}
+	virtual void readImage(uint16_t, uint8_t*, uint8_t){}
+
+	/**
+	* Node - hand a checked image to the bootloader, keeping its CRC for
+	* installedImage(); doesn't return on a real node
+	*/
+	virtual void activateImage(uint16_t, uint32_t){}
+
+	/**
+	* Node - CRC of the image last activated
+	*/
+	virtual uint32_t installedImage(){ return 0; }
+
+	// Coordinator - talking to the host
+	virtual void requestBlocks(uint16_t, uint8_t){}
+	virtual void targetFinished(uint8_t, UpdateState){}
+	virtual void updateFinished(){}
+};
+
+uint16_t crc16(uint16_t crc, const uint8_t* data, uint8_t length);
+uint32_t crc32(uint32_t crc, const uint8_t* data, uint16_t length);
+
+/**
+* Node side: keeps the image store up to date and answers polls
+*/
+class UpdateReceiver{
+public:
+	UpdateReceiver(uint8_t unit, UpdateHandler& handler);
+
+	/**
+	* Handle a start, block, poll or activate packet
+	*/
+	void receive(const uint8_t* packet, uint8_t length);
+
+	UpdateState state() const{
+		return _state;
+	}
+
+private:
+	UpdateReceiver(const UpdateReceiver&);
+	UpdateReceiver& operator=(const UpdateReceiver&);
+
+	void receiveStart(FrameReader& fields);
+	void receiveBlock(const uint8_t* packet, uint8_t length);
+	void receiveActivate(FrameReader& fields);
+	bool moveToWindow(uint16_t window);
+	uint8_t windowMask(uint16_t window) const;
+	void verify();
+	void sendStatus(uint16_t window);
+
+	uint8_t _unit;
+	UpdateHandler& _handler;
+	UpdateState _state;
+	uint16_t _size;
+	uint32_t _crc;
+	uint16_t _blocks;
+	uint16_t _window;	// First block of the window being received
+	uint8_t _received;	// Bitmap
+};
+
+/**
+* Coordinator side: feeds the image from the host to the nodes
+*/
+class UpdateSender{
+public:
+	/**
+	* @param routes The network's routing table, for updates to every node
+	* @param targets Progress per unit, routeCount long
+	* @param window UPDATE_WINDOW * UPDATE_BLOCK_SIZE bytes for the window being sent
+	*/
+	UpdateSender(const UpdateConfig& config, UpdateHandler& handler, const NetworkRoute* routes,
+		UpdateTarget* targets, uint8_t routeCount, uint8_t* window);
+
+	/**
+	* Handle a serial command from the host
+	*/
+	void command(const uint8_t* frame, uint8_t length, NetworkTime now);
+
+	/**
+	* Handle a node's status report
+	*/
+	void receive(const uint8_t* packet, uint8_t length, NetworkTime now);
+
+	/**
+	* Send, poll and time out as things come due
+	*/
+	void update(NetworkTime now);
+
+	bool active() const{
+		return _phase != PHASE_IDLE;
+	}
+
+private:
+	UpdateSender(const UpdateSender&);
+	UpdateSender& operator=(const UpdateSender&);
+
+	enum Phase{
+		PHASE_IDLE,
+		PHASE_STARTING,
+		PHASE_LOADING,
+		PHASE_POLLING,
+		PHASE_ACTIVATING
+	};
+
+	void start(uint8_t unit, uint16_t size, uint32_t crc, NetworkTime now);
+	void loadWindow(uint16_t window, NetworkTime now);
+	void sendWindow(uint8_t blocks, NetworkTime now);
+	void startPolling(NetworkTime now);
+	void pollNext(NetworkTime now);
+	void finishWindow(NetworkTime now);
+	void activateNext(NetworkTime now);
+	void dropTarget(uint8_t unit, UpdateState state);
+	void finish();
+	uint8_t windowMask(uint16_t window) const;
+	uint8_t remainingTargets() const;
+	void sendStart(uint8_t unit);
+
+	UpdateConfig _config;
+	UpdateHandler& _handler;
+	const NetworkRoute* _routes;
+	UpdateTarget* _targets;
+	uint8_t _routeCount;
+	uint8_t* _windowData;
+
+	Phase _phase;
+	uint16_t _size;
+	uint32_t _crc;
+	uint16_t _blocks;
+	uint16_t _window;
+	uint8_t _loaded;	// Blocks of the window in from the host
+	uint8_t _rounds;	// Resends of the window, or requests to the host while loading
+	uint8_t _polling;	// Unit being polled or activated
+	NetworkTime _since;	// Start of the current wait
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "energy_model.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+const double US_PER_HOUR = 3600e6;
+const double MS_PER_HOUR = 3600e3;
+
+//////////////////////////////////////////////////////////////////////////
+// Table
+
+/**
+* Datasheet typicals at 5 V and 16 MHz
+*/
+EnergyTable::EnergyTable() :
+	boardQuiescent(6.0),
+	mcuActive(9.0),
+	mcuSleep(0.006),
+	wakeTime(0.1),
+	packetTime(0.5),
+	sampleTime(25),
+	dht11Measure(2.5),
+	dht11Standby(0.1),
+	dht11Time(25),
+	bh1750Measure(0.19),
+	bh1750PowerDown(0.0001),
+	bh1750Time(120),
+	pirIdle(0.065),
+	batteryCapacity(2600),
+	batteryUsable(0.85){
+	radio[RADIO_POWER_DOWN] = 0.0009;
+	radio[RADIO_STANDBY] = 0.026;
+	radio[RADIO_RX] = 13.1;	// 1 Mbps
+	radio[RADIO_TX] = 11.3;	// 0 dBm
+}
+
+struct EnergySetting{
+	const char* part;
+	const char* name;
+	size_t offset;
+};
+
+#define SETTING(part, name, member) { part, name, offsetof(EnergyTable, member) }
+
+static const EnergySetting SETTINGS[] = {
+	SETTING("board", "quiescent", boardQuiescent),
+	SETTING("mcu", "active", mcuActive),
+	SETTING("mcu", "sleep", mcuSleep),
+	SETTING("mcu", "wake_time", wakeTime),
+	SETTING("mcu", "packet_time", packetTime),
+	SETTING("mcu", "sample_time", sampleTime),
+	SETTING("radio", "power_down", radio[RADIO_POWER_DOWN]),
+	SETTING("radio", "standby", radio[RADIO_STANDBY]),
+	SETTING("radio", "rx", radio[RADIO_RX]),
+	SETTING("radio", "tx", radio[RADIO_TX]),
+	SETTING("dht11", "measure", dht11Measure),
+	SETTING("dht11", "standby", dht11Standby),
+	SETTING("dht11", "measure_time", dht11Time),
+	SETTING("bh1750", "measure", bh1750Measure),
+	SETTING("bh1750", "power_down", bh1750PowerDown),
+	SETTING("bh1750", "measure_time", bh1750Time),
+	SETTING("pir", "idle", pirIdle),
+	SETTING("battery", "capacity", batteryCapacity),
+	SETTING("battery", "usable", batteryUsable)
+};
+
+#undef SETTING
+
+bool loadEnergyTable(const char* path, EnergyTable& table){
+	FILE* file = fopen(path, "r");
+	if (file == NULL){
+		return false;
+	}
+
+	char line[256];
+	int number = 0;
+	bool valid = true;
+
+	while (valid && fgets(line, sizeof(line), file) != NULL){
+		char part[32];
+		char name[32];
+		double value;
+
+		number++;
+
+		char* comment = strchr(line, '#');
+		if (comment != NULL){
+			*comment = 0;
+		}
+
+		int fields = sscanf(line, "%31s %31s %lf", part, name, &value);
+		if (fields <= 0){
+			continue;
+		}
+
+		valid = false;
+
+		if (fields == 3 && value >= 0){
+			for (size_t i = 0; i < sizeof(SETTINGS) / sizeof(SETTINGS[0]); i++){
+				if (strcmp(part, SETTINGS[i].part) == 0 && strcmp(name, SETTINGS[i].name) == 0){
+					*(double*)((char*)&table + SETTINGS[i].offset) = value;
+					valid = true;
+					break;
+				}
+			}
+		}
+
+		if (!valid){
+			fprintf(stderr, "%s:%d: bad setting\n", path, number);
+		}
+	}
+
+	fclose(file);
+	return valid && table.batteryUsable <= 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Estimates
+
+EnergyReport estimateEnergy(const EnergyTable& table, const EnergyUsage& usage, int64_t poweredTime){
+	EnergyReport report;
+	double hours = poweredTime / US_PER_HOUR;
+	double active = usage.mcuActiveTime / US_PER_HOUR;
+
+	report.hours = hours;
+	report.board = table.boardQuiescent * hours;
+	report.mcu = table.mcuActive * active + table.mcuSleep * (hours - active);
+
+	report.radio = 0;
+	for (int state = 0; state < RADIO_STATE_COUNT; state++){
+		report.radio += table.radio[state] * usage.radioTime[state] / US_PER_HOUR;
+	}
+
+	// Each sample wakes the DHT11 and takes a one-time BH1750 reading; the
+	// PIR is always on
+	double dht11 = usage.samples * table.dht11Time / MS_PER_HOUR;
+	double bh1750 = usage.samples * table.bh1750Time / MS_PER_HOUR;
+
+	report.sensors = table.dht11Measure * dht11 + table.dht11Standby * (hours - dht11)
+		+ table.bh1750Measure * bh1750 + table.bh1750PowerDown * (hours - bh1750)
+		+ table.pirIdle * hours;
+
+	return report;
+}
+
+double EnergyReport::batteryLife(const EnergyTable& table) const{
+	double average = current();
+	return average > 0 ? table.batteryCapacity * table.batteryUsable / average : 0;
+}
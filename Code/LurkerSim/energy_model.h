@@ -0,0 +1,114 @@
+#ifndef LURKER_ENERGY_MODEL_H
+#define LURKER_ENERGY_MODEL_H
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Energy Model
+//
+// Turns the time a node's parts spend in each state into charge drawn
+// from the battery, and from that an average current and a battery life.
+// The simulator counts the time; the currents come from an EnergyTable,
+// which defaults to datasheet figures for a Nano with an nRF24L01+, a
+// DHT11, a BH1750 and an HC-SR501 PIR, and can be overridden from a file.
+//
+// Table file, one setting per line, '#' for comments; currents in mA,
+// times in ms:
+//	board quiescent 6.0
+//	mcu active 9.0
+//	radio rx 13.5
+//	dht11 measure 2.5
+//	battery capacity 2600
+// See energy.conf for every setting.
+//////////////////////////////////////////////////////////////////////////
+
+enum RadioState{
+	RADIO_POWER_DOWN,
+	RADIO_STANDBY,
+	RADIO_RX,
+	RADIO_TX,
+	RADIO_STATE_COUNT
+};
+
+struct EnergyTable{
+	// Regulator, power LED and USB serial chip; drawn whatever the MCU does
+	double boardQuiescent;
+
+	// ATmega328P
+	double mcuActive;
+	double mcuSleep;	// Power-down with the watchdog running
+	double wakeTime;	// Awake per timer or radio interrupt
+	double packetTime;	// Awake handling a received packet
+	double sampleTime;	// Awake reading the sensors (mostly the DHT11 handshake)
+
+	// nRF24L01+
+	double radio[RADIO_STATE_COUNT];
+
+	// DHT11
+	double dht11Measure;
+	double dht11Standby;
+	double dht11Time;	// Measuring per sample
+
+	// BH1750
+	double bh1750Measure;
+	double bh1750PowerDown;
+	double bh1750Time;	// One-time high resolution conversion
+
+	// HC-SR501
+	double pirIdle;
+
+	// Battery
+	double batteryCapacity;	// mAh
+	double batteryUsable;	// Share of the capacity available before brown-out
+
+	EnergyTable();
+};
+
+/**
+* Read a table file over the defaults
+* @return False if the file can't be read or has a bad line
+*/
+bool loadEnergyTable(const char* path, EnergyTable& table);
+
+/**
+* What a node did, as counted by the simulator
+*/
+struct EnergyUsage{
+	int64_t radioTime[RADIO_STATE_COUNT];	// us
+	int64_t mcuActiveTime;	// us
+	uint64_t samples;
+};
+
+/**
+* Charge drawn over a period, in mAh
+*/
+struct EnergyReport{
+	double board;
+	double mcu;
+	double radio;
+	double sensors;
+	double hours;	// Length of the period
+
+	double total() const{
+		return board + mcu + radio + sensors;
+	}
+
+	/**
+	* Average current in mA
+	*/
+	double current() const{
+		return hours > 0 ? total() / hours : 0;
+	}
+
+	/**
+	* Hours a battery lasts at the average current
+	*/
+	double batteryLife(const EnergyTable& table) const;
+};
+
+/**
+* @param poweredTime Time the node has been running, in us
+*/
+EnergyReport estimateEnergy(const EnergyTable& table, const EnergyUsage& usage, int64_t poweredTime);
+
+#endif
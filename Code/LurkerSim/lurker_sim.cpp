@@ -0,0 +1,425 @@
+//////////////////////////////////////////////////////////////////////////
+// Lurker Sim
+//
+// Runs a whole Lurker network in virtual time: the coordinator and every
+// node run the sketch's own network code (lurker_network.cpp) against a
+// simulated nRF24L01+ channel. A day of a 100 node network takes seconds,
+// and the same seed and options always give the same results, so changes
+// to the protocol or its timing can be tried on far more nodes than we
+// have hardware for.
+//
+// It also counts the time each node's MCU, radio and sensors spend in
+// each state and projects battery life from an energy table, so polling,
+// batching and sleep settings can be compared before anything runs on a
+// battery.
+//
+// Usage:
+//	lurker_sim [options]
+//
+//	-n nodes	Nodes besides the coordinator, up to 254 (default 100)
+//	-t time	Simulated time, with s, m, h or d (default 1d)
+//	-S seed	Seed (default 1)
+//	-l loss	Chance of losing a packet or ack on the average link (default 0.02)
+//	-L spread	Link loss varies by this share either way (default 0.5)
+//	-r retries	Radio retransmits, 0 to 15 (default 15)
+//	-C	No collisions; overlapping packets both get through
+//	-p ms	Coordinator poll interval (default batch * sample / (nodes + 1))
+//	-T ms	Node timeout (default 120000, or three poll periods if longer)
+//	-j ms	Join interval (default 60000)
+//	-b time	Nodes boot at random within this time (default 60s)
+//	-d ppm	Clocks are off by up to this much either way (default 1000)
+//	-s ms	Sensor sample interval (default 20000)
+//	-B samples	Samples sent per data response (default 1)
+//	-P mode	Node power mode: on, mcu (MCU sleeps) or radio (radio sleeps
+//		between polls too) (default on)
+//	-g ms	Radio sleep - wake this long before a poll is due, on top of
+//		the worst clock drift over a poll period (default 100)
+//	-E file	Energy table; see energy.conf (default datasheet figures)
+//	-o file	Write the coordinator's serial output, the relayed frames
+//	-c file	Write per-node results as CSV
+//	-v	Trace network events to stderr
+//
+// Build:
+//	g++ -std=c++11 -O2 -I../LurkerNano -o lurker_sim lurker_sim.cpp network_sim.cpp energy_model.cpp ../LurkerNano/lurker_network.cpp
+//////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "network_sim.h"
+
+static void printUsage(){
+	fprintf(stderr,
+		"Usage: lurker_sim [-n nodes] [-t time] [-S seed] [-l loss] [-L spread] [-r retries] [-C]\n"
+		"                  [-p ms] [-T ms] [-j ms] [-b time] [-d ppm] [-s ms] [-B samples]\n"
+		"                  [-P on|mcu|radio] [-g ms] [-E energy.conf] [-o frames] [-c nodes.csv] [-v]\n");
+}
+
+/**
+* Parse a duration like 90, 90s, 15m, 6h or 2d
+*/
+static bool parseDuration(const char* text, SimTime& duration){
+	char* end;
+	double value = strtod(text, &end);
+	double scale = 1;
+
+	switch (*end){
+	case 'd':
+		scale = 86400;
+		end++;
+		break;
+	case 'h':
+		scale = 3600;
+		end++;
+		break;
+	case 'm':
+		scale = 60;
+		end++;
+		break;
+	case 's':
+		end++;
+		break;
+	}
+
+	if (end == text || *end != '\0' || value < 0){
+		return false;
+	}
+
+	duration = SimTime(value * scale * SIM_SECOND);
+	return true;
+}
+
+static double monotonicSeconds(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double percent(uint64_t part, uint64_t whole){
+	return whole > 0 ? 100.0 * part / whole : 0;
+}
+
+static const char* POWER_MODES[] = { "on", "mcu", "radio" };
+
+static bool writeNodeCsv(const char* path, const NetworkSimulator& sim, const EnergyTable& table, SimTime duration){
+	FILE* file = fopen(path, "w");
+	if (file == NULL){
+		perror(path);
+		return false;
+	}
+
+	fprintf(file, "unit,connected,first_join_s,joins,timeouts,polls,readings,longest_gap_s,"
+		"sent,acked,failed,attempts,collisions,received,air_time_ms,duty_cycle,"
+		"mcu_active_s,radio_rx_s,radio_tx_s,samples,current_ma,mcu_ma,radio_ma,sensor_ma,life_days\n");
+
+	for (size_t unit = 1; unit < sim.deviceCount(); unit++){
+		const DeviceStats& stats = sim.stats(unit);
+		EnergyReport energy = estimateEnergy(table, stats.energy, sim.poweredTime(unit));
+
+		fprintf(file, "%zu,%d,%.3f,%llu,%llu,%llu,%llu,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,%.3f,%.6f,"
+			"%.3f,%.3f,%.3f,%llu,%.4f,%.4f,%.4f,%.4f,%.1f\n",
+			unit, sim.connected(unit), stats.firstJoin / double(SIM_SECOND),
+			(unsigned long long)stats.joins, (unsigned long long)stats.timeouts,
+			(unsigned long long)stats.polls, (unsigned long long)stats.readings,
+			stats.longestGap / double(SIM_SECOND),
+			(unsigned long long)stats.packetsSent, (unsigned long long)stats.packetsAcked,
+			(unsigned long long)stats.packetsFailed, (unsigned long long)stats.attempts,
+			(unsigned long long)stats.collisions, (unsigned long long)stats.packetsReceived,
+			stats.airTime / double(SIM_MS), double(stats.airTime) / duration,
+			stats.energy.mcuActiveTime / double(SIM_SECOND), stats.energy.radioTime[RADIO_RX] / double(SIM_SECOND),
+			stats.energy.radioTime[RADIO_TX] / double(SIM_SECOND), (unsigned long long)stats.energy.samples,
+			energy.current(), energy.mcu / energy.hours, energy.radio / energy.hours, energy.sensors / energy.hours,
+			energy.batteryLife(table) / 24);
+	}
+
+	fclose(file);
+	return true;
+}
+
+static void printReport(const NetworkSimulator& sim, SimTime duration, double wallTime){
+	double seconds = duration / double(SIM_SECOND);
+	size_t nodes = sim.deviceCount() - 1;
+
+	fprintf(stderr, "Simulated %.1f h of 1 coordinator and %zu nodes in %.2f s (%.0fx), %llu events\n",
+		seconds / 3600, nodes, wallTime, wallTime > 0 ? seconds / wallTime : 0,
+		(unsigned long long)sim.events());
+
+	// Radio, every device
+	DeviceStats total;
+	memset(&total, 0, sizeof(total));
+
+	for (size_t i = 0; i < sim.deviceCount(); i++){
+		const DeviceStats& stats = sim.stats(i);
+		total.packetsSent += stats.packetsSent;
+		total.packetsAcked += stats.packetsAcked;
+		total.packetsFailed += stats.packetsFailed;
+		total.attempts += stats.attempts;
+		total.collisions += stats.collisions;
+	}
+
+	fprintf(stderr, "Radio: %llu packets, %llu attempts, %llu collisions, %llu failed (%.2f%%), channel busy %.2f%%\n",
+		(unsigned long long)total.packetsSent, (unsigned long long)total.attempts,
+		(unsigned long long)total.collisions, (unsigned long long)total.packetsFailed,
+		percent(total.packetsFailed, total.packetsSent), percent(sim.busyTime(), duration));
+
+	if (nodes == 0){
+		return;
+	}
+
+	// Nodes
+	size_t joined = 0;
+	size_t connected = 0;
+	uint64_t timeouts = 0;
+	uint64_t polls = 0;
+	uint64_t readings = 0;
+	uint64_t fewest = UINT64_MAX;
+	uint64_t most = 0;
+	double joinTime = 0;
+	double lastJoin = 0;
+	SimTime longestGap = 0;
+	size_t longestGapUnit = 0;
+
+	for (size_t unit = 1; unit <= nodes; unit++){
+		const DeviceStats& stats = sim.stats(unit);
+
+		if (stats.firstJoin >= 0){
+			double join = stats.firstJoin / double(SIM_SECOND);
+			joined++;
+			joinTime += join;
+			lastJoin = std::max(lastJoin, join);
+		}
+
+		connected += sim.connected(unit);
+		timeouts += stats.timeouts;
+		polls += stats.polls;
+		readings += stats.readings;
+		fewest = std::min(fewest, stats.readings);
+		most = std::max(most, stats.readings);
+
+		if (stats.longestGap > longestGap){
+			longestGap = stats.longestGap;
+			longestGapUnit = unit;
+		}
+	}
+
+	fprintf(stderr, "Nodes: %zu joined (mean %.1f s, last %.1f s), %zu connected at the end, %llu timeouts\n",
+		joined, joined > 0 ? joinTime / joined : 0, lastJoin, connected, (unsigned long long)timeouts);
+
+	fprintf(stderr, "Readings: %llu of %llu requests delivered (%.2f%%), %.1f per node (%llu to %llu)\n",
+		(unsigned long long)readings, (unsigned long long)polls, percent(readings, polls),
+		double(readings) / nodes, (unsigned long long)fewest, (unsigned long long)most);
+
+	if (longestGapUnit != 0){
+		fprintf(stderr, "Longest gap between readings: %.1f s (unit %zu)\n", longestGap / double(SIM_SECOND), longestGapUnit);
+	}
+}
+
+/**
+* Average current and battery life of the nodes; the coordinator is taken
+* to be on mains power
+*/
+static void printEnergy(const NetworkSimulator& sim, const SimConfig& config){
+	const EnergyTable& table = config.energy;
+	size_t nodes = sim.deviceCount() - 1;
+
+	if (nodes == 0){
+		return;
+	}
+
+	EnergyReport mean;
+	memset(&mean, 0, sizeof(mean));
+
+	double shortest = HUGE_VAL;
+	double longest = 0;
+	double life = 0;
+	size_t shortestUnit = 0;
+
+	for (size_t unit = 1; unit <= nodes; unit++){
+		EnergyReport energy = estimateEnergy(table, sim.stats(unit).energy, sim.poweredTime(unit));
+		double hours = energy.batteryLife(table);
+
+		// Per hour, so nodes that booted late count the same
+		if (energy.hours > 0){
+			mean.board += energy.board / energy.hours / nodes;
+			mean.mcu += energy.mcu / energy.hours / nodes;
+			mean.radio += energy.radio / energy.hours / nodes;
+			mean.sensors += energy.sensors / energy.hours / nodes;
+		}
+
+		life += hours / nodes;
+		longest = std::max(longest, hours);
+
+		if (hours < shortest){
+			shortest = hours;
+			shortestUnit = unit;
+		}
+	}
+	mean.hours = 1;
+
+	fprintf(stderr, "Energy (power %s, sample %u ms, batch %u): %.3f mA per node (board %.3f, MCU %.3f, radio %.3f, sensors %.3f)\n",
+		POWER_MODES[config.power], config.sampleInterval, config.batch,
+		mean.current(), mean.board, mean.mcu, mean.radio, mean.sensors);
+
+	fprintf(stderr, "Battery life (%.0f mAh, %.0f%% usable): %.1f days mean, %.1f to %.1f (shortest unit %zu)\n",
+		table.batteryCapacity, table.batteryUsable * 100, life / 24, shortest / 24, longest / 24, shortestUnit);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Main
+
+int main(int argc, char** argv){
+	SimConfig config;
+	SimTime duration = 86400 * SIM_SECOND;
+	long pollInterval = 0;
+	bool nodeTimeout = false;
+	const char* outputPath = NULL;
+	const char* csvPath = NULL;
+	bool trace = false;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:t:S:l:L:r:Cp:T:j:b:d:s:B:P:g:E:o:c:v")) != -1){
+		bool valid = true;
+
+		switch (option){
+		case 'n':
+			config.nodes = strtoul(optarg, NULL, 10);
+			valid = config.nodes < BROADCAST;
+			break;
+		case 't':
+			valid = parseDuration(optarg, duration);
+			break;
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'l':
+			config.radio.loss = atof(optarg);
+			valid = config.radio.loss >= 0 && config.radio.loss <= 1;
+			break;
+		case 'L':
+			config.radio.lossSpread = atof(optarg);
+			valid = config.radio.lossSpread >= 0 && config.radio.lossSpread <= 1;
+			break;
+		case 'r':
+			config.radio.retries = atoi(optarg);
+			valid = atoi(optarg) >= 0 && atoi(optarg) <= 15;
+			break;
+		case 'C':
+			config.radio.collisions = false;
+			break;
+		case 'p':
+			pollInterval = atol(optarg);
+			valid = pollInterval > 0;
+			break;
+		case 'T':
+			config.network.nodeTimeout = strtoul(optarg, NULL, 10);
+			valid = config.network.nodeTimeout > 0;
+			nodeTimeout = true;
+			break;
+		case 'j':
+			config.network.joinInterval = strtoul(optarg, NULL, 10);
+			valid = config.network.joinInterval > 0;
+			break;
+		case 'b':
+			valid = parseDuration(optarg, config.bootSpread);
+			break;
+		case 'd':
+			config.clockDrift = atof(optarg);
+			valid = config.clockDrift >= 0 && config.clockDrift < 100000;
+			break;
+		case 's':
+			config.sampleInterval = strtoul(optarg, NULL, 10);
+			valid = config.sampleInterval > 0;
+			break;
+		case 'B':
+			config.batch = atoi(optarg);
+			valid = atoi(optarg) > 0 && atoi(optarg) <= 255;
+			break;
+		case 'P':
+			valid = false;
+			for (int mode = POWER_ALWAYS_ON; mode <= POWER_SLEEP_RADIO; mode++){
+				if (strcmp(optarg, POWER_MODES[mode]) == 0){
+					config.power = PowerMode(mode);
+					valid = true;
+				}
+			}
+			break;
+		case 'g':
+			config.listenGuard = strtoul(optarg, NULL, 10);
+			break;
+		case 'E':
+			valid = loadEnergyTable(optarg, config.energy);
+			break;
+		case 'o':
+			outputPath = optarg;
+			break;
+		case 'c':
+			csvPath = optarg;
+			break;
+		case 'v':
+			trace = true;
+			break;
+		default:
+			valid = false;
+			break;
+		}
+
+		if (!valid){
+			fprintf(stderr, "Bad option: -%c %s\n", option, optarg != NULL ? optarg : "");
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (optind != argc){
+		printUsage();
+		return 1;
+	}
+
+	// Each node polled once per batch of samples; once per sample, as the
+	// sketch does, by default
+	if (pollInterval == 0){
+		pollInterval = std::max(1UL, (unsigned long)config.batch * config.sampleInterval / (config.nodes + 1));
+	}
+	config.network.pollInterval = pollInterval;
+
+	// Long batches mustn't look like a dead node
+	if (!nodeTimeout){
+		config.network.nodeTimeout = std::max<NetworkTime>(config.network.nodeTimeout, 3 * (config.nodes + 1) * pollInterval);
+	}
+
+	FILE* output = NULL;
+	if (outputPath != NULL){
+		output = fopen(outputPath, "w");
+		if (output == NULL){
+			perror(outputPath);
+			return 1;
+		}
+	}
+
+	NetworkSimulator sim(config);
+	sim.setOutput(output);
+	sim.setTrace(trace ? stderr : NULL);
+
+	double start = monotonicSeconds();
+	sim.run(duration);
+	double wallTime = monotonicSeconds() - start;
+
+	if (output != NULL){
+		fclose(output);
+	}
+
+	printReport(sim, duration, wallTime);
+	printEnergy(sim, config);
+
+	if (csvPath != NULL && !writeNodeCsv(csvPath, sim, config.energy, duration)){
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,652 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "network_sim.h"
+
+// nRF24L01+ framing with dynamic payloads: preamble, 5 byte address,
+// 9 bit packet control field, payload and 2 byte CRC
+const uint32_t FRAMING_BITS = (1 + 5 + 2) * 8 + 9;
+const uint32_t ACK_BITS = FRAMING_BITS;
+const SimTime SETTLE_TIME = 130;	// PLL settling before every transmission
+
+const double DAY = 86400.0;
+
+struct QueuedPacket{
+	uint8_t unit;
+	uint8_t length;
+	uint8_t data[NETWORK_PAYLOAD_SIZE];
+};
+
+struct NetworkSimulator::Device : public NetworkHandler{
+	Device(NetworkSimulator& sim, uint8_t unit, const NetworkConfig& config, uint8_t routeCount) :
+		sim(sim),
+		unit(unit),
+		routes(routeCount),
+		network(unit, config, *this, routeCount > 0 ? &routes[0] : 0, routeCount),
+		booted(false),
+		bootTime(0),
+		clockRate(1),
+		generation(0),
+		nextSample(0),
+		linkLoss(0),
+		radioState(RADIO_POWER_DOWN),
+		radioSince(0),
+		radioGeneration(0),
+		polled(false),
+		lastPoll(0),
+		transmitting(false),
+		transmitStart(0),
+		collided(false),
+		delivered(false),
+		attempts(0){
+		memset(&stats, 0, sizeof(stats));
+		memset(&reading, 0, sizeof(reading));
+		stats.firstJoin = -1;
+		stats.lastReading = -1;
+	}
+
+	virtual ~Device(){}
+
+	void transmit(uint8_t unit, const uint8_t* packet, uint8_t length){
+		sim.queuePacket(*this, unit, packet, length);
+	}
+
+	void readSensors(SensorReading& reading){
+		sim.readSensors(*this, reading);
+	}
+
+	void readingReceived(const SensorReading& reading){
+		sim.readingReceived(*this, reading);
+	}
+
+	void networkEvent(NetworkEvent event, uint8_t unit){
+		sim.networkEvent(*this, event, unit);
+	}
+
+	NetworkSimulator& sim;
+	uint8_t unit;
+	std::vector<NetworkRoute> routes;
+	LurkerNetwork network;
+
+	bool booted;
+	SimTime bootTime;
+	double clockRate;	// Local time per simulated time
+	uint32_t generation;	// Of the pending update event
+	uint64_t nextSample;	// Local ms
+
+	// Radio
+	double linkLoss;	// To and from the coordinator
+	RadioState radioState;
+	SimTime radioSince;
+	uint32_t radioGeneration;	// Of the pending radio sleep or wake event
+	bool polled;	// lastPoll is known
+	uint64_t lastPoll;	// Local ms
+
+	// Transmit queue; out of receive mode until the head is done
+	std::deque<QueuedPacket> txQueue;
+	bool transmitting;
+	SimTime transmitStart;
+	bool collided;
+	bool delivered;	// Current packet reached the receiver; retries are duplicates
+	uint8_t attempts;
+
+	// Sensors
+	SensorReading reading;	// Last sample
+	float temperatureOffset;
+	float humidityOffset;
+	float lightLevel;
+	float motionRate;
+
+	DeviceStats stats;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// Simulator
+
+NetworkSimulator::NetworkSimulator(const SimConfig& config) :
+	_config(config),
+	_random(config.seed),
+	_now(0),
+	_events(0),
+	_sequence(0),
+	_busyTime(0),
+	_busySince(0),
+	_ackAirTime(SETTLE_TIME + SimTime(ACK_BITS) * SIM_SECOND / config.radio.bitRate),
+	_trace(0),
+	_output(0){
+	// Unit numbers are a byte and BROADCAST is taken
+	uint32_t nodes = std::min<uint32_t>(config.nodes, BROADCAST - 1);
+
+	// The coordinator polls one slot of its table per interval, its own
+	// included
+	_pollPeriod = (nodes + 1) * config.network.pollInterval;
+
+	for (uint32_t unit = 0; unit <= nodes; unit++){
+		Device* device = new Device(*this, unit, config.network, unit == COORDINATOR ? nodes + 1 : 0);
+
+		double spread = config.radio.lossSpread;
+		device->linkLoss = std::min(1.0, config.radio.loss * _random.uniform(1 - spread, 1 + spread));
+		device->clockRate = 1 + _random.uniform(-config.clockDrift, config.clockDrift) * 1e-6;
+
+		device->temperatureOffset = float(_random.uniform(-3, 3));
+		device->humidityOffset = float(_random.uniform(-10, 10));
+		device->lightLevel = float(_random.uniform(50, 800));
+		device->motionRate = float(_random.uniform(0, 0.3));
+
+		if (unit != COORDINATOR){
+			device->bootTime = SimTime(_random.uniform() * config.bootSpread);
+		}
+		device->radioSince = device->bootTime;
+
+		_devices.push_back(device);
+		schedule(device->bootTime, EVENT_BOOT, unit);
+	}
+}
+
+NetworkSimulator::~NetworkSimulator(){
+	for (size_t i = 0; i < _devices.size(); i++){
+		delete _devices[i];
+	}
+}
+
+void NetworkSimulator::run(SimTime until){
+	const EnergyTable& energy = _config.energy;
+
+	while (!_queue.empty() && _queue.top().time <= until){
+		Event event = _queue.top();
+		_queue.pop();
+
+		_now = event.time;
+		_events++;
+
+		Device& device = *_devices[event.device];
+
+		switch (event.type){
+		case EVENT_BOOT:
+			boot(device);
+			break;
+
+		case EVENT_UPDATE:
+			if (event.generation == device.generation){
+				wake(device, SimTime(energy.wakeTime * SIM_MS));
+				update(device);
+			}
+			break;
+
+		case EVENT_SAMPLE:
+			sample(device);
+			break;
+
+		case EVENT_RADIO_WAKE:
+			if (event.generation == device.radioGeneration && device.radioState == RADIO_POWER_DOWN){
+				wake(device, SimTime(energy.wakeTime * SIM_MS));
+				setRadio(device, RADIO_RX);
+			}
+			break;
+
+		case EVENT_RADIO_SLEEP:
+			if (event.generation == device.radioGeneration && device.radioState == RADIO_RX && !device.network.connected()){
+				setRadio(device, RADIO_POWER_DOWN);
+			}
+			break;
+
+		case EVENT_ATTEMPT:
+			startAttempt(device);
+			break;
+
+		case EVENT_AIR_END:
+			endAttempt(device);
+			break;
+		}
+	}
+
+	_now = std::max(_now, until);
+	closeAccounts();
+}
+
+const DeviceStats& NetworkSimulator::stats(size_t device) const{
+	return _devices[device]->stats;
+}
+
+bool NetworkSimulator::connected(size_t device) const{
+	const Device& d = *_devices[device];
+
+	if (d.unit == COORDINATOR){
+		return d.booted;
+	}
+
+	return d.network.connected();
+}
+
+SimTime NetworkSimulator::poweredTime(size_t device) const{
+	return std::max<SimTime>(0, _now - _devices[device]->bootTime);
+}
+
+void NetworkSimulator::schedule(SimTime time, EventType type, uint32_t device, uint32_t generation){
+	Event event = { time, _sequence++, type, device, generation };
+	_queue.push(event);
+}
+
+/**
+* Schedule an event for when the device's own clock reaches a time
+*/
+void NetworkSimulator::scheduleLocal(Device& device, uint64_t localTime, EventType type, uint32_t generation){
+	SimTime time = device.bootTime + SimTime(ceil(localTime * SIM_MS / device.clockRate));
+	schedule(std::max(_now, time), type, device.unit, generation);
+}
+
+/**
+* Schedule the next update a device's network asks for
+* Replaces whatever update was pending, since anything received may have
+* moved the deadline.
+*/
+void NetworkSimulator::scheduleUpdate(Device& device){
+	NetworkTime now = millis(device);
+	NetworkTime delay = device.network.nextUpdate(now) - now;
+
+	scheduleLocal(device, localTime(device) + delay, EVENT_UPDATE, ++device.generation);
+}
+
+/**
+* Milliseconds on the device's clock since it booted
+*/
+uint64_t NetworkSimulator::localTime(const Device& device) const{
+	return uint64_t((_now - device.bootTime) * device.clockRate / SIM_MS);
+}
+
+/**
+* The device's own millis()
+*/
+NetworkTime NetworkSimulator::millis(const Device& device) const{
+	return NetworkTime(localTime(device));
+}
+
+void NetworkSimulator::boot(Device& device){
+	device.booted = true;
+	device.network.begin(millis(device));
+	scheduleUpdate(device);
+
+	if (device.unit != COORDINATOR){
+		device.nextSample = _config.sampleInterval;
+		scheduleLocal(device, device.nextSample, EVENT_SAMPLE);
+	}
+
+	radioIdle(device);
+}
+
+void NetworkSimulator::update(Device& device){
+	device.network.update(millis(device));
+	scheduleUpdate(device);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Power
+
+/**
+* Count time the MCU is awake; with no sleep it always is
+*/
+void NetworkSimulator::wake(Device& device, SimTime duration){
+	if (_config.power != POWER_ALWAYS_ON){
+		device.stats.energy.mcuActiveTime += duration;
+	}
+}
+
+void NetworkSimulator::setRadio(Device& device, RadioState state){
+	device.stats.energy.radioTime[device.radioState] += _now - device.radioSince;
+	device.radioSince = _now;
+	device.radioState = state;
+}
+
+/**
+* Radio has nothing to send; listen, or with radio sleep, power down until
+* there is something to hear
+*/
+void NetworkSimulator::radioIdle(Device& device){
+	setRadio(device, RADIO_RX);
+
+	if (_config.power != POWER_SLEEP_RADIO || device.unit == COORDINATOR){
+		return;
+	}
+
+	uint64_t now = localTime(device);
+
+	if (!device.network.connected()){
+		// Hang on for a join confirmation, then sleep until the next attempt
+		scheduleLocal(device, now + _config.listenGuard, EVENT_RADIO_SLEEP, ++device.radioGeneration);
+	}
+	else if (device.polled){
+		// Slots come round at a fixed period, so the next poll is due a
+		// period after the last; wake early enough to cover the drift
+		// between the two clocks and the coordinator's retries
+		uint64_t guard = _config.listenGuard + uint64_t(2 * _config.clockDrift * 1e-6 * _pollPeriod);
+		uint64_t wake = device.lastPoll + _pollPeriod - std::min<uint64_t>(guard, _pollPeriod);
+
+		if (wake > now){
+			setRadio(device, RADIO_POWER_DOWN);
+			scheduleLocal(device, wake, EVENT_RADIO_WAKE, ++device.radioGeneration);
+		}
+	}
+
+	// Otherwise just joined; listen until the first poll shows where the
+	// slot is
+}
+
+/**
+* Bring the time counts up to now
+* With no sleep, the MCU is awake the whole time it's powered.
+*/
+void NetworkSimulator::closeAccounts(){
+	for (size_t i = 0; i < _devices.size(); i++){
+		Device& device = *_devices[i];
+
+		if (!device.booted){
+			continue;
+		}
+
+		setRadio(device, device.radioState);
+
+		if (_config.power == POWER_ALWAYS_ON){
+			device.stats.energy.mcuActiveTime = _now - device.bootTime;
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Radio Medium
+
+void NetworkSimulator::queuePacket(Device& device, uint8_t unit, const uint8_t* packet, uint8_t length){
+	QueuedPacket queued;
+	queued.unit = unit;
+	queued.length = std::min(length, NETWORK_PAYLOAD_SIZE);
+	memcpy(queued.data, packet, queued.length);
+
+	device.txQueue.push_back(queued);
+	device.stats.packetsSent++;
+
+	// Batched samples would follow the response in payloads of their own;
+	// there's no batch format yet, so they are only counted
+	if (_config.batch > 1 && packet[0] == DATA_TRANSMIT_RESPONSE){
+		uint32_t perPayload = std::max(1, NETWORK_PAYLOAD_SIZE / length);
+		uint32_t extra = (_config.batch + perPayload - 1) / perPayload - 1;
+		SimTime extraAirTime = packetAirTime(perPayload * length);
+
+		device.stats.airTime += extra * extraAirTime;
+		device.stats.energy.radioTime[RADIO_TX] += extra * extraAirTime;
+		device.stats.energy.radioTime[RADIO_RX] += extra * _ackAirTime;
+		wake(device, extra * (extraAirTime + _ackAirTime));
+	}
+
+	if (!device.transmitting){
+		device.transmitting = true;
+		device.transmitStart = _now;
+		device.attempts = 0;
+		device.delivered = false;
+		schedule(_now, EVENT_ATTEMPT, device.unit);
+	}
+}
+
+/**
+* Time on the air for a payload, settling included
+*/
+SimTime NetworkSimulator::packetAirTime(uint8_t length) const{
+	return SETTLE_TIME + SimTime(FRAMING_BITS + length * 8) * SIM_SECOND / _config.radio.bitRate;
+}
+
+/**
+* Put the head of the device's queue on the air
+* Anything already on the air overlaps it, and with collisions on, neither
+* gets through.
+*/
+void NetworkSimulator::startAttempt(Device& device){
+	device.collided = false;
+	device.attempts++;
+	device.stats.attempts++;
+	SimTime airTime = packetAirTime(device.txQueue.front().length);
+
+	device.stats.airTime += airTime;
+	setRadio(device, RADIO_TX);
+
+	if (_onAir.empty()){
+		_busySince = _now;
+	}
+
+	if (_config.radio.collisions){
+		for (size_t i = 0; i < _onAir.size(); i++){
+			Device& other = *_devices[_onAir[i]];
+
+			if (!other.collided){
+				other.collided = true;
+				other.stats.collisions++;
+			}
+			if (!device.collided){
+				device.collided = true;
+				device.stats.collisions++;
+			}
+		}
+	}
+
+	_onAir.push_back(device.unit);
+	schedule(_now + airTime, EVENT_AIR_END, device.unit);
+}
+
+void NetworkSimulator::endAttempt(Device& device){
+	_onAir.erase(std::find(_onAir.begin(), _onAir.end(), device.unit));
+
+	if (_onAir.empty()){
+		_busyTime += _now - _busySince;
+	}
+
+	// Waiting out the retransmit delay
+	setRadio(device, RADIO_STANDBY);
+
+	const QueuedPacket& packet = device.txQueue.front();
+
+	if (packet.unit == BROADCAST){
+		for (size_t i = 0; i < _devices.size(); i++){
+			if (_devices[i] != &device){
+				deliver(device, *_devices[i]);
+			}
+		}
+
+		// No acks on the broadcast pipe
+		finishPacket(device, true);
+		return;
+	}
+
+	// Listening for the ack; short enough to count without its own event
+	device.stats.energy.radioTime[RADIO_RX] += _ackAirTime;
+
+	bool acked = false;
+
+	if (packet.unit < _devices.size()){
+		Device& receiver = *_devices[packet.unit];
+
+		if (deliver(device, receiver)){
+			Device& node = device.unit != COORDINATOR ? device : receiver;
+			acked = !_random.chance(node.linkLoss);
+		}
+	}
+
+	if (acked){
+		device.stats.airTime += _ackAirTime;
+		finishPacket(device, true);
+	}
+	else if (device.attempts <= _config.radio.retries){
+		schedule(_now + _config.radio.retryDelay, EVENT_ATTEMPT, device.unit);
+	}
+	else{
+		finishPacket(device, false);
+	}
+}
+
+/**
+* Hand the packet on the air to a receiver, if it hears it
+* @return Packet arrived, whether or not it was a duplicate
+*/
+bool NetworkSimulator::deliver(Device& sender, Device& receiver){
+	// Off, asleep, or sending and so not listening
+	if (receiver.radioState != RADIO_RX || sender.collided){
+		return false;
+	}
+
+	// Every link runs through the coordinator, so it's the node's link
+	Device& node = sender.unit != COORDINATOR ? sender : receiver;
+
+	if (_random.chance(node.linkLoss)){
+		return false;
+	}
+
+	// The receiver drops a retry of a packet it already has (same PID and CRC)
+	if (sender.delivered){
+		return true;
+	}
+	sender.delivered = true;
+
+	const QueuedPacket& packet = sender.txQueue.front();
+
+	if (packet.data[0] == DATA_TRANSMIT_REQUEST && receiver.unit != COORDINATOR){
+		receiver.polled = true;
+		receiver.lastPoll = localTime(receiver);
+	}
+
+	receiver.stats.packetsReceived++;
+	wake(receiver, SimTime(_config.energy.packetTime * SIM_MS));
+	receiver.network.receive(packet.data, packet.length, millis(receiver));
+	scheduleUpdate(receiver);
+
+	return true;
+}
+
+void NetworkSimulator::finishPacket(Device& device, bool acked){
+	if (acked){
+		device.stats.packetsAcked++;
+	}
+	else{
+		device.stats.packetsFailed++;
+	}
+
+	device.txQueue.pop_front();
+	device.attempts = 0;
+	device.delivered = false;
+
+	if (!device.txQueue.empty()){
+		schedule(_now, EVENT_ATTEMPT, device.unit);
+		return;
+	}
+
+	// radio.write() blocks until the last packet is done
+	wake(device, _now - device.transmitStart);
+	device.transmitting = false;
+	radioIdle(device);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Devices
+
+/**
+* Take a sample, as the sketch's timer does
+* Rough indoor conditions: a daily swing in temperature and light with
+* some noise, and motion now and then.
+*/
+void NetworkSimulator::sample(Device& device){
+	double day = fmod(_now / double(SIM_SECOND), DAY) / DAY;
+	double swing = sin(2 * M_PI * (day - 0.375));	// Warmest mid-afternoon
+	double light = std::max(0.0, sin(2 * M_PI * (day - 0.25)));
+
+	SensorReading& reading = device.reading;
+	reading.temperature = float(21 + device.temperatureOffset + 3 * swing + _random.uniform(-0.2, 0.2));
+	reading.humidity = float(std::min(100.0, std::max(0.0, 50 + device.humidityOffset - 8 * swing + _random.uniform(-1, 1))));
+	reading.illuminance = uint16_t(device.lightLevel * light + _random.uniform(0, 5));
+	reading.motion = _random.chance(device.motionRate * (0.2 + light));
+	reading.valid = ALL_VALID;
+
+	device.stats.energy.samples++;
+	wake(device, SimTime(_config.energy.sampleTime * SIM_MS));
+
+	device.nextSample += _config.sampleInterval;
+	scheduleLocal(device, device.nextSample, EVENT_SAMPLE);
+}
+
+/**
+* Node has been polled; hand over the last sample
+*/
+void NetworkSimulator::readSensors(Device& device, SensorReading& reading){
+	reading = device.reading;
+	device.stats.polls++;
+}
+
+/**
+* Coordinator has a reading; relay it as the sketch does
+*/
+void NetworkSimulator::readingReceived(Device&, const SensorReading& reading){
+	if (reading.unit >= _devices.size()){
+		return;
+	}
+
+	DeviceStats& stats = _devices[reading.unit]->stats;
+	stats.readings++;
+
+	SimTime since = stats.lastReading >= 0 ? stats.lastReading : stats.firstJoin;
+	if (since >= 0){
+		stats.longestGap = std::max(stats.longestGap, _now - since);
+	}
+	stats.lastReading = _now;
+
+	if (_output != 0){
+		fprintf(_output, "#{\"id\":%u,\"temperature\":%.2f,\"humidity\":%.2f,\"illuminance\":%u,\"motion\":%s}$\r\n",
+			reading.unit, reading.temperature, reading.humidity, reading.illuminance,
+			reading.motion ? "true" : "false");
+	}
+}
+
+void NetworkSimulator::networkEvent(Device& device, NetworkEvent event, uint8_t unit){
+	const char* message = 0;
+
+	switch (event){
+	case NETWORK_JOIN_ATTEMPT:
+		message = "attempting network join";
+		break;
+	case NETWORK_JOINED:
+		device.stats.joins++;
+		if (device.stats.firstJoin < 0){
+			device.stats.firstJoin = _now;
+		}
+		message = "joined network";
+		break;
+	case NETWORK_TIMED_OUT:
+		device.stats.timeouts++;
+		message = "timed out from network";
+		break;
+	case NETWORK_DATA_REQUESTED:
+		message = "data request received";
+		break;
+	case NETWORK_NODE_JOINED:
+		message = "unit joined the network";
+		break;
+	case NETWORK_NODE_TIMED_OUT:
+		message = "unit timed out";
+		break;
+	case NETWORK_NODE_POLLED:
+		message = "requesting data";
+		break;
+	case NETWORK_PACKET_REJECTED:
+		message = "packet rejected";
+		break;
+	case NETWORK_VERSION_MISMATCH:
+		message = "packet from another protocol version";
+		break;
+	}
+
+	if (_trace != 0 && message != 0){
+		fprintf(_trace, "%12.6f unit %3u: %s", _now / double(SIM_SECOND), device.unit, message);
+		if (device.unit == COORDINATOR && event != NETWORK_PACKET_REJECTED){
+			fprintf(_trace, " (unit %u)", unit);
+		}
+		fputc('\n', _trace);
+	}
+}
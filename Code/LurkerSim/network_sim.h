@@ -0,0 +1,284 @@
+#ifndef LURKER_NETWORK_SIM_H
+#define LURKER_NETWORK_SIM_H
+
+#include <deque>
+#include <queue>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "energy_model.h"
+#include "lurker_network.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Network Simulator
+//
+// Discrete-event simulation of a Lurker network: a coordinator and any
+// number of nodes, each running the sketch's own LurkerNetwork code on a
+// virtual millis(), sharing a radio medium modelled on the nRF24L01+:
+//	- airtime of each dynamic-length payload at the configured bit rate
+//	- auto-ack, with setRetries() style retransmits and delay
+//	- lost packets per link, collisions between overlapping packets
+//	- half duplex; a radio that is sending hears nothing
+//	- duplicate suppression when only the ack was lost
+//
+// Every device runs on its own clock, a little fast or slow. The time each
+// node's MCU and radio spend in each state is counted, along with its
+// sensor samples, for the energy model. The sketch itself never sleeps;
+// the power modes show what sleeping would save and what it costs in
+// missed polls.
+//
+// Time only moves from one event to the next, so a day of a large network
+// takes seconds, and everything random comes from the seed, so a run can
+// be repeated exactly.
+//////////////////////////////////////////////////////////////////////////
+
+typedef int64_t SimTime;	// us since the start of the simulation
+
+const SimTime SIM_MS = 1000;
+const SimTime SIM_SECOND = 1000000;
+
+/**
+* Small, fast and reproducible random numbers (splitmix64)
+*/
+class SimRandom{
+public:
+	explicit SimRandom(uint64_t seed = 0) : _state(seed){}
+
+	uint64_t next(){
+		uint64_t z = (_state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	/**
+	* Uniform in [0, 1)
+	*/
+	double uniform(){
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	double uniform(double low, double high){
+		return low + (high - low) * uniform();
+	}
+
+	bool chance(double probability){
+		return uniform() < probability;
+	}
+
+private:
+	uint64_t _state;
+};
+
+struct RadioConfig{
+	double loss;	// Chance of losing a packet or its ack, for the average link
+	double lossSpread;	// Links vary from loss * (1 - spread) to loss * (1 + spread)
+	uint8_t retries;	// Retransmits before giving up, as setRetries()
+	SimTime retryDelay;	// Wait before each retransmit
+	uint32_t bitRate;	// bit/s
+	bool collisions;	// Overlapping packets are both lost
+
+	RadioConfig() :
+		loss(0.02),
+		lossSpread(0.5),
+		retries(15),
+		retryDelay(4000),	// setRetries(15, 15): (15 + 1) * 250 us
+		bitRate(1000000),
+		collisions(true){
+	}
+};
+
+enum PowerMode{
+	POWER_ALWAYS_ON,	// As the sketch runs now
+	POWER_SLEEP_MCU,	// MCU sleeps between interrupts; the radio keeps listening
+	POWER_SLEEP_RADIO	// Nodes also power the radio down until their next poll is due
+};
+
+struct SimConfig{
+	uint32_t nodes;
+	uint64_t seed;
+	SimTime bootSpread;	// Nodes power up at random within this time
+	double clockDrift;	// Clocks are off by up to this many ppm either way
+	NetworkConfig network;
+	RadioConfig radio;
+
+	// Nodes
+	PowerMode power;
+	NetworkTime sampleInterval;	// Time between sensor samples, ms
+	uint8_t batch;	// Samples sent per data response
+	NetworkTime listenGuard;	// Radio sleep - wake this long before a poll is due, plus the drift, ms
+	EnergyTable energy;	// For how long the MCU is kept awake
+
+	SimConfig() :
+		nodes(100),
+		seed(1),
+		bootSpread(60 * SIM_SECOND),
+		clockDrift(1000),
+		power(POWER_ALWAYS_ON),
+		sampleInterval(20000),
+		batch(1),
+		listenGuard(100){
+		network.nodeTimeout = 120000;
+		network.joinInterval = 60000;
+		network.pollInterval = sampleInterval / (nodes + 1);
+	}
+};
+
+struct DeviceStats{
+	// Radio
+	uint64_t packetsSent;	// Handed to the radio
+	uint64_t packetsAcked;
+	uint64_t packetsFailed;	// Gave up after the last retry
+	uint64_t attempts;	// Including retransmits
+	uint64_t collisions;
+	uint64_t packetsReceived;
+	SimTime airTime;
+
+	// Network
+	uint64_t joins;
+	uint64_t timeouts;
+	uint64_t polls;	// Data requests answered
+	uint64_t readings;	// Readings that reached the coordinator
+	SimTime firstJoin;	// -1 until joined
+	SimTime lastReading;
+	SimTime longestGap;	// Longest wait between readings at the coordinator
+
+	EnergyUsage energy;
+};
+
+class NetworkSimulator{
+public:
+	explicit NetworkSimulator(const SimConfig& config);
+	~NetworkSimulator();
+
+	/**
+	* Run until the given time, or until there is nothing left to do
+	*/
+	void run(SimTime until);
+
+	SimTime now() const{
+		return _now;
+	}
+
+	uint64_t events() const{
+		return _events;
+	}
+
+	/**
+	* Devices by unit number; the coordinator is device 0
+	*/
+	size_t deviceCount() const{
+		return _devices.size();
+	}
+
+	const DeviceStats& stats(size_t device) const;
+	bool connected(size_t device) const;
+
+	/**
+	* Time since the device booted
+	*/
+	SimTime poweredTime(size_t device) const;
+
+	/**
+	* Time the channel was carrying at least one packet
+	*/
+	SimTime busyTime() const{
+		return _busyTime;
+	}
+
+	/**
+	* Log network events, one line each
+	*/
+	void setTrace(FILE* trace){
+		_trace = trace;
+	}
+
+	/**
+	* Write the coordinator's serial output, the relayed JSON frames
+	*/
+	void setOutput(FILE* output){
+		_output = output;
+	}
+
+private:
+	NetworkSimulator(const NetworkSimulator&);
+	NetworkSimulator& operator=(const NetworkSimulator&);
+
+	struct Device;
+
+	// At equal times, events run in this order; a packet that ends as
+	// another starts doesn't overlap it
+	enum EventType{
+		EVENT_AIR_END,	// Packet has left the air
+		EVENT_BOOT,
+		EVENT_UPDATE,
+		EVENT_SAMPLE,
+		EVENT_RADIO_WAKE,	// Radio sleep - listen for the next poll
+		EVENT_RADIO_SLEEP,	// Radio sleep - give up listening for a join confirmation
+		EVENT_ATTEMPT	// Start (re)sending the packet at the head of the queue
+	};
+
+	struct Event{
+		SimTime time;
+		uint64_t sequence;	// Keeps equal times in scheduling order
+		EventType type;
+		uint32_t device;
+		uint32_t generation;	// Update and radio events are dropped once superseded
+
+		bool operator>(const Event& other) const{
+			if (time != other.time){
+				return time > other.time;
+			}
+			if (type != other.type){
+				return type > other.type;
+			}
+			return sequence > other.sequence;
+		}
+	};
+
+	void schedule(SimTime time, EventType type, uint32_t device, uint32_t generation = 0);
+	void scheduleLocal(Device& device, uint64_t localTime, EventType type, uint32_t generation = 0);
+	void scheduleUpdate(Device& device);
+	uint64_t localTime(const Device& device) const;
+	NetworkTime millis(const Device& device) const;
+
+	void boot(Device& device);
+	void update(Device& device);
+	void sample(Device& device);
+	void wake(Device& device, SimTime duration);
+	void setRadio(Device& device, RadioState state);
+	void radioIdle(Device& device);
+	void closeAccounts();
+
+	SimTime packetAirTime(uint8_t length) const;
+	void startAttempt(Device& device);
+	void endAttempt(Device& device);
+	bool deliver(Device& sender, Device& receiver);
+	void finishPacket(Device& device, bool acked);
+
+	// Called back from the devices' networks
+	void queuePacket(Device& device, uint8_t unit, const uint8_t* packet, uint8_t length);
+	void readSensors(Device& device, SensorReading& reading);
+	void readingReceived(Device& device, const SensorReading& reading);
+	void networkEvent(Device& device, NetworkEvent event, uint8_t unit);
+
+	SimConfig _config;
+	SimRandom _random;
+	std::vector<Device*> _devices;
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event> > _queue;
+	std::vector<uint32_t> _onAir;	// Devices with a packet on the air
+
+	SimTime _now;
+	uint64_t _events;
+	uint64_t _sequence;
+	SimTime _busyTime;
+	SimTime _busySince;
+	SimTime _ackAirTime;
+	NetworkTime _pollPeriod;	// Time between polls of the same node
+
+	FILE* _trace;
+	FILE* _output;
+};
+
+#endif
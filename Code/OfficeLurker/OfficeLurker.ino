@@ -1,8 +1,6 @@
 #include <JsonGenerator.h>
-#include <Adafruit_Sensor.h>
 #include <pgmspace.h>
-#include <Adafruit_TSL2561_U.h>
-#include <Wire.h>
+#include <AsyncTwi.h>
 #include <DallasTemperature.h>
 #include <OneWire.h>
 #include <DHT.h>
@@ -57,8 +55,43 @@ DallasTemperature tempSensors(&oneWire);
 #define DHT_TYPE DHT22
 DHT humiditySensor(HUMD_PIN, DHT_TYPE);
 
-// Light
-Adafruit_TSL2561_Unified lightSensor = Adafruit_TSL2561_Unified(TSL2561_ADDR_FLOAT);	// Nothing attached to address pin (floating)
+// Light - TSL2561, read in the background over TWI
+#define LIGHT_ADDRESS 0x39	// Nothing attached to address pin (floating)
+#define LIGHT_TIMEOUT 100	// A read still pending after this many ms has the bus reset
+#define LIGHT_LEAD_TIME 200	// Reads are started this long before a sample, in ms
+
+#define TSL2561_COMMAND 0x80
+#define TSL2561_WORD 0x20
+#define TSL2561_CONTROL 0x00
+#define TSL2561_TIMING 0x01
+#define TSL2561_DATA0 0x0C	// Broadband channel
+#define TSL2561_DATA1 0x0E	// Infrared channel
+#define TSL2561_POWER_ON 0x03
+#define TSL2561_13MS_GAIN_1X 0x00
+#define TSL2561_CLIP 4900	// Counts past which a 13 ms reading is saturated
+
+const uint8_t lightSetup[] = {
+	TSL2561_COMMAND | TSL2561_CONTROL, TSL2561_POWER_ON,
+	TSL2561_COMMAND | TSL2561_TIMING, TSL2561_13MS_GAIN_1X
+};
+const uint8_t lightChannels[] = {
+	TSL2561_COMMAND | TSL2561_WORD | TSL2561_DATA0,
+	TSL2561_COMMAND | TSL2561_WORD | TSL2561_DATA1
+};
+uint8_t broadbandData[2];
+uint8_t infraredData[2];
+void lightReadFinished(TwiTransaction& transaction);
+
+TwiTransaction lightPowerOn = { LIGHT_ADDRESS, &lightSetup[0], 2, 0, 0, 0 };
+TwiTransaction lightTiming = { LIGHT_ADDRESS, &lightSetup[2], 2, 0, 0, 0 };
+TwiTransaction broadbandRead = { LIGHT_ADDRESS, &lightChannels[0], 1, broadbandData, 2, 0 };
+TwiTransaction infraredRead = { LIGHT_ADDRESS, &lightChannels[1], 1, infraredData, 2, lightReadFinished };
+
+volatile unsigned int broadbandCount = 0;
+volatile unsigned int infraredCount = 0;
+volatile bool lightValid = false;	// The counts are from the last read, and it worked
+bool lightReadStarted = false;	// Since the last sample
+unsigned long timeOfLightRead = 0;
 
 // Sound
 #define MIC_ANALOG_PIN A0
@@ -76,6 +109,7 @@ int airTemperature = 0;
 int deskTemperature = 0;
 unsigned int humidity = 0;
 unsigned int illuminance = 0;
+bool illuminanceValid = false;
 unsigned int noiseLevel = 0;
 bool movementDetected = false;
 
@@ -132,7 +166,12 @@ void printSensorData(){
 	entry["air_temp"] = float(airTemperature)/100;
 	entry["surface_temp"] = float(deskTemperature)/100;
 	entry["humidity"] = float(humidity)/100;
-	entry["illuminance"] = long(illuminance);
+	if (illuminanceValid){
+		entry["illuminance"] = long(illuminance);
+	}
+	else{
+		entry["illuminance"] = (const char*)0;	// null - the sensor couldn't give a reading
+	}
 	entry["noise_level"] = long(noiseLevel);
 	entry["motion"] = 0;
 
@@ -198,10 +237,14 @@ void initialiseHumiditySensor(){
 
 
 /**
-* Initialise the BH1750FVI sensor
+* Initialise the TSL2561 sensor
+* It's left integrating continuously, at the shortest time and lowest
+* gain, as the Adafruit driver had it.
 */
 void initialiseLightSensor(){
-	lightSensor.begin();
+	twi.begin(TWI_FAST);
+	twi.queue(lightPowerOn);
+	twi.queue(lightTiming);
 }
 
 
@@ -242,6 +285,8 @@ void initialiseSoundSensor(){
 * Results are saved as global variables
 */
 void checkSensors(){
+	updateLight();
+
 	// Periodically check climate sensors
 	if ((millis() - timeOfSample) > SAMPLE_PERIOD){
 		checkTemperature();
@@ -250,6 +295,7 @@ void checkSensors(){
 		noiseLevel = getSoundLevel(200);
 		
 		timeOfSample = millis();
+		lightReadStarted = false;
 		
 		printSensorData();
 	}
@@ -286,15 +332,110 @@ void checkHumidity(){
 }
 
 
+/**
+* Start reading both light channels once a sample, LIGHT_LEAD_TIME
+* before it's due
+* The reads finish in the background, from the TWI interrupt, so the
+* counts are there for checkLight() and the bus is left free the rest
+* of the time.
+*/
+void updateLight(){
+	if (infraredRead.pending()){
+		// Something is holding the bus; the reset fails the read
+		if ((millis() - timeOfLightRead) > LIGHT_TIMEOUT){
+			twi.reset();
+		}
+		return;
+	}
+
+	if (lightReadStarted || (millis() - timeOfSample) < SAMPLE_PERIOD - LIGHT_LEAD_TIME){
+		return;
+	}
+
+	lightValid = false;
+	lightReadStarted = true;
+	twi.queue(broadbandRead);
+	twi.queue(infraredRead);
+	timeOfLightRead = millis();
+}
+
+
+/**
+* Callback from the TWI interrupt, once both channels are read or the
+* read has failed
+*/
+void lightReadFinished(TwiTransaction& transaction){
+	if (broadbandRead.status == TWI_DONE && transaction.status == TWI_DONE){
+		broadbandCount = broadbandData[0] | (broadbandData[1] << 8);
+		infraredCount = infraredData[0] | (infraredData[1] << 8);
+		lightValid = true;
+	}
+	else{
+		lightValid = false;
+	}
+}
+
+
 /**
 * Check the light level hitting the sensor.
-* Illuminance saved in lux as an integer
+* Illuminance saved in lux as an integer; invalid if this sample's read
+* failed or never finished
 */
 void checkLight(){
-	// TSL2561
-	sensors_event_t event;
-	lightSensor.getEvent(&event);
-	illuminance = event.light;
+	noInterrupts();
+	unsigned int broadband = broadbandCount;
+	unsigned int infrared = infraredCount;
+	bool valid = lightValid;
+	interrupts();
+
+	illuminanceValid = valid;
+	if (valid){
+		illuminance = calculateLux(broadband, infrared);
+	}
+}
+
+
+/**
+* Convert the TSL2561's channel counts to lux
+* TAOS' integer approximation for the T, FN and CL packages, with the
+* counts scaled up from 13.7 ms integration at 1x gain to the 402 ms and
+* 16x the formula expects.
+*
+* @param broadband Count from channel 0, visible and infrared
+* @param infrared Count from channel 1, infrared only
+* @return Illuminance in lux; 65535 if the sensor is saturated
+*/
+unsigned int calculateLux(unsigned int broadband, unsigned int infrared){
+	if (broadband > TSL2561_CLIP || infrared > TSL2561_CLIP){
+		return 65535;
+	}
+
+	unsigned long channelScale = 0x7517UL << 4;	// 322/11 for the time, then 16 for the gain, in 2^10
+	unsigned long channel0 = (broadband * channelScale) >> 10;
+	unsigned long channel1 = (infrared * channelScale) >> 10;
+
+	// Infrared's share of the light, in 2^9, picks the segment of the curve
+	unsigned long ratio = 0;
+	if (channel0 != 0){
+		ratio = ((channel1 << 10) / channel0 + 1) >> 1;
+	}
+
+	unsigned int b, m;
+	if (ratio <= 0x0040){ b = 0x01F2; m = 0x01BE; }
+	else if (ratio <= 0x0080){ b = 0x0214; m = 0x02D1; }
+	else if (ratio <= 0x00C0){ b = 0x023F; m = 0x037B; }
+	else if (ratio <= 0x0100){ b = 0x0270; m = 0x03FE; }
+	else if (ratio <= 0x0138){ b = 0x016F; m = 0x01FC; }
+	else if (ratio <= 0x019A){ b = 0x00D2; m = 0x00FB; }
+	else if (ratio <= 0x029A){ b = 0x0018; m = 0x0012; }
+	else{ b = 0x0000; m = 0x0000; }
+
+	unsigned long visible = channel0 * b;
+	unsigned long infraredPart = channel1 * m;
+	unsigned long lux = visible > infraredPart ? visible - infraredPart : 0;
+
+	// Round off the 2^14 scale
+	return (lux + (1UL << 13)) >> 14;
 }
 
 
@@ -1,11 +1,11 @@
 import json
 
 thingspeakMapping = {
-    "airTemp" = "field1",
-    "surfaceTemp" = "field2",
-    "humidity" = "field3",
-    "illuminance" = "field4",
-    "noiseLevel" = "field5",
-    "motion" = "field6"
+    "airTemp": "field1",
+    "surfaceTemp": "field2",
+    "humidity": "field3",
+    "illuminance": "field4",
+    "noiseLevel": "field5",
+    "motion": "field6"
 }
 
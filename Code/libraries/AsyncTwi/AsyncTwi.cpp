@@ -0,0 +1,188 @@
+#include <Arduino.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+
+#include "AsyncTwi.h"
+
+AsyncTwi twi;
+
+// TWCR with the interrupt on, for each step
+const uint8_t TWI_NEXT = bit(TWINT) | bit(TWEN) | bit(TWIE);
+const uint8_t TWI_ACK = TWI_NEXT | bit(TWEA);
+const uint8_t TWI_START = TWI_NEXT | bit(TWSTA);
+const uint8_t TWI_STOP = TWI_NEXT | bit(TWSTO);
+
+AsyncTwi::AsyncTwi() :
+	_head(0),
+	_tail(0),
+	_index(0){
+}
+
+void AsyncTwi::begin(uint32_t frequency){
+	// Internal pull-ups, as Wire has them; boards should still have their own
+	digitalWrite(SDA, HIGH);
+	digitalWrite(SCL, HIGH);
+
+	TWSR = 0;	// Prescaler 1
+	TWBR = ((F_CPU / frequency) - 16) / 2;
+	TWCR = bit(TWEN) | bit(TWIE);
+}
+
+bool AsyncTwi::queue(TwiTransaction& transaction){
+	uint8_t sreg = SREG;
+	cli();
+
+	if (transaction.status == TWI_PENDING){
+		SREG = sreg;
+		return false;
+	}
+
+	transaction.status = TWI_PENDING;
+	transaction.next = 0;
+
+	if (_head){
+		_tail->next = &transaction;
+		_tail = &transaction;
+	}
+	else{
+		_head = &transaction;
+		_tail = &transaction;
+		start();
+	}
+
+	SREG = sreg;
+	return true;
+}
+
+void AsyncTwi::reset(){
+	uint8_t sreg = SREG;
+	cli();
+
+	TWCR = 0;
+
+	while (_head){
+		TwiTransaction* transaction = _head;
+		_head = transaction->next;
+
+		transaction->status = TWI_ERROR;
+		if (transaction->callback){
+			transaction->callback(*transaction);
+		}
+	}
+	_tail = 0;
+
+	TWCR = bit(TWEN) | bit(TWIE);
+	SREG = sreg;
+}
+
+void AsyncTwi::start(){
+	_index = 0;
+	TWCR = TWI_START;
+}
+
+/**
+* End the transaction at the head of the queue and start the next; the
+* TWI sends a stop and then a start when asked for both
+*/
+void AsyncTwi::finish(TwiStatus status, bool stop){
+	TwiTransaction* transaction = _head;
+	_head = transaction->next;
+
+	uint8_t control = stop ? TWI_STOP : TWI_NEXT;
+
+	if (_head){
+		_index = 0;
+		control |= bit(TWSTA);
+	}
+	else{
+		_tail = 0;
+	}
+
+	TWCR = control;
+
+	transaction->status = status;
+	if (transaction->callback){
+		transaction->callback(*transaction);
+	}
+}
+
+/**
+* Ask for the next byte, and acknowledge it unless it's the last
+*/
+void AsyncTwi::readNext(){
+	TWCR = _index + 1 < _head->readLength ? TWI_ACK : TWI_NEXT;
+}
+
+void AsyncTwi::handleInterrupt(){
+	TwiTransaction* transaction = _head;
+
+	if (!transaction){
+		TWCR = bit(TWEN) | bit(TWIE);
+		return;
+	}
+
+	switch (TW_STATUS){
+	case TW_START:
+	case TW_REP_START:
+		// Reads come after the write, if there's one; with neither it's a
+		// write of nothing, to see if the device is there
+		if (_index < transaction->writeLength || transaction->readLength == 0){
+			TWDR = uint8_t(transaction->address << 1) | TW_WRITE;
+		}
+		else{
+			_index = 0;
+			TWDR = uint8_t(transaction->address << 1) | TW_READ;
+		}
+		TWCR = TWI_NEXT;
+		break;
+
+	// Writing
+	case TW_MT_SLA_ACK:
+	case TW_MT_DATA_ACK:
+		if (_index < transaction->writeLength){
+			TWDR = transaction->writeData[_index++];
+			TWCR = TWI_NEXT;
+		}
+		else if (transaction->readLength > 0){
+			TWCR = TWI_START;
+		}
+		else{
+			finish(TWI_DONE, true);
+		}
+		break;
+
+	case TW_MT_SLA_NACK:
+	case TW_MT_DATA_NACK:
+	case TW_MR_SLA_NACK:
+		finish(TWI_NACK, true);
+		break;
+
+	// Reading
+	case TW_MR_SLA_ACK:
+		readNext();
+		break;
+
+	case TW_MR_DATA_ACK:
+		transaction->readData[_index++] = TWDR;
+		readNext();
+		break;
+
+	case TW_MR_DATA_NACK:
+		transaction->readData[_index++] = TWDR;
+		finish(TWI_DONE, true);
+		break;
+
+	// Another master has the bus; let go of it
+	case TW_MT_ARB_LOST:
+		finish(TWI_ERROR, false);
+		break;
+
+	default:
+		finish(TWI_ERROR, true);
+		break;
+	}
+}
+
+ISR(TWI_vect){
+	twi.handleInterrupt();
+}
@@ -0,0 +1,95 @@
+#ifndef ASYNC_TWI_H
+#define ASYNC_TWI_H
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Asynchronous TWI (I2C)
+//
+// A stand-in for Wire that never waits on the bus. Transactions are
+// queued and run one after another from the TWI interrupt: an optional
+// write, then a read after a repeated start. When one finishes, its
+// status is set and its callback is run, still in the interrupt, so
+// callbacks should only copy out the result.
+//
+// Transactions belong to the caller and are linked into the queue
+// in place, so nothing is allocated; one can't be queued again until it
+// has finished. Don't use Wire alongside; both want the TWI interrupt.
+//////////////////////////////////////////////////////////////////////////
+
+const uint32_t TWI_STANDARD = 100000;
+const uint32_t TWI_FAST = 400000;
+
+enum TwiStatus{
+	TWI_IDLE,	// Never queued
+	TWI_PENDING,	// Queued or on the bus
+	TWI_DONE,
+	TWI_NACK,	// The device didn't answer, or turned down a byte
+	TWI_ERROR	// Bus error, lost arbitration or reset()
+};
+
+struct TwiTransaction;
+typedef void(*TwiCallback)(TwiTransaction& transaction);
+
+struct TwiTransaction{
+	uint8_t address;	// 7-bit
+	const uint8_t* writeData;
+	uint8_t writeLength;
+	uint8_t* readData;
+	uint8_t readLength;
+	TwiCallback callback;	// Optional; from the interrupt
+
+	volatile TwiStatus status;
+	TwiTransaction* next;	// Queue link
+
+	bool pending() const{
+		return status == TWI_PENDING;
+	}
+};
+
+class AsyncTwi{
+public:
+	AsyncTwi();
+
+	/**
+	* Take over the TWI pins and set the bus speed
+	*/
+	void begin(uint32_t frequency = TWI_FAST);
+
+	/**
+	* Add a transaction to the queue, starting the bus if it's idle
+	* @return False if it's still pending from before
+	*/
+	bool queue(TwiTransaction& transaction);
+
+	/**
+	* Drop everything queued, as TWI_ERROR, and reset the TWI
+	* For a bus that's stuck, e.g. a device holding SDA low.
+	*/
+	void reset();
+
+	bool busy() const{
+		return _head != 0;
+	}
+
+	/**
+	* Interrupt - the TWI has finished a step
+	*/
+	void handleInterrupt();
+
+private:
+	AsyncTwi(const AsyncTwi&);
+	AsyncTwi& operator=(const AsyncTwi&);
+
+	void start();
+	void finish(TwiStatus status, bool stop);
+	void readNext();
+
+	TwiTransaction* volatile _head;
+	TwiTransaction* volatile _tail;
+	volatile uint8_t _index;	// Byte of the current write or read
+};
+
+extern AsyncTwi twi;
+
+#endif